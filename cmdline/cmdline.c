@@ -47,6 +47,7 @@ int dc_reset_tables(dc_context_t* context, int bits)
 		dc_sqlite3_execute(context->sql, "DELETE FROM chats WHERE id>" DC_STRINGIFY(DC_CHAT_ID_LAST_SPECIAL) ";");
 		dc_sqlite3_execute(context->sql, "DELETE FROM chats_contacts;");
 		dc_sqlite3_execute(context->sql, "DELETE FROM msgs WHERE id>" DC_STRINGIFY(DC_MSG_ID_LAST_SPECIAL) ";");
+		dc_sqlite3_execute(context->sql, "DELETE FROM decrypt_cache;");
 		dc_sqlite3_execute(context->sql, "DELETE FROM config WHERE keyname LIKE 'imap.%' OR keyname LIKE 'configured%';");
 		dc_sqlite3_execute(context->sql, "DELETE FROM leftgrps;");
 		dc_log_info(context, 0, "(8) Rest but server config reset.");
@@ -101,6 +101,10 @@ static uintptr_t receive_event(dc_context_t* context, int event, uintptr_t data1
 			printf(ANSI_YELLOW "{{Received DC_EVENT_IMEX_PROGRESS(%i ‰)}}\n" ANSI_NORMAL, (int)data1);
 			break;
 
+		case DC_EVENT_KEYGEN_PROGRESS:
+			printf(ANSI_YELLOW "{{Received DC_EVENT_KEYGEN_PROGRESS(%i ‰)}}\n" ANSI_NORMAL, (int)data1);
+			break;
+
 		case DC_EVENT_IMEX_FILE_WRITTEN:
 			printf(ANSI_YELLOW "{{Received DC_EVENT_IMEX_FILE_WRITTEN(%s)}}\n" ANSI_NORMAL, (char*)data1);
 			break;
@@ -267,6 +271,7 @@ int main(int argc, char ** argv)
 	char*         cmd = NULL;
 	dc_context_t* context = dc_context_new(receive_event, NULL, "CLI");
 	int           stresstest_only = 0;
+	int           benchmark_only = 0;
 
 	dc_cmdline_skip_auth(context); /* disable the need to enter the command `auth <password>` for all mailboxes. */
 
@@ -275,6 +280,9 @@ int main(int argc, char ** argv)
 		if (strcmp(argv[1], "--stress")==0) {
 			stresstest_only = 1;
 		}
+		else if (strcmp(argv[1], "--bench")==0) {
+			benchmark_only = 1;
+		}
 		else if (!dc_open(context, argv[1], NULL)) {
 			printf("ERROR: Cannot open %s.\n", argv[1]);
 		}
@@ -283,6 +291,11 @@ int main(int argc, char ** argv)
 		printf("ERROR: Bad arguments\n");
 	}
 
+	if (benchmark_only) {
+		stress_benchmarks(context);
+		return 0;
+	}
+
 	s_do_log_info = 0;
 	stress_functions(context);
 	s_do_log_info = 1;
@@ -6,6 +6,10 @@ $ valgrind --leak-check=full --tool=memcheck ./deltachat-core <db>
 
 #include <ctype.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <netpgp-extra.h>
+#include <openssl/evp.h>
 #include "../src/dc_context.h"
 #include "../src/dc_simplify.h"
 #include "../src/dc_mimeparser.h"
@@ -15,6 +19,7 @@ $ valgrind --leak-check=full --tool=memcheck ./deltachat-core <db>
 #include "../src/dc_aheader.h"
 #include "../src/dc_keyring.h"
 #include "../src/dc_saxparser.h"
+#include "../src/dc_dehtml.h"
 
 
 /* some data used for testing
@@ -150,6 +155,122 @@ static const char* s_em_setupfile =
 "=9sJE\n"
 "-----END PGP MESSAGE-----\n";
 
+/* s_simplify_corpus contains typical plain-text mails
+and the text dc_simplify_simplify() is expected to return for them */
+static const struct {
+	const char* text;
+	int         is_msgrmsg;
+	const char* simplified;
+} s_simplify_corpus[] = {
+	/* reply with the quote at the end */
+	{ "Hi Alice,\r\n\r\nsounds good, see you tomorrow.\r\n\r\nBob\r\n\r\nOn Mon, 3 Sep 2018 at 10:12, Alice <alice@example.org> wrote:\r\n> Shall we meet at 10?\r\n>\r\n> Alice\r\n", 0,
+	  "Hi Alice,\n\nsounds good, see you tomorrow.\n\nBob [...]" },
+	/* reply below the quote */
+	{ "On 03.09.2018 10:12, Alice wrote:\n> Shall we meet at 10?\n\nYes, 10 is fine.\n", 0,
+	  "[...] Yes, 10 is fine." },
+	/* standard footer and footer with a quoted-printable space */
+	{ "Thanks for the patch, merged.\n\n-- \nBob Example\nhttps://example.org\n", 0,
+	  "Thanks for the patch, merged." },
+	{ "Thanks for the patch, merged.\n\n--  \nBob Example\n", 0,
+	  "Thanks for the patch, merged." },
+	/* non-standard footer */
+	{ "Call me.\n--\nSent from my phone\n", 0,
+	  "Call me. [...]" },
+	/* full quote introduced by a separator */
+	{ "Please find the report attached.\r\n\r\nRegards\r\nCarol\r\n\r\n-----Original Message-----\r\nFrom: Dave\r\nSent: Monday\r\nSubject: report\r\n\r\nCan you send the report?\r\n", 0,
+	  "Please find the report attached.\n\nRegards\nCarol [...]" },
+	{ "Ok.\r\n\r\n________________________________\r\nFrom: Erin <erin@example.org>\r\nSent: Tuesday, 4 September 2018 09:00\r\n\r\nAre you ok?\r\n", 0,
+	  "Ok. [...]" },
+	/* forwarded message */
+	{ "---------- Forwarded message ----------\nFrom: Alice <alice@example.org>\n\nHello from the forwarded mail.\n\n> with a quote\n\n-- \nAlice\n", 0,
+	  "Hello from the forwarded mail. [...]" },
+	{ "---------- Forwarded message ----------\nFrom: Alice <alice@example.org>\n", 0,
+	  "" },
+	/* mailing list digest */
+	{ "Send Foo-dev mailing list submissions to\n\tfoo-dev@lists.example.org\n\nTo subscribe or unsubscribe, visit\n\thttps://lists.example.org/foo-dev\n\n"
+	  "Today's Topics:\n\n   1. Re: build failure (Bob)\n   2. release plan (Carol)\n\n\n"
+	  "----------------------------------------------------------------------\n\nMessage: 1\nDate: Mon, 3 Sep 2018 10:12:00 +0200\nFrom: Bob\n\n> it fails on ARM\n\nfixed in master.\n", 0,
+	  "Send Foo-dev mailing list submissions to\n\tfoo-dev@lists.example.org\n\nTo subscribe or unsubscribe, visit\n\thttps://lists.example.org/foo-dev\n\nToday's Topics:\n\n   1. Re: build failure (Bob)\n   2. release plan (Carol) [...]" },
+	/* interleaved answers, only the leading quote is removed */
+	{ "> > Did you test it?\n> Not yet.\n\nI did now, works.\n\n> And on ARM?\n\nAlso works.\n\nBob\n", 0,
+	  "[...] I did now, works.\n\n> And on ARM?\n\nAlso works.\n\nBob" },
+	/* empty line and headline before the quote, headline too long to be one */
+	{ "Agreed.\n\nAm 03.09.2018 um 10:12 schrieb Jürgen:\n\n> Sollen wir das so machen?\n", 0,
+	  "Agreed. [...]" },
+	{ "Agreed. This line is long enough not to be taken as a quote headline, even if it ends with a colon:\n> quote\n", 0,
+	  "Agreed. This line is long enough not to be taken as a quote headline, even if it ends with a colon: [...]" },
+	/* nothing but quotes and empty lines */
+	{ "> only a quote\n>\n> nothing else\n\n", 0,
+	  " [...]" },
+	{ "Wrote:\n> quote\n\n\n", 0,
+	  "Wrote: [...]" },
+	/* messenger messages keep their quotes */
+	{ "> quoted\nreply\n> quoted again\n", 1,
+	  "> quoted\nreply\n> quoted again" },
+	/* empty lines and whitespace */
+	{ "\n\n  \nHello\n\n\n\n\nWorld\n \t \n", 0,
+	  "Hello\n\nWorld" },
+	{ "line 1\r\nline 2\rwith a stray carriage return\r\r\n\r\n", 0,
+	  "line 1\nline 2with a stray carriage return" },
+	{ "", 0,
+	  "" },
+	{ "-- \nonly a footer", 0,
+	  "" },
+	{ "=====\nonly a separator", 0,
+	  " [...]" },
+};
+
+
+static int count_gossiped(dc_context_t* context, uint32_t chat_id, const char* fingerprint)
+{
+	sqlite3_stmt* stmt = dc_sqlite3_prepare(context->sql,
+		"SELECT COUNT(*) FROM gossiped_keys WHERE chat_id=? AND (?='' OR fingerprint=?);");
+	sqlite3_bind_int (stmt, 1, chat_id);
+	sqlite3_bind_text(stmt, 2, fingerprint? fingerprint : "", -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 3, fingerprint? fingerprint : "", -1, SQLITE_STATIC);
+	int cnt = sqlite3_step(stmt)==SQLITE_ROW? sqlite3_column_int(stmt, 0) : -1;
+	sqlite3_finalize(stmt);
+	return cnt;
+}
+
+
+static int count_decrypt_cache(dc_context_t* context, const char* rfc724_mid)
+{
+	sqlite3_stmt* stmt = dc_sqlite3_prepare(context->sql,
+		"SELECT COUNT(*) FROM decrypt_cache WHERE rfc724_mid=?;");
+	sqlite3_bind_text(stmt, 1, rfc724_mid, -1, SQLITE_STATIC);
+	int cnt = sqlite3_step(stmt)==SQLITE_ROW? sqlite3_column_int(stmt, 0) : -1;
+	sqlite3_finalize(stmt);
+	return cnt;
+}
+
+
+static void* stress_foreign_writer(void* sql)
+{
+	dc_sqlite3_set_config((dc_sqlite3_t*)sql, "stress.foreign", "1");
+	return NULL;
+}
+
+
+static void stress_saxparser_starttag_cb(void* userdata, const char* tag, char** attr)
+{
+	dc_strbuilder_t* ret = (dc_strbuilder_t*)userdata;
+	const char*      href = dc_attr_find(attr, "href");
+	dc_strbuilder_catf(ret, "<%s%s%s>", tag, href? " href=" : "", href? href : "");
+}
+
+
+static void stress_saxparser_endtag_cb(void* userdata, const char* tag)
+{
+	dc_strbuilder_catf((dc_strbuilder_t*)userdata, "</%s>", tag);
+}
+
+
+static void stress_saxparser_text_cb(void* userdata, const char* text, int len)
+{
+	dc_strbuilder_catf((dc_strbuilder_t*)userdata, "%.*s", len, text);
+}
+
 
 void stress_functions(dc_context_t* context)
 {
@@ -159,8 +280,18 @@ void stress_functions(dc_context_t* context)
 	{
 		dc_saxparser_t saxparser;
 		dc_saxparser_init(&saxparser, NULL);
-		dc_saxparser_parse(&saxparser, "<tag attr=val="); // should not crash or cause a deadlock
-		dc_saxparser_parse(&saxparser, "<tag attr=\"val\"="); // should not crash or cause a deadlock
+		dc_saxparser_parse(&saxparser, "<tag attr=val=", 14); // should not crash or cause a deadlock
+		dc_saxparser_parse(&saxparser, "<tag attr=\"val\"=", 16); // should not crash or cause a deadlock
+
+		dc_strbuilder_t ret;
+		dc_strbuilder_init(&ret, 0);
+		dc_saxparser_init(&saxparser, &ret);
+		dc_saxparser_set_tag_handler(&saxparser, stress_saxparser_starttag_cb, stress_saxparser_endtag_cb);
+		dc_saxparser_set_text_handler(&saxparser, stress_saxparser_text_cb);
+		const char* xml = "<A HREF='a&amp;amp;b'>x &amp;lt; &#228;&#xe4;&#x1F600; &#;&#x;&#99999999999;&#1 y\r\nz</a>IGNORED";
+		dc_saxparser_parse(&saxparser, xml, strlen(xml)-7); /* the buffer is not null-terminated after the end-tag; entities are decoded until none is left, as before */
+		assert( strcmp(ret.buf, "<a href=a&b>x < \xC3\xA4\xC3\xA4\xF0\x9F\x98\x80 &#;&#x;&#99999999999;&#1 y\nz</a>")==0 );
+		free(ret.buf);
 	}
 
 	/* test dc_simplify_t and dc_saxparser_t (indirectly used by dc_simplify_t)
@@ -184,11 +315,32 @@ void stress_functions(dc_context_t* context)
 		assert( strcmp(plain, "text *bold*<>")==0 );
 		free(plain);
 
+		html = "<p>para1</p>\n<p>para2<br>\n<i>line</i>\n<br></p><pre>a\nb</pre><style>x</style><a>no href</a>";
+		plain = dc_simplify_simplify(simplify, html, strlen(html), 1, 0);
+		assert( strcmp(plain, "para1\n\npara2\n_line_ \n\na\nb\n\nno href")==0 );
+		free(plain);
+
 		html = "&lt;&gt;&quot;&apos;&amp; &auml;&Auml;&ouml;&Ouml;&uuml;&Uuml;&szlig; foo&AElig;&ccedil;&Ccedil; &diams;&noent;&lrm;&rlm;&zwnj;&zwj;";
 		plain = dc_simplify_simplify(simplify, html, strlen(html), 1, 0);
 		assert( strcmp(plain, "<>\"'& äÄöÖüÜß fooÆçÇ ♦&noent;")==0 );
 		free(plain);
 
+		for (int i = 0; i < (int)(sizeof(s_simplify_corpus)/sizeof(s_simplify_corpus[0])); i++) {
+			plain = dc_simplify_simplify(simplify, s_simplify_corpus[i].text, strlen(s_simplify_corpus[i].text), 0, s_simplify_corpus[i].is_msgrmsg);
+			assert( strcmp(plain, s_simplify_corpus[i].simplified)==0 );
+			free(plain);
+		}
+
+		const char* txt = "---------- Forwarded message ----------\r\nFrom: Alice\r\n\r\n> hi\r\n\r\nhello";
+		plain = dc_simplify_simplify(simplify, txt, strlen(txt), 0, 0);
+		assert( strcmp(plain, "[...] hello")==0 );
+		assert( simplify->is_forwarded && simplify->is_cut_at_begin && !simplify->is_cut_at_end );
+		free(plain);
+
+		plain = dc_simplify_simplify(simplify, "text\0-- \n", 9, 0, 0); /* the text ends at the null-byte */
+		assert( strcmp(plain, "text")==0 );
+		free(plain);
+
 		dc_simplify_unref(simplify);
 	}
 
@@ -320,7 +472,73 @@ void stress_functions(dc_context_t* context)
 
 		assert( carray_count(mimeparser->parts) == 1 );
 
+		/* 7bit texts are not copied, the raw text points into the parsed message */
+		dc_mimepart_t* part = (dc_mimepart_t*)carray_get(mimeparser->parts, 0);
+		assert( part->msg_raw > raw && part->msg_raw < raw+strlen(raw) );
+		assert( part->msg_raw_bytes >= 5 && strncmp(part->msg_raw, "test1", 5)==0 );
+
+		/* decoded texts are kept by the parser */
+		raw =
+			"Content-Type: text/plain; charset=iso-8859-1\n"
+			"Content-Transfer-Encoding: quoted-printable\n"
+			"Subject: decoded\n"
+			"\n"
+			"Gr=F6=DFe\n";
+		dc_mimeparser_parse(mimeparser, raw, strlen(raw));
+		assert( carray_count(mimeparser->parts) == 1 );
+		part = (dc_mimepart_t*)carray_get(mimeparser->parts, 0);
+		assert( carray_count(mimeparser->buffers) == 1 );
+		assert( part->msg_raw==(const char*)carray_get(mimeparser->buffers, 0) );
+		assert( part->msg_raw_bytes >= 7 && strncmp(part->msg_raw, "Gr\xc3\xb6\xc3\x9f" "e", 7)==0 );
+
+		dc_mimeparser_unref(mimeparser);
+	}
+
+	if (dc_is_open(context))
+	{
+		/* attachments are decoded to the blobdir in chunks; check that chunk borders inside line breaks and quads do not matter */
+		#define ATTACH_BYTES (200*1024+7)
+		unsigned char* attach = malloc(ATTACH_BYTES);
+		for (int i = 0; i < ATTACH_BYTES; i++) {
+			attach[i] = (unsigned char)(rand()&0xFF);
+		}
+		char* base64 = encode_base64((const char*)attach, ATTACH_BYTES);
+		dc_strbuilder_t raw;
+		dc_strbuilder_init(&raw, 0);
+		dc_strbuilder_cat(&raw,
+			"Content-Type: multipart/mixed; boundary=\"==break==\";\n"
+			"Subject: attachment\n"
+			"\n"
+			"--==break==\n"
+			"Content-Type: application/octet-stream\n"
+			"Content-Disposition: attachment; filename=\"stress-attach.bin\"\n"
+			"Content-Transfer-Encoding: base64\n"
+			"\n");
+		for (size_t pos = 0, len = strlen(base64); pos < len; pos += 76) {
+			char line[80];
+			snprintf(line, sizeof(line), "%.76s\r\n", &base64[pos]);
+			dc_strbuilder_cat(&raw, line);
+		}
+		dc_strbuilder_cat(&raw, "--==break==--\n");
+
+		dc_mimeparser_t* mimeparser = dc_mimeparser_new(context->blobdir, context);
+		dc_mimeparser_parse(mimeparser, raw.buf, strlen(raw.buf));
+		assert( carray_count(mimeparser->parts) == 1 );
+		dc_mimepart_t* part = (dc_mimepart_t*)carray_get(mimeparser->parts, 0);
+		assert( part->type==DC_MSG_FILE && part->bytes==ATTACH_BYTES );
+
+		char* file = dc_param_get(part->param, DC_PARAM_FILE, NULL);
+		void* buf = NULL; size_t buf_bytes = 0;
+		assert( dc_read_file(context, file, &buf, &buf_bytes) );
+		assert( buf_bytes==ATTACH_BYTES && memcmp(buf, attach, ATTACH_BYTES)==0 );
+		dc_delete_file(context, file);
+
+		free(buf);
+		free(file);
 		dc_mimeparser_unref(mimeparser);
+		free(raw.buf);
+		free(base64);
+		free(attach);
 	}
 
 	/* test message helpers
@@ -435,6 +653,17 @@ void stress_functions(dc_context_t* context)
 		clist_free(list);
 		free(str);
 
+		size_t bin_bytes = 0;
+		uint8_t* bin = dc_hex_to_binary("00fF7a", &bin_bytes);
+		assert( bin && bin_bytes==3 && bin[0]==0x00 && bin[1]==0xFF && bin[2]==0x7A );
+		str = dc_binary_to_uc_hex(bin, bin_bytes);
+		assert( strcmp(str, "00FF7A")==0 );
+		free(str);
+		free(bin);
+		assert( dc_hex_to_binary("", &bin_bytes)==NULL && bin_bytes==0 );
+		assert( dc_hex_to_binary("ABC", &bin_bytes)==NULL );
+		assert( dc_hex_to_binary("0G", &bin_bytes)==NULL );
+
 		assert( strcmp("fresh="     DC_STRINGIFY(DC_STATE_IN_FRESH),      "fresh=10")==0 ); /* these asserts check the values, the existance of the macros and also DC_STRINGIFY() */
 		assert( strcmp("noticed="   DC_STRINGIFY(DC_STATE_IN_NOTICED),    "noticed=13")==0 );
 		assert( strcmp("seen="      DC_STRINGIFY(DC_STATE_IN_SEEN),       "seen=16")==0 );
@@ -570,6 +799,54 @@ void stress_functions(dc_context_t* context)
 		free(buf1);
 		free(buf2);
 
+		{
+			char   out[256];
+			size_t out_bytes = 0, used = 0;
+
+			buf1 = dc_encode_base64("Björn Petersen", 15, 8, "\r\n");
+			assert( strcmp(buf1, "QmrDtnJu\r\nIFBldGVy\r\nc2Vu")==0 );
+			out_bytes = dc_decode_base64(buf1, strlen(buf1), out, NULL);
+			assert( out_bytes==15 && memcmp(out, "Björn Petersen", 15)==0 );
+			out_bytes = dc_decode_base64(buf1, 12, out, &used); /* incomplete blocks are left for the next chunk */
+			assert( out_bytes==6 && used==10 );
+			free(buf1);
+
+			const char* qp = "Bj=C3=B6rn=\r\n Peter=\nsen\nok=";
+			out_bytes = dc_decode_quoted_printable(qp, strlen(qp), out, NULL);
+			assert( out_bytes==20 && memcmp(out, "Bj\xc3\xb6rn Petersen\r\nok=", 20)==0 );
+			out_bytes = dc_decode_quoted_printable("Bj=C3=B", 7, out, &used);
+			assert( out_bytes==3 && used==5 );
+
+			/* the results must not differ from libetpan's ones, whether blocks are decoded at once or not */
+			for (int i = 0; i < 200; i++) {
+				unsigned char bin[200];
+				size_t        bin_bytes = rand()%sizeof(bin);
+				for (size_t j = 0; j < bin_bytes; j++) {
+					bin[j] = (unsigned char)(rand()&0xFF);
+				}
+
+				char* expected = encode_base64((const char*)bin, bin_bytes);
+				buf1 = dc_encode_base64(bin, bin_bytes, 0, NULL);
+				assert( strcmp(buf1, expected)==0 );
+				free(buf1);
+				free(expected);
+
+				buf1 = dc_encode_base64(bin, bin_bytes, 1+rand()%80, "\r\n");
+				for (int enc = 0; enc <= 1; enc++) {
+					size_t index = 0, result_bytes = 0;
+					char*  result = NULL;
+					char*  decoded = malloc(DC_DECODE_QUOTED_PRINTABLE_MAX_BYTES(strlen(buf1)));
+					assert( mailmime_part_parse(buf1, strlen(buf1), &index, enc? MAILMIME_MECHANISM_QUOTED_PRINTABLE : MAILMIME_MECHANISM_BASE64,
+						&result, &result_bytes)==MAILIMF_NO_ERROR );
+					out_bytes = enc? dc_decode_quoted_printable(buf1, strlen(buf1), decoded, NULL) : dc_decode_base64(buf1, strlen(buf1), decoded, NULL);
+					assert( out_bytes==result_bytes && memcmp(decoded, result, out_bytes)==0 );
+					mmap_string_unref(result);
+					free(decoded);
+				}
+				free(buf1);
+			}
+		}
+
 		assert(  DC_EVENT_DATA1_IS_STRING(2100) );
 		assert(  DC_EVENT_DATA1_IS_STRING(2052) );
 		assert( !DC_EVENT_DATA1_IS_STRING(100) );
@@ -707,6 +984,10 @@ void stress_functions(dc_context_t* context)
 		assert( strstr(keys, " e2ee_enabled ")!=NULL );
 		assert( strstr(keys, " mdns_enabled ")!=NULL );
 		assert( strstr(keys, " save_mime_headers ")!=NULL );
+		assert( strstr(keys, " fetch_batch_cnt ")!=NULL );
+		assert( strstr(keys, " fetch_batch_bytes ")!=NULL );
+		assert( strstr(keys, " imap_compress ")!=NULL );
+		assert( strstr(keys, " gossip_interval ")!=NULL );
 		assert( strstr(keys, " configured_addr ")!=NULL );
 		assert( strstr(keys, " configured_mail_server ")!=NULL );
 		assert( strstr(keys, " configured_mail_user ")!=NULL );
@@ -721,6 +1002,421 @@ void stress_functions(dc_context_t* context)
 		free(keys);
 	}
 
+	/* test the statement cache of dc_sqlite3_t
+	 **************************************************************************/
+
+	if (dc_is_open(context))
+	{
+		#define TEST_STMT "SELECT value FROM config WHERE keyname='stress.stmt_cache';"
+		dc_sqlite3_t* sql = context->sql;
+		int hits = sql->stmt_cache_hits, misses = sql->stmt_cache_misses;
+
+		sqlite3_stmt* stmt1 = dc_sqlite3_borrow_stmt(sql, TEST_STMT);
+		assert( stmt1 );
+		assert( sql->stmt_cache_misses==misses+1 );
+
+		sqlite3_stmt* stmt2 = dc_sqlite3_borrow_stmt(sql, TEST_STMT); /* stmt1 is borrowed, so this must be another statement */
+		assert( stmt2 && stmt2!=stmt1 );
+		assert( sql->stmt_cache_misses==misses+2 );
+
+		sqlite3_step(stmt1);
+		dc_sqlite3_return_stmt(sql, stmt1);
+		dc_sqlite3_return_stmt(sql, stmt2); /* finalized as there is already a statement for this query in the cache */
+
+		sqlite3_stmt* stmt3 = dc_sqlite3_borrow_stmt(sql, TEST_STMT);
+		assert( stmt3==stmt1 );
+		assert( sql->stmt_cache_hits==hits+1 );
+		assert( sqlite3_step(stmt3)==SQLITE_DONE ); /* the statement was reset on return */
+		dc_sqlite3_return_stmt(sql, stmt3);
+		#undef TEST_STMT
+	}
+
+	/* test the peerstate cache of dc_sqlite3_t
+	 **************************************************************************/
+
+	if (dc_is_open(context))
+	{
+		#define TEST_ADDR "stress.peerstate@bar.de"
+		#define TEST_FPR1 "0123456789ABCDEF0123456789ABCDEF01234567"
+		#define TEST_FPR2 "76543210FEDCBA9876543210FEDCBA9876543210"
+		dc_sqlite3_t*    sql = context->sql;
+		dc_apeerstate_t* peerstate = dc_apeerstate_new(context);
+
+		dc_sqlite3_execute(sql, "DELETE FROM acpeerstates WHERE addr='" TEST_ADDR "';");
+		dc_apeerstate_clear_cache(sql); /* needed as acpeerstates was modified directly */
+		int hits = sql->peerstate_cache_hits;
+
+		assert( !dc_apeerstate_load_by_addr(peerstate, sql, TEST_ADDR) );
+		assert( !dc_apeerstate_load_by_addr(peerstate, sql, "Stress.Peerstate@bar.de") ); /* known to be missing */
+		assert( sql->peerstate_cache_hits==hits+1 );
+
+		peerstate->addr = dc_strdup(TEST_ADDR);
+		peerstate->prefer_encrypt = DC_PE_MUTUAL;
+		peerstate->public_key_fingerprint = dc_strdup(TEST_FPR1);
+		assert( dc_apeerstate_save_to_db(peerstate, sql, 1/*create*/) );
+		assert( dc_apeerstate_load_by_addr(peerstate, sql, TEST_ADDR) );
+		assert( sql->peerstate_cache_hits==hits+2 && peerstate->prefer_encrypt==DC_PE_MUTUAL );
+
+		peerstate->last_seen = 1234;
+		peerstate->to_save = DC_SAVE_TIMESTAMPS;
+		assert( dc_apeerstate_save_to_db(peerstate, sql, 0) );
+		assert( dc_apeerstate_load_by_addr(peerstate, sql, TEST_ADDR) );
+		assert( sql->peerstate_cache_hits==hits+3 && peerstate->last_seen==1234 );
+
+		assert( dc_apeerstate_load_by_fingerprint(peerstate, sql, TEST_FPR1) );
+		assert( dc_apeerstate_load_by_fingerprint(peerstate, sql, TEST_FPR1) );
+		assert( sql->peerstate_cache_hits==hits+4 && strcmp(peerstate->addr, TEST_ADDR)==0 );
+
+		free(peerstate->public_key_fingerprint); /* a changed fingerprint must not be found by the old one */
+		peerstate->public_key_fingerprint = dc_strdup(TEST_FPR2);
+		peerstate->to_save = DC_SAVE_ALL;
+		assert( dc_apeerstate_save_to_db(peerstate, sql, 0) );
+		assert( !dc_apeerstate_load_by_fingerprint(peerstate, sql, TEST_FPR1) );
+		assert( dc_apeerstate_load_by_fingerprint(peerstate, sql, TEST_FPR2) && peerstate->last_seen==1234 );
+
+		dc_apeerstate_clear_cache(sql); /* the database is searched by the binary fingerprints, the case does not matter */
+		assert( !dc_apeerstate_load_by_fingerprint(peerstate, sql, "") );
+		assert( dc_apeerstate_load_by_fingerprint(peerstate, sql, "76543210fedcba9876543210fedcba9876543210") && peerstate->last_seen==1234 );
+
+		dc_sqlite3_begin_transaction(sql); /* peerstates written by a transaction rolled back must not be used */
+			peerstate->prefer_encrypt = DC_PE_RESET;
+			peerstate->to_save = DC_SAVE_ALL;
+			assert( dc_apeerstate_save_to_db(peerstate, sql, 0) );
+		dc_sqlite3_rollback(sql);
+		assert( dc_apeerstate_load_by_addr(peerstate, sql, TEST_ADDR) && peerstate->prefer_encrypt==DC_PE_MUTUAL );
+
+		dc_sqlite3_execute(sql, "DELETE FROM acpeerstates WHERE addr='" TEST_ADDR "';");
+		dc_apeerstate_clear_cache(sql);
+		dc_apeerstate_unref(peerstate);
+		#undef TEST_ADDR
+		#undef TEST_FPR1
+		#undef TEST_FPR2
+	}
+
+	/* test nested transactions of dc_sqlite3_t
+	 **************************************************************************/
+
+	if (dc_is_open(context))
+	{
+		dc_sqlite3_t* sql = context->sql;
+
+		dc_sqlite3_begin_transaction(sql);
+			dc_sqlite3_set_config(sql, "stress.outer", "1");
+
+			dc_sqlite3_begin_transaction(sql); /* rolling back an inner transaction must not affect the outer one */
+				dc_sqlite3_set_config(sql, "stress.inner1", "1");
+			dc_sqlite3_rollback(sql);
+
+			dc_sqlite3_begin_transaction(sql);
+				dc_sqlite3_set_config(sql, "stress.inner2", "1");
+			dc_sqlite3_commit(sql);
+		dc_sqlite3_commit(sql);
+		assert( sql->transaction_depth==0 );
+
+		assert( dc_sqlite3_get_config_int(sql, "stress.outer", 0)==1 );
+		assert( dc_sqlite3_get_config_int(sql, "stress.inner1", 0)==0 );
+		assert( dc_sqlite3_get_config_int(sql, "stress.inner2", 0)==1 );
+		dc_sqlite3_set_config(sql, "stress.outer", NULL);
+		dc_sqlite3_set_config(sql, "stress.inner2", NULL);
+	}
+
+	if (dc_is_open(context) && context->sql->transaction_cobj)
+	{
+		/* writes of other threads are not part of a transaction and survive its rollback */
+		dc_sqlite3_t* sql = context->sql;
+		pthread_t     writer;
+
+		dc_sqlite3_begin_transaction(sql);
+			dc_sqlite3_set_config(sql, "stress.outer", "1");
+			pthread_create(&writer, NULL, stress_foreign_writer, sql);
+			usleep(100*1000); /* the writer waits for the write lock */
+		dc_sqlite3_rollback(sql);
+		pthread_join(writer, NULL);
+
+		assert( dc_sqlite3_get_config_int(sql, "stress.outer", 0)==0 );
+		assert( dc_sqlite3_get_config_int(sql, "stress.foreign", 0)==1 );
+		dc_sqlite3_set_config(sql, "stress.foreign", NULL);
+
+		/* a failed COMMIT rolls back the transaction, so that it does not keep the write lock;
+		a deferred foreign key violation lets COMMIT fail and leaves the transaction open */
+		assert( sqlite3_exec(sql->transaction_cobj, "PRAGMA foreign_keys=ON;"
+			" CREATE TEMP TABLE stress_parent (id INTEGER PRIMARY KEY);"
+			" CREATE TEMP TABLE stress_child (parent_id INTEGER REFERENCES stress_parent(id) DEFERRABLE INITIALLY DEFERRED);", NULL, NULL, NULL)==SQLITE_OK );
+		dc_sqlite3_begin_transaction(sql);
+			dc_sqlite3_set_config(sql, "stress.outer", "1");
+			dc_sqlite3_execute(sql, "INSERT INTO stress_child (parent_id) VALUES (1);");
+		dc_sqlite3_commit(sql);
+		assert( sql->transaction_depth==0 && sqlite3_get_autocommit(sql->transaction_cobj) );
+		assert( dc_sqlite3_get_config_int(sql, "stress.outer", 0)==0 );
+		sqlite3_exec(sql->transaction_cobj, "DROP TABLE stress_child; DROP TABLE stress_parent; PRAGMA foreign_keys=OFF;", NULL, NULL, NULL);
+
+		dc_sqlite3_begin_transaction(sql);
+			dc_sqlite3_set_config(sql, "stress.outer", "1");
+		dc_sqlite3_commit(sql);
+		assert( dc_sqlite3_get_config_int(sql, "stress.outer", 0)==1 );
+		dc_sqlite3_set_config(sql, "stress.outer", NULL);
+
+		/* if BEGIN fails, nested transactions and the final COMMIT/ROLLBACK do not start or end one */
+		sqlite3* locker = NULL;
+		assert( sqlite3_open_v2(sqlite3_db_filename(sql->cobj, "main"), &locker, SQLITE_OPEN_READWRITE, NULL)==SQLITE_OK );
+		assert( sqlite3_exec(locker, "BEGIN IMMEDIATE;", NULL, NULL, NULL)==SQLITE_OK );
+		sqlite3_busy_timeout(sql->transaction_cobj, 0);
+		dc_sqlite3_begin_transaction(sql);
+			assert( sql->transaction_failed );
+			dc_sqlite3_begin_transaction(sql);
+				assert( sqlite3_get_autocommit(sql->transaction_cobj) );
+			dc_sqlite3_commit(sql);
+		dc_sqlite3_rollback(sql);
+		assert( sql->transaction_depth==0 && !sql->transaction_failed && sqlite3_get_autocommit(sql->transaction_cobj) );
+		sqlite3_exec(locker, "ROLLBACK;", NULL, NULL, NULL);
+		sqlite3_close(locker);
+		sqlite3_busy_timeout(sql->transaction_cobj, 10*1000);
+	}
+
+	/* test the read-only connections of dc_sqlite3_t
+	 **************************************************************************/
+
+	if (dc_is_open(context) && context->sql->wal)
+	{
+		dc_sqlite3_t* sql = context->sql;
+		#define TEST_STMT "SELECT value FROM config WHERE keyname='stress.readers';"
+
+		dc_sqlite3_set_config(sql, "stress.readers", "1");
+		sqlite3_stmt* stmt1 = dc_sqlite3_prepare_read(sql, TEST_STMT);
+		sqlite3_stmt* stmt2 = dc_sqlite3_prepare_read(sql, TEST_STMT);
+		assert( stmt1 && stmt2 );
+		assert( sqlite3_db_handle(stmt1)!=sql->cobj && sqlite3_db_handle(stmt2)!=sql->cobj && sqlite3_db_handle(stmt1)!=sqlite3_db_handle(stmt2) );
+		assert( sqlite3_step(stmt1)==SQLITE_ROW && strcmp((const char*)sqlite3_column_text(stmt1, 0), "1")==0 );
+		sqlite3_finalize(stmt1);
+		sqlite3_finalize(stmt2);
+
+		dc_sqlite3_begin_transaction(sql);
+			dc_sqlite3_set_config(sql, "stress.readers", "2");
+
+			/* uncommitted changes are not visible to other threads, however, to the thread owning the transaction */
+			stmt1 = dc_sqlite3_prepare_read(sql, TEST_STMT);
+			assert( sqlite3_db_handle(stmt1)==(sql->transaction_cobj? sql->transaction_cobj : sql->cobj) );
+			assert( sqlite3_step(stmt1)==SQLITE_ROW && strcmp((const char*)sqlite3_column_text(stmt1, 0), "2")==0 );
+			sqlite3_finalize(stmt1);
+
+			stmt1 = NULL;
+			sqlite3_prepare_v2(sql->readers[0], TEST_STMT, -1, &stmt1, NULL);
+			assert( sqlite3_step(stmt1)==SQLITE_ROW && strcmp((const char*)sqlite3_column_text(stmt1, 0), "1")==0 );
+			sqlite3_finalize(stmt1);
+		dc_sqlite3_commit(sql);
+
+		/* the backup contains committed changes not yet checkpointed to the database file */
+		char* backup_file = dc_mprintf("%s/stress-backup.sqlite", context->blobdir);
+		assert( dc_sqlite3_backup(sql, backup_file) );
+		dc_sqlite3_t* backup_sql = dc_sqlite3_new(context);
+		assert( dc_sqlite3_open(backup_sql, backup_file, DC_OPEN_READONLY) );
+		assert( dc_sqlite3_get_config_int(backup_sql, "stress.readers", 0)==2 );
+		dc_sqlite3_unref(backup_sql);
+
+		/* statements of read-only connections stay usable if the database is closed meanwhile */
+		backup_sql = dc_sqlite3_new(context);
+		assert( dc_sqlite3_open(backup_sql, backup_file, 0) && backup_sql->wal );
+		stmt1 = dc_sqlite3_prepare_read(backup_sql, TEST_STMT);
+		assert( stmt1 && sqlite3_db_handle(stmt1)!=backup_sql->cobj );
+		dc_sqlite3_close(backup_sql);
+		assert( sqlite3_step(stmt1)==SQLITE_ROW && strcmp((const char*)sqlite3_column_text(stmt1, 0), "2")==0 );
+		sqlite3_finalize(stmt1); /* closes the read-only connection */
+		dc_sqlite3_unref(backup_sql);
+
+		/* the read-only connection closed last cannot remove these */
+		char* backup_wal = dc_mprintf("%s-wal", backup_file);
+		char* backup_shm = dc_mprintf("%s-shm", backup_file);
+		dc_delete_file(context, backup_wal);
+		dc_delete_file(context, backup_shm);
+		free(backup_wal);
+		free(backup_shm);
+		dc_delete_file(context, backup_file);
+		free(backup_file);
+
+		dc_sqlite3_set_config(sql, "stress.readers", NULL);
+		#undef TEST_STMT
+	}
+
+	/* test the summaries loaded by dc_chatlist_t
+	 **************************************************************************/
+
+	if (dc_is_open(context))
+	{
+		uint32_t chat_id = dc_create_group_chat(context, 0, "stress.summaries");
+		assert( chat_id > DC_CHAT_ID_LAST_SPECIAL );
+		dc_set_draft(context, chat_id, NULL); /* remove the draft added by dc_create_group_chat() */
+		dc_add_device_msg(context, chat_id, "stress summary text");
+
+		dc_chatlist_t* chatlist = dc_get_chatlist(context, DC_GCL_NO_SPECIALS, "stress.summaries", 0);
+		assert( dc_chatlist_get_cnt(chatlist)==1 && dc_chatlist_get_chat_id(chatlist, 0)==chat_id );
+		assert( dc_chatlist_get_msg_id(chatlist, 0) > DC_MSG_ID_LAST_SPECIAL ); /* the last message is taken from chats.last_msg_id */
+		assert( chatlist->summaries==NULL );
+
+		dc_lot_t* summary = dc_chatlist_get_summary(chatlist, 0, NULL);
+		assert( chatlist->summaries && chatlist->summaries[0] );
+		assert( strcmp(dc_lot_get_text2(summary), "stress summary text")==0 );
+		assert( dc_lot_get_text1(summary)==NULL ); /* messages of the device are info messages, no sender is shown */
+		assert( dc_lot_get_timestamp(summary) > 0 );
+		dc_lot_unref(summary);
+
+		assert( dc_chatlist_load_summaries(chatlist, 0, 100) ); /* cached, the range is truncated */
+		summary = dc_chatlist_get_summary(chatlist, 1, NULL);
+		assert( strcmp(dc_lot_get_text2(summary), "ErrBadChatlistIndex")==0 );
+		dc_lot_unref(summary);
+
+		dc_chatlist_unref(chatlist);
+		dc_delete_chat(context, chat_id);
+	}
+
+	/* test the keys gossiped to a group, see dc_e2ee_save_gossiped_keys()
+	 **************************************************************************/
+
+	if (dc_is_open(context))
+	{
+		uint32_t chat_id = dc_create_group_chat(context, 0, "stress.gossip");
+		uint32_t contact_id = dc_create_contact(context, NULL, "stress.gossip@bar.de");
+		dc_hash_t* gossiped_keys = calloc(1, sizeof(dc_hash_t));
+		dc_hash_init(gossiped_keys, DC_HASH_STRING, DC_HASH_COPY_KEY);
+		dc_hash_insert_str(gossiped_keys, "one@bar.de", dc_strdup("FPR1"));
+		dc_hash_insert_str(gossiped_keys, "two@bar.de", dc_strdup("FPR2"));
+
+		dc_e2ee_save_gossiped_keys(context, chat_id, gossiped_keys, 1);
+		assert( count_gossiped(context, chat_id, NULL)==2 );
+		assert( count_gossiped(context, chat_id, "FPR1")==1 );
+
+		free(dc_hash_find_str(gossiped_keys, "one@bar.de")); /* a changed key is gossiped alone */
+		dc_hash_insert_str(gossiped_keys, "One@bar.de", NULL);
+		free(dc_hash_find_str(gossiped_keys, "two@bar.de"));
+		dc_hash_insert_str(gossiped_keys, "two@bar.de", dc_strdup("FPR3"));
+		dc_e2ee_save_gossiped_keys(context, chat_id, gossiped_keys, 0);
+		assert( count_gossiped(context, chat_id, NULL)==2 );
+		assert( count_gossiped(context, chat_id, "FPR3")==1 && count_gossiped(context, chat_id, "FPR2")==0 );
+
+		dc_e2ee_save_gossiped_keys(context, chat_id, gossiped_keys, 1); /* gossiping all keys removes the others */
+		assert( count_gossiped(context, chat_id, NULL)==1 );
+
+		dc_add_to_chat_contacts_table(context, chat_id, contact_id); /* a new member needs all keys */
+		assert( count_gossiped(context, chat_id, NULL)==0 );
+
+		dc_e2ee_save_gossiped_keys(context, chat_id, gossiped_keys, 1);
+		dc_delete_chat(context, chat_id);
+		assert( count_gossiped(context, chat_id, NULL)==0 );
+
+		dc_e2ee_free_gossiped_keys(gossiped_keys);
+		dc_delete_contact(context, contact_id);
+	}
+
+	/* test the full-text index used by dc_search_msgs()
+	 **************************************************************************/
+
+	if (dc_is_open(context) && context->sql->search_index)
+	{
+		dc_sqlite3_t* sql = context->sql;
+		while (!sql->search_index_ready) {
+			dc_build_search_index(context);
+		}
+
+		uint32_t chat_id = dc_create_group_chat(context, 0, "stress.search");
+		dc_set_draft(context, chat_id, NULL);
+		dc_add_device_msg(context, chat_id, "Stress: Überprüfung der Volltextsuche");
+
+		dc_array_t* msgs = dc_search_msgs(context, chat_id, "uberpr VOLL"); /* words are prefixes, case and diacritics are ignored */
+		assert( msgs && dc_array_get_cnt(msgs)==1 );
+		uint32_t msg_id = dc_array_get_id(msgs, 0);
+		dc_array_unref(msgs);
+
+		msgs = dc_search_msgs(context, 0, "\"volltext* DER");                /* no FTS5 syntax */
+		assert( msgs && dc_array_get_cnt(msgs)==1 && dc_array_get_id(msgs, 0)==msg_id );
+		dc_array_unref(msgs);
+
+		msgs = dc_search_msgs(context, chat_id, "prüfung");                  /* no prefix */
+		assert( msgs && dc_array_get_cnt(msgs)==0 );
+		dc_array_unref(msgs);
+
+		/* until the index is rebuilt, LIKE is used */
+		dc_sqlite3_execute(sql, "DELETE FROM msgs_fts;");
+		dc_sqlite3_set_config_int(sql, "search_index_todo", msg_id);
+		sql->search_index_ready = 0;
+
+		msgs = dc_search_msgs(context, chat_id, "prüfung");
+		assert( msgs && dc_array_get_cnt(msgs)==1 );
+		dc_array_unref(msgs);
+
+		while (!sql->search_index_ready) {
+			dc_build_search_index(context);
+		}
+		dc_job_kill_action(context, DC_JOB_BUILD_SEARCH_INDEX);
+
+		msgs = dc_search_msgs(context, 0, "uberpr");
+		assert( msgs && dc_array_get_cnt(msgs)==1 && dc_array_get_id(msgs, 0)==msg_id );
+		dc_array_unref(msgs);
+
+		dc_delete_chat(context, chat_id);
+		msgs = dc_search_msgs(context, 0, "uberpr");
+		assert( msgs && dc_array_get_cnt(msgs)==0 );
+		dc_array_unref(msgs);
+	}
+
+	/* test compressed texts and dc_compact_msgs()
+	 **************************************************************************/
+
+	if (dc_is_open(context))
+	{
+		dc_sqlite3_t*   sql = context->sql;
+		dc_strbuilder_t long_txt;
+		dc_strbuilder_init(&long_txt, 0);
+		for (int i = 0; i < 100; i++) {
+			dc_strbuilder_catf(&long_txt, "Received: from mail%i.example.org\r\n", i);
+		}
+
+		sqlite3_stmt* stmt = dc_sqlite3_prepare(sql, "SELECT ?, ?, ?, ?;");
+		dc_sqlite3_bind_compressed(stmt, 1, long_txt.buf, -1);
+		dc_sqlite3_bind_compressed(stmt, 2, "short text", -1);
+		dc_sqlite3_bind_compressed(stmt, 3, NULL, 0);
+		dc_sqlite3_bind_compressed(stmt, 4, long_txt.buf, 200); /* not null-terminated at the given length */
+		assert( sqlite3_step(stmt)==SQLITE_ROW );
+		assert( sqlite3_column_type(stmt, 0)==SQLITE_BLOB && sqlite3_column_bytes(stmt, 0) < (int)strlen(long_txt.buf)/4 );
+		assert( sqlite3_column_type(stmt, 1)==SQLITE_TEXT );
+		char* str = dc_sqlite3_column_uncompressed(stmt, 0); assert( strcmp(str, long_txt.buf)==0 ); free(str);
+		str = dc_sqlite3_column_uncompressed(stmt, 1); assert( strcmp(str, "short text")==0 ); free(str);
+		assert( dc_sqlite3_column_uncompressed(stmt, 2)==NULL );
+		str = dc_sqlite3_column_uncompressed(stmt, 3); assert( strlen(str)==200 && strncmp(str, long_txt.buf, 200)==0 ); free(str);
+		sqlite3_finalize(stmt);
+
+		/* messages stored before compression was added are compacted in the background */
+		uint32_t chat_id = dc_create_group_chat(context, 0, "stress.compact");
+		dc_add_device_msg(context, chat_id, "Stress: compact");
+		dc_array_t* msgs = dc_get_chat_msgs(context, chat_id, 0, 0);
+		assert( dc_array_get_cnt(msgs)==1 );
+		uint32_t msg_id = dc_array_get_id(msgs, 0);
+		dc_array_unref(msgs);
+
+		stmt = dc_sqlite3_prepare(sql, "UPDATE msgs SET txt_raw=?, mime_headers=?, from_id=" DC_STRINGIFY(DC_CONTACT_ID_SELF) ", to_id=0 WHERE id=?;"); /* dc_get_msg_info() shows txt_raw only for normal messages */
+		sqlite3_bind_text(stmt, 1, long_txt.buf, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 2, long_txt.buf, -1, SQLITE_STATIC);
+		sqlite3_bind_int (stmt, 3, msg_id);
+		sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+
+		dc_sqlite3_set_config_int(sql, "compact_todo", msg_id);
+		while (dc_sqlite3_get_config_int(sql, "compact_todo", 0)) {
+			dc_compact_msgs(context);
+		}
+		dc_job_kill_action(context, DC_JOB_COMPACT_MSGS);
+
+		stmt = dc_sqlite3_prepare(sql, "SELECT typeof(txt_raw), typeof(mime_headers) FROM msgs WHERE id=?;");
+		sqlite3_bind_int(stmt, 1, msg_id);
+		assert( sqlite3_step(stmt)==SQLITE_ROW );
+		assert( strcmp((const char*)sqlite3_column_text(stmt, 0), "blob")==0 && strcmp((const char*)sqlite3_column_text(stmt, 1), "blob")==0 );
+		sqlite3_finalize(stmt);
+
+		str = dc_get_mime_headers(context, msg_id); assert( str && strcmp(str, long_txt.buf)==0 ); free(str);
+		str = dc_get_msg_info(context, msg_id); assert( strstr(str, "Received: from mail99.example.org") ); free(str);
+
+		dc_delete_chat(context, chat_id);
+		free(long_txt.buf);
+	}
+
 	/* test Autocrypt header parsing functions
 	 **************************************************************************/
 
@@ -890,6 +1586,55 @@ void stress_functions(dc_context_t* context)
 		free(setupcode);
 	}
 
+	/* test symmetric encryption; the results must not differ from OpenSSL's AES-CFB formerly used by netpgp
+	 **************************************************************************/
+
+	{
+		#define SYMM_BYTES 5000
+		static const size_t chunks[] = { 1, 15, 16, 17, 4096, 100000 };
+		uint8_t key[32], iv[16], *plain = malloc(SYMM_BYTES), *expected = malloc(SYMM_BYTES), *buf = malloc(SYMM_BYTES);
+		for (int i = 0; i < 32; i++) { key[i] = (uint8_t)(i*7+1); }
+		for (int i = 0; i < 16; i++) { iv[i] = (uint8_t)(i*13+5); }
+		for (int i = 0; i < SYMM_BYTES; i++) { plain[i] = (uint8_t)(rand()&0xFF); }
+
+		for (int alg = 0; alg <= 1; alg++) {
+			EVP_CIPHER_CTX* legacy_ctx = EVP_CIPHER_CTX_new();
+			int             legacy_bytes = 0;
+			assert( EVP_EncryptInit_ex(legacy_ctx, alg? EVP_aes_256_cfb128() : EVP_aes_128_cfb128(), NULL, key, iv) );
+			assert( EVP_EncryptUpdate(legacy_ctx, expected, &legacy_bytes, plain, SYMM_BYTES) && legacy_bytes==SYMM_BYTES );
+			EVP_CIPHER_CTX_free(legacy_ctx);
+
+			for (int c = 0; c < (int)(sizeof(chunks)/sizeof(chunks[0])); c++) {
+				pgp_crypt_t crypt;
+				assert( pgp_crypt_any(&crypt, alg? PGP_SA_AES_256 : PGP_SA_AES_128) );
+				crypt.set_iv(&crypt, iv);
+				crypt.set_crypt_key(&crypt, key);
+				pgp_encrypt_init(&crypt);
+				for (size_t pos = 0; pos < SYMM_BYTES; pos += chunks[c]) {
+					crypt.cfb_encrypt(&crypt, &buf[pos], &plain[pos], DC_MIN(chunks[c], SYMM_BYTES-pos));
+				}
+				crypt.decrypt_finish(&crypt);
+				assert( memcmp(buf, expected, SYMM_BYTES)==0 );
+
+				/* decrypt in place using other chunks */
+				assert( pgp_crypt_any(&crypt, alg? PGP_SA_AES_256 : PGP_SA_AES_128) );
+				crypt.set_iv(&crypt, iv);
+				crypt.set_crypt_key(&crypt, key);
+				pgp_decrypt_init(&crypt);
+				size_t chunk = chunks[(c+1)%(sizeof(chunks)/sizeof(chunks[0]))];
+				for (size_t pos = 0; pos < SYMM_BYTES; pos += chunk) {
+					crypt.cfb_decrypt(&crypt, &buf[pos], &buf[pos], DC_MIN(chunk, SYMM_BYTES-pos));
+				}
+				crypt.decrypt_finish(&crypt);
+				assert( memcmp(buf, plain, SYMM_BYTES)==0 );
+			}
+		}
+
+		free(plain);
+		free(expected);
+		free(buf);
+	}
+
 	/* test end-to-end-encryption
 	 **************************************************************************/
 
@@ -963,6 +1708,7 @@ void stress_functions(dc_context_t* context)
 			dc_hash_t valid_signatures;
 			dc_hash_init(&valid_signatures, DC_HASH_STRING, 1/*copy key*/);
 			int ok;
+			int key_cache_hits = context->key_cache_hits;
 
 			ok = dc_pgp_pk_decrypt(context, ctext_signed, ctext_signed_bytes, keyring, public_keyring/*for validate*/, 1, &plain, &plain_bytes, &valid_signatures);
 			assert( ok && plain && plain_bytes>0 );
@@ -1000,6 +1746,10 @@ void stress_functions(dc_context_t* context)
 			free(plain); plain = NULL;
 			dc_hash_clear(&valid_signatures);
 
+			assert( context->key_cache_hits >= key_cache_hits+10 ); /* the keys were parsed by dc_pgp_pk_encrypt() before */
+			dc_pgp_clear_key_cache(context);
+			assert( dc_hash_cnt(&context->key_cache)==0 );
+
 			dc_keyring_unref(keyring);
 			dc_keyring_unref(public_keyring);
 			dc_keyring_unref(public_keyring2);
@@ -1022,6 +1772,255 @@ void stress_functions(dc_context_t* context)
 			dc_keyring_unref(public_keyring);
 		}
 
+		{
+			/* independent messages are decrypted in parallel, the results equal those of dc_pgp_pk_decrypt() */
+			#define BATCH_CNT 12
+			dc_keyring_t* keyring = dc_keyring_new();
+			dc_keyring_add(keyring, private_key);
+			dc_keyring_t* public_keyring = dc_keyring_new();
+			dc_keyring_add(public_keyring, public_key);
+
+			dc_pgp_decrypt_job_t jobs[BATCH_CNT];
+			dc_hash_t            valid_signatures[BATCH_CNT];
+			memset(jobs, 0, sizeof(jobs));
+			for (int i = 0; i < BATCH_CNT; i++) {
+				dc_hash_init(&valid_signatures[i], DC_HASH_STRING, 1/*copy key*/);
+				jobs[i].ctext                  = (i%3==0)? ctext_unsigned : ctext_signed;
+				jobs[i].ctext_bytes            = (i%3==0)? ctext_unsigned_bytes : ctext_signed_bytes;
+				jobs[i].private_keys           = keyring;
+				jobs[i].validate_keys          = public_keyring;
+				jobs[i].use_armor              = 1;
+				jobs[i].signature_fingerprints = &valid_signatures[i];
+			}
+			jobs[BATCH_CNT-1].ctext_bytes = 50; /* a broken message does not affect the others */
+
+			assert( dc_pgp_pk_decrypt_batch(context, jobs, BATCH_CNT)==BATCH_CNT-1 );
+			for (int i = 0; i < BATCH_CNT-1; i++) {
+				assert( jobs[i].success && jobs[i].plain_bytes==strlen(original_text) );
+				assert( strncmp((char*)jobs[i].plain, original_text, jobs[i].plain_bytes)==0 );
+				assert( dc_hash_cnt(&valid_signatures[i])==((i%3==0)? 0 : 1) );
+			}
+			assert( !jobs[BATCH_CNT-1].success && jobs[BATCH_CNT-1].plain==NULL );
+
+			for (int i = 0; i < BATCH_CNT; i++) {
+				free(jobs[i].plain);
+				dc_hash_clear(&valid_signatures[i]);
+			}
+			assert( dc_pgp_pk_decrypt_batch(context, jobs, 0)==0 );
+
+			dc_keyring_unref(keyring);
+			dc_keyring_unref(public_keyring);
+			#undef BATCH_CNT
+		}
+
+		{
+			/* large data is written in packets with partial body lengths */
+			#define LARGE_BYTES (300*1024+123)
+			char* large = malloc(LARGE_BYTES);
+			for (int i = 0; i < LARGE_BYTES; i++) {
+				large[i] = (i%7==0)? (char)(rand()&0xFF) : (char)('a'+i%26); /* hardly compressible in parts */
+			}
+
+			dc_keyring_t* keyring = dc_keyring_new();
+			dc_keyring_add(keyring, public_key);
+			dc_keyring_t* private_keyring = dc_keyring_new();
+			dc_keyring_add(private_keyring, private_key);
+
+			for (int sign = 0; sign <= 1; sign++) {
+				void* ctext = NULL; size_t ctext_bytes = 0;
+				dc_pgp_encrypt_t* enc = dc_pgp_pk_encrypt_begin(context, keyring, sign? private_key : NULL, 0/*binary*/);
+				assert( enc );
+				for (int pos = 0; pos < LARGE_BYTES; pos += 1000) { /* write in pieces as mailmime_write_driver() does */
+					assert( dc_pgp_pk_encrypt_write(enc, &large[pos], pos+1000<=LARGE_BYTES? 1000 : LARGE_BYTES-pos) );
+				}
+				assert( dc_pgp_pk_encrypt_end(enc, &ctext, &ctext_bytes) && ctext && ctext_bytes>0 );
+
+				void* plain = NULL; size_t plain_bytes = 0;
+				dc_hash_t valid_signatures;
+				dc_hash_init(&valid_signatures, DC_HASH_STRING, 1/*copy key*/);
+				int ok = dc_pgp_pk_decrypt(context, ctext, ctext_bytes, private_keyring, keyring/*for validate*/, 0/*binary*/, &plain, &plain_bytes, &valid_signatures);
+				assert( ok && plain_bytes==LARGE_BYTES && memcmp(plain, large, LARGE_BYTES)==0 );
+				assert( dc_hash_cnt(&valid_signatures) == sign );
+				dc_hash_clear(&valid_signatures);
+				free(plain);
+
+				/* decrypting to a file gives the same result; the signature is checked using a hash calculated while decrypting */
+				FILE* f = tmpfile();
+				assert( f );
+				ok = dc_pgp_pk_decrypt_to_fd(context, ctext, ctext_bytes, private_keyring, keyring/*for validate*/, 0/*binary*/, fileno(f), &valid_signatures);
+				assert( ok && dc_hash_cnt(&valid_signatures) == sign );
+				dc_hash_clear(&valid_signatures);
+				plain = malloc(LARGE_BYTES+1);
+				rewind(f);
+				assert( fread(plain, 1, LARGE_BYTES+1, f)==LARGE_BYTES && memcmp(plain, large, LARGE_BYTES)==0 );
+				free(plain);
+				fclose(f);
+
+				free(ctext);
+			}
+
+			dc_pgp_pk_encrypt_end(dc_pgp_pk_encrypt_begin(context, keyring, private_key, 1), NULL, NULL); /* aborting does not leak */
+
+			dc_keyring_unref(keyring);
+			dc_keyring_unref(private_keyring);
+			free(large);
+		}
+
+		if (dc_is_open(context))
+		{
+			/* a spare keypair is used instead of creating a new one */
+			dc_key_t* test_key = dc_key_new();
+			int spare_keypair = dc_sqlite3_get_config_int(context->sql, "spare_keypair", DC_SPARE_KEYPAIR_DEFAULT);
+			dc_sqlite3_set_config_int(context->sql, "spare_keypair", 0); /* do not create a new spare keypair */
+			assert( !dc_key_has_spare_keypair("spare@bar.de", context->sql) );
+			assert( dc_key_save_spare_keypair(public_key, private_key, "spare@bar.de", context->sql) );
+			assert( dc_key_has_spare_keypair("SPARE@bar.de", context->sql) );
+
+			dc_start_keygen(context, "spare@bar.de");
+			dc_start_keygen(context, "spare@bar.de"); /* does nothing, the thread is running or the keypair exists */
+			dc_stop_keygen(context);
+			assert( context->keygen_thread_state==DC_KEYGEN_THREAD_NONE && !context->keygen_running );
+
+			assert( dc_key_load_self_public(test_key, "spare@bar.de", context->sql) );
+			assert( dc_key_equals(test_key, public_key) );
+			assert( !dc_key_has_spare_keypair("spare@bar.de", context->sql) );
+
+			dc_sqlite3_execute(context->sql, "DELETE FROM keypairs WHERE addr='spare@bar.de';");
+			dc_sqlite3_set_config_int(context->sql, "spare_keypair", spare_keypair);
+			dc_key_unref(test_key);
+		}
+
+		if (dc_is_open(context) && !dc_is_configured(context))
+		{
+			/* messages seen again are taken from the table decrypt_cache */
+			#define TEST_ADDR "stress.decrypt@bar.de"
+			#define TEST_MID  "stress.decrypt.mid@bar.de"
+			dc_sqlite3_set_config(context->sql, "configured_addr", TEST_ADDR);
+			dc_key_save_self_keypair(public_key, private_key, TEST_ADDR, 0, context->sql);
+
+			dc_apeerstate_t* peerstate = dc_apeerstate_new(context);
+			peerstate->addr = dc_strdup(TEST_ADDR);
+			peerstate->public_key = dc_key_ref(public_key);
+			dc_apeerstate_recalc_fingerprint(peerstate);
+			dc_apeerstate_save_to_db(peerstate, context->sql, 1/*create*/);
+
+			const char* inner = "Content-Type: text/plain\r\n\r\ndecrypt cache test\r\n";
+			dc_keyring_t* keyring = dc_keyring_new();
+			dc_keyring_add(keyring, public_key);
+			void* ctext = NULL;
+			size_t ctext_bytes = 0;
+			assert( dc_pgp_pk_encrypt(context, inner, strlen(inner), keyring, private_key, 1, &ctext, &ctext_bytes) );
+
+			char* raw = dc_mprintf(
+				"From: <" TEST_ADDR ">\n"
+				"Message-ID: <" TEST_MID ">\n"
+				"Chat-Version: 1.0\n"
+				"MIME-Version: 1.0\n"
+				"Content-Type: multipart/encrypted; protocol=\"application/pgp-encrypted\"; boundary=\"==break==\"\n"
+				"\n"
+				"--==break==\n"
+				"Content-Type: application/pgp-encrypted\n"
+				"\n"
+				"Version: 1\n"
+				"--==break==\n"
+				"Content-Type: application/octet-stream\n"
+				"\n"
+				"%.*s\n"
+				"--==break==--\n", (int)ctext_bytes, (char*)ctext);
+
+			int hits = context->decrypt_cache_hits, misses = context->decrypt_cache_misses;
+			for (int i = 0; i < 3; i++) {
+				if (i==2) { /* the signature is valid only if the key is still known */
+					dc_sqlite3_execute(context->sql, "DELETE FROM acpeerstates WHERE addr='" TEST_ADDR "';");
+					dc_apeerstate_clear_cache(context->sql);
+				}
+				dc_mimeparser_t* mimeparser = dc_mimeparser_new(context->blobdir, context);
+				dc_mimeparser_parse(mimeparser, raw, strlen(raw));
+				assert( mimeparser->e2ee_helper->encrypted && !mimeparser->decrypting_failed );
+				assert( dc_hash_cnt(mimeparser->e2ee_helper->signatures)==(i<2? 1 : 0) );
+				assert( carray_count(mimeparser->parts)==1 );
+				assert( strcmp(((dc_mimepart_t*)carray_get(mimeparser->parts, 0))->msg, "decrypt cache test")==0 );
+				dc_mimeparser_unref(mimeparser);
+			}
+			assert( context->decrypt_cache_misses==misses+1 && context->decrypt_cache_hits==hits+2 );
+			assert( count_decrypt_cache(context, TEST_MID)==1 );
+
+			/* results without a valid signature are not cached, the signing key may become known later */
+			dc_sqlite3_execute(context->sql, "DELETE FROM decrypt_cache;");
+			for (int i = 0; i < 2; i++) {
+				if (i==1) {
+					dc_apeerstate_save_to_db(peerstate, context->sql, 1/*create*/);
+				}
+				dc_mimeparser_t* mimeparser = dc_mimeparser_new(context->blobdir, context);
+				dc_mimeparser_parse(mimeparser, raw, strlen(raw));
+				assert( dc_hash_cnt(mimeparser->e2ee_helper->signatures)==i );
+				dc_mimeparser_unref(mimeparser);
+				assert( count_decrypt_cache(context, TEST_MID)==i );
+			}
+
+			/* the plaintext is deleted together with the message */
+			dc_sqlite3_execute(context->sql, "INSERT INTO msgs (rfc724_mid, chat_id) VALUES ('" TEST_MID "', " DC_STRINGIFY(DC_CHAT_ID_TRASH) ");");
+			dc_delete_msg_from_db(context, (uint32_t)sqlite3_last_insert_rowid(context->sql->cobj));
+			assert( count_decrypt_cache(context, TEST_MID)==0 );
+
+			free(raw);
+			free(ctext);
+			dc_keyring_unref(keyring);
+			dc_apeerstate_unref(peerstate);
+			dc_sqlite3_execute(context->sql, "DELETE FROM decrypt_cache;");
+			dc_sqlite3_execute(context->sql, "DELETE FROM acpeerstates WHERE addr='" TEST_ADDR "';");
+			dc_apeerstate_clear_cache(context->sql);
+			dc_sqlite3_execute(context->sql, "DELETE FROM keypairs WHERE addr='" TEST_ADDR "';");
+			dc_sqlite3_set_config(context->sql, "configured_addr", NULL);
+			#undef TEST_MID
+			#undef TEST_ADDR
+		}
+
+		{
+			/* gossip headers use the rendered keys cached by the context */
+			dc_apeerstate_t* peerstate = dc_apeerstate_new(context);
+			dc_aheader_t*    aheader = dc_aheader_new();
+			peerstate->addr = dc_strdup("gossip@bar.de");
+			peerstate->public_key = dc_key_ref(public_key);
+			aheader->addr = dc_strdup("gossip@bar.de");
+			dc_key_set_from_key(aheader->public_key, public_key);
+
+			char* rendered = dc_aheader_render(aheader);
+			char* gossip1 = dc_apeerstate_render_gossip_header(peerstate, DC_NOT_VERIFIED);
+			char* gossip2 = dc_apeerstate_render_gossip_header(peerstate, DC_NOT_VERIFIED);
+			assert( rendered && gossip1 && gossip2 );
+			assert( strcmp(rendered, gossip1)==0 && strcmp(gossip1, gossip2)==0 );
+			assert( dc_hash_find(&context->key_render_cache, public_key->binary, public_key->bytes)!=NULL );
+			assert( dc_apeerstate_render_gossip_header(peerstate, DC_BIDIRECT_VERIFIED)==NULL ); /* no verified key */
+
+			/* a full cache evicts only the least recently used key */
+			dc_apeerstate_clear_render_cache(context);
+			free(dc_apeerstate_render_gossip_header(peerstate, DC_NOT_VERIFIED));
+			dc_apeerstate_t* other = dc_apeerstate_new(context);
+			other->addr = dc_strdup("other@bar.de");
+			other->public_key = dc_key_new();
+			for (int i = 0; i < DC_KEY_RENDER_CACHE_SIZE; i++) {
+				uint8_t fake[8] = { 'f', 'a', 'k', 'e', (uint8_t)(i>>8), (uint8_t)i, 0, 0 };
+				dc_key_set_from_binary(other->public_key, fake, sizeof(fake), DC_KEY_PUBLIC);
+				free(dc_apeerstate_render_gossip_header(other, DC_NOT_VERIFIED));
+				if (i==0) {
+					free(dc_apeerstate_render_gossip_header(peerstate, DC_NOT_VERIFIED)); /* public_key is used more recently than fake key #0 */
+				}
+			}
+			assert( dc_hash_cnt(&context->key_render_cache)==DC_KEY_RENDER_CACHE_SIZE );
+			assert( dc_hash_find(&context->key_render_cache, public_key->binary, public_key->bytes)!=NULL );
+			uint8_t fake0[8] = { 'f', 'a', 'k', 'e', 0, 0, 0, 0 };
+			assert( dc_hash_find(&context->key_render_cache, fake0, sizeof(fake0))==NULL );
+			dc_apeerstate_unref(other);
+			dc_apeerstate_clear_render_cache(context);
+
+			free(rendered);
+			free(gossip1);
+			free(gossip2);
+			dc_aheader_unref(aheader);
+			dc_apeerstate_unref(peerstate);
+		}
+
 		free(ctext_signed);
 		free(ctext_unsigned);
 		dc_key_unref(public_key2);
@@ -1060,3 +2059,301 @@ void stress_functions(dc_context_t* context)
 		dc_lot_unref(res);
 	}
 }
+
+
+/*******************************************************************************
+ * Benchmarks, run by `delta --bench`
+ ******************************************************************************/
+
+
+static double mb_per_s(size_t bytes, int rounds, clock_t start)
+{
+	double seconds = (double)(clock()-start)/CLOCKS_PER_SEC;
+	return seconds>0? (double)bytes*rounds/(1024*1024)/seconds : 0;
+}
+
+
+static double wall_clock(void)
+{
+	/* clock() measures the time of all threads together, so it cannot be used for parallel code */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+
+void stress_benchmarks(dc_context_t* context)
+{
+	/* symmetric encryption of OpenPGP messages by netpgp;
+	for comparison, "legacy" is OpenSSL's AES-CFB formerly used by netpgp
+	 **************************************************************************/
+
+	{
+		static const size_t sizes[] = { 1024, 64*1024, 10*1024*1024 };
+		uint8_t key[16], iv[16];
+		memset(key, 0x42, sizeof(key));
+		memset(iv, 0x17, sizeof(iv));
+
+		for (int s = 0; s < (int)(sizeof(sizes)/sizeof(sizes[0])); s++) {
+			size_t   bytes = sizes[s];
+			int      rounds = DC_MAX(1, (int)((64*1024*1024)/bytes));
+			uint8_t* plain = calloc(1, bytes);
+			uint8_t* buf = malloc(bytes);
+			double   mbs[4];
+			clock_t  start;
+
+			EVP_CIPHER_CTX* legacy_ctx = EVP_CIPHER_CTX_new();
+			for (int dir = 0; dir <= 1; dir++) {
+				start = clock();
+				for (int r = 0; r < rounds; r++) {
+					int legacy_bytes = 0;
+					EVP_CipherInit_ex(legacy_ctx, EVP_aes_128_cfb128(), NULL, key, iv, dir? 0 : 1);
+					EVP_CipherUpdate(legacy_ctx, buf, &legacy_bytes, plain, (int)bytes);
+				}
+				mbs[dir] = mb_per_s(bytes, rounds, start);
+			}
+			EVP_CIPHER_CTX_free(legacy_ctx);
+
+			for (int dir = 0; dir <= 1; dir++) {
+				start = clock();
+				for (int r = 0; r < rounds; r++) {
+					pgp_crypt_t crypt;
+					pgp_crypt_any(&crypt, PGP_SA_AES_128);
+					crypt.set_iv(&crypt, iv);
+					crypt.set_crypt_key(&crypt, key);
+					pgp_encrypt_init(&crypt);
+					if (dir) {
+						crypt.cfb_decrypt(&crypt, buf, plain, bytes);
+					}
+					else {
+						crypt.cfb_encrypt(&crypt, buf, plain, bytes);
+					}
+					crypt.decrypt_finish(&crypt);
+				}
+				mbs[2+dir] = mb_per_s(bytes, rounds, start);
+			}
+
+			printf("AES-128-CFB %8i bytes: encrypt %7.1f MB/s (legacy %7.1f MB/s), decrypt %7.1f MB/s (legacy %7.1f MB/s)\n",
+				(int)bytes, mbs[2], mbs[0], mbs[3], mbs[1]);
+
+			free(plain);
+			free(buf);
+		}
+	}
+
+	/* decryption of independent messages, one after the other and using dc_pgp_pk_decrypt_batch()
+	 **************************************************************************/
+
+	{
+		#define BENCH_MSGS 64
+		dc_key_t*     public_key = dc_key_new();
+		dc_key_t*     private_key = dc_key_new();
+		dc_keyring_t* public_keyring = dc_keyring_new();
+		dc_keyring_t* private_keyring = dc_keyring_new();
+		size_t        plain_bytes = 16*1024;
+		char*         plain = malloc(plain_bytes);
+		void*         ctext = NULL;
+		size_t        ctext_bytes = 0;
+		double        start, serial_s, batch_s;
+
+		memset(plain, 'x', plain_bytes);
+		dc_pgp_create_keypair(context, "bench@bar.de", public_key, private_key);
+		dc_keyring_add(public_keyring, public_key);
+		dc_keyring_add(private_keyring, private_key);
+		dc_pgp_pk_encrypt(context, plain, plain_bytes, public_keyring, private_key, 1, &ctext, &ctext_bytes);
+
+		dc_pgp_decrypt_job_t jobs[BENCH_MSGS];
+		memset(jobs, 0, sizeof(jobs));
+		for (int i = 0; i < BENCH_MSGS; i++) {
+			jobs[i].ctext         = ctext;
+			jobs[i].ctext_bytes   = ctext_bytes;
+			jobs[i].private_keys  = private_keyring;
+			jobs[i].validate_keys = public_keyring;
+			jobs[i].use_armor     = 1;
+		}
+
+		start = wall_clock();
+		for (int i = 0; i < BENCH_MSGS; i++) {
+			void*  p = NULL;
+			size_t p_bytes = 0;
+			dc_pgp_pk_decrypt(context, ctext, ctext_bytes, private_keyring, public_keyring, 1, &p, &p_bytes, NULL);
+			free(p);
+		}
+		serial_s = wall_clock()-start;
+
+		start = wall_clock();
+		int ok_cnt = dc_pgp_pk_decrypt_batch(context, jobs, BENCH_MSGS);
+		batch_s = wall_clock()-start;
+		for (int i = 0; i < BENCH_MSGS; i++) {
+			free(jobs[i].plain);
+		}
+
+		printf("Decrypt %i signed messages of %i bytes: one by one %7.1f msgs/s, batch %7.1f msgs/s (%i ok, %li cores)\n",
+			BENCH_MSGS, (int)plain_bytes, serial_s>0? BENCH_MSGS/serial_s : 0, batch_s>0? BENCH_MSGS/batch_s : 0,
+			ok_cnt, sysconf(_SC_NPROCESSORS_ONLN));
+
+		free(ctext);
+		free(plain);
+		dc_keyring_unref(public_keyring);
+		dc_keyring_unref(private_keyring);
+		dc_key_unref(public_key);
+		dc_key_unref(private_key);
+		#undef BENCH_MSGS
+	}
+
+	/* transfer encodings of a 25 MB attachment;
+	for comparison, "libetpan" is encode_base64()+dc_insert_breaks() and mailmime_part_parse() formerly used
+	 **************************************************************************/
+
+	{
+		#define BENCH_BYTES (25*1024*1024)
+		uint8_t* bin = malloc(BENCH_BYTES);
+		for (int i = 0; i < BENCH_BYTES; i++) {
+			bin[i] = (uint8_t)(rand()&0xFF);
+		}
+
+		/* quoted-printable: mostly text with some encoded characters and soft line breaks every 76 characters */
+		char* qp = malloc(BENCH_BYTES+1);
+		for (int i = 0; i < BENCH_BYTES; i++) {
+			qp[i] = i%78==76? '=' : i%78==77? '\n' : i%20==0? '=' : i%20<3? "0123456789ABCDEF"[bin[i]&0xF] : 'a'+(bin[i]%26);
+		}
+		qp[BENCH_BYTES] = 0;
+
+		for (int enc = 0; enc <= 1; enc++) {
+			clock_t start;
+			double  gbs[2];
+			char*   encoded = enc? qp : dc_encode_base64(bin, BENCH_BYTES, 76, "\r\n");
+			size_t  encoded_bytes = strlen(encoded);
+			char*   decoded = malloc(DC_DECODE_QUOTED_PRINTABLE_MAX_BYTES(encoded_bytes));
+			size_t  index = 0, decoded_bytes = 0;
+			char*   result = NULL;
+
+			start = clock();
+			mailmime_part_parse(encoded, encoded_bytes, &index, enc? MAILMIME_MECHANISM_QUOTED_PRINTABLE : MAILMIME_MECHANISM_BASE64, &result, &decoded_bytes);
+			gbs[0] = mb_per_s(encoded_bytes, 1, start)/1024;
+			mmap_string_unref(result);
+
+			start = clock();
+			decoded_bytes = enc? dc_decode_quoted_printable(encoded, encoded_bytes, decoded, NULL) : dc_decode_base64(encoded, encoded_bytes, decoded, NULL);
+			gbs[1] = mb_per_s(encoded_bytes, 1, start)/1024;
+			assert( enc || (decoded_bytes==BENCH_BYTES && memcmp(decoded, bin, BENCH_BYTES)==0) );
+
+			printf("Decode %i MB %s: %5.2f GB/s (libetpan %5.2f GB/s)\n",
+				(int)(encoded_bytes/(1024*1024)), enc? "quoted-printable" : "base64", gbs[1], gbs[0]);
+
+			free(decoded);
+			if (!enc) {
+				free(encoded);
+			}
+		}
+
+		{
+			clock_t start;
+			double  gbs[2];
+			char*   encoded = NULL;
+
+			start = clock();
+			char* temp = encode_base64((const char*)bin, BENCH_BYTES);
+			encoded = dc_insert_breaks(temp, 76, "\r\n");
+			gbs[0] = mb_per_s(BENCH_BYTES, 1, start)/1024;
+			free(temp);
+			free(encoded);
+
+			start = clock();
+			encoded = dc_encode_base64(bin, BENCH_BYTES, 76, "\r\n");
+			gbs[1] = mb_per_s(BENCH_BYTES, 1, start)/1024;
+			free(encoded);
+
+			printf("Encode %i MB base64: %5.2f GB/s (libetpan %5.2f GB/s)\n", BENCH_BYTES/(1024*1024), gbs[1], gbs[0]);
+		}
+
+		free(qp);
+		free(bin);
+		#undef BENCH_BYTES
+	}
+	/* simplifying plain-text mails: the corpus, repeated, and a long thread quoted at the end
+	 **************************************************************************/
+
+	{
+		dc_simplify_t* simplify = dc_simplify_new();
+		int            corpus_cnt = (int)(sizeof(s_simplify_corpus)/sizeof(s_simplify_corpus[0]));
+		size_t         corpus_bytes = 0;
+		int            rounds = 20000;
+		clock_t        start;
+
+		for (int i = 0; i < corpus_cnt; i++) {
+			corpus_bytes += strlen(s_simplify_corpus[i].text);
+		}
+
+		start = clock();
+		for (int r = 0; r < rounds; r++) {
+			for (int i = 0; i < corpus_cnt; i++) {
+				char* plain = dc_simplify_simplify(simplify, s_simplify_corpus[i].text, strlen(s_simplify_corpus[i].text), 0, s_simplify_corpus[i].is_msgrmsg);
+				assert( strcmp(plain, s_simplify_corpus[i].simplified)==0 );
+				free(plain);
+			}
+		}
+		printf("Simplify corpus of %i mails: %6.1f MB/s\n", corpus_cnt, mb_per_s(corpus_bytes, rounds, start));
+
+		dc_strbuilder_t thread;
+		dc_strbuilder_init(&thread, 0);
+		dc_strbuilder_cat(&thread, "Sounds good.\r\n\r\nOn Mon, 3 Sep 2018 at 10:12, Alice <alice@example.org> wrote:\r\n");
+		for (int i = 0; i < 100000; i++) {
+			dc_strbuilder_catf(&thread, "%s quoted line %i\r\n", i%10? ">" : ">\r\n> >", i);
+		}
+
+		rounds = 20;
+		start = clock();
+		for (int r = 0; r < rounds; r++) {
+			char* plain = dc_simplify_simplify(simplify, thread.buf, strlen(thread.buf), 0, 0);
+			assert( strcmp(plain, "Sounds good. [...]")==0 );
+			free(plain);
+		}
+		printf("Simplify %i MB thread: %6.1f MB/s\n", (int)(strlen(thread.buf)/(1024*1024)), mb_per_s(strlen(thread.buf), rounds, start));
+
+		free(thread.buf);
+		dc_simplify_unref(simplify);
+	}
+
+	/* converting HTML mails: a newsletter with tables, styles, links and entities
+	 **************************************************************************/
+
+	{
+		dc_strbuilder_t html;
+		dc_strbuilder_init(&html, 0);
+		dc_strbuilder_cat(&html, "<!DOCTYPE html>\r\n<html><head><title>Newsletter</title><style type=\"text/css\">td { padding: 0; }</style></head>\r\n<body><table width=\"100%\">\r\n");
+		for (int i = 0; i < 1000; i++) {
+			dc_strbuilder_catf(&html,
+				"<tr><td class=\"item\" style=\"font-family: Arial, sans-serif; color: #333333;\">\r\n"
+				"<div><b>Article %i</b> &ndash; <a href=\"https://example.org/articles/%i?utm_source=newsletter&amp;utm_medium=mail\">read more</a></div>\r\n"
+				"<p>Lorem ipsum dolor sit amet, consectetur &amp; adipiscing elit, sed do eiusmod tempor &quot;incididunt&quot;<br>\r\n"
+				"ut labore et dolore magna aliqua &#8211; &auml;&ouml;&uuml;&#x2014;&nbsp;end.</p></td></tr>\r\n", i, i);
+		}
+		dc_strbuilder_cat(&html, "</table></body></html>\r\n");
+
+		size_t         html_bytes = strlen(html.buf);
+		int            rounds = 50;
+		dc_saxparser_t saxparser;
+		clock_t        start;
+		double         mbs[2];
+
+		start = clock();
+		for (int r = 0; r < rounds; r++) {
+			dc_saxparser_init(&saxparser, NULL);
+			dc_saxparser_parse(&saxparser, html.buf, html_bytes);
+		}
+		mbs[0] = mb_per_s(html_bytes, rounds, start);
+
+		start = clock();
+		for (int r = 0; r < rounds; r++) {
+			char* plain = dc_dehtml(html.buf, html_bytes);
+			assert( strstr(plain, "*Article 999* \xE2\x80\x93 [read more](https://example.org/articles/999?utm_source=newsletter&utm_medium=mail)") );
+			free(plain);
+		}
+		mbs[1] = mb_per_s(html_bytes, rounds, start);
+
+		printf("Parse %i KB HTML: %6.1f MB/s, dehtml %6.1f MB/s\n", (int)(html_bytes/1024), mbs[0], mbs[1]);
+
+		free(html.buf);
+	}
+}
@@ -6,6 +6,7 @@ extern "C" {
 
 
 void stress_functions(dc_context_t*);
+void stress_benchmarks(dc_context_t*);
 
 
 #ifdef __cplusplus
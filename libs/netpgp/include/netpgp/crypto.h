@@ -231,6 +231,17 @@ pgp_decrypt_and_validate_buf(pgp_io_t *io,
 			const unsigned use_armour,
             key_id_t **recipients_key_ids,
             unsigned *recipients_count);
+unsigned
+pgp_decrypt_and_validate_fd(pgp_io_t *io,
+			pgp_validation_t *result,
+			const void *input,
+			const size_t insize,
+			pgp_keyring_t *secring,
+			pgp_keyring_t *pubring,
+			const unsigned use_armour,
+			int fd,
+			key_id_t **recipients_key_ids,
+			unsigned *recipients_count);
 
 /* Keys */
 #if 0 //////
@@ -134,4 +134,14 @@ int DSA_set0_key(DSA *d, BIGNUM *pub_key, BIGNUM *priv_key)
     return 1;
 }
 
+EVP_MD_CTX *EVP_MD_CTX_new(void)
+{
+    return EVP_MD_CTX_create();
+}
+
+void EVP_MD_CTX_free(EVP_MD_CTX *ctx)
+{
+    EVP_MD_CTX_destroy(ctx);
+}
+
 #endif
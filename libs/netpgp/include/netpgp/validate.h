@@ -96,6 +96,9 @@ typedef struct {
 	const pgp_keyring_t		*keyring;
 	pgp_validation_t		*result;
 	char				*detachname;
+	unsigned			 hash_stream;	/* hash literal data of one-pass signed messages as it arrives instead of collecting it in mem */
+	unsigned			 onepassc;	/* number of one-pass signature packets seen */
+	pgp_hash_t			*streamhash;	/* the running hash, if hash_stream is used */
 } validate_data_cb_t;
 
 #if 0 //////
@@ -132,6 +135,7 @@ unsigned   pgp_validate_mem_detached(pgp_io_t *,
 			pgp_memory_t *);
 
 pgp_cb_ret_t validate_data_cb(const pgp_packet_t *, pgp_cbdata_t *);
+void pgp_validate_free_streamhash(validate_data_cb_t *);
 void pgp_free_sig_info(pgp_sig_info_t *);
 
 #if 0 //////
@@ -114,9 +114,8 @@ unsigned pgp_write_mpi(pgp_output_t *, const BIGNUM *);
 void pgp_writer_info_delete(pgp_writer_t *);
 unsigned pgp_writer_info_finalise(pgp_error_t **, pgp_writer_t *);
 
-#if 0 //////
-void pgp_push_stream_enc_se_ip(pgp_output_t *, pgp_key_t *, const char *);
-#endif //////
+int pgp_push_stream_enc_se_ip(pgp_output_t *, const pgp_keyring_t *, const char *, unsigned);
+int pgp_push_stream_sign(pgp_output_t *, const pgp_seckey_t *, pgp_hash_alg_t, const time_t, const time_t);
 
 void pgp_push_sum16_writer(pgp_output_t *output);
 
@@ -649,6 +649,7 @@ pgp_decrypt_and_validate_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 	switch (pkt->tag) {
 	case PGP_PTAG_CT_LITDATA_BODY:
 	case PGP_PTAG_CT_SIGNED_CLEARTEXT_BODY:
+	case PGP_PTAG_CT_1_PASS_SIG:
 	case PGP_PTAG_CT_SIGNATURE:	/* V3 sigs */
 	case PGP_PTAG_CT_SIGNATURE_FOOTER:	/* V4 sigs */
         ret_validate_cb = validate_data_cb(pkt, cbinfo);
@@ -665,62 +666,53 @@ pgp_decrypt_and_validate_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
            PGP_KEEP_MEMORY : PGP_RELEASE_MEMORY;
 }
 
-/* decrypt and validate an area of memory */
-pgp_memory_t *
-pgp_decrypt_and_validate_buf(pgp_io_t *io,
+/* decrypt and validate an area of memory, writing the plaintext to the
+   given output; the input is not copied */
+static unsigned
+decrypt_and_validate(pgp_io_t *io,
 			pgp_validation_t *result,
 			const void *input,
 			const size_t insize,
 			pgp_keyring_t *secring,
 			pgp_keyring_t *pubring,
 			const unsigned use_armour,
-            key_id_t **recipients_key_ids,
-            unsigned *recipients_count)
+			pgp_output_t *output,
+			key_id_t **recipients_key_ids,
+			unsigned *recipients_count)
 {
-    // historical code bloat...
-    const unsigned sshkeys = 0;
-    //void *passfp = NULL; -- EDIT BY MR
-    //int numtries = -1; -- EDIT BY MR
-    //pgp_cbfunc_t *getpassfunc = NULL; -- EDIT BY MR
-
-    validate_data_cb_t	 validation;
+	validate_data_cb_t	 validation;
 	pgp_stream_t	*stream = NULL;
-	pgp_memory_t	*outmem;
-	pgp_memory_t	*inmem;
+	pgp_memory_t	 inmem;
 	const int	 printerrors = 1;
 
-	if (input == NULL) {
-		(void) fprintf(io->errs,
-			"pgp_encrypt_buf: null memory\n");
-		return 0;
-	}
-
-	inmem = pgp_memory_new();
-	pgp_memory_add(inmem, input, insize);
+	*recipients_count = 0;
+	*recipients_key_ids = NULL;
 
 	/* set up to read from memory */
-	pgp_setup_memory_read(io, &stream, inmem,
+	(void) memset(&inmem, 0x0, sizeof(inmem));
+	inmem.buf = (uint8_t *)(uintptr_t)input;
+	inmem.length = insize;
+	pgp_setup_memory_read(io, &stream, &inmem,
 				    &validation,
 				    pgp_decrypt_and_validate_cb,
 				    1);
 
-	/* Set verification reader and handling options */
+	/* Set verification reader and handling options; the literal data
+	 * of one-pass signed messages is hashed as it arrives, so that the
+	 * plaintext is not collected a second time */
 	(void) memset(&validation, 0x0, sizeof(validation));
 	validation.result = result;
 	validation.keyring = pubring;
 	validation.mem = pgp_memory_new();
 	pgp_memory_init(validation.mem, 128);
+	validation.hash_stream = 1;
 
 	/* setup for writing decrypted contents */
-	pgp_setup_memory_write(&stream->cbinfo.output, &outmem, insize);
+	stream->cbinfo.output = output;
 
-	/* setup keyring and passphrase callback */
+	/* setup keyring */
 	stream->cbinfo.cryptinfo.secring = secring;
 	stream->cbinfo.cryptinfo.pubring = pubring;
-	//stream->cbinfo.passfp = passfp; -- EDIT BY MR
-	//stream->cbinfo.cryptinfo.getpassphrase = getpassfunc; // EDIT BY MR
-	stream->cbinfo.sshseckey = (sshkeys) ? &secring->keys[0].key.seckey : NULL;
-	//stream->cbinfo.numtries = numtries; -- EDIT BY MR
 
 	/* Set up armour */
 	if (use_armour) {
@@ -735,32 +727,106 @@ pgp_decrypt_and_validate_buf(pgp_io_t *io,
 		pgp_reader_pop_dearmour(stream);
 	}
 
-    *recipients_count = stream->cbinfo.cryptinfo.recipients_key_idsc;
-    if (*recipients_count == 0) {
-        *recipients_key_ids = NULL;
-    } else {
-        *recipients_key_ids = calloc(sizeof(key_id_t),*recipients_count);
-        if( *recipients_key_ids != NULL)
-        {
-            memcpy(*recipients_key_ids,
-                  stream->cbinfo.cryptinfo.recipients_key_idss,
-                  sizeof(key_id_t) * *recipients_count);
-        }
-    }
+	*recipients_count = stream->cbinfo.cryptinfo.recipients_key_idsc;
+	if (*recipients_count > 0) {
+		*recipients_key_ids = calloc(sizeof(key_id_t), *recipients_count);
+		if (*recipients_key_ids != NULL) {
+			memcpy(*recipients_key_ids,
+			      stream->cbinfo.cryptinfo.recipients_key_idss,
+			      sizeof(key_id_t) * *recipients_count);
+		}
+	}
+	if (*recipients_key_ids == NULL) {
+		*recipients_count = 0;
+	}
 
-    if( *recipients_key_ids == NULL)
-    {
-        pgp_memory_free(outmem);
-        *recipients_count = 0;
-        outmem = NULL;
-    }
+	/* tidy up; the output belongs to the caller */
+	stream->cbinfo.output = NULL;
+	pgp_stream_delete(stream);
+	pgp_validate_free_streamhash(&validation);
+	pgp_memory_free(validation.mem);
 
-	/* tidy up */
-    pgp_writer_close(stream->cbinfo.output);
-    pgp_output_delete(stream->cbinfo.output);
+	return (*recipients_key_ids != NULL);
+}
 
-	pgp_teardown_memory_read(stream, inmem); /* calls pgp_stream_delete() and pgp_memory_free() */
-	pgp_memory_free(validation.mem);
+/* decrypt and validate an area of memory */
+pgp_memory_t *
+pgp_decrypt_and_validate_buf(pgp_io_t *io,
+			pgp_validation_t *result,
+			const void *input,
+			const size_t insize,
+			pgp_keyring_t *secring,
+			pgp_keyring_t *pubring,
+			const unsigned use_armour,
+            key_id_t **recipients_key_ids,
+            unsigned *recipients_count)
+{
+	pgp_output_t	*output = NULL;
+	pgp_memory_t	*outmem;
+
+	if (input == NULL) {
+		(void) fprintf(io->errs,
+			"pgp_encrypt_buf: null memory\n");
+		return 0;
+	}
+
+	/* setup for writing decrypted contents */
+	pgp_setup_memory_write(&output, &outmem, insize);
+
+	if (!decrypt_and_validate(io, result, input, insize, secring, pubring,
+			use_armour, output, recipients_key_ids, recipients_count)) {
+		pgp_memory_free(outmem);
+		outmem = NULL;
+	}
+
+	/* tidy up */
+	pgp_writer_close(output);
+	pgp_output_delete(output);
 
 	return outmem;
 }
+
+/* decrypt and validate an area of memory, writing the plaintext to the
+   given file descriptor instead of memory */
+unsigned
+pgp_decrypt_and_validate_fd(pgp_io_t *io,
+			pgp_validation_t *result,
+			const void *input,
+			const size_t insize,
+			pgp_keyring_t *secring,
+			pgp_keyring_t *pubring,
+			const unsigned use_armour,
+			int fd,
+			key_id_t **recipients_key_ids,
+			unsigned *recipients_count)
+{
+	pgp_output_t	*output;
+	unsigned	 ret;
+
+	if (input == NULL || fd < 0) {
+		(void) fprintf(io->errs,
+			"pgp_decrypt_and_validate_fd: bad args\n");
+		return 0;
+	}
+
+	if ((output = pgp_output_new()) == NULL) {
+		(void) fprintf(io->errs,
+			"pgp_decrypt_and_validate_fd: bad alloc\n");
+		return 0;
+	}
+	pgp_writer_set_fd(output, fd);
+
+	ret = decrypt_and_validate(io, result, input, insize, secring, pubring,
+			use_armour, output, recipients_key_ids, recipients_count);
+
+	/* tidy up; the file descriptor is not closed */
+	if (!pgp_writer_close(output) || output->errors) {
+		(void) fprintf(io->errs,
+			"pgp_decrypt_and_validate_fd: write failed\n");
+		ret = 0;
+	}
+	pgp_free_errors(output->errors);
+	pgp_output_delete(output);
+
+	return ret;
+}
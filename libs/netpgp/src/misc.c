@@ -484,12 +484,17 @@ pgp_keyid(uint8_t *keyid, const size_t idlen, const pgp_pubkey_t *key, pgp_hash_
 void
 pgp_hash_add_int(pgp_hash_t *hash, unsigned n, unsigned length)
 {
-	uint8_t   c;
+	uint8_t   c[sizeof(n)];
+	unsigned  i;
 
-	while (length--) {
-		c = n >> (length * 8);
-		hash->add(hash, &c, 1);
+	if (length > sizeof(c)) {
+		length = sizeof(c);
 	}
+	/* add all bytes by a single call, big endian */
+	for (i = 0; i < length; i++) {
+		c[i] = (uint8_t)(n >> ((length - 1 - i) * 8));
+	}
+	hash->add(hash, c, length);
 }
 
 /**
@@ -1226,10 +1231,11 @@ netpgp_log(const char *fmt, ...)
 	va_list	 vp;
 	time_t	 t;
 	char	 buf[BUFSIZ * 2];
+	char	 timebuf[32];
 	int	 cc;
 
 	(void) time(&t);
-	cc = snprintf(buf, sizeof(buf), "%.24s: netpgp: ", ctime(&t));
+	cc = snprintf(buf, sizeof(buf), "%.24s: netpgp: ", ctime_r(&t, timebuf));
 	va_start(vp, fmt);
 	(void) vsnprintf(&buf[cc], sizeof(buf) - (size_t)cc, fmt, vp);
 	va_end(vp);
@@ -143,39 +143,56 @@ pgp_hash_md5(pgp_hash_t *hash)
 	*hash = md5;
 }
 
+/*
+ * The SHA hashes use the EVP interface, so that OpenSSL can use the
+ * SHA extensions of the CPU; hash->data holds an EVP_MD_CTX.
+ */
 static int
-sha1_init(pgp_hash_t *hash)
+digest_init(pgp_hash_t *hash, const EVP_MD *md)
 {
 	if (hash->data) {
-		(void) fprintf(stderr, "sha1_init: hash data non-null\n");
+		(void) fprintf(stderr, "digest_init: hash data non-null\n");
 	}
-	if ((hash->data = calloc(1, sizeof(SHA_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha1_init: bad alloc\n");
+	if ((hash->data = EVP_MD_CTX_new()) == NULL) {
+		(void) fprintf(stderr, "digest_init: bad alloc\n");
+		return 0;
+	}
+	if (!EVP_DigestInit_ex(hash->data, md, NULL)) {
+		(void) fprintf(stderr, "digest_init: can't init %s\n", hash->name);
+		EVP_MD_CTX_free(hash->data);
+		hash->data = NULL;
 		return 0;
 	}
-	SHA1_Init(hash->data);
 	return 1;
 }
 
 static void
-sha1_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
+digest_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
 {
 	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha1_add", data, length);
+		hexdump(stderr, hash->name, data, length);
 	}
-	SHA1_Update(hash->data, data, length);
+	(void) EVP_DigestUpdate(hash->data, data, length);
 }
 
 static unsigned
-sha1_finish(pgp_hash_t *hash, uint8_t *out)
+digest_finish(pgp_hash_t *hash, uint8_t *out)
 {
-	SHA1_Final(out, hash->data);
+	unsigned	len = 0;
+
+	(void) EVP_DigestFinal_ex(hash->data, out, &len);
 	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha1_finish", out, PGP_SHA1_HASH_SIZE);
+		hexdump(stderr, hash->name, out, len);
 	}
-	free(hash->data);
+	EVP_MD_CTX_free(hash->data);
 	hash->data = NULL;
-	return PGP_SHA1_HASH_SIZE;
+	return len;
+}
+
+static int
+sha1_init(pgp_hash_t *hash)
+{
+	return digest_init(hash, EVP_sha1());
 }
 
 static const pgp_hash_t sha1 = {
@@ -183,8 +200,8 @@ static const pgp_hash_t sha1 = {
 	PGP_SHA1_HASH_SIZE,
 	"SHA1",
 	sha1_init,
-	sha1_add,
-	sha1_finish,
+	digest_add,
+	digest_finish,
 	NULL
 };
 
@@ -202,36 +219,7 @@ pgp_hash_sha1(pgp_hash_t *hash)
 static int
 sha256_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha256_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA256_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha256_init: bad alloc\n");
-		return 0;
-	}
-	SHA256_Init(hash->data);
-	return 1;
-}
-
-static void
-sha256_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha256_add", data, length);
-	}
-	SHA256_Update(hash->data, data, length);
-}
-
-static unsigned
-sha256_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA256_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha1_finish", out, SHA256_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA256_DIGEST_LENGTH;
+	return digest_init(hash, EVP_sha256());
 }
 
 static const pgp_hash_t sha256 = {
@@ -239,8 +227,8 @@ static const pgp_hash_t sha256 = {
 	SHA256_DIGEST_LENGTH,
 	"SHA256",
 	sha256_init,
-	sha256_add,
-	sha256_finish,
+	digest_add,
+	digest_finish,
 	NULL
 };
 
@@ -256,36 +244,7 @@ pgp_hash_sha256(pgp_hash_t *hash)
 static int
 sha384_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha384_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA512_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha384_init: bad alloc\n");
-		return 0;
-	}
-	SHA384_Init(hash->data);
-	return 1;
-}
-
-static void
-sha384_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha384_add", data, length);
-	}
-	SHA384_Update(hash->data, data, length);
-}
-
-static unsigned
-sha384_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA384_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha384_finish", out, SHA384_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA384_DIGEST_LENGTH;
+	return digest_init(hash, EVP_sha384());
 }
 
 static const pgp_hash_t sha384 = {
@@ -293,8 +252,8 @@ static const pgp_hash_t sha384 = {
 	SHA384_DIGEST_LENGTH,
 	"SHA384",
 	sha384_init,
-	sha384_add,
-	sha384_finish,
+	digest_add,
+	digest_finish,
 	NULL
 };
 
@@ -310,36 +269,7 @@ pgp_hash_sha384(pgp_hash_t *hash)
 static int
 sha512_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha512_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA512_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha512_init: bad alloc\n");
-		return 0;
-	}
-	SHA512_Init(hash->data);
-	return 1;
-}
-
-static void
-sha512_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha512_add", data, length);
-	}
-	SHA512_Update(hash->data, data, length);
-}
-
-static unsigned
-sha512_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA512_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha512_finish", out, SHA512_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA512_DIGEST_LENGTH;
+	return digest_init(hash, EVP_sha512());
 }
 
 static const pgp_hash_t sha512 = {
@@ -347,8 +277,8 @@ static const pgp_hash_t sha512 = {
 	SHA512_DIGEST_LENGTH,
 	"SHA512",
 	sha512_init,
-	sha512_add,
-	sha512_finish,
+	digest_add,
+	digest_finish,
 	NULL
 };
 
@@ -365,36 +295,7 @@ pgp_hash_sha512(pgp_hash_t *hash)
 static int
 sha224_init(pgp_hash_t *hash)
 {
-	if (hash->data) {
-		(void) fprintf(stderr, "sha224_init: hash data non-null\n");
-	}
-	if ((hash->data = calloc(1, sizeof(SHA256_CTX))) == NULL) {
-		(void) fprintf(stderr, "sha256_init: bad alloc\n");
-		return 0;
-	}
-	SHA224_Init(hash->data);
-	return 1;
-}
-
-static void
-sha224_add(pgp_hash_t *hash, const uint8_t *data, unsigned length)
-{
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha224_add", data, length);
-	}
-	SHA224_Update(hash->data, data, length);
-}
-
-static unsigned
-sha224_finish(pgp_hash_t *hash, uint8_t *out)
-{
-	SHA224_Final(out, hash->data);
-	if (pgp_get_debug_level(__FILE__)) {
-		hexdump(stderr, "sha224_finish", out, SHA224_DIGEST_LENGTH);
-	}
-	free(hash->data);
-	hash->data = NULL;
-	return SHA224_DIGEST_LENGTH;
+	return digest_init(hash, EVP_sha224());
 }
 
 static const pgp_hash_t sha224 = {
@@ -402,8 +303,8 @@ static const pgp_hash_t sha224 = {
 	SHA224_DIGEST_LENGTH,
 	"SHA224",
 	sha224_init,
-	sha224_add,
-	sha224_finish,
+	digest_add,
+	digest_finish,
 	NULL
 };
 
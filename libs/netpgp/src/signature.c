@@ -388,17 +388,30 @@ init_key_sig(pgp_hash_t *hash, const pgp_sig_t *sig,
 static void
 hash_add_trailer(pgp_hash_t *hash, const pgp_sig_t *sig)
 {
+	uint8_t		trailer[6];
+	unsigned	n;
+
 	if (sig->info.version == PGP_V4) {
 		if (sig->info.v4_hashlen) {
 			hash->add(hash, sig->info.v4_hashed,
 				  (unsigned)sig->info.v4_hashlen);
 		}
-		pgp_hash_add_int(hash, (unsigned)sig->info.version, 1);
-		pgp_hash_add_int(hash, 0xff, 1);
-		pgp_hash_add_int(hash, (unsigned)sig->info.v4_hashlen, 4);
+		n = (unsigned)sig->info.v4_hashlen;
+		trailer[0] = (uint8_t)sig->info.version;
+		trailer[1] = 0xff;
+		trailer[2] = (uint8_t)(n >> 24);
+		trailer[3] = (uint8_t)(n >> 16);
+		trailer[4] = (uint8_t)(n >> 8);
+		trailer[5] = (uint8_t)n;
+		hash->add(hash, trailer, 6);
 	} else {
-		pgp_hash_add_int(hash, (unsigned)sig->info.type, 1);
-		pgp_hash_add_int(hash, (unsigned)sig->info.birthtime, 4);
+		n = (unsigned)sig->info.birthtime;
+		trailer[0] = (uint8_t)sig->info.type;
+		trailer[1] = (uint8_t)(n >> 24);
+		trailer[2] = (uint8_t)(n >> 16);
+		trailer[3] = (uint8_t)(n >> 8);
+		trailer[4] = (uint8_t)n;
+		hash->add(hash, trailer, 5);
 	}
 }
 
@@ -74,6 +74,8 @@ __RCSID("$NetBSD$");
 #include <openssl/aes.h>
 #endif
 
+#include <openssl/evp.h>
+
 #ifdef HAVE_OPENSSL_DES_H
 #include <openssl/des.h>
 #endif
@@ -275,65 +277,171 @@ static const pgp_crypt_t idea =
 };
 #endif				/* OPENSSL_NO_IDEA */
 
-/* AES with 128-bit key (AES) */
+/*
+ * AES is done using the EVP interface in ECB mode, so that OpenSSL can use
+ * AES-NI or ARMv8 crypto extensions; CFB mode is implemented on top of it
+ * with the state kept in iv/num as done by AES_cfb128_encrypt().
+ * encrypt_key and decrypt_key hold EVP_CIPHER_CTX objects.
+ */
 
 #define KEYBITS_AES128 128
+#define KEYBITS_AES256 256
 
-static int
-aes128_init(pgp_crypt_t *crypt)
+/* number of blocks decrypted by a single EVP call in aes_cfb_decrypt() */
+#define AES_BULK_BLOCKS 256
+
+static void
+aes_finish(pgp_crypt_t *crypt)
 {
 	if (crypt->encrypt_key) {
-		free(crypt->encrypt_key);
-	}
-	if ((crypt->encrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes128_init: alloc failure\n");
-		return 0;
-	}
-	if (AES_set_encrypt_key(crypt->key, KEYBITS_AES128,
-			crypt->encrypt_key)) {
-		fprintf(stderr, "aes128_init: Error setting encrypt_key\n");
+		EVP_CIPHER_CTX_free(crypt->encrypt_key);
+		crypt->encrypt_key = NULL;
 	}
-
 	if (crypt->decrypt_key) {
-		free(crypt->decrypt_key);
+		EVP_CIPHER_CTX_free(crypt->decrypt_key);
+		crypt->decrypt_key = NULL;
 	}
-	if ((crypt->decrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes128_init: alloc failure\n");
+}
+
+static int
+aes_init(pgp_crypt_t *crypt, const EVP_CIPHER *cipher)
+{
+	aes_finish(crypt);
+	if ((crypt->encrypt_key = EVP_CIPHER_CTX_new()) == NULL ||
+	    (crypt->decrypt_key = EVP_CIPHER_CTX_new()) == NULL) {
+		(void) fprintf(stderr, "aes_init: alloc failure\n");
+		aes_finish(crypt);
 		return 0;
 	}
-	if (AES_set_decrypt_key(crypt->key, KEYBITS_AES128,
-				crypt->decrypt_key)) {
-		fprintf(stderr, "aes128_init: Error setting decrypt_key\n");
+	if (!EVP_EncryptInit_ex(crypt->encrypt_key, cipher, NULL,
+			crypt->key, NULL) ||
+	    !EVP_DecryptInit_ex(crypt->decrypt_key, cipher, NULL,
+			crypt->key, NULL)) {
+		fprintf(stderr, "aes_init: Error setting key\n");
+		aes_finish(crypt);
+		return 0;
 	}
+	(void) EVP_CIPHER_CTX_set_padding(crypt->encrypt_key, 0);
+	(void) EVP_CIPHER_CTX_set_padding(crypt->decrypt_key, 0);
 	return 1;
 }
 
+static int
+aes128_init(pgp_crypt_t *crypt)
+{
+	return aes_init(crypt, EVP_aes_128_ecb());
+}
+
+static int
+aes256_init(pgp_crypt_t *crypt)
+{
+	return aes_init(crypt, EVP_aes_256_ecb());
+}
+
+/* en- or decrypt a multiple of AES_BLOCK_SIZE bytes, in and out may be equal */
+static void
+aes_ecb(EVP_CIPHER_CTX *ctx, uint8_t *out, const uint8_t *in, size_t count)
+{
+	int	outl;
+
+	(void) EVP_CipherUpdate(ctx, out, &outl, in, (int)count);
+}
+
 static void
 aes_block_encrypt(pgp_crypt_t *crypt, void *out, const void *in)
 {
-	AES_encrypt(in, out, crypt->encrypt_key);
+	aes_ecb(crypt->encrypt_key, out, in, AES_BLOCK_SIZE);
 }
 
 static void
 aes_block_decrypt(pgp_crypt_t *crypt, void *out, const void *in)
 {
-	AES_decrypt(in, out, crypt->decrypt_key);
+	aes_ecb(crypt->decrypt_key, out, in, AES_BLOCK_SIZE);
 }
 
 static void
-aes_cfb_encrypt(pgp_crypt_t *crypt, void *out, const void *in, size_t count)
+aes_cfb_encrypt(pgp_crypt_t *crypt, void *outvoid, const void *invoid,
+		size_t count)
 {
-	AES_cfb128_encrypt(in, out, (unsigned)count,
-			   crypt->encrypt_key, crypt->iv, &crypt->num,
-			   AES_ENCRYPT);
+	const uint8_t	*in = invoid;
+	uint8_t		*out = outvoid;
+	uint8_t		*iv = crypt->iv;
+	unsigned	 n = (unsigned)crypt->num;
+	unsigned	 i;
+
+	/* complete a block started by the previous call */
+	for (; n != 0 && count > 0; n = (n + 1) % AES_BLOCK_SIZE, count--) {
+		*out++ = iv[n] ^= *in++;
+	}
+
+	/* each block depends on the previous ciphertext, so encrypting
+	 * cannot be batched */
+	for (; count >= AES_BLOCK_SIZE; count -= AES_BLOCK_SIZE) {
+		aes_ecb(crypt->encrypt_key, iv, iv, AES_BLOCK_SIZE);
+		for (i = 0; i < AES_BLOCK_SIZE; i++) {
+			out[i] = iv[i] ^= in[i];
+		}
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+
+	if (count > 0) {
+		aes_ecb(crypt->encrypt_key, iv, iv, AES_BLOCK_SIZE);
+		for (; count > 0; n++, count--) {
+			out[n] = iv[n] ^= in[n];
+		}
+	}
+	crypt->num = (int)n;
 }
 
 static void
-aes_cfb_decrypt(pgp_crypt_t *crypt, void *out, const void *in, size_t count)
+aes_cfb_decrypt(pgp_crypt_t *crypt, void *outvoid, const void *invoid,
+		size_t count)
 {
-	AES_cfb128_encrypt(in, out, (unsigned)count,
-			   crypt->encrypt_key, crypt->iv, &crypt->num,
-			   AES_DECRYPT);
+	const uint8_t	*in = invoid;
+	uint8_t		*out = outvoid;
+	uint8_t		*iv = crypt->iv;
+	uint8_t		 keystream[AES_BULK_BLOCKS * AES_BLOCK_SIZE];
+	unsigned	 n = (unsigned)crypt->num;
+	size_t		 bytes;
+	size_t		 i;
+	uint8_t		 c;
+
+	for (; n != 0 && count > 0; n = (n + 1) % AES_BLOCK_SIZE, count--) {
+		c = *in++;
+		*out++ = iv[n] ^ c;
+		iv[n] = c;
+	}
+
+	/* the ciphertext is known, so the keystream of all full blocks
+	 * is calculated by a single call */
+	while (count >= AES_BLOCK_SIZE) {
+		bytes = count / AES_BLOCK_SIZE;
+		bytes = (bytes > AES_BULK_BLOCKS) ? AES_BULK_BLOCKS : bytes;
+		bytes *= AES_BLOCK_SIZE;
+		(void) memcpy(keystream, iv, AES_BLOCK_SIZE);
+		(void) memcpy(&keystream[AES_BLOCK_SIZE], in,
+				bytes - AES_BLOCK_SIZE);
+		/* save the iv before writing, out may be equal to in */
+		(void) memcpy(iv, &in[bytes - AES_BLOCK_SIZE], AES_BLOCK_SIZE);
+		aes_ecb(crypt->encrypt_key, keystream, keystream, bytes);
+		for (i = 0; i < bytes; i++) {
+			out[i] = in[i] ^ keystream[i];
+		}
+		in += bytes;
+		out += bytes;
+		count -= bytes;
+	}
+
+	if (count > 0) {
+		aes_ecb(crypt->encrypt_key, iv, iv, AES_BLOCK_SIZE);
+		for (; count > 0; n++, count--) {
+			c = in[n];
+			out[n] = iv[n] ^ c;
+			iv[n] = c;
+		}
+	}
+	crypt->num = (int)n;
 }
 
 static const pgp_crypt_t aes128 =
@@ -349,52 +457,10 @@ static const pgp_crypt_t aes128 =
 	aes_block_decrypt,
 	aes_cfb_encrypt,
 	aes_cfb_decrypt,
-	std_finish,
+	aes_finish,
 	TRAILER
 };
 
-/* AES with 256-bit key */
-
-#define KEYBITS_AES256 256
-
-static int
-aes256_init(pgp_crypt_t *crypt)
-{
-	if (crypt->encrypt_key) {
-		free(crypt->encrypt_key);
-	}
-	if ((crypt->encrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes256_init: alloc failure\n");
-		return 0;
-	}
-	if (AES_set_encrypt_key(crypt->key, KEYBITS_AES256,
-			crypt->encrypt_key)) {
-		fprintf(stderr, "aes256_init: Error setting encrypt_key\n");
-		free(crypt->encrypt_key);
-		crypt->encrypt_key = NULL;
-		return 0;
-	}
-	if (crypt->decrypt_key) {
-		free(crypt->decrypt_key);
-	}
-	if ((crypt->decrypt_key = calloc(1, sizeof(AES_KEY))) == NULL) {
-		(void) fprintf(stderr, "aes256_init: alloc failure\n");
-		free(crypt->encrypt_key);
-		crypt->encrypt_key = NULL;
-		return 0;
-	}
-	if (AES_set_decrypt_key(crypt->key, KEYBITS_AES256,
-			crypt->decrypt_key)) {
-		fprintf(stderr, "aes256_init: Error setting decrypt_key\n");
-		free(crypt->encrypt_key);
-		crypt->encrypt_key = NULL;
-		free(crypt->decrypt_key);
-		crypt->decrypt_key = NULL;
-		return 0;
-	}
-	return 1;
-}
-
 static const pgp_crypt_t aes256 =
 {
 	PGP_SA_AES_256,
@@ -408,7 +474,7 @@ static const pgp_crypt_t aes256 =
 	aes_block_decrypt,
 	aes_cfb_encrypt,
 	aes_cfb_decrypt,
-	std_finish,
+	aes_finish,
 	TRAILER
 };
 
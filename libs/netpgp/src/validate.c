@@ -172,25 +172,18 @@ The hash value is calculated by the following method:
 to give the final hash value that is checked against the one in the signature
 */
 
-/* Does the signed hash match the given hash? */
+/* Adds the trailer to a hash over the signed data and checks the result;
+   the hash is finished in any case */
 static unsigned
-check_binary_sig(const uint8_t *data,
-		const unsigned len,
+finish_binary_sig(pgp_hash_t *hash,
 		const pgp_sig_t *sig,
 		const pgp_pubkey_t *signer)
 {
 	unsigned    hashedlen;
-	pgp_hash_t	hash;
 	unsigned	n;
 	uint8_t		hashout[PGP_MAX_HASH_SIZE];
 	uint8_t		trailer[6];
 
-	pgp_hash_any(&hash, sig->info.hash_alg);
-	if (!hash.init(&hash)) {
-		(void) fprintf(stderr, "check_binary_sig: bad hash init\n");
-		return 0;
-	}
-	hash.add(&hash, data, len);
 	switch (sig->info.version) {
 	case PGP_V3:
 		trailer[0] = sig->info.type;
@@ -198,7 +191,7 @@ check_binary_sig(const uint8_t *data,
 		trailer[2] = (unsigned)(sig->info.birthtime) >> 16;
 		trailer[3] = (unsigned)(sig->info.birthtime) >> 8;
 		trailer[4] = (uint8_t)(sig->info.birthtime);
-		hash.add(&hash, trailer, 5);
+		hash->add(hash, trailer, 5);
 		break;
 
 	case PGP_V4:
@@ -206,7 +199,7 @@ check_binary_sig(const uint8_t *data,
 			hexdump(stderr, "v4 hash", sig->info.v4_hashed,
 					sig->info.v4_hashlen);
 		}
-		hash.add(&hash, sig->info.v4_hashed, (unsigned)sig->info.v4_hashlen);
+		hash->add(hash, sig->info.v4_hashed, (unsigned)sig->info.v4_hashlen);
 		trailer[0] = 0x04;	/* version */
 		trailer[1] = 0xFF;
 		hashedlen = (unsigned)sig->info.v4_hashlen;
@@ -214,22 +207,41 @@ check_binary_sig(const uint8_t *data,
 		trailer[3] = (uint8_t)(hashedlen >> 16);
 		trailer[4] = (uint8_t)(hashedlen >> 8);
 		trailer[5] = (uint8_t)(hashedlen);
-		hash.add(&hash, trailer, 6);
+		hash->add(hash, trailer, 6);
 		break;
 
 	default:
 		(void) fprintf(stderr, "Invalid signature version %d\n",
 				sig->info.version);
+		(void) hash->finish(hash, hashout);
 		return 0;
 	}
 
-	n = hash.finish(&hash, hashout);
+	n = hash->finish(hash, hashout);
 	if (pgp_get_debug_level(__FILE__)) {
 		hexdump(stdout, "hash out", hashout, n);
 	}
 	return pgp_check_sig(hashout, n, sig, signer);
 }
 
+/* Does the signed hash match the given hash? */
+static unsigned
+check_binary_sig(const uint8_t *data,
+		const unsigned len,
+		const pgp_sig_t *sig,
+		const pgp_pubkey_t *signer)
+{
+	pgp_hash_t	hash;
+
+	pgp_hash_any(&hash, sig->info.hash_alg);
+	if (!hash.init(&hash)) {
+		(void) fprintf(stderr, "check_binary_sig: bad hash init\n");
+		return 0;
+	}
+	hash.add(&hash, data, len);
+	return finish_binary_sig(&hash, sig, signer);
+}
+
 static void validate_key_cb_free (validate_key_cb_t *vdata){
 
     /* Free according to previous allocated type */
@@ -572,6 +584,12 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 	case PGP_PTAG_CT_LITDATA_BODY:
 		data->data.litdata_body = content->litdata_body;
 		data->type = LITDATA;
+		if (data->streamhash) {
+			data->streamhash->add(data->streamhash,
+				data->data.litdata_body.data,
+				data->data.litdata_body.length);
+			return PGP_KEEP_MEMORY;
+		}
 		pgp_memory_add(data->mem, data->data.litdata_body.data,
 				       data->data.litdata_body.length);
 		return PGP_KEEP_MEMORY;
@@ -635,6 +653,17 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 				hexdump(stderr, "sig dump", (const uint8_t *)(const void *)&content->sig,
 					sizeof(content->sig));
 			}
+			if (data->streamhash) {
+				/* the data was hashed as it arrived */
+				if (content->sig.info.hash_alg == data->streamhash->alg) {
+					valid = finish_binary_sig(data->streamhash,
+						&content->sig,
+						sigkey);
+					free(data->streamhash);
+					data->streamhash = NULL;
+				}
+				break;
+			}
 			valid = check_binary_sig(pgp_mem_data(data->mem),
 					(const unsigned)pgp_mem_len(data->mem),
 					&content->sig,
@@ -673,7 +702,30 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 	case PGP_PTAG_CT_SIGNATURE_HEADER:
 	case PGP_PTAG_CT_ARMOUR_HEADER:
 	case PGP_PTAG_CT_ARMOUR_TRAILER:
+		break;
+
 	case PGP_PTAG_CT_1_PASS_SIG:
+		if (!data->hash_stream) {
+			break;
+		}
+		if (++data->onepassc > 1 || pgp_mem_len(data->mem) != 0) {
+			/* several signatures, maybe using different
+			 * hash algorithms: collect the data instead */
+			pgp_validate_free_streamhash(data);
+			data->hash_stream = 0;
+			break;
+		}
+		if ((data->streamhash = calloc(1, sizeof(*data->streamhash))) == NULL) {
+			(void) fprintf(io->errs, "validate_data_cb: bad alloc\n");
+			data->hash_stream = 0;
+			break;
+		}
+		if (!pgp_hash_any(data->streamhash, content->one_pass_sig.hash_alg) ||
+		    !data->streamhash->init(data->streamhash)) {
+			free(data->streamhash);
+			data->streamhash = NULL;
+			data->hash_stream = 0;
+		}
 		break;
 
 	case PGP_PARSER_PACKET_END:
@@ -686,6 +738,23 @@ validate_data_cb(const pgp_packet_t *pkt, pgp_cbdata_t *cbinfo)
 	return PGP_RELEASE_MEMORY;
 }
 
+/**
+   \ingroup HighLevel_Verify
+   \brief Frees the hash of a validate_data_cb_t not used for a signature
+   \param data The validation data
+*/
+void
+pgp_validate_free_streamhash(validate_data_cb_t *data)
+{
+	uint8_t		hashout[PGP_MAX_HASH_SIZE];
+
+	if (data->streamhash) {
+		(void) data->streamhash->finish(data->streamhash, hashout);
+		free(data->streamhash);
+		data->streamhash = NULL;
+	}
+}
+
 #if 0 //////
 static char *
 fmtsecs(int64_t n, char *buf, size_t size)
@@ -74,6 +74,10 @@ __RCSID("$NetBSD$");
 #include <openssl/cast.h>
 #endif
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
 #include "netpgp/create.h"
 #include "netpgp/writer.h"
 #include "netpgp/keyring.h"
@@ -1492,447 +1496,558 @@ pgp_pop_sum16_writer(pgp_output_t *output)
 
 /**************************************************************************/
 
-#if 0 //////
-#define MAX_PARTIAL_DATA_LENGTH 1073741824
+/*
+ * Streaming writers: the data is written in packets with partial body
+ * lengths (RFC 4880, 4.2.2.4), so neither the plain text nor intermediate
+ * packets need to be held in memory completely.
+ */
+
+#define STREAM_CHUNK_BITS	13
+#define STREAM_CHUNK_SIZE	(1U << STREAM_CHUNK_BITS) /* the first partial length must be at least 512 octets */
+
+typedef unsigned stream_out_t(void *, const uint8_t *, unsigned);
 
 typedef struct {
-	pgp_crypt_t	*crypt;
-	pgp_memory_t	*mem_data;
-	pgp_memory_t	*litmem;
-	pgp_output_t	*litoutput;
-	pgp_memory_t	*se_ip_mem;
-	pgp_output_t	*se_ip_out;
-	pgp_hash_t	 hash;
-} str_enc_se_ip_t;
-#endif //////
+	pgp_content_enum	 tag;
+	uint8_t			*buf;		/* body not yet written */
+	unsigned		 len;
+	unsigned		 started;	/* packet tag written */
+	stream_out_t		*out;
+	void			*out_arg;
+} stream_pkt_t;
 
-#if 0 //////
 static unsigned
-str_enc_se_ip_writer(const uint8_t *src,
-			    unsigned len,
-			    pgp_error_t **errors,
-			    pgp_writer_t *writer);
+stream_pkt_init(stream_pkt_t *pkt, pgp_content_enum tag, stream_out_t *out, void *out_arg)
+{
+	pkt->tag = tag;
+	pkt->len = 0;
+	pkt->started = 0;
+	pkt->out = out;
+	pkt->out_arg = out_arg;
+	if ((pkt->buf = calloc(1, STREAM_CHUNK_SIZE)) == NULL) {
+		(void) fprintf(stderr, "stream_pkt_init: bad alloc\n");
+		return 0;
+	}
+	return 1;
+}
 
+/* write a chunk with a partial body length */
 static unsigned
-str_enc_se_ip_finaliser(pgp_error_t **errors,
-			       pgp_writer_t * writer);
-
-static void     str_enc_se_ip_destroyer(pgp_writer_t *writer);
-#endif //////
+stream_pkt_write_chunk(stream_pkt_t *pkt, const uint8_t *data)
+{
+	uint8_t		hdr[2];
+	unsigned	hdrlen = 0;
 
-/* */
+	if (!pkt->started) {
+		hdr[hdrlen++] = pkt->tag | PGP_PTAG_ALWAYS_SET | PGP_PTAG_NEW_FORMAT;
+		pkt->started = 1;
+	}
+	hdr[hdrlen++] = 224 + STREAM_CHUNK_BITS;
+	return pkt->out(pkt->out_arg, hdr, hdrlen) &&
+		pkt->out(pkt->out_arg, data, STREAM_CHUNK_SIZE);
+}
 
-/**
-\ingroup Core_WritersNext
-\param output
-\param pubkey
-*/
-#if 0 //////
-void
-pgp_push_stream_enc_se_ip(pgp_output_t *output, pgp_key_t *pubkey, const char *cipher)
+static unsigned
+stream_pkt_write(stream_pkt_t *pkt, const uint8_t *data, unsigned len)
 {
-	pgp_pk_sesskey_t	*encrypted_pk_sesskey;
-	str_enc_se_ip_t		*se_ip;
-	const unsigned	 	 bufsz = 1024;
-	pgp_crypt_t		*encrypted;
-	uint8_t			*iv;
+	unsigned	n;
 
-	if ((se_ip = calloc(1, sizeof(*se_ip))) == NULL) {
-		(void) fprintf(stderr,
-			"pgp_push_stream_enc_se_ip: bad alloc\n");
-		return;
+	while (len > 0) {
+		/* the buffer is written only if more data follows, the last chunk must not be partial */
+		if (pkt->len == STREAM_CHUNK_SIZE) {
+			if (!stream_pkt_write_chunk(pkt, pkt->buf)) {
+				return 0;
+			}
+			pkt->len = 0;
+		}
+		/* large writes are passed through without copying */
+		while (pkt->len == 0 && len > STREAM_CHUNK_SIZE) {
+			if (!stream_pkt_write_chunk(pkt, data)) {
+				return 0;
+			}
+			data += STREAM_CHUNK_SIZE;
+			len -= STREAM_CHUNK_SIZE;
+		}
+		n = STREAM_CHUNK_SIZE - pkt->len;
+		if (n > len) {
+			n = len;
+		}
+		(void) memcpy(&pkt->buf[pkt->len], data, n);
+		pkt->len += n;
+		data += n;
+		len -= n;
 	}
-	encrypted_pk_sesskey = pgp_create_pk_sesskey(pubkey, cipher, NULL);
-	pgp_write_pk_sesskey(output, encrypted_pk_sesskey);
+	return 1;
+}
 
-	/* Setup the se_ip */
-	if ((encrypted = calloc(1, sizeof(*encrypted))) == NULL) {
-		free(se_ip);
-		(void) fprintf(stderr,
-			"pgp_push_stream_enc_se_ip: bad alloc\n");
-		return;
-	}
-	if( !pgp_crypt_any(encrypted, encrypted_pk_sesskey->symm_alg) ) {
-		return; // EDIT BY MR
-	}
-	if ((iv = calloc(1, encrypted->blocksize)) == NULL) {
-		free(encrypted);
-		free(se_ip);
-		(void) fprintf(stderr,
-			"pgp_push_stream_enc_se_ip: bad alloc\n");
-		return;
+/* write the rest of the body with a normal length */
+static unsigned
+stream_pkt_finish(stream_pkt_t *pkt)
+{
+	uint8_t		hdr[6];
+	unsigned	hdrlen = 0;
+	unsigned	len = pkt->len;
+
+	if (!pkt->started) {
+		hdr[hdrlen++] = pkt->tag | PGP_PTAG_ALWAYS_SET | PGP_PTAG_NEW_FORMAT;
+		pkt->started = 1;
 	}
-	encrypted->set_iv(encrypted, iv);
-	encrypted->set_crypt_key(encrypted, &encrypted_pk_sesskey->key[0]);
-	pgp_encrypt_init(encrypted);
+	if (len < 192) {
+		hdr[hdrlen++] = len;
+	} else if (len < 8192 + 192) {
+		hdr[hdrlen++] = ((len - 192) >> 8) + 192;
+		hdr[hdrlen++] = (len - 192) & 0xff;
+	} else {
+		hdr[hdrlen++] = 0xff;
+		hdr[hdrlen++] = len >> 24;
+		hdr[hdrlen++] = len >> 16;
+		hdr[hdrlen++] = len >> 8;
+		hdr[hdrlen++] = len;
+	}
+	pkt->len = 0;
+	return pkt->out(pkt->out_arg, hdr, hdrlen) &&
+		pkt->out(pkt->out_arg, pkt->buf, len);
+}
 
-	se_ip->crypt = encrypted;
+/* literal data header, filename and date are not used, see pgp_write_litdata() */
+static unsigned
+stream_litdata_init(stream_pkt_t *pkt, const pgp_litdata_enum type, stream_out_t *out, void *out_arg)
+{
+	uint8_t		hdr[6];
 
-	se_ip->mem_data = pgp_memory_new();
-	pgp_memory_init(se_ip->mem_data, bufsz);
+	(void) memset(hdr, 0x0, sizeof(hdr));
+	hdr[0] = (uint8_t)type;
+	return stream_pkt_init(pkt, PGP_PTAG_CT_LITDATA, out, out_arg) &&
+		stream_pkt_write(pkt, hdr, sizeof(hdr));
+}
 
-	se_ip->litmem = NULL;
-	se_ip->litoutput = NULL;
+/**************************************************************************/
 
-	pgp_setup_memory_write(&se_ip->se_ip_out, &se_ip->se_ip_mem, bufsz);
+#define STREAM_ZBUF_SIZE	8192
 
-	/* And push writer on stack */
-	pgp_writer_push(output,
-			str_enc_se_ip_writer,
-			str_enc_se_ip_finaliser,
-			str_enc_se_ip_destroyer, se_ip);
-	/* tidy up */
-	free(encrypted_pk_sesskey);
-	free(iv);
-}
-#endif //////
+typedef struct {
+	pgp_crypt_t	*crypt;
+	pgp_hash_t	 hash;		/* SHA-1 for the modification detection code */
+	z_stream	 zstream;
+	unsigned	 zinit;
+	uint8_t		*zbuf;
+	uint8_t		*encbuf;
+	unsigned	 raw;
+	stream_pkt_t	 lit;		/* only used if !raw */
+	stream_pkt_t	 z;
+	stream_pkt_t	 se_ip;
+	pgp_writer_t	*writer;	/* set while writing or finalising */
+	pgp_error_t	**errors;
+} str_enc_se_ip_t;
 
+static unsigned	str_enc_se_ip_writer(const uint8_t *,
+		     unsigned,
+		     pgp_error_t **,
+		     pgp_writer_t *);
+static unsigned	str_enc_se_ip_finaliser(pgp_error_t **, pgp_writer_t *);
+static void	str_enc_se_ip_destroyer(pgp_writer_t *);
 
-/* calculate the partial data length */
-#if 0 //////
+/* encrypted data goes to the next writer */
 static unsigned
-partial_data_len(unsigned len)
+str_enc_se_ip_out(void *arg, const uint8_t *data, unsigned len)
 {
-	unsigned	mask;
-	int		i;
+	str_enc_se_ip_t	*se_ip = arg;
 
-	if (len == 0) {
-		(void) fprintf(stderr, "partial_data_len: 0 len\n");
-		return 0;
-	}
-	if (len > MAX_PARTIAL_DATA_LENGTH) {
-		return MAX_PARTIAL_DATA_LENGTH;
-	}
-	mask = MAX_PARTIAL_DATA_LENGTH;
-	for (i = 0; i <= 30; i++) {
-		if (mask & len) {
-			break;
-		}
-		mask >>= 1;
-	}
-	return mask;
+	return stacked_write(se_ip->writer, data, len, se_ip->errors);
 }
-#endif //////
 
-#if 0 //////
+/* compressed data is hashed for the MDC and encrypted */
 static unsigned
-write_partial_len(pgp_output_t *output, unsigned len)
+str_enc_se_ip_encrypt(void *arg, const uint8_t *data, unsigned len)
 {
-	/* len must be a power of 2 from 0 to 30 */
-	uint8_t	c;
-	int	i;
+	str_enc_se_ip_t	*se_ip = arg;
+	unsigned	 n;
 
-	for (i = 0; i <= 30; i++) {
-		if ((len >> i) & 1) {
-			break;
+	se_ip->hash.add(&se_ip->hash, data, len);
+	while (len > 0) {
+		n = (len < STREAM_ZBUF_SIZE) ? len : STREAM_ZBUF_SIZE;
+		se_ip->crypt->cfb_encrypt(se_ip->crypt, se_ip->encbuf, data, n);
+		if (!stream_pkt_write(&se_ip->se_ip, se_ip->encbuf, n)) {
+			return 0;
 		}
+		data += n;
+		len -= n;
 	}
-	c = 224 + i;
-	return pgp_write(output, &c, 1);
+	return 1;
 }
-#endif //////
 
-#if 0 //////
 static unsigned
-stream_write_litdata(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len)
+str_enc_se_ip_deflate(str_enc_se_ip_t *se_ip, const uint8_t *data, unsigned len, int flush)
 {
-	size_t          pdlen;
-
-	while (len > 0) {
-		pdlen = partial_data_len(len);
-		write_partial_len(output, (unsigned)pdlen);
-		pgp_write(output, data, (unsigned)pdlen);
-		data += pdlen;
-		len -= (unsigned)pdlen;
-	}
+	int	r;
+
+	se_ip->zstream.next_in = (uint8_t *)__UNCONST(data);
+	se_ip->zstream.avail_in = len;
+	do {
+		se_ip->zstream.next_out = se_ip->zbuf;
+		se_ip->zstream.avail_out = STREAM_ZBUF_SIZE;
+		r = deflate(&se_ip->zstream, flush);
+		if (r == Z_STREAM_ERROR) {
+			(void) fprintf(stderr, "str_enc_se_ip_deflate: deflate error\n");
+			return 0;
+		}
+		if (se_ip->zstream.avail_out < STREAM_ZBUF_SIZE &&
+		    !stream_pkt_write(&se_ip->z, se_ip->zbuf,
+				STREAM_ZBUF_SIZE - se_ip->zstream.avail_out)) {
+			return 0;
+		}
+	} while (se_ip->zstream.avail_out == 0 || (flush == Z_FINISH && r != Z_STREAM_END));
 	return 1;
 }
-#endif //////
 
-#if 0 //////
+/* packets to encrypt are compressed */
 static unsigned
-stream_write_litdata_first(pgp_output_t *output,
-				const uint8_t *data,
-				unsigned len,
-				const pgp_litdata_enum type)
+str_enc_se_ip_compress(void *arg, const uint8_t *data, unsigned len)
 {
-	/* \todo add filename  */
-	/* \todo add date */
-	/* \todo do we need to check text data for <cr><lf> line endings ? */
+	return str_enc_se_ip_deflate(arg, data, len, Z_NO_FLUSH);
+}
 
-	unsigned	sz_towrite;
-	size_t		sz_pd;
+/**
+\ingroup Core_WritersNext
+\brief Push streaming encrypted writer onto stack
 
-	sz_towrite = 1 + 1 + 4 + len;
-	sz_pd = (size_t)partial_data_len(sz_towrite);
-	if (sz_pd < 512) {
-		(void) fprintf(stderr,
-			"stream_write_litdata_first: bad sz_pd\n");
+Unlike pgp_push_enc_se_ip(), the data is compressed, encrypted and passed
+to the next writer as it is written, using packets with partial body lengths.
+The packets are completed by pgp_writer_close().
+
+\param output
+\param pubkeys The keys to encrypt the session key for
+\param cipher The symmetric cipher, NULL for the default
+\param raw If set, the data written are packets, eg. written by
+	pgp_push_stream_sign(); otherwise the data is written as a literal data packet
+\return 1 if OK, otherwise 0
+*/
+int
+pgp_push_stream_enc_se_ip(pgp_output_t *output, const pgp_keyring_t *pubkeys, const char *cipher, unsigned raw)
+{
+	pgp_pk_sesskey_t *initial_sesskey = NULL;
+	pgp_pk_sesskey_t *encrypted_pk_sesskey;
+	str_enc_se_ip_t	*se_ip;
+	uint8_t		*iv;
+	uint8_t		 preamble[PGP_MAX_BLOCK_SIZE + 2];
+	uint8_t		 c;
+	size_t		 blocksize;
+	unsigned	 n;
+
+	if ((se_ip = calloc(1, sizeof(*se_ip))) == NULL) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: bad alloc\n");
 		return 0;
 	}
-	pgp_write_ptag(output, PGP_PTAG_CT_LITDATA);
-	write_partial_len(output, (unsigned)sz_pd);
-	pgp_write_scalar(output, (unsigned)type, 1);
-	pgp_write_scalar(output, 0, 1);
-	pgp_write_scalar(output, 0, 4);
-	pgp_write(output, data, (unsigned)(sz_pd - 6));
 
-	data += (sz_pd - 6);
-	sz_towrite -= (unsigned)sz_pd;
+	for (n = 0; n < pubkeys->keyc; ++n) {
+		/* Create and write encrypted PK session key */
+		if ((encrypted_pk_sesskey =
+			 pgp_create_pk_sesskey(&pubkeys->keys[n],
+			     cipher, initial_sesskey)) == NULL) {
+			(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: null pk sesskey\n");
+			goto error;
+		}
+		if (initial_sesskey == NULL) {
+			initial_sesskey = encrypted_pk_sesskey;
+		}
+		pgp_write_pk_sesskey(output, encrypted_pk_sesskey);
+		if (encrypted_pk_sesskey != initial_sesskey) {
+			pgp_pk_sesskey_free(encrypted_pk_sesskey);
+			free(encrypted_pk_sesskey);
+		}
+	}
+	if (initial_sesskey == NULL) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: no sesskey\n");
+		goto error;
+	}
 
-	return stream_write_litdata(output, data, (unsigned)sz_towrite);
-}
-#endif //////
+	/* Setup the se_ip */
+	if ((se_ip->crypt = calloc(1, sizeof(*se_ip->crypt))) == NULL ||
+	    !pgp_crypt_any(se_ip->crypt, initial_sesskey->symm_alg)) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: bad crypt\n");
+		goto error;
+	}
+	blocksize = se_ip->crypt->blocksize;
+	if (blocksize > PGP_MAX_BLOCK_SIZE ||
+	    (iv = calloc(1, blocksize)) == NULL) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: bad alloc\n");
+		goto error;
+	}
+	se_ip->crypt->set_iv(se_ip->crypt, iv);
+	se_ip->crypt->set_crypt_key(se_ip->crypt, &initial_sesskey->key[0]);
+	pgp_encrypt_init(se_ip->crypt);
+	free(iv);
 
-#if 0 //////
-static unsigned
-stream_write_litdata_last(pgp_output_t *output,
-				const uint8_t *data,
-				unsigned len)
-{
-	pgp_write_length(output, len);
-	return pgp_write(output, data, len);
-}
-#endif //////
+	pgp_hash_any(&se_ip->hash, PGP_HASH_SHA1);
+	if (!se_ip->hash.init(&se_ip->hash)) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: bad hash init\n");
+		goto error;
+	}
 
-#if 0 //////
-static unsigned
-stream_write_se_ip(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len,
-			str_enc_se_ip_t *se_ip)
-{
-	size_t          pdlen;
+	if ((int)deflateInit(&se_ip->zstream, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: can't initialise\n");
+		goto error;
+	}
+	se_ip->zinit = 1;
 
-	while (len > 0) {
-		pdlen = partial_data_len(len);
-		write_partial_len(output, (unsigned)pdlen);
+	if ((se_ip->zbuf = calloc(1, STREAM_ZBUF_SIZE)) == NULL ||
+	    (se_ip->encbuf = calloc(1, STREAM_ZBUF_SIZE)) == NULL) {
+		(void) fprintf(stderr, "pgp_push_stream_enc_se_ip: bad alloc\n");
+		goto error;
+	}
 
-		pgp_push_enc_crypt(output, se_ip->crypt);
-		pgp_write(output, data, (unsigned)pdlen);
-		pgp_writer_pop(output);
+	/* SE IP packet: version, encrypted preamble, encrypted compressed packet and MDC packet */
+	c = PGP_SE_IP_DATA_VERSION;
+	if (!stream_pkt_init(&se_ip->se_ip, PGP_PTAG_CT_SE_IP_DATA, str_enc_se_ip_out, se_ip) ||
+	    !stream_pkt_write(&se_ip->se_ip, &c, 1)) {
+		goto error;
+	}
+	pgp_random(preamble, (unsigned)blocksize);
+	preamble[blocksize] = preamble[blocksize - 2];
+	preamble[blocksize + 1] = preamble[blocksize - 1];
+	if (!str_enc_se_ip_encrypt(se_ip, preamble, (unsigned)(blocksize + 2))) {
+		goto error;
+	}
 
-		se_ip->hash.add(&se_ip->hash, data, (unsigned)pdlen);
+	/* compressed packet: algorithm and compressed data */
+	c = PGP_C_ZLIB;
+	if (!stream_pkt_init(&se_ip->z, PGP_PTAG_CT_COMPRESSED, str_enc_se_ip_encrypt, se_ip) ||
+	    !stream_pkt_write(&se_ip->z, &c, 1)) {
+		goto error;
+	}
 
-		data += pdlen;
-		len -= (unsigned)pdlen;
+	se_ip->raw = raw;
+	if (!raw && !stream_litdata_init(&se_ip->lit, PGP_LDT_BINARY, str_enc_se_ip_compress, se_ip)) {
+		goto error;
 	}
+
+	/* nothing is written to the next writer until the first chunk is complete */
+	pgp_writer_push(output, str_enc_se_ip_writer, str_enc_se_ip_finaliser,
+			str_enc_se_ip_destroyer, se_ip);
+
+	pgp_pk_sesskey_free(initial_sesskey);
+	free(initial_sesskey);
 	return 1;
+
+error:
+	if (initial_sesskey) {
+		pgp_pk_sesskey_free(initial_sesskey);
+		free(initial_sesskey);
+	}
+	{
+		pgp_writer_t	tmp;
+
+		(void) memset(&tmp, 0x0, sizeof(tmp));
+		tmp.arg = se_ip;
+		str_enc_se_ip_destroyer(&tmp);
+	}
+	return 0;
 }
-#endif //////
 
-#if 0 //////
 static unsigned
-stream_write_se_ip_first(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len,
-			str_enc_se_ip_t *se_ip)
+str_enc_se_ip_writer(const uint8_t *src,
+		     unsigned len,
+		     pgp_error_t **errors,
+		     pgp_writer_t *writer)
 {
-	uint8_t	*preamble;
-	size_t	blocksize;
-	size_t 	preamblesize;
-	size_t 	sz_towrite;
-	size_t 	sz_pd;
-
-	blocksize = se_ip->crypt->blocksize;
-	preamblesize = blocksize + 2;
-	sz_towrite = preamblesize + 1 + len;
-	if ((preamble = calloc(1, preamblesize)) == NULL) {
-		(void) fprintf(stderr,
-			"stream_write_se_ip_first: bad alloc\n");
-		return 0;
-	}
-	sz_pd = (size_t)partial_data_len((unsigned)sz_towrite);
-	if (sz_pd < 512) {
-		free(preamble);
-		(void) fprintf(stderr,
-			"stream_write_se_ip_first: bad sz_pd\n");
-		return 0;
-	}
-	pgp_write_ptag(output, PGP_PTAG_CT_SE_IP_DATA);
-	write_partial_len(output, (unsigned)sz_pd);
-	pgp_write_scalar(output, PGP_SE_IP_DATA_VERSION, 1);
-	pgp_push_enc_crypt(output, se_ip->crypt);
+	str_enc_se_ip_t	*se_ip = pgp_writer_get_arg(writer);
 
-	pgp_random(preamble, blocksize);
-	preamble[blocksize] = preamble[blocksize - 2];
-	preamble[blocksize + 1] = preamble[blocksize - 1];
-	pgp_hash_any(&se_ip->hash, PGP_HASH_SHA1);
-	if (!se_ip->hash.init(&se_ip->hash)) {
-		free(preamble);
-		(void) fprintf(stderr,
-			"stream_write_se_ip_first: bad hash init\n");
-		return 0;
+	se_ip->writer = writer;
+	se_ip->errors = errors;
+	if (se_ip->raw) {
+		return str_enc_se_ip_compress(se_ip, src, len);
 	}
-	pgp_write(output, preamble, (unsigned)preamblesize);
-	se_ip->hash.add(&se_ip->hash, preamble, (unsigned)preamblesize);
-	pgp_write(output, data, (unsigned)(sz_pd - preamblesize - 1));
-	se_ip->hash.add(&se_ip->hash, data, (unsigned)(sz_pd - preamblesize - 1));
-	data += (sz_pd - preamblesize - 1);
-	sz_towrite -= sz_pd;
-	pgp_writer_pop(output);
-	stream_write_se_ip(output, data, (unsigned)sz_towrite, se_ip);
-	free(preamble);
-	return 1;
+	return stream_pkt_write(&se_ip->lit, src, len);
 }
-#endif //////
 
-#if 0 //////
 static unsigned
-stream_write_se_ip_last(pgp_output_t *output,
-			const uint8_t *data,
-			unsigned len,
-			str_enc_se_ip_t *se_ip)
+str_enc_se_ip_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
 {
-	pgp_output_t	*mdcoutput;
-	pgp_memory_t	*mdcmem;
-	const size_t	 mdcsize = 1 + 1 + PGP_SHA1_HASH_SIZE;
-	uint8_t		 c;
-	uint8_t		 hashed[PGP_SHA1_HASH_SIZE];
-	size_t		 bufsize = len + mdcsize;
-
-	se_ip->hash.add(&se_ip->hash, data, len);
+	str_enc_se_ip_t	*se_ip = pgp_writer_get_arg(writer);
+	uint8_t		 mdc[1 + 1 + PGP_SHA1_HASH_SIZE];
 
-	/* MDC packet tag */
-	c = MDC_PKT_TAG;
-	se_ip->hash.add(&se_ip->hash, &c, 1);
+	se_ip->writer = writer;
+	se_ip->errors = errors;
+	if (!se_ip->raw && !stream_pkt_finish(&se_ip->lit)) {
+		return 0;
+	}
+	if (!str_enc_se_ip_deflate(se_ip, NULL, 0, Z_FINISH) ||
+	    !stream_pkt_finish(&se_ip->z)) {
+		return 0;
+	}
 
-	/* MDC packet len */
-	c = PGP_SHA1_HASH_SIZE;
-	se_ip->hash.add(&se_ip->hash, &c, 1);
+	/* the MDC hash includes the MDC packet tag and length */
+	mdc[0] = MDC_PKT_TAG;
+	mdc[1] = PGP_SHA1_HASH_SIZE;
+	se_ip->hash.add(&se_ip->hash, mdc, 2);
+	se_ip->hash.finish(&se_ip->hash, &mdc[2]);
+	se_ip->crypt->cfb_encrypt(se_ip->crypt, se_ip->encbuf, mdc, sizeof(mdc));
 
-	/* finish */
-	se_ip->hash.finish(&se_ip->hash, hashed);
+	return stream_pkt_write(&se_ip->se_ip, se_ip->encbuf, sizeof(mdc)) &&
+		stream_pkt_finish(&se_ip->se_ip);
+}
 
-	pgp_setup_memory_write(&mdcoutput, &mdcmem, mdcsize);
-	pgp_write_mdc(mdcoutput, hashed);
+static void
+str_enc_se_ip_destroyer(pgp_writer_t *writer)
+{
+	str_enc_se_ip_t	*se_ip = pgp_writer_get_arg(writer);
 
-	/* write length of last se_ip chunk */
-	pgp_write_length(output, (unsigned)bufsize);
+	if (se_ip->crypt) {
+		if (se_ip->crypt->decrypt_finish) {
+			se_ip->crypt->decrypt_finish(se_ip->crypt);
+		}
+		free(se_ip->crypt);
+	}
+	if (se_ip->hash.data) {
+		uint8_t	 discard[PGP_SHA1_HASH_SIZE];
 
-	/* encode everting */
-	pgp_push_enc_crypt(output, se_ip->crypt);
+		se_ip->hash.finish(&se_ip->hash, discard);
+	}
+	if (se_ip->zinit) {
+		deflateEnd(&se_ip->zstream);
+	}
+	free(se_ip->lit.buf);
+	free(se_ip->z.buf);
+	free(se_ip->se_ip.buf);
+	free(se_ip->zbuf);
+	free(se_ip->encbuf);
+	free(se_ip);
+}
 
-	pgp_write(output, data, len);
-	pgp_write(output, pgp_mem_data(mdcmem), (unsigned)pgp_mem_len(mdcmem));
+/**************************************************************************/
 
-	pgp_writer_pop(output);
+typedef struct {
+	pgp_create_sig_t	*sig;
+	const pgp_seckey_t	*seckey;
+	pgp_hash_alg_t		 hash_alg;
+	time_t			 from;
+	time_t			 duration;
+	stream_pkt_t		 lit;
+	pgp_writer_t		*writer;	/* set while writing or finalising */
+	pgp_error_t		**errors;
+} str_sign_t;
+
+static unsigned	str_sign_writer(const uint8_t *,
+		     unsigned,
+		     pgp_error_t **,
+		     pgp_writer_t *);
+static unsigned	str_sign_finaliser(pgp_error_t **, pgp_writer_t *);
+static void	str_sign_destroyer(pgp_writer_t *);
 
-	pgp_teardown_memory_write(mdcoutput, mdcmem);
+static unsigned
+str_sign_out(void *arg, const uint8_t *data, unsigned len)
+{
+	str_sign_t	*sign = arg;
 
-	return 1;
+	return stacked_write(sign->writer, data, len, sign->errors);
 }
-#endif //////
 
-#if 0 //////
-static unsigned
-str_enc_se_ip_writer(const uint8_t *src,
-			    unsigned len,
-			    pgp_error_t **errors,
-			    pgp_writer_t *writer)
-{
-	str_enc_se_ip_t	*se_ip;
-	unsigned	 ret;
-	size_t           datalength;
+/**
+\ingroup Core_WritersNext
+\brief Push streaming signing writer onto stack
 
-	se_ip = pgp_writer_get_arg(writer);
-	if (se_ip->litoutput == NULL) {
-		/* first literal data chunk is not yet written */
+Writes a one-pass signature packet, the data as a literal data packet
+with partial body lengths and, on pgp_writer_close(), the signature packet;
+the result is the same as of pgp_sign_buf() without armour and cleartext.
 
-		pgp_memory_add(se_ip->mem_data, src, len);
-		datalength = pgp_mem_len(se_ip->mem_data);
+\param output
+\param seckey The key to sign with
+\param hash_alg The hash algorithm to use
+\param from Creation time of the signature
+\param duration Expiration time of the signature, 0 for none
+\return 1 if OK, otherwise 0
+*/
+int
+pgp_push_stream_sign(pgp_output_t *output, const pgp_seckey_t *seckey,
+		     pgp_hash_alg_t hash_alg, const time_t from, const time_t duration)
+{
+	str_sign_t	*sign;
 
-		/* 4.2.2.4. Partial Body Lengths */
-		/* The first partial length MUST be at least 512 octets long. */
-		if (datalength < 512) {
-			return 1;	/* will wait for more data or
-						 * end of stream             */
-		}
-		pgp_setup_memory_write(&se_ip->litoutput,
-				&se_ip->litmem, datalength + 32);
-		stream_write_litdata_first(se_ip->litoutput,
-				pgp_mem_data(se_ip->mem_data),
-				(unsigned)datalength,
-				PGP_LDT_BINARY);
-
-		stream_write_se_ip_first(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem), se_ip);
-	} else {
-		stream_write_litdata(se_ip->litoutput, src, len);
-		stream_write_se_ip(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem), se_ip);
+	if ((sign = calloc(1, sizeof(*sign))) == NULL ||
+	    (sign->sig = pgp_create_sig_new()) == NULL) {
+		(void) fprintf(stderr, "pgp_push_stream_sign: bad alloc\n");
+		free(sign);
+		return 0;
 	}
+	sign->seckey = seckey;
+	sign->hash_alg = hash_alg;
+	sign->from = from;
+	sign->duration = duration;
+	pgp_start_sig(sign->sig, seckey, hash_alg, PGP_SIG_BINARY);
 
-	/* now write memory to next writer */
-	ret = stacked_write(writer, pgp_mem_data(se_ip->se_ip_mem),
-				(unsigned)pgp_mem_len(se_ip->se_ip_mem), errors);
+	if (!stream_litdata_init(&sign->lit, PGP_LDT_BINARY, str_sign_out, sign) ||
+	    !pgp_write_one_pass_sig(output, seckey, hash_alg, PGP_SIG_BINARY)) {
+		pgp_writer_t	tmp;
 
-	pgp_memory_clear(se_ip->litmem);
-	pgp_memory_clear(se_ip->se_ip_mem);
+		(void) memset(&tmp, 0x0, sizeof(tmp));
+		tmp.arg = sign;
+		str_sign_destroyer(&tmp);
+		return 0;
+	}
 
-	return ret;
+	pgp_writer_push(output, str_sign_writer, str_sign_finaliser,
+			str_sign_destroyer, sign);
+	return 1;
 }
-#endif //////
 
-/* write last chunk of data */
-#if 0 //////
 static unsigned
-str_enc_se_ip_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
+str_sign_writer(const uint8_t *src,
+		unsigned len,
+		pgp_error_t **errors,
+		pgp_writer_t *writer)
 {
-	str_enc_se_ip_t	*se_ip;
-
-	se_ip = pgp_writer_get_arg(writer);
-	if (se_ip->litoutput == NULL) {
-		/* first literal data chunk was not written */
-		/* so we know the total length of data, write a simple packet */
+	str_sign_t	*sign = pgp_writer_get_arg(writer);
+	pgp_hash_t	*hash = pgp_sig_get_hash(sign->sig);
 
-		/* create literal data packet from buffered data */
-		pgp_setup_memory_write(&se_ip->litoutput, &se_ip->litmem,
-				 pgp_mem_len(se_ip->mem_data) + 32);
+	sign->writer = writer;
+	sign->errors = errors;
+	hash->add(hash, src, len);
+	return stream_pkt_write(&sign->lit, src, len);
+}
 
-		pgp_write_litdata(se_ip->litoutput,
-			pgp_mem_data(se_ip->mem_data),
-			(const int)pgp_mem_len(se_ip->mem_data),
-			PGP_LDT_BINARY);
+static unsigned
+str_sign_finaliser(pgp_error_t **errors, pgp_writer_t *writer)
+{
+	str_sign_t	*sign = pgp_writer_get_arg(writer);
+	pgp_output_t	*sigoutput = NULL;
+	pgp_memory_t	*sigmem = NULL;
+	uint8_t		 keyid[PGP_KEY_ID_SIZE];
+	unsigned	 ret = 0;
+
+	sign->writer = writer;
+	sign->errors = errors;
+	if (!stream_pkt_finish(&sign->lit)) {
+		return 0;
+	}
 
-		/* create SE IP packet set from this literal data */
-		pgp_write_se_ip_pktset(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem),
-				se_ip->crypt);
+	pgp_add_creation_time(sign->sig, sign->from);
+	pgp_add_sig_expiration_time(sign->sig, sign->duration);
+	pgp_keyid(keyid, PGP_KEY_ID_SIZE, &sign->seckey->pubkey, sign->hash_alg);
+	pgp_add_issuer_keyid(sign->sig, keyid);
+	pgp_end_hashed_subpkts(sign->sig);
 
-	} else {
-		/* finish writing */
-		stream_write_litdata_last(se_ip->litoutput, NULL, 0);
-		stream_write_se_ip_last(se_ip->se_ip_out,
-				pgp_mem_data(se_ip->litmem),
-				(unsigned)pgp_mem_len(se_ip->litmem), se_ip);
+	pgp_setup_memory_write(&sigoutput, &sigmem, 128);
+	if (pgp_write_sig(sigoutput, sign->sig, &sign->seckey->pubkey, sign->seckey)) {
+		ret = stacked_write(writer, pgp_mem_data(sigmem),
+				(unsigned)pgp_mem_len(sigmem), errors);
 	}
-
-	/* now write memory to next writer */
-	return stacked_write(writer, pgp_mem_data(se_ip->se_ip_mem),
-				 (unsigned)pgp_mem_len(se_ip->se_ip_mem), errors);
+	pgp_teardown_memory_write(sigoutput, sigmem);
+	return ret;
 }
-#endif //////
 
-#if 0 //////
 static void
-str_enc_se_ip_destroyer(pgp_writer_t *writer)
+str_sign_destroyer(pgp_writer_t *writer)
 {
-	str_enc_se_ip_t *se_ip;
+	str_sign_t	*sign = pgp_writer_get_arg(writer);
+	pgp_hash_t	*hash = pgp_sig_get_hash(sign->sig);
 
-	se_ip = pgp_writer_get_arg(writer);
-	pgp_memory_free(se_ip->mem_data);
-	pgp_teardown_memory_write(se_ip->litoutput, se_ip->litmem);
-	pgp_teardown_memory_write(se_ip->se_ip_out, se_ip->se_ip_mem);
-
-	se_ip->crypt->decrypt_finish(se_ip->crypt);
+	if (hash->data) {
+		/* not finished by pgp_write_sig() */
+		uint8_t	 discard[PGP_MAX_HASH_SIZE];
 
-	free(se_ip->crypt);
-	free(se_ip);
+		hash->finish(hash, discard);
+	}
+	pgp_create_sig_delete(sign->sig);
+	free(sign->lit.buf);
+	free(sign);
 }
-#endif //////
\ No newline at end of file
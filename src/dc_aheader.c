@@ -40,15 +40,45 @@ void dc_aheader_empty(dc_aheader_t* aheader)
  */
 char* dc_aheader_render(const dc_aheader_t* aheader)
 {
-	int             success = 0;
-	char*           keybase64_wrapped = NULL;
+	char* keybase64_wrapped = NULL;
+	char* ret = NULL;
+
+	if (aheader==NULL || aheader->public_key==NULL || aheader->public_key->binary==NULL) {
+		return NULL;
+	}
+
+	/* adds a whitespace every 78 characters, this allows libEtPan to wrap the lines according to RFC 5322
+	(which may insert a linebreak before every whitespace) */
+	if ((keybase64_wrapped = dc_key_render_base64(aheader->public_key, 78, " ", 0/*no checksum*/))!=NULL) {
+		ret = dc_aheader_render_keydata(aheader, keybase64_wrapped);
+	}
+
+	free(keybase64_wrapped);
+	return ret; /* NULL on errors, this may happen for various reasons */
+}
+
+
+/**
+ * Render the header using the given rendering of the public key.
+ * This allows to render the keys only once if they are used in several headers.
+ *
+ * @private @memberof dc_aheader_t
+ * @param aheader The header to render, the public key must be set.
+ * @param keybase64_wrapped The public key as returned by
+ *     dc_key_render_base64(key, 78, " ", 0).
+ * @return The header value, must be free()'d. NULL on errors.
+ */
+char* dc_aheader_render_keydata(const dc_aheader_t* aheader, const char* keybase64_wrapped)
+{
 	dc_strbuilder_t ret;
-	dc_strbuilder_init(&ret, 0);
 
-	if (aheader==NULL || aheader->addr==NULL || aheader->public_key->binary==NULL || aheader->public_key->type!=DC_KEY_PUBLIC) {
-		goto cleanup;
+	if (aheader==NULL || aheader->addr==NULL || keybase64_wrapped==NULL
+	 || aheader->public_key==NULL || aheader->public_key->binary==NULL || aheader->public_key->type!=DC_KEY_PUBLIC) {
+		return NULL;
 	}
 
+	dc_strbuilder_init(&ret, 0);
+
 	dc_strbuilder_cat(&ret, "addr=");
 	dc_strbuilder_cat(&ret, aheader->addr);
 	dc_strbuilder_cat(&ret, "; ");
@@ -58,21 +88,9 @@ char* dc_aheader_render(const dc_aheader_t* aheader)
 	}
 
 	dc_strbuilder_cat(&ret, "keydata= "); /* the trailing space together with dc_insert_breaks() allows a proper transport */
-
-	/* adds a whitespace every 78 characters, this allows libEtPan to wrap the lines according to RFC 5322
-	(which may insert a linebreak before every whitespace) */
-	if ((keybase64_wrapped = dc_key_render_base64(aheader->public_key, 78, " ", 0/*no checksum*/))==NULL) {
-		goto cleanup;
-	}
-
 	dc_strbuilder_cat(&ret, keybase64_wrapped);
 
-	success = 1;
-
-cleanup:
-	if (!success) { free(ret.buf); ret.buf = NULL; }
-	free(keybase64_wrapped);
-	return ret.buf; /* NULL on errors, this may happen for various reasons */
+	return ret.buf;
 }
 
 
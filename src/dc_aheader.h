@@ -30,6 +30,7 @@ void          dc_aheader_unref             (dc_aheader_t*);
 int           dc_aheader_set_from_string   (dc_aheader_t*, const char* header_str);
 
 char*         dc_aheader_render            (const dc_aheader_t*);
+char*         dc_aheader_render_keydata    (const dc_aheader_t*, const char* keybase64_wrapped);
 
 
 #ifdef __cplusplus
@@ -79,10 +79,253 @@ static void dc_apeerstate_set_from_stmt(dc_apeerstate_t* peerstate, sqlite3_stmt
 }
 
 
+/*******************************************************************************
+ * Cache of peerstates
+ ******************************************************************************/
+
+
+typedef struct _dc_cached_peerstate
+{
+	dc_apeerstate_t* peerstate;   /* copy of the database record, NULL if there is no record for the address */
+	uint32_t         last_used;
+} dc_cached_peerstate_t;
+
+
+static dc_key_t* dup_key(const dc_key_t* key)
+{
+	dc_key_t* ret = NULL;
+	if (key) {
+		ret = dc_key_new();
+		dc_key_set_from_key(ret, key);
+	}
+	return ret;
+}
+
+
+static void copy_peerstate(dc_apeerstate_t* dst, const dc_apeerstate_t* src)
+{
+	dc_apeerstate_empty(dst);
+
+	dst->addr                     = dc_strdup(src->addr);
+	dst->last_seen                = src->last_seen;
+	dst->last_seen_autocrypt      = src->last_seen_autocrypt;
+	dst->prefer_encrypt           = src->prefer_encrypt;
+	dst->public_key               = dup_key(src->public_key);
+	dst->public_key_fingerprint   = dc_strdup(src->public_key_fingerprint);
+	dst->gossip_key               = dup_key(src->gossip_key);
+	dst->gossip_timestamp         = src->gossip_timestamp;
+	dst->gossip_key_fingerprint   = dc_strdup(src->gossip_key_fingerprint);
+	dst->verified_key             = dup_key(src->verified_key); /* not shared with the other keys, as if loaded from the database */
+	dst->verified_key_fingerprint = dc_strdup(src->verified_key_fingerprint);
+}
+
+
+static void remove_fingerprint(dc_sqlite3_t* sql, const char* fingerprint, const dc_cached_peerstate_t* entry)
+{
+	/* remove the fingerprint if it refers to the given entry or, if entry is NULL, to any entry */
+	if (fingerprint && fingerprint[0]) {
+		void* data = dc_hash_find_str(&sql->peerstate_cache_fp, fingerprint);
+		if (data && (entry==NULL || data==entry)) {
+			dc_hash_insert_str(&sql->peerstate_cache_fp, fingerprint, NULL);
+		}
+	}
+}
+
+
+static void remove_entry(dc_sqlite3_t* sql, const char* addr)
+{
+	dc_cached_peerstate_t* entry = dc_hash_find_str(&sql->peerstate_cache, addr);
+	if (entry) {
+		if (entry->peerstate) {
+			remove_fingerprint(sql, entry->peerstate->public_key_fingerprint, entry);
+			remove_fingerprint(sql, entry->peerstate->gossip_key_fingerprint, entry);
+		}
+		dc_hash_insert_str(&sql->peerstate_cache, addr, NULL);
+		dc_apeerstate_unref(entry->peerstate);
+		free(entry);
+	}
+}
+
+
+static void evict_least_recently_used(dc_sqlite3_t* sql)
+{
+	/* this is only done if the cache is full, a linear search is fine compared to loading a peerstate */
+	dc_hashelem_t*         elem = NULL;
+	dc_hashelem_t*         lru_elem = NULL;
+	char*                  lru_addr = NULL;
+
+	for (elem=dc_hash_first(&sql->peerstate_cache); elem; elem=dc_hash_next(elem)) {
+		if (lru_elem==NULL
+		 || ((dc_cached_peerstate_t*)dc_hash_data(elem))->last_used < ((dc_cached_peerstate_t*)dc_hash_data(lru_elem))->last_used) {
+			lru_elem = elem;
+		}
+	}
+
+	if (lru_elem) {
+		lru_addr = dc_strdup(dc_hash_key(lru_elem));
+		remove_entry(sql, lru_addr);
+		free(lru_addr);
+	}
+}
+
+
+/* Copy a cached peerstate to the given object; to look up a fingerprint, addr must be NULL.
+Returns 1 if the peerstate is cached, -1 if it is known that there is no peerstate for the address, 0 otherwise.
+On 0, ret_version is set to the value to be passed to add_to_cache() after loading the peerstate from the database. */
+static int get_from_cache(dc_sqlite3_t* sql, const char* addr, const char* fingerprint, dc_apeerstate_t* peerstate, uint32_t* ret_version)
+{
+	int                    ret = 0;
+	dc_cached_peerstate_t* entry = NULL;
+
+	pthread_mutex_lock(&sql->peerstate_cache_mutex);
+		entry = addr? dc_hash_find_str(&sql->peerstate_cache, addr) : dc_hash_find_str(&sql->peerstate_cache_fp, fingerprint);
+		if (entry) {
+			entry->last_used = ++sql->peerstate_cache_clock;
+			sql->peerstate_cache_hits++;
+			if (entry->peerstate) {
+				copy_peerstate(peerstate, entry->peerstate);
+				ret = 1;
+			}
+			else {
+				ret = -1;
+			}
+		}
+		else {
+			sql->peerstate_cache_misses++;
+			*ret_version = sql->peerstate_cache_version;
+		}
+	pthread_mutex_unlock(&sql->peerstate_cache_mutex);
+
+	return ret;
+}
+
+
+/* Add a peerstate loaded from the database; if the peerstate was loaded by its fingerprint, this is given as well.
+If the database was modified since get_from_cache() was called, the peerstate may be outdated and is not added. */
+static void add_to_cache(dc_sqlite3_t* sql, const char* addr, const char* fingerprint, const dc_apeerstate_t* peerstate, uint32_t version)
+{
+	dc_cached_peerstate_t* entry = NULL;
+
+	pthread_mutex_lock(&sql->peerstate_cache_mutex);
+		if (version==sql->peerstate_cache_version) {
+			remove_entry(sql, addr);
+			if (dc_hash_cnt(&sql->peerstate_cache) >= DC_PEERSTATE_CACHE_SIZE) {
+				evict_least_recently_used(sql);
+			}
+
+			if ((entry=calloc(1, sizeof(dc_cached_peerstate_t)))==NULL) {
+				exit(65); /* cannot allocate little memory, unrecoverable error */
+			}
+			if (peerstate) {
+				entry->peerstate = dc_apeerstate_new(NULL);
+				copy_peerstate(entry->peerstate, peerstate);
+			}
+			entry->last_used = ++sql->peerstate_cache_clock;
+			dc_hash_insert_str(&sql->peerstate_cache, addr, entry);
+
+			if (fingerprint && peerstate) {
+				dc_hash_insert_str(&sql->peerstate_cache_fp, fingerprint, entry);
+			}
+		}
+	pthread_mutex_unlock(&sql->peerstate_cache_mutex);
+}
+
+
+/* Update the cache after dc_apeerstate_save_to_db() has written the peerstate; if written is 0, the peerstate is removed from the cache. */
+static void write_to_cache(dc_sqlite3_t* sql, const dc_apeerstate_t* peerstate, int written)
+{
+	dc_cached_peerstate_t* entry = NULL;
+
+	pthread_mutex_lock(&sql->peerstate_cache_mutex);
+		sql->peerstate_cache_version++; /* peerstates being loaded concurrently may be outdated */
+
+		/* other peerstates may have been found by the new fingerprints */
+		remove_fingerprint(sql, peerstate->public_key_fingerprint, NULL);
+		remove_fingerprint(sql, peerstate->gossip_key_fingerprint, NULL);
+
+		entry = dc_hash_find_str(&sql->peerstate_cache, peerstate->addr);
+		if (written&DC_SAVE_ALL) {
+			remove_entry(sql, peerstate->addr);
+			if (dc_hash_cnt(&sql->peerstate_cache) >= DC_PEERSTATE_CACHE_SIZE) {
+				evict_least_recently_used(sql);
+			}
+
+			if ((entry=calloc(1, sizeof(dc_cached_peerstate_t)))==NULL) {
+				exit(65);
+			}
+			entry->peerstate = dc_apeerstate_new(NULL);
+			copy_peerstate(entry->peerstate, peerstate);
+			entry->last_used = ++sql->peerstate_cache_clock;
+			dc_hash_insert_str(&sql->peerstate_cache, peerstate->addr, entry);
+		}
+		else if ((written&DC_SAVE_TIMESTAMPS) && entry && entry->peerstate) {
+			entry->peerstate->last_seen           = peerstate->last_seen;
+			entry->peerstate->last_seen_autocrypt = peerstate->last_seen_autocrypt;
+			entry->peerstate->gossip_timestamp    = peerstate->gossip_timestamp;
+		}
+		else {
+			remove_entry(sql, peerstate->addr);
+		}
+	pthread_mutex_unlock(&sql->peerstate_cache_mutex);
+}
+
+
+/**
+ * Remove all peerstates from the cache used by dc_apeerstate_load_by_addr()
+ * and dc_apeerstate_load_by_fingerprint().
+ *
+ * dc_apeerstate_save_to_db() updates the cache, so this is needed only if
+ * the table acpeerstates is modified otherwise, eg. by a rollback or if the
+ * database is closed.
+ *
+ * @private @memberof dc_apeerstate_t
+ * @param sql The database object the cache belongs to.
+ * @return None.
+ */
+void dc_apeerstate_clear_cache(dc_sqlite3_t* sql)
+{
+	dc_hashelem_t* elem = NULL;
+
+	if (sql==NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&sql->peerstate_cache_mutex);
+		for (elem=dc_hash_first(&sql->peerstate_cache); elem; elem=dc_hash_next(elem)) {
+			dc_cached_peerstate_t* entry = (dc_cached_peerstate_t*)dc_hash_data(elem);
+			dc_apeerstate_unref(entry->peerstate);
+			free(entry);
+		}
+		dc_hash_clear(&sql->peerstate_cache);
+		dc_hash_clear(&sql->peerstate_cache_fp);
+		sql->peerstate_cache_version++;
+	pthread_mutex_unlock(&sql->peerstate_cache_mutex);
+}
+
+
+char* dc_apeerstate_get_cache_str(dc_sqlite3_t* sql)
+{
+	char* ret = NULL;
+
+	if (sql==NULL) {
+		return dc_strdup("");
+	}
+
+	pthread_mutex_lock(&sql->peerstate_cache_mutex);
+		ret = dc_mprintf("%i peerstates, %i hits, %i misses",
+			dc_hash_cnt(&sql->peerstate_cache), sql->peerstate_cache_hits, sql->peerstate_cache_misses);
+	pthread_mutex_unlock(&sql->peerstate_cache_mutex);
+
+	return ret;
+}
+
+
 int dc_apeerstate_load_by_addr(dc_apeerstate_t* peerstate, dc_sqlite3_t* sql, const char* addr)
 {
 	int           success = 0;
 	sqlite3_stmt* stmt = NULL;
+	int           cached = 0;
+	uint32_t      version = 0;
 
 	if (peerstate==NULL || sql==NULL || addr==NULL) {
 		goto cleanup;
@@ -90,15 +333,22 @@ int dc_apeerstate_load_by_addr(dc_apeerstate_t* peerstate, dc_sqlite3_t* sql, co
 
 	dc_apeerstate_empty(peerstate);
 
+	if ((cached=get_from_cache(sql, addr, NULL, peerstate, &version))!=0) {
+		success = (cached==1);
+		goto cleanup;
+	}
+
 	stmt = dc_sqlite3_prepare(sql,
 		"SELECT " PEERSTATE_FIELDS
 		 " FROM acpeerstates "
 		 " WHERE addr=? COLLATE NOCASE;");
 	sqlite3_bind_text(stmt, 1, addr, -1, SQLITE_STATIC);
 	if (sqlite3_step(stmt)!=SQLITE_ROW) {
+		add_to_cache(sql, addr, NULL, NULL, version); /* most addresses have no peerstate, remember this as well */
 		goto cleanup;
 	}
 	dc_apeerstate_set_from_stmt(peerstate, stmt);
+	add_to_cache(sql, addr, NULL, peerstate, version);
 
 	success = 1;
 
@@ -112,6 +362,9 @@ int dc_apeerstate_load_by_fingerprint(dc_apeerstate_t* peerstate, dc_sqlite3_t*
 {
 	int           success = 0;
 	sqlite3_stmt* stmt = NULL;
+	uint32_t      version = 0;
+	uint8_t*      fingerprint_bin = NULL;
+	size_t        fingerprint_bytes = 0;
 
 	if (peerstate==NULL || sql==NULL || fingerprint==NULL) {
 		goto cleanup;
@@ -119,32 +372,57 @@ int dc_apeerstate_load_by_fingerprint(dc_apeerstate_t* peerstate, dc_sqlite3_t*
 
 	dc_apeerstate_empty(peerstate);
 
+	if (fingerprint[0] && get_from_cache(sql, NULL, fingerprint, peerstate, &version)==1) {
+		success = 1;
+		goto cleanup;
+	}
+
+	if ((fingerprint_bin=dc_hex_to_binary(fingerprint, &fingerprint_bytes))==NULL) {
+		goto cleanup;
+	}
+
+	/* the binary columns are compared bytewise and are indexed, unlike `COLLATE NOCASE` on the hex columns */
 	stmt = dc_sqlite3_prepare(sql,
 		"SELECT " PEERSTATE_FIELDS
 		 " FROM acpeerstates "
-		 " WHERE public_key_fingerprint=? COLLATE NOCASE "
-		 "    OR gossip_key_fingerprint=? COLLATE NOCASE "
-		 " ORDER BY public_key_fingerprint=? DESC;"); // if for, any reasons, different peers have the same key, prefer the peer with the correct public key. should not happen, however.
-	sqlite3_bind_text(stmt, 1, fingerprint, -1, SQLITE_STATIC);
-	sqlite3_bind_text(stmt, 2, fingerprint, -1, SQLITE_STATIC);
-	sqlite3_bind_text(stmt, 3, fingerprint, -1, SQLITE_STATIC);
+		 " WHERE public_key_fingerprint_bin=? "
+		 "    OR gossip_key_fingerprint_bin=? "
+		 " ORDER BY public_key_fingerprint_bin=? DESC;"); // if for, any reasons, different peers have the same key, prefer the peer with the correct public key. should not happen, however.
+	sqlite3_bind_blob(stmt, 1, fingerprint_bin, fingerprint_bytes, SQLITE_STATIC);
+	sqlite3_bind_blob(stmt, 2, fingerprint_bin, fingerprint_bytes, SQLITE_STATIC);
+	sqlite3_bind_blob(stmt, 3, fingerprint_bin, fingerprint_bytes, SQLITE_STATIC);
 	if (sqlite3_step(stmt)!=SQLITE_ROW) {
 		goto cleanup;
 	}
 	dc_apeerstate_set_from_stmt(peerstate, stmt);
+	if (fingerprint[0] && peerstate->addr) {
+		add_to_cache(sql, peerstate->addr, fingerprint, peerstate, version);
+	}
 
 	success = 1;
 
 cleanup:
 	sqlite3_finalize(stmt);
+	free(fingerprint_bin);
 	return success;
 }
 
 
+static void bind_fingerprint_bin(sqlite3_stmt* stmt, int index, const char* fingerprint)
+{
+	/* the fingerprints are also stored as binary, these columns are indexed and used for lookups */
+	size_t   bytes = 0;
+	uint8_t* bin = dc_hex_to_binary(fingerprint, &bytes);
+	sqlite3_bind_blob(stmt, index, bin/*NULL results in sqlite3_bind_null()*/, bytes, SQLITE_TRANSIENT);
+	free(bin);
+}
+
+
 int dc_apeerstate_save_to_db(const dc_apeerstate_t* peerstate, dc_sqlite3_t* sql, int create)
 {
 	int           success = 0;
 	sqlite3_stmt* stmt = NULL;
+	int           written = 0;
 
 	if (peerstate==NULL || sql==NULL || peerstate->addr==NULL) {
 		return 0;
@@ -163,7 +441,8 @@ int dc_apeerstate_save_to_db(const dc_apeerstate_t* peerstate, dc_sqlite3_t* sql
 		stmt = dc_sqlite3_prepare(sql,
 			"UPDATE acpeerstates "
 			"   SET last_seen=?, last_seen_autocrypt=?, prefer_encrypted=?, "
-			"       public_key=?, gossip_timestamp=?, gossip_key=?, public_key_fingerprint=?, gossip_key_fingerprint=?, verified_key=?, verified_key_fingerprint=? "
+			"       public_key=?, gossip_timestamp=?, gossip_key=?, public_key_fingerprint=?, gossip_key_fingerprint=?, verified_key=?, verified_key_fingerprint=?, "
+			"       public_key_fingerprint_bin=?, gossip_key_fingerprint_bin=?, verified_key_fingerprint_bin=? "
 			" WHERE addr=?;");
 		sqlite3_bind_int64(stmt, 1, peerstate->last_seen);
 		sqlite3_bind_int64(stmt, 2, peerstate->last_seen_autocrypt);
@@ -175,12 +454,16 @@ int dc_apeerstate_save_to_db(const dc_apeerstate_t* peerstate, dc_sqlite3_t* sql
 		sqlite3_bind_text (stmt, 8, peerstate->gossip_key_fingerprint, -1, SQLITE_STATIC);
 		sqlite3_bind_blob (stmt, 9, peerstate->verified_key? peerstate->verified_key->binary : NULL/*results in sqlite3_bind_null()*/, peerstate->verified_key? peerstate->verified_key->bytes : 0, SQLITE_STATIC);
 		sqlite3_bind_text (stmt,10, peerstate->verified_key_fingerprint, -1, SQLITE_STATIC);
-		sqlite3_bind_text (stmt,11, peerstate->addr, -1, SQLITE_STATIC);
+		bind_fingerprint_bin(stmt, 11, peerstate->public_key_fingerprint);
+		bind_fingerprint_bin(stmt, 12, peerstate->gossip_key_fingerprint);
+		bind_fingerprint_bin(stmt, 13, peerstate->verified_key_fingerprint);
+		sqlite3_bind_text (stmt,14, peerstate->addr, -1, SQLITE_STATIC);
 		if (sqlite3_step(stmt)!=SQLITE_DONE) {
 			goto cleanup;
 		}
 		sqlite3_finalize(stmt);
 		stmt = NULL;
+		written = DC_SAVE_ALL;
 	}
 	else if (peerstate->to_save&DC_SAVE_TIMESTAMPS)
 	{
@@ -195,12 +478,16 @@ int dc_apeerstate_save_to_db(const dc_apeerstate_t* peerstate, dc_sqlite3_t* sql
 		}
 		sqlite3_finalize(stmt);
 		stmt = NULL;
+		written = DC_SAVE_TIMESTAMPS;
 	}
 
 	success = 1;
 
 cleanup:
 	sqlite3_finalize(stmt);
+	if (create || peerstate->to_save) {
+		write_to_cache(sql, peerstate, written); /* on errors, written is 0 and the peerstate is removed from the cache */
+	}
 	return success;
 }
 
@@ -231,6 +518,108 @@ void dc_apeerstate_unref(dc_apeerstate_t* peerstate)
 }
 
 
+/*******************************************************************************
+ * Render gossip headers
+ ******************************************************************************/
+
+
+typedef struct _dc_rendered_key
+{
+	char*    base64;
+	uint32_t last_used;
+} dc_rendered_key_t;
+
+
+static void evict_least_recently_rendered(dc_context_t* context)
+{
+	/* the cache is small and this is only done if it is full, so a linear search is fine */
+	dc_hashelem_t* elem = NULL;
+	dc_hashelem_t* lru_elem = NULL;
+
+	for (elem=dc_hash_first(&context->key_render_cache); elem; elem=dc_hash_next(elem)) {
+		if (lru_elem==NULL
+		 || ((dc_rendered_key_t*)dc_hash_data(elem))->last_used < ((dc_rendered_key_t*)dc_hash_data(lru_elem))->last_used) {
+			lru_elem = elem;
+		}
+	}
+
+	if (lru_elem) {
+		dc_rendered_key_t* entry = (dc_rendered_key_t*)dc_hash_data(lru_elem);
+		dc_hash_insert(&context->key_render_cache, dc_hash_key(lru_elem), dc_hash_keysize(lru_elem), NULL);
+		free(entry->base64);
+		free(entry);
+	}
+}
+
+
+/* Render a key as needed for Autocrypt-Gossip headers; the same keys are gossiped
+with every message sent to a group, so the rendering is cached by the raw key */
+static char* render_key(dc_context_t* context, const dc_key_t* key)
+{
+	char*              ret = NULL;
+	dc_rendered_key_t* entry = NULL;
+
+	if (context==NULL) {
+		return dc_key_render_base64(key, 78, " ", 0/*no checksum*/);
+	}
+
+	pthread_mutex_lock(&context->key_render_cache_mutex);
+		if ((entry=dc_hash_find(&context->key_render_cache, key->binary, key->bytes))!=NULL) {
+			entry->last_used = ++context->key_render_cache_clock;
+			ret = dc_strdup(entry->base64);
+		}
+	pthread_mutex_unlock(&context->key_render_cache_mutex);
+
+	if (ret==NULL) {
+		if ((ret=dc_key_render_base64(key, 78, " ", 0/*no checksum*/))==NULL) {
+			return NULL;
+		}
+
+		pthread_mutex_lock(&context->key_render_cache_mutex);
+			if (dc_hash_find(&context->key_render_cache, key->binary, key->bytes)==NULL) {
+				if (dc_hash_cnt(&context->key_render_cache) >= DC_KEY_RENDER_CACHE_SIZE) {
+					evict_least_recently_rendered(context);
+				}
+				if ((entry=calloc(1, sizeof(dc_rendered_key_t)))==NULL) {
+					exit(79); /* cannot allocate little memory, unrecoverable error */
+				}
+				entry->base64    = dc_strdup(ret);
+				entry->last_used = ++context->key_render_cache_clock;
+				dc_hash_insert(&context->key_render_cache, key->binary, key->bytes, entry);
+			}
+		pthread_mutex_unlock(&context->key_render_cache_mutex);
+	}
+
+	return ret;
+}
+
+
+/**
+ * Free the keys cached by dc_apeerstate_render_gossip_header().
+ *
+ * @private @memberof dc_apeerstate_t
+ * @param context The context object the cache belongs to.
+ * @return None.
+ */
+void dc_apeerstate_clear_render_cache(dc_context_t* context)
+{
+	dc_hashelem_t* elem = NULL;
+
+	if (context==NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&context->key_render_cache_mutex);
+		for (elem=dc_hash_first(&context->key_render_cache); elem; elem=dc_hash_next(elem)) {
+			dc_rendered_key_t* entry = (dc_rendered_key_t*)dc_hash_data(elem);
+			free(entry->base64);
+			free(entry);
+		}
+		dc_hash_clear(&context->key_render_cache);
+	pthread_mutex_unlock(&context->key_render_cache_mutex);
+}
+
+
 /**
  * Render an Autocrypt-Gossip header value.  The contained key is either
  * public_key or gossip_key if public_key is NULL.
@@ -245,18 +634,27 @@ char* dc_apeerstate_render_gossip_header(const dc_apeerstate_t* peerstate, int m
 {
 	char*         ret = NULL;
 	dc_aheader_t* autocryptheader = dc_aheader_new();
+	dc_key_t*     key = NULL;
+	char*         keybase64_wrapped = NULL;
 
-	if (peerstate==NULL || peerstate->addr==NULL) {
+	if (peerstate==NULL || peerstate->addr==NULL
+	 || (key=dc_apeerstate_peek_key(peerstate, min_verified))==NULL) {
 		goto cleanup;
 	}
 
 	autocryptheader->prefer_encrypt = DC_PE_NOPREFERENCE; /* the spec says, we SHOULD NOT gossip this flag */
 	autocryptheader->addr           = dc_strdup(peerstate->addr);
-	autocryptheader->public_key     = dc_key_ref(dc_apeerstate_peek_key(peerstate, min_verified)); /* may be NULL */
+	dc_key_unref(autocryptheader->public_key);
+	autocryptheader->public_key     = dc_key_ref(key);
+
+	if ((keybase64_wrapped=render_key(peerstate->context, key))==NULL) {
+		goto cleanup;
+	}
 
-	ret = dc_aheader_render(autocryptheader);
+	ret = dc_aheader_render_keydata(autocryptheader, keybase64_wrapped);
 
 cleanup:
+	free(keybase64_wrapped);
 	dc_aheader_unref(autocryptheader);
 	return ret;
 }
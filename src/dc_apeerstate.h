@@ -82,6 +82,13 @@ int              dc_apeerstate_load_by_addr         (dc_apeerstate_t*, dc_sqlite
 int              dc_apeerstate_load_by_fingerprint  (dc_apeerstate_t*, dc_sqlite3_t*, const char* fingerprint);
 int              dc_apeerstate_save_to_db           (const dc_apeerstate_t*, dc_sqlite3_t*, int create);
 
+/* peerstates loaded by dc_apeerstate_load_by_addr() and dc_apeerstate_load_by_fingerprint() are cached in dc_sqlite3_t */
+#define          DC_PEERSTATE_CACHE_SIZE 256
+void             dc_apeerstate_clear_cache          (dc_sqlite3_t*);
+char*            dc_apeerstate_get_cache_str        (dc_sqlite3_t*);
+#define          DC_KEY_RENDER_CACHE_SIZE 256
+void             dc_apeerstate_clear_render_cache   (dc_context_t*);
+
 int              dc_apeerstate_has_verified_key     (const dc_apeerstate_t*, const dc_hash_t* fingerprints);
 
 #ifdef __cplusplus
@@ -387,6 +387,57 @@ int dc_chat_is_self_talk(const dc_chat_t* chat)
 }
 
 
+/* the columns chats.last_msg_id, chats.last_timestamp and chats.fresh_cnt are a copy of data from the msgs table
+that allows loading the chatlist without looking at the messages.  the subqueries use the index msgs_index7 on (chat_id, timestamp)
+and the index over the state-column (there are typically only few fresh messages) */
+#define UPDATE_CHAT_CACHE_SQL \
+	"UPDATE chats SET " \
+	" last_msg_id=IFNULL((SELECT id FROM msgs WHERE chat_id=chats.id AND (hidden=0 OR (hidden=1 AND state=" DC_STRINGIFY(DC_STATE_OUT_DRAFT) ")) ORDER BY timestamp DESC, id DESC LIMIT 1),0)," \
+	" last_timestamp=IFNULL((SELECT MAX(timestamp) FROM msgs WHERE chat_id=chats.id AND (hidden=0 OR (hidden=1 AND state=" DC_STRINGIFY(DC_STATE_OUT_DRAFT) "))),0)," \
+	" fresh_cnt=(SELECT COUNT(*) FROM msgs WHERE state=" DC_STRINGIFY(DC_STATE_IN_FRESH) " AND hidden=0 AND chat_id=chats.id)"
+
+
+/**
+ * Update the columns chats.last_msg_id, chats.last_timestamp and chats.fresh_cnt
+ * from the messages of a chat.  Must be called after messages are added, deleted,
+ * moved to another chat or after their state changes from or to DC_STATE_IN_FRESH.
+ *
+ * @private @memberof dc_context_t
+ * @param sql The database to update.
+ * @param chat_id The chat to update. 0 updates all chats.
+ * @return None.
+ */
+void dc_update_chat_cache(dc_sqlite3_t* sql, uint32_t chat_id)
+{
+	sqlite3_stmt* stmt = NULL;
+
+	if (chat_id) {
+		stmt = dc_sqlite3_borrow_stmt(sql, UPDATE_CHAT_CACHE_SQL " WHERE id=?;");
+		sqlite3_bind_int(stmt, 1, chat_id);
+	}
+	else {
+		stmt = dc_sqlite3_borrow_stmt(sql, UPDATE_CHAT_CACHE_SQL ";");
+	}
+
+	sqlite3_step(stmt);
+	dc_sqlite3_return_stmt(sql, stmt);
+}
+
+
+/**
+ * Same as dc_update_chat_cache() but for the chat the given message belongs to.
+ *
+ * @private @memberof dc_context_t
+ */
+void dc_update_chat_cache_by_msg(dc_sqlite3_t* sql, uint32_t msg_id)
+{
+	sqlite3_stmt* stmt = dc_sqlite3_borrow_stmt(sql, UPDATE_CHAT_CACHE_SQL " WHERE id=(SELECT chat_id FROM msgs WHERE id=?);");
+	sqlite3_bind_int(stmt, 1, msg_id);
+	sqlite3_step(stmt);
+	dc_sqlite3_return_stmt(sql, stmt);
+}
+
+
 int dc_chat_update_param(dc_chat_t* chat)
 {
 	int success = 0;
@@ -400,18 +451,24 @@ int dc_chat_update_param(dc_chat_t* chat)
 }
 
 
-static int set_from_stmt(dc_chat_t* chat, sqlite3_stmt* row)
+/**
+ * Set the chat object from a row of a statement selecting DC_CHAT_FIELDS.
+ *
+ * @private @memberof dc_chat_t
+ * @param chat The chat object to set.  Existing data are free()'d using dc_chat_empty().
+ * @param row The statement, must be positioned on a row.
+ * @param row_offset Index of the first column of DC_CHAT_FIELDS.
+ * @return The index of the first column after DC_CHAT_FIELDS, 0 on errors.
+ */
+int dc_chat_set_from_stmt(dc_chat_t* chat, sqlite3_stmt* row, int row_offset)
 {
-	int         row_offset = 0;
-
 	if (chat==NULL || chat->magic!=DC_CHAT_MAGIC || row==NULL) {
 		return 0;
 	}
 
 	dc_chat_empty(chat);
 
-	#define CHAT_FIELDS " c.id,c.type,c.name, c.grpid,c.param,c.archived, c.blocked "
-	chat->id              =                    sqlite3_column_int  (row, row_offset++); /* the columns are defined in CHAT_FIELDS */
+	chat->id              =                    sqlite3_column_int  (row, row_offset++); /* the columns are defined in DC_CHAT_FIELDS */
 	chat->type            =                    sqlite3_column_int  (row, row_offset++);
 	chat->name            =   dc_strdup((char*)sqlite3_column_text (row, row_offset++));
 	chat->grpid           =   dc_strdup((char*)sqlite3_column_text (row, row_offset++));
@@ -464,14 +521,14 @@ int dc_chat_load_from_db(dc_chat_t* chat, uint32_t chat_id)
 	dc_chat_empty(chat);
 
 	stmt = dc_sqlite3_prepare(chat->context->sql,
-		"SELECT " CHAT_FIELDS " FROM chats c WHERE c.id=?;");
+		"SELECT " DC_CHAT_FIELDS " FROM chats c WHERE c.id=?;");
 	sqlite3_bind_int(stmt, 1, chat_id);
 
 	if (sqlite3_step(stmt)!=SQLITE_ROW) {
 		goto cleanup;
 	}
 
-	if (!set_from_stmt(chat, stmt)) {
+	if (!dc_chat_set_from_stmt(chat, stmt, 0)) {
 		goto cleanup;
 	}
 
@@ -521,6 +578,8 @@ int dc_add_to_chat_contacts_table(dc_context_t* context, uint32_t chat_id, uint3
 	sqlite3_bind_int(stmt, 2, contact_id);
 	ret = (sqlite3_step(stmt)==SQLITE_DONE)? 1 : 0;
 	sqlite3_finalize(stmt);
+
+	dc_e2ee_reset_gossiped_keys(context, chat_id); /* the new member needs all keys */
 	return ret;
 }
 
@@ -603,6 +662,7 @@ void dc_marknoticed_chat(dc_context_t* context, uint32_t chat_id)
 		" WHERE chat_id=? AND state=" DC_STRINGIFY(DC_STATE_IN_FRESH) ";");
 	sqlite3_bind_int(update, 1, chat_id);
 	sqlite3_step(update);
+	dc_update_chat_cache(context->sql, chat_id);
 
 	context->cb(context, DC_EVENT_MSGS_CHANGED, 0, 0);
 
@@ -640,6 +700,7 @@ void dc_marknoticed_all_chats(dc_context_t* context)
 		"   SET state=" DC_STRINGIFY(DC_STATE_IN_NOTICED)
 		" WHERE state=" DC_STRINGIFY(DC_STATE_IN_FRESH) ";");
 	sqlite3_step(update);
+	dc_update_chat_cache(context->sql, 0);
 
 	context->cb(context, DC_EVENT_MSGS_CHANGED, 0, 0);
 
@@ -1016,7 +1077,7 @@ dc_array_t* dc_get_chat_msgs(dc_context_t* context, uint32_t chat_id, uint32_t f
 
 	if (chat_id==DC_CHAT_ID_DEADDROP)
 	{
-		stmt = dc_sqlite3_prepare(context->sql,
+		stmt = dc_sqlite3_prepare_read(context->sql,
 			"SELECT m.id, m.timestamp"
 				" FROM msgs m"
 				" LEFT JOIN chats ON m.chat_id=chats.id"
@@ -1029,7 +1090,7 @@ dc_array_t* dc_get_chat_msgs(dc_context_t* context, uint32_t chat_id, uint32_t f
 	}
 	else if (chat_id==DC_CHAT_ID_STARRED)
 	{
-		stmt = dc_sqlite3_prepare(context->sql,
+		stmt = dc_sqlite3_prepare_read(context->sql,
 			"SELECT m.id, m.timestamp"
 				" FROM msgs m"
 				" LEFT JOIN contacts ct ON m.from_id=ct.id"
@@ -1040,7 +1101,7 @@ dc_array_t* dc_get_chat_msgs(dc_context_t* context, uint32_t chat_id, uint32_t f
 	}
 	else
 	{
-		stmt = dc_sqlite3_prepare(context->sql,
+		stmt = dc_sqlite3_prepare_read(context->sql,
 			"SELECT m.id, m.timestamp"
 				" FROM msgs m"
 				//" LEFT JOIN contacts ct ON m.from_id=ct.id"
@@ -1176,6 +1237,9 @@ static int set_draft_raw(dc_context_t* context, uint32_t chat_id, dc_msg_t* msg)
 
 
 cleanup:
+	if (sth_changed) {
+		dc_update_chat_cache(context->sql, chat_id);
+	}
 	sqlite3_finalize(stmt);
 	free(pathNfilename);
 	return sth_changed;
@@ -1422,10 +1486,7 @@ int dc_get_fresh_msg_cnt(dc_context_t* context, uint32_t chat_id)
 	}
 
 	stmt = dc_sqlite3_prepare(context->sql,
-		"SELECT COUNT(*) FROM msgs "
-		" WHERE state=" DC_STRINGIFY(DC_STATE_IN_FRESH)
-		"   AND hidden=0 "
-		"   AND chat_id=?;"); /* we have an index over the state-column, this should be sufficient as there are typically only few fresh messages */
+		"SELECT fresh_cnt FROM chats WHERE id=?;"); /* fresh_cnt is updated by dc_update_chat_cache() */
 	sqlite3_bind_int(stmt, 1, chat_id);
 
 	if (sqlite3_step(stmt)!=SQLITE_ROW) {
@@ -1472,6 +1533,7 @@ void dc_archive_chat(dc_context_t* context, uint32_t chat_id, int archive)
 		sqlite3_bind_int(stmt, 1, chat_id);
 		sqlite3_step(stmt);
 		sqlite3_finalize(stmt);
+		dc_update_chat_cache(context->sql, chat_id);
 	}
 
 	sqlite3_stmt* stmt = dc_sqlite3_prepare(context->sql,
@@ -1559,6 +1621,22 @@ void dc_delete_chat(dc_context_t* context, uint32_t chat_id)
 		sqlite3_free(q3);
 		q3 = NULL;
 
+		if (context->sql->search_index) {
+			q3 = sqlite3_mprintf("DELETE FROM msgs_fts WHERE rowid IN (SELECT id FROM msgs WHERE chat_id=%i);", chat_id);
+			if (!dc_sqlite3_execute(context->sql, q3)) {
+				goto cleanup;
+			}
+			sqlite3_free(q3);
+			q3 = NULL;
+		}
+
+		q3 = sqlite3_mprintf("DELETE FROM decrypt_cache WHERE rfc724_mid IN (SELECT rfc724_mid FROM msgs WHERE chat_id=%i);", chat_id);
+		if (!dc_sqlite3_execute(context->sql, q3)) {
+			goto cleanup;
+		}
+		sqlite3_free(q3);
+		q3 = NULL;
+
 		q3 = sqlite3_mprintf("DELETE FROM msgs WHERE chat_id=%i;", chat_id);
 		if (!dc_sqlite3_execute(context->sql, q3)) {
 			goto cleanup;
@@ -1573,6 +1651,13 @@ void dc_delete_chat(dc_context_t* context, uint32_t chat_id)
 		sqlite3_free(q3);
 		q3 = NULL;
 
+		q3 = sqlite3_mprintf("DELETE FROM gossiped_keys WHERE chat_id=%i;", chat_id);
+		if (!dc_sqlite3_execute(context->sql, q3)) {
+			goto cleanup;
+		}
+		sqlite3_free(q3);
+		q3 = NULL;
+
 		q3 = sqlite3_mprintf("DELETE FROM chats WHERE id=%i;", chat_id);
 		if (!dc_sqlite3_execute(context->sql, q3)) {
 			goto cleanup;
@@ -2351,6 +2436,8 @@ static uint32_t send_msg_raw(dc_context_t* context, dc_chat_t* chat, const dc_ms
 	}
 
 	msg_id = dc_sqlite3_get_rowid(context->sql, "msgs", "rfc724_mid", new_rfc724_mid);
+	dc_update_chat_cache(context->sql, chat->id);
+	dc_update_search_index(context->sql, msg_id);
 	dc_job_add(context, DC_JOB_SEND_MSG_TO_SMTP, msg_id, NULL, 0);
 
 cleanup:
@@ -2555,6 +2642,8 @@ void dc_add_device_msg(dc_context_t* context, uint32_t chat_id, const char* text
 		goto cleanup;
 	}
 	msg_id = dc_sqlite3_get_rowid(context->sql, "msgs", "rfc724_mid", rfc724_mid);
+	dc_update_chat_cache(context->sql, chat_id);
+	dc_update_search_index(context->sql, msg_id);
 	context->cb(context, DC_EVENT_MSGS_CHANGED, chat_id, msg_id);
 
 cleanup:
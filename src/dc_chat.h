@@ -27,6 +27,9 @@ struct _dc_chat
 };
 
 int             dc_chat_load_from_db               (dc_chat_t*, uint32_t id);
+
+#define         DC_CHAT_FIELDS                     " c.id,c.type,c.name, c.grpid,c.param,c.archived, c.blocked "
+int             dc_chat_set_from_stmt              (dc_chat_t*, sqlite3_stmt* row, int row_offset); /* field order must be DC_CHAT_FIELDS */
 int             dc_chat_update_param               (dc_chat_t*);
 
 #define         DC_CHAT_TYPE_IS_MULTI(a)   ((a)==DC_CHAT_TYPE_GROUP || (a)==DC_CHAT_TYPE_VERIFIED_GROUP)
@@ -36,6 +39,8 @@ int             dc_chat_update_param               (dc_chat_t*);
 
 
 // Context functions to work with chats
+void            dc_update_chat_cache                       (dc_sqlite3_t*, uint32_t chat_id);
+void            dc_update_chat_cache_by_msg                (dc_sqlite3_t*, uint32_t msg_id);
 int             dc_add_to_chat_contacts_table              (dc_context_t*, uint32_t chat_id, uint32_t contact_id);
 int             dc_is_contact_in_chat                      (dc_context_t*, uint32_t chat_id, uint32_t contact_id);
 size_t          dc_get_chat_cnt                            (dc_context_t*);
@@ -65,6 +65,16 @@ void dc_chatlist_empty(dc_chatlist_t* chatlist)
 
 	chatlist->cnt = 0;
 	dc_array_empty(chatlist->chatNlastmsg_ids);
+
+	if (chatlist->summaries) {
+		size_t i;
+		for (i = 0; i < chatlist->summaries_cnt; i++) {
+			dc_lot_unref(chatlist->summaries[i]);
+		}
+		free(chatlist->summaries);
+		chatlist->summaries = NULL;
+		chatlist->summaries_cnt = 0;
+	}
 }
 
 
@@ -127,51 +137,39 @@ uint32_t dc_chatlist_get_msg_id(const dc_chatlist_t* chatlist, size_t index)
 }
 
 
-/**
- * Get a summary for a chatlist index.
- *
- * The summary is returned by a dc_lot_t object with the following fields:
- *
- * - dc_lot_t::text1: contains the username or the strings "Me", "Draft" and so on.
- *   The string may be colored by having a look at text1_meaning.
- *   If there is no such name or it should not be displayed, the element is NULL.
- *
- * - dc_lot_t::text1_meaning: one of DC_TEXT1_USERNAME, DC_TEXT1_SELF or DC_TEXT1_DRAFT.
- *   Typically used to show dc_lot_t::text1 with different colors. 0 if not applicable.
- *
- * - dc_lot_t::text2: contains an excerpt of the message text or strings as
- *   "No messages".  May be NULL of there is no such text (eg. for the archive link)
- *
- * - dc_lot_t::timestamp: the timestamp of the message.  0 if not applicable.
- *
- * - dc_lot_t::state: The state of the message as one of the DC_STATE_* constants (see #dc_msg_get_state()).  0 if not applicable.
- *
- * @memberof dc_chatlist_t
- * @param chatlist The chatlist to query as returned eg. from dc_get_chatlist().
- * @param index The index to query in the chatlist.
- * @param chat To speed up things, pass an already available chat object here.
- *     If the chat object is not yet available, it is faster to pass NULL.
- * @return The summary as an dc_lot_t object. Must be freed using dc_lot_unref().  NULL is never returned.
- */
-dc_lot_t* dc_chatlist_get_summary(const dc_chatlist_t* chatlist, size_t index, dc_chat_t* chat /*may be NULL*/)
+static void fill_summary(dc_lot_t* ret, const dc_chat_t* chat, const dc_msg_t* lastmsg, const dc_contact_t* lastcontact, dc_context_t* context)
 {
 	/* The summary is created by the chat, not by the last message.
 	This is because we may want to display drafts here or stuff as
 	"is typing".
 	Also, sth. as "No messages" would not work if the summary comes from a
 	message. */
+	if (chat->id==DC_CHAT_ID_ARCHIVED_LINK)
+	{
+		ret->text2 = dc_strdup(NULL);
+	}
+	else if (lastmsg==NULL || lastmsg->from_id==0)
+	{
+		/* no messages */
+		ret->text2 = dc_stock_str(context, DC_STR_NOMESSAGES);
+	}
+	else
+	{
+		/* show the last message */
+		dc_lot_fill(ret, lastmsg, chat, lastcontact, context);
+	}
+}
+
 
+static dc_lot_t* load_summary(const dc_chatlist_t* chatlist, size_t index, dc_chat_t* chat /*may be NULL*/)
+{
+	/* load the summary for a single index; used if dc_chatlist_load_summaries() fails */
 	dc_lot_t*      ret = dc_lot_new(); /* the function never returns NULL */
 	uint32_t       lastmsg_id = 0;
 	dc_msg_t*      lastmsg = NULL;
 	dc_contact_t*  lastcontact = NULL;
 	dc_chat_t*     chat_to_delete = NULL;
 
-	if (chatlist==NULL || chatlist->magic!=DC_CHATLIST_MAGIC || index>=chatlist->cnt) {
-		ret->text2 = dc_strdup("ErrBadChatlistIndex");
-		goto cleanup;
-	}
-
 	lastmsg_id = dc_array_get_id(chatlist->chatNlastmsg_ids, index*DC_CHATLIST_IDS_PER_RESULT+1);
 
 	if (chat==NULL) {
@@ -195,26 +193,201 @@ dc_lot_t* dc_chatlist_get_summary(const dc_chatlist_t* chatlist, size_t index, d
 		}
 	}
 
-	if (chat->id==DC_CHAT_ID_ARCHIVED_LINK)
-	{
-		ret->text2 = dc_strdup(NULL);
+	fill_summary(ret, chat, lastmsg, lastcontact, chatlist->context);
+
+cleanup:
+	dc_msg_unref(lastmsg);
+	dc_contact_unref(lastcontact);
+	dc_chat_unref(chat_to_delete);
+	return ret;
+}
+
+
+/**
+ * Load the summaries for a range of chatlist indexes.
+ *
+ * The chats, last messages and senders needed for the summaries
+ * are loaded by a single database query and the summaries are cached in the chatlist object;
+ * subsequent calls to dc_chatlist_get_summary() for these indexes do not access the database.
+ *
+ * dc_chatlist_get_summary() loads the summaries in pages of DC_CHATLIST_SUMMARY_PAGE items itself,
+ * so calling this function is optional; a UI may use it to load exactly the items that are in view.
+ * Summaries already cached are not loaded again.
+ *
+ * @memberof dc_chatlist_t
+ * @param chatlist The chatlist to load the summaries for, as returned eg. from dc_get_chatlist().
+ * @param index The first index to load the summary for.
+ * @param cnt The number of summaries to load.  If the range exceeds the chatlist, it is truncated.
+ * @return 1=success, 0=error.
+ */
+int dc_chatlist_load_summaries(dc_chatlist_t* chatlist, size_t index, size_t cnt)
+{
+	int             success = 0;
+	size_t          i = 0;
+	int             missing_cnt = 0;
+	dc_strbuilder_t values;
+	char*           q3 = NULL;
+	sqlite3_stmt*   stmt = NULL;
+	dc_chat_t*      chat = NULL;
+	dc_msg_t*       lastmsg = NULL;
+	dc_contact_t*   lastcontact = NULL;
+
+	dc_strbuilder_init(&values, 0);
+
+	if (chatlist==NULL || chatlist->magic!=DC_CHATLIST_MAGIC) {
+		goto cleanup;
 	}
-	else if (lastmsg==NULL || lastmsg->from_id==0)
-	{
-		/* no messages */
-		ret->text2 = dc_stock_str(chatlist->context, DC_STR_NOMESSAGES);
+
+	if (chatlist->summaries==NULL && chatlist->cnt > 0) {
+		if ((chatlist->summaries=calloc(chatlist->cnt, sizeof(dc_lot_t*)))==NULL) {
+			exit(60); /* cannot allocate little memory, unrecoverable error */
+		}
+		chatlist->summaries_cnt = chatlist->cnt;
 	}
-	else
+
+	if (index >= chatlist->cnt) {
+		success = 1;
+		goto cleanup;
+	}
+
+	if (cnt > chatlist->cnt-index) {
+		cnt = chatlist->cnt-index;
+	}
+
+	/* map the indexes to their chat and message IDs; the IDs are integers, so they can be written to the query directly */
+	for (i = index; i < index+cnt; i++) {
+		if (chatlist->summaries[i]==NULL) {
+			dc_strbuilder_catf(&values, "%s(%i,%i,%i)", missing_cnt? "," : "", (int)i,
+				(int)dc_array_get_id(chatlist->chatNlastmsg_ids, i*DC_CHATLIST_IDS_PER_RESULT),
+				(int)dc_array_get_id(chatlist->chatNlastmsg_ids, i*DC_CHATLIST_IDS_PER_RESULT+1));
+			missing_cnt++;
+		}
+	}
+
+	if (missing_cnt==0) {
+		success = 1;
+		goto cleanup;
+	}
+
+	// c.blocked from DC_MSG_FIELDS refers to the chat of the chatlist, not to the chat of the message;
+	// this differs only for the deaddrop and affects only the truncation of the message text which is done for the summary anyway.
+	q3 = sqlite3_mprintf("WITH r(idx, chat_id, msg_id) AS (VALUES %s)"
+		" SELECT r.idx, " DC_CHAT_FIELDS ", " DC_MSG_FIELDS ", " DC_CONTACT_FIELDS
+		" FROM r"
+		" LEFT JOIN chats c ON c.id=r.chat_id"
+		" LEFT JOIN msgs m ON m.id=r.msg_id"
+		" LEFT JOIN contacts ct ON ct.id=m.from_id;", values.buf);
+	if ((stmt=dc_sqlite3_prepare_read(chatlist->context->sql, q3))==NULL) {
+		goto cleanup;
+	}
+
+	chat        = dc_chat_new(chatlist->context);
+	lastmsg     = dc_msg_new_untyped(chatlist->context);
+	lastcontact = dc_contact_new(chatlist->context);
+
+	while (sqlite3_step(stmt)==SQLITE_ROW)
 	{
-		/* show the last message */
-		dc_lot_fill(ret, lastmsg, chat, lastcontact, chatlist->context);
+		int       row_offset = 1;
+		int       has_lastmsg = 0;
+		int       has_lastcontact = 0;
+		dc_lot_t* summary = dc_lot_new();
+
+		i = sqlite3_column_int(stmt, 0);
+
+		if (sqlite3_column_type(stmt, row_offset)==SQLITE_NULL) {
+			summary->text2 = dc_strdup("ErrCannotReadChat");
+		}
+		else {
+			row_offset = dc_chat_set_from_stmt(chat, stmt, row_offset);
+
+			if (sqlite3_column_type(stmt, row_offset)!=SQLITE_NULL) {
+				dc_msg_set_from_stmt(lastmsg, stmt, row_offset);
+				lastmsg->context = chatlist->context;
+				has_lastmsg = 1;
+			}
+			row_offset += DC_MSG_FIELDS_CNT;
+
+			if (has_lastmsg && lastmsg->from_id!=DC_CONTACT_ID_SELF && DC_CHAT_TYPE_IS_MULTI(chat->type)) {
+				dc_contact_set_from_stmt(lastcontact, stmt, row_offset); /* if the contact does not exist, it is left empty */
+				has_lastcontact = 1;
+			}
+
+			fill_summary(summary, chat, has_lastmsg? lastmsg : NULL, has_lastcontact? lastcontact : NULL, chatlist->context);
+		}
+
+		dc_lot_unref(chatlist->summaries[i]);
+		chatlist->summaries[i] = summary;
 	}
 
+	success = 1;
+
 cleanup:
+	sqlite3_finalize(stmt);
+	sqlite3_free(q3);
+	free(values.buf);
+	dc_chat_unref(chat);
 	dc_msg_unref(lastmsg);
 	dc_contact_unref(lastcontact);
-	dc_chat_unref(chat_to_delete);
-	return ret;
+	return success;
+}
+
+
+/**
+ * Get a summary for a chatlist index.
+ *
+ * The summary is returned by a dc_lot_t object with the following fields:
+ *
+ * - dc_lot_t::text1: contains the username or the strings "Me", "Draft" and so on.
+ *   The string may be colored by having a look at text1_meaning.
+ *   If there is no such name or it should not be displayed, the element is NULL.
+ *
+ * - dc_lot_t::text1_meaning: one of DC_TEXT1_USERNAME, DC_TEXT1_SELF or DC_TEXT1_DRAFT.
+ *   Typically used to show dc_lot_t::text1 with different colors. 0 if not applicable.
+ *
+ * - dc_lot_t::text2: contains an excerpt of the message text or strings as
+ *   "No messages".  May be NULL of there is no such text (eg. for the archive link)
+ *
+ * - dc_lot_t::timestamp: the timestamp of the message.  0 if not applicable.
+ *
+ * - dc_lot_t::state: The state of the message as one of the DC_STATE_* constants (see #dc_msg_get_state()).  0 if not applicable.
+ *
+ * The summaries are loaded in pages of DC_CHATLIST_SUMMARY_PAGE items and cached
+ * in the chatlist object, see dc_chatlist_load_summaries().
+ *
+ * @memberof dc_chatlist_t
+ * @param chatlist The chatlist to query as returned eg. from dc_get_chatlist().
+ * @param index The index to query in the chatlist.
+ * @param chat Not needed, summaries are loaded together with their chats.
+ *     Only used if the summaries cannot be loaded in pages.  Can be NULL.
+ * @return The summary as an dc_lot_t object. Must be freed using dc_lot_unref().  NULL is never returned.
+ */
+dc_lot_t* dc_chatlist_get_summary(const dc_chatlist_t* chatlist, size_t index, dc_chat_t* chat /*may be NULL*/)
+{
+	dc_lot_t* ret = NULL;
+	dc_lot_t* cached = NULL;
+
+	if (chatlist==NULL || chatlist->magic!=DC_CHATLIST_MAGIC || index>=chatlist->cnt) {
+		ret = dc_lot_new();
+		ret->text2 = dc_strdup("ErrBadChatlistIndex");
+		return ret;
+	}
+
+	if (chatlist->summaries==NULL || chatlist->summaries[index]==NULL) {
+		/* the cache does not change the chatlist as seen by the caller, so casting away const is fine */
+		dc_chatlist_load_summaries((dc_chatlist_t*)chatlist, index - index%DC_CHATLIST_SUMMARY_PAGE, DC_CHATLIST_SUMMARY_PAGE);
+	}
+
+	if (chatlist->summaries && (cached=chatlist->summaries[index])!=NULL) {
+		ret = dc_lot_new();
+		ret->text1_meaning = cached->text1_meaning;
+		ret->text1         = cached->text1? dc_strdup(cached->text1) : NULL;
+		ret->text2         = cached->text2? dc_strdup(cached->text2) : NULL;
+		ret->timestamp     = cached->timestamp;
+		ret->state         = cached->state;
+		return ret;
+	}
+
+	return load_summary(chatlist, index, chat);
 }
 
 
@@ -281,23 +454,14 @@ static int dc_chatlist_load_from_db(dc_chatlist_t* chatlist, int listflags, cons
 
 	dc_chatlist_empty(chatlist);
 
-	// select with left join and minimum:
-	// - the inner select must use `hidden` and _not_ `m.hidden`
-	//   which would refer the outer select and take a lot of time
-	// - `GROUP BY` is needed several messages may have the same timestamp
+	// the last message and its timestamp are copied to the chats table by dc_update_chat_cache(),
+	// so the list can be created without looking at the messages.
 	// - the list starts with the newest chats
-	#define QUR1 "SELECT c.id, m.id FROM chats c " \
-	             " LEFT JOIN msgs m " \
-	             "        ON c.id=m.chat_id " \
-	             "       AND m.timestamp=( " \
-	                         "SELECT MAX(timestamp) " \
-	                         "  FROM msgs " \
-	                         " WHERE chat_id=c.id " \
-	                         "   AND (hidden=0 OR (hidden=1 AND state=" DC_STRINGIFY(DC_STATE_OUT_DRAFT) ")))" \
+	// - the index chats_index3 on (archived, last_timestamp) is used for the normal and for the archived chatlist
+	#define QUR1 "SELECT c.id, c.last_msg_id FROM chats c " \
 	             " WHERE c.id>" DC_STRINGIFY(DC_CHAT_ID_LAST_SPECIAL) \
 	             "   AND c.blocked=0"
-	#define QUR2 " GROUP BY c.id " \
-	             " ORDER BY IFNULL(m.timestamp,0) DESC, m.id DESC;"
+	#define QUR2 " ORDER BY c.last_timestamp DESC, c.last_msg_id DESC;"
 
 	// nb: the query currently shows messages from blocked contacts in groups.
 	// however, for normal-groups, this is okay as the message is also returned by dc_get_chat_msgs()
@@ -308,14 +472,14 @@ static int dc_chatlist_load_from_db(dc_chatlist_t* chatlist, int listflags, cons
 	if (query_contact_id)
 	{
 		// show chats shared with a given contact
-		stmt = dc_sqlite3_prepare(chatlist->context->sql,
+		stmt = dc_sqlite3_prepare_read(chatlist->context->sql,
 			QUR1 " AND c.id IN(SELECT chat_id FROM chats_contacts WHERE contact_id=?) " QUR2);
 		sqlite3_bind_int(stmt, 1, query_contact_id);
 	}
 	else if (listflags & DC_GCL_ARCHIVED_ONLY)
 	{
 		/* show archived chats */
-		stmt = dc_sqlite3_prepare(chatlist->context->sql,
+		stmt = dc_sqlite3_prepare_read(chatlist->context->sql,
 			QUR1 " AND c.archived=1 " QUR2);
 	}
 	else if (query__==NULL)
@@ -330,7 +494,7 @@ static int dc_chatlist_load_from_db(dc_chatlist_t* chatlist, int listflags, cons
 			add_archived_link_item = 1;
 		}
 
-		stmt = dc_sqlite3_prepare(chatlist->context->sql,
+		stmt = dc_sqlite3_prepare_read(chatlist->context->sql,
 			QUR1 " AND c.archived=0 " QUR2);
 	}
 	else
@@ -343,7 +507,7 @@ static int dc_chatlist_load_from_db(dc_chatlist_t* chatlist, int listflags, cons
 			goto cleanup;
 		}
 		strLikeCmd = dc_mprintf("%%%s%%", query);
-		stmt = dc_sqlite3_prepare(chatlist->context->sql,
+		stmt = dc_sqlite3_prepare_read(chatlist->context->sql,
 			QUR1 " AND c.name LIKE ? " QUR2);
 		sqlite3_bind_text(stmt, 1, strLikeCmd, -1, SQLITE_STATIC);
 	}
@@ -14,6 +14,10 @@ struct _dc_chatlist
 	#define         DC_CHATLIST_IDS_PER_RESULT 2
 	size_t          cnt;
 	dc_array_t*     chatNlastmsg_ids;
+
+	#define         DC_CHATLIST_SUMMARY_PAGE 20
+	dc_lot_t**      summaries;      /**< cached summaries, one pointer per index, NULL if not yet loaded, see dc_chatlist_load_summaries() */
+	size_t          summaries_cnt;
 };
 
 
@@ -134,7 +134,7 @@ static void moz_autoconfigure_text_cb(void* userdata, const char* text, int len)
 {
 	moz_autoconfigure_t* moz_ac = (moz_autoconfigure_t*)userdata;
 
-	char* val = dc_strdup(text);
+	char* val = dc_null_terminate(text, len);
 	dc_trim(val);
 	dc_str_replace(&val, "%EMAILADDRESS%",   moz_ac->in->addr);
 	dc_str_replace(&val, "%EMAILLOCALPART%", moz_ac->in_emaillocalpart);
@@ -237,7 +237,7 @@ static dc_loginparam_t* moz_autoconfigure(dc_context_t* context, const char* url
 	dc_saxparser_init            (&saxparser, &moz_ac);
 	dc_saxparser_set_tag_handler (&saxparser, moz_autoconfigure_starttag_cb, moz_autoconfigure_endtag_cb);
 	dc_saxparser_set_text_handler(&saxparser, moz_autoconfigure_text_cb);
-	dc_saxparser_parse           (&saxparser, xml_raw);
+	dc_saxparser_parse           (&saxparser, xml_raw, strlen(xml_raw));
 
 	if (moz_ac.out->mail_server==NULL
 	 || moz_ac.out->mail_port  ==0
@@ -314,7 +314,7 @@ static void outlk_autodiscover_text_cb(void* userdata, const char* text, int len
 {
 	outlk_autodiscover_t* outlk_ad = (outlk_autodiscover_t*)userdata;
 
-	char* val = dc_strdup(text);
+	char* val = dc_null_terminate(text, len);
 	dc_trim(val);
 
 	free(outlk_ad->config[outlk_ad->tag_config]);
@@ -381,7 +381,7 @@ static dc_loginparam_t* outlk_autodiscover(dc_context_t* context, const char* ur
 		dc_saxparser_init            (&saxparser, &outlk_ad);
 		dc_saxparser_set_tag_handler (&saxparser, outlk_autodiscover_starttag_cb, outlk_autodiscover_endtag_cb);
 		dc_saxparser_set_text_handler(&saxparser, outlk_autodiscover_text_cb);
-		dc_saxparser_parse           (&saxparser, xml_raw);
+		dc_saxparser_parse           (&saxparser, xml_raw, strlen(xml_raw));
 
 		if (outlk_ad.config[OUTLK_REDIRECTURL] && outlk_ad.config[OUTLK_REDIRECTURL][0]) {
 			free(url);
@@ -744,6 +744,10 @@ void dc_job_do_DC_JOB_CONFIGURE_IMAP(dc_context_t* context, dc_job_t* job)
 	}
 	param_domain++;
 
+	/* the keypair is needed at the end of the configuration; creating it takes some seconds,
+	so we start now and create it while waiting for the servers */
+	dc_start_keygen(context, param->addr);
+
 	param_addr_urlencoded = dc_urlencode(param->addr);
 
 	/* if no password is given, assume an empty password.
@@ -996,9 +1000,10 @@ void dc_job_do_DC_JOB_CONFIGURE_IMAP(dc_context_t* context, dc_job_t* job)
 
 	PROGRESS(920)
 
-	// we generate the keypair just now - we could also postpone this until the first message is sent, however,
+	// we make sure, the keypair exists just now - we could also postpone this until the first message is sent, however,
 	// this may result in a unexpected and annoying delay when the user sends his very first message
 	// (~30 seconds on a Moto G4 play) and might looks as if message sending is always that slow.
+	// typically, the keypair was already created in the background by dc_start_keygen() above, otherwise we wait for it.
 	dc_ensure_secret_key_exists(context);
 
 	success = 1;
@@ -338,6 +338,40 @@ int dc_contact_is_verified(dc_contact_t* contact)
 }
 
 
+/**
+ * Set the contact object from a row of a statement selecting DC_CONTACT_FIELDS.
+ * Only real contacts can be set this way, DC_CONTACT_ID_SELF must be loaded using dc_contact_load_from_db().
+ *
+ * @private @memberof dc_contact_t
+ * @param contact The contact object to set.  Existing data are free()'d using dc_contact_empty().
+ * @param row The statement, must be positioned on a row.
+ * @param row_offset Index of the first column of DC_CONTACT_FIELDS.
+ * @return The index of the first column after DC_CONTACT_FIELDS.
+ *     0 on errors or if the contact ID is NULL, eg. as the contact was not found by a LEFT JOIN.
+ */
+int dc_contact_set_from_stmt(dc_contact_t* contact, sqlite3_stmt* row, int row_offset)
+{
+	if (contact==NULL || contact->magic!=DC_CONTACT_MAGIC || row==NULL) {
+		return 0;
+	}
+
+	dc_contact_empty(contact);
+
+	if (sqlite3_column_type(row, row_offset)==SQLITE_NULL) {
+		return 0;
+	}
+
+	contact->id               =                  sqlite3_column_int  (row, row_offset++); /* the columns are defined in DC_CONTACT_FIELDS */
+	contact->name             = dc_strdup((char*)sqlite3_column_text (row, row_offset++));
+	contact->addr             = dc_strdup((char*)sqlite3_column_text (row, row_offset++));
+	contact->origin           =                  sqlite3_column_int  (row, row_offset++);
+	contact->blocked          =                  sqlite3_column_int  (row, row_offset++);
+	contact->authname         = dc_strdup((char*)sqlite3_column_text (row, row_offset++));
+
+	return row_offset;
+}
+
+
 /**
  * Load a contact from the database to the contact object.
  *
@@ -362,27 +396,24 @@ int dc_contact_load_from_db(dc_contact_t* contact, dc_sqlite3_t* sql, uint32_t c
 	}
 	else
 	{
-		stmt = dc_sqlite3_prepare(sql,
-			"SELECT c.name, c.addr, c.origin, c.blocked, c.authname "
-			" FROM contacts c "
-			" WHERE c.id=?;");
+		stmt = dc_sqlite3_borrow_stmt(sql,
+			"SELECT " DC_CONTACT_FIELDS
+			" FROM contacts ct "
+			" WHERE ct.id=?;");
 		sqlite3_bind_int(stmt, 1, contact_id);
 		if (sqlite3_step(stmt)!=SQLITE_ROW) {
 			goto cleanup;
 		}
 
-		contact->id               = contact_id;
-		contact->name             = dc_strdup((char*)sqlite3_column_text (stmt, 0));
-		contact->addr             = dc_strdup((char*)sqlite3_column_text (stmt, 1));
-		contact->origin           =                  sqlite3_column_int  (stmt, 2);
-		contact->blocked          =                  sqlite3_column_int  (stmt, 3);
-		contact->authname         = dc_strdup((char*)sqlite3_column_text (stmt, 4));
+		if (!dc_contact_set_from_stmt(contact, stmt, 0)) {
+			goto cleanup;
+		}
 	}
 
 	success = 1;
 
 cleanup:
-	sqlite3_finalize(stmt);
+	dc_sqlite3_return_stmt(sql, stmt);
 	return success;
 }
 
@@ -726,6 +757,8 @@ uint32_t dc_add_or_lookup_contact( dc_context_t* context,
 				sqlite3_bind_int (stmt, 2, DC_CHAT_TYPE_SINGLE);
 				sqlite3_bind_int (stmt, 3, row_id);
 				sqlite3_step     (stmt);
+
+				dc_update_search_index_by_contact(context->sql, row_id);
 			}
 
 			*sth_modified = CONTACT_MODIFIED;
@@ -1051,7 +1084,7 @@ dc_array_t* dc_get_contacts(dc_context_t* context, uint32_t listflags, const cha
 			goto cleanup;
 		}
 		// see comments in dc_search_msgs() about the LIKE operator
-		stmt = dc_sqlite3_prepare(context->sql,
+		stmt = dc_sqlite3_prepare_read(context->sql,
 			"SELECT c.id FROM contacts c"
 				" LEFT JOIN acpeerstates ps ON c.addr=ps.addr "
 				" WHERE c.addr!=?1 AND c.id>?2 AND c.origin>=?3"
@@ -1073,7 +1106,7 @@ dc_array_t* dc_get_contacts(dc_context_t* context, uint32_t listflags, const cha
 	}
 	else
 	{
-		stmt = dc_sqlite3_prepare(context->sql,
+		stmt = dc_sqlite3_prepare_read(context->sql,
 			"SELECT id FROM contacts"
 				" WHERE addr!=?1 AND id>?2 AND origin>=?3 AND blocked=0"
 				" ORDER BY LOWER(name||addr),id;");
@@ -1185,6 +1218,8 @@ void dc_marknoticed_contact(dc_context_t* context, uint32_t contact_id)
 	sqlite3_step(stmt);
 	sqlite3_finalize(stmt);
 
+	dc_update_chat_cache(context->sql, 0); /* the messages of the contact may be in several chats */
+
 	context->cb(context, DC_EVENT_MSGS_CHANGED, 0, 0);
 }
 
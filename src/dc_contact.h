@@ -55,6 +55,9 @@ struct _dc_contact
 #define DC_ORIGIN_MIN_START_NEW_NCHAT (0x7FFFFFFF)                  /* contacts with at least this origin value start a new "normal" chat, defaults to off */
 
 int          dc_contact_load_from_db             (dc_contact_t*, dc_sqlite3_t*, uint32_t contact_id);
+
+#define      DC_CONTACT_FIELDS                   " ct.id, ct.name, ct.addr, ct.origin, ct.blocked, ct.authname "
+int          dc_contact_set_from_stmt            (dc_contact_t*, sqlite3_stmt* row, int row_offset); /* field order must be DC_CONTACT_FIELDS */
 int          dc_contact_is_verified_ex           (dc_contact_t*, const dc_apeerstate_t*);
 
 
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <openssl/opensslv.h>
 #include <assert.h>
+#include <ctype.h>
 #include "dc_context.h"
 #include "dc_imap.h"
 #include "dc_smtp.h"
@@ -37,6 +38,11 @@ static const char* config_keys[] = {
 	,"mvbox_watch"
 	,"mvbox_move"
 	,"save_mime_headers"
+	,"fetch_batch_cnt"
+	,"fetch_batch_bytes"
+	,"imap_compress"
+	,"spare_keypair"
+	,"gossip_interval"
 	,"configured_addr"
 	,"configured_mail_server"
 	,"configured_mail_user"
@@ -73,7 +79,7 @@ static uintptr_t cb_dummy(dc_context_t* context, int event, uintptr_t data1, uin
 
 
 /**
- * The following three callback are given to dc_imap_new() to read/write configuration
+ * The following callbacks are given to dc_imap_new() to read/write configuration
  * and to handle received messages. As the imap-functions are typically used in
  * a separate user-thread, also these functions may be called from a different thread.
  *
@@ -148,6 +154,23 @@ static void cb_receive_imf(dc_imap_t* imap, const char* imf_raw_not_terminated,
 }
 
 
+static void cb_receive_flags(dc_imap_t* imap, const char* server_folder, uint32_t server_uid, uint32_t flags)
+{
+	dc_context_t* context = (dc_context_t*)imap->userData;
+	if ((flags&DC_IMAP_SEEN)
+	 && dc_markseen_msgs_by_server_uid(context, server_folder, server_uid)) {
+		context->cb(context, DC_EVENT_MSGS_CHANGED, 0, 0);
+	}
+}
+
+
+static void cb_receive_vanished(dc_imap_t* imap, const char* server_folder, uint32_t first_uid, uint32_t last_uid)
+{
+	dc_context_t* context = (dc_context_t*)imap->userData;
+	dc_forget_server_uids(context, server_folder, first_uid, last_uid);
+}
+
+
 /**
  * Create a new context object.  After creation it is usually
  * opened, connected and mails are fetched.
@@ -187,6 +210,14 @@ dc_context_t* dc_context_new(dc_callback_t cb, void* userdata, const char* os_na
 	dc_jobthread_init(&context->mvbox_thread, context, "MVBOX", "configured_mvbox_folder");
 	pthread_mutex_init(&context->smtpidle_condmutex, NULL);
 	pthread_cond_init(&context->smtpidle_cond, NULL);
+	pthread_mutex_init(&context->key_cache_mutex, NULL);
+	dc_hash_init(&context->key_cache, DC_HASH_BINARY, 0/*the keys are owned by the cache entries*/);
+	pthread_mutex_init(&context->key_render_cache_mutex, NULL);
+	dc_hash_init(&context->key_render_cache, DC_HASH_BINARY, DC_HASH_COPY_KEY);
+	pthread_mutex_init(&context->decrypt_cache_mutex, NULL);
+	pthread_mutex_init(&context->keygen_mutex, NULL);
+	pthread_cond_init(&context->keygen_cond, NULL);
+	pthread_mutex_init(&context->keygen_thread_mutex, NULL);
 
 	context->magic    = DC_CONTEXT_MAGIC;
 	context->userdata = userdata;
@@ -198,9 +229,9 @@ dc_context_t* dc_context_new(dc_callback_t cb, void* userdata, const char* os_na
 
 	dc_pgp_init();
 	context->sql      = dc_sqlite3_new(context);
-	context->inbox    = dc_imap_new(cb_get_config, cb_set_config, cb_precheck_imf, cb_receive_imf, (void*)context, context);
-	context->sentbox_thread.imap = dc_imap_new(cb_get_config, cb_set_config, cb_precheck_imf, cb_receive_imf, (void*)context, context);
-	context->mvbox_thread.imap = dc_imap_new(cb_get_config, cb_set_config, cb_precheck_imf, cb_receive_imf, (void*)context, context);
+	context->inbox    = dc_imap_new(cb_get_config, cb_set_config, cb_precheck_imf, cb_receive_imf, cb_receive_flags, cb_receive_vanished, (void*)context, context);
+	context->sentbox_thread.imap = dc_imap_new(cb_get_config, cb_set_config, cb_precheck_imf, cb_receive_imf, cb_receive_flags, cb_receive_vanished, (void*)context, context);
+	context->mvbox_thread.imap = dc_imap_new(cb_get_config, cb_set_config, cb_precheck_imf, cb_receive_imf, cb_receive_flags, cb_receive_vanished, (void*)context, context);
 	context->smtp     = dc_smtp_new(context);
 
 	/* Random-seed.  An additional seed with more random data is done just before key generation
@@ -258,6 +289,14 @@ void dc_context_unref(dc_context_t* context)
 	dc_jobthread_exit(&context->mvbox_thread);
 	pthread_cond_destroy(&context->smtpidle_cond);
 	pthread_mutex_destroy(&context->smtpidle_condmutex);
+	dc_pgp_clear_key_cache(context);
+	pthread_mutex_destroy(&context->key_cache_mutex);
+	dc_apeerstate_clear_render_cache(context);
+	pthread_mutex_destroy(&context->key_render_cache_mutex);
+	pthread_mutex_destroy(&context->decrypt_cache_mutex);
+	pthread_cond_destroy(&context->keygen_cond);
+	pthread_mutex_destroy(&context->keygen_mutex);
+	pthread_mutex_destroy(&context->keygen_thread_mutex);
 
 	free(context->os_name);
 	context->magic = 0;
@@ -326,6 +365,14 @@ int dc_open(dc_context_t* context, const char* dbfile, const char* blobdir)
 		goto cleanup;
 	}
 
+	/* for configured accounts, this does nothing in most cases; however, if the keypair was deleted or
+	if a spare keypair is wanted, the keypair is created now and not when the first message is sent */
+	if (dc_sqlite3_get_config_int(context->sql, "configured", 0)) {
+		char* addr = dc_sqlite3_get_config(context->sql, "configured_addr", NULL);
+		dc_start_keygen(context, addr);
+		free(addr);
+	}
+
 	success = 1;
 
 cleanup:
@@ -360,10 +407,15 @@ void dc_close(dc_context_t* context)
 	dc_imap_disconnect(context->mvbox_thread.imap);
 	dc_smtp_disconnect(context->smtp);
 
+	dc_stop_keygen(context);
+
 	if (dc_sqlite3_is_open(context->sql)) {
 		dc_sqlite3_close(context->sql);
 	}
 
+	dc_pgp_clear_key_cache(context); /* do not keep secret keys of a closed account in memory */
+	dc_apeerstate_clear_render_cache(context);
+
 	free(context->dbfile);
 	context->dbfile = NULL;
 
@@ -507,6 +559,18 @@ static char* get_sys_config_str(const char* key)
  *                    0=do not move chat-messages
  * - `save_mime_headers` = 1=save mime headers and make dc_get_mime_headers() work for subsequent calls,
  *                    0=do not save mime headers (default)
+ * - `fetch_batch_cnt` = maximal number of messages whose bodies are downloaded with a single IMAP command,
+ *                    defaults to 50, 1=download messages one by one
+ * - `fetch_batch_bytes` = maximal number of bytes downloaded with a single IMAP command,
+ *                    defaults to 5 MB, larger messages are downloaded alone
+ * - `imap_compress` = 1=use IMAP COMPRESS=DEFLATE if supported by the server (default),
+ *                    0=do not compress; takes effect on the next connect
+ * - `spare_keypair` = 1=keep a spare keypair for the configured address in the database,
+ *                    so that setting up the account again does not need to wait for key generation,
+ *                    0=no spare keypair (default)
+ * - `gossip_interval` = seconds after which the keys of all members are gossiped again to a group,
+ *                    defaults to 2 days; in between, only new or changed keys are gossiped,
+ *                    0=always gossip all keys
  *
  * If you want to retrieve a value, use dc_get_config().
  *
@@ -548,6 +612,15 @@ int dc_set_config(dc_context_t* context, const char* key, const char* value)
 		ret = dc_sqlite3_set_config(context->sql, key, value);
 		dc_interrupt_mvbox_idle(context); // force idle() to be called again with the new mode
 	}
+	else if(strcmp(key, "spare_keypair")==0)
+	{
+		ret = dc_sqlite3_set_config(context->sql, key, value);
+		if (dc_sqlite3_get_config_int(context->sql, "configured", 0)) {
+			char* addr = dc_sqlite3_get_config(context->sql, "configured_addr", NULL);
+			dc_start_keygen(context, addr); // create the spare keypair in the background
+			free(addr);
+		}
+	}
 	else if (strcmp(key, "selfstatus")==0) {
 		// if the status text equals to the default,
 		// store it as NULL to support future updatates of this text
@@ -635,6 +708,21 @@ char* dc_get_config(dc_context_t* context, const char* key)
 		else if (strcmp(key, "mvbox_move")==0) {
 			value = dc_mprintf("%i", DC_MVBOX_MOVE_DEFAULT);
 		}
+		else if (strcmp(key, "fetch_batch_cnt")==0) {
+			value = dc_mprintf("%i", DC_FETCH_BATCH_CNT_DEFAULT);
+		}
+		else if (strcmp(key, "fetch_batch_bytes")==0) {
+			value = dc_mprintf("%i", DC_FETCH_BATCH_BYTES_DEFAULT);
+		}
+		else if (strcmp(key, "imap_compress")==0) {
+			value = dc_mprintf("%i", DC_IMAP_COMPRESS_DEFAULT);
+		}
+		else if (strcmp(key, "spare_keypair")==0) {
+			value = dc_mprintf("%i", DC_SPARE_KEYPAIR_DEFAULT);
+		}
+		else if (strcmp(key, "gossip_interval")==0) {
+			value = dc_mprintf("%i", DC_GOSSIP_INTERVAL_DEFAULT);
+		}
 		else if (strcmp(key, "selfstatus")==0) {
 			value = dc_stock_str(context, DC_STR_STATUSLINE);
 		}
@@ -731,6 +819,13 @@ char* dc_get_info(dc_context_t* context)
 	int              folders_configured = 0;
 	char*            configured_sentbox_folder = NULL;
 	char*            configured_mvbox_folder = NULL;
+	char*            inbox_traffic = NULL;
+	char*            mvbox_traffic = NULL;
+	char*            sentbox_traffic = NULL;
+	char*            stmt_cache = NULL;
+	char*            key_cache = NULL;
+	char*            peerstate_cache = NULL;
+	char*            decrypt_cache = NULL;
 	int              contacts = 0;
 	int              chats = 0;
 	int              real_msgs = 0;
@@ -797,6 +892,14 @@ char* dc_get_info(dc_context_t* context)
 	configured_sentbox_folder = dc_sqlite3_get_config(context->sql, "configured_sentbox_folder", "<unset>");
 	configured_mvbox_folder = dc_sqlite3_get_config(context->sql, "configured_mvbox_folder", "<unset>");
 
+	inbox_traffic = dc_imap_get_traffic_str(context->inbox);
+	mvbox_traffic = dc_imap_get_traffic_str(context->mvbox_thread.imap);
+	sentbox_traffic = dc_imap_get_traffic_str(context->sentbox_thread.imap);
+	stmt_cache = dc_sqlite3_get_stmt_cache_str(context->sql);
+	key_cache = dc_pgp_get_key_cache_str(context);
+	peerstate_cache = dc_apeerstate_get_cache_str(context->sql);
+	decrypt_cache = dc_e2ee_get_decrypt_cache_str(context);
+
 	temp = dc_mprintf(
 		"deltachat_core_version=v%s\n"
 		"sqlite_version=%s\n"
@@ -811,6 +914,7 @@ char* dc_get_info(dc_context_t* context)
 		"number_of_contacts=%i\n"
 		"database_dir=%s\n"
 		"database_version=%i\n"
+		"database_stmt_cache=%s\n"
 		"blobdir=%s\n"
 		"display_name=%s\n"
 		"is_configured=%i\n"
@@ -823,11 +927,17 @@ char* dc_get_info(dc_context_t* context)
 		"folders_configured=%i\n"
 		"configured_sentbox_folder=%s\n"
 		"configured_mvbox_folder=%s\n"
+		"inbox_traffic=%s\n"
+		"mvbox_traffic=%s\n"
+		"sentbox_traffic=%s\n"
 		"mdns_enabled=%i\n"
 		"e2ee_enabled=%i\n"
 		"private_key_count=%i\n"
 		"public_key_count=%i\n"
 		"fingerprint=%s\n"
+		"key_cache=%s\n"
+		"peerstate_cache=%s\n"
+		"decrypt_cache=%s\n"
 
 		, DC_VERSION_STR
 		, SQLITE_VERSION
@@ -841,6 +951,7 @@ char* dc_get_info(dc_context_t* context)
 		, contacts
 		, context->dbfile? context->dbfile : unset
 		, dbversion
+		, stmt_cache
 		, context->blobdir? context->blobdir : unset
 		, displayname? displayname : unset
 		, is_configured
@@ -853,11 +964,17 @@ char* dc_get_info(dc_context_t* context)
 		, folders_configured
 		, configured_sentbox_folder
 		, configured_mvbox_folder
+		, inbox_traffic
+		, mvbox_traffic
+		, sentbox_traffic
 		, mdns_enabled
 		, e2ee_enabled
 		, prv_key_cnt
 		, pub_key_cnt
 		, fingerprint_str
+		, key_cache
+		, peerstate_cache
+		, decrypt_cache
 		);
 	dc_strbuilder_cat(&ret, temp);
 	free(temp);
@@ -870,6 +987,13 @@ char* dc_get_info(dc_context_t* context)
 	free(l2_readable_str);
 	free(configured_sentbox_folder);
 	free(configured_mvbox_folder);
+	free(inbox_traffic);
+	free(mvbox_traffic);
+	free(sentbox_traffic);
+	free(stmt_cache);
+	free(key_cache);
+	free(peerstate_cache);
+	free(decrypt_cache);
 	free(fingerprint_str);
 	dc_key_unref(self_public);
 	return ret.buf; /* must be freed by the caller */
@@ -925,11 +1049,51 @@ cleanup:
 }
 
 
+static char* get_fts_query(const char* query)
+{
+	/* each word is searched as a prefix, so that the search can be done while typing;
+	the words are quoted as strings, characters with a special meaning for FTS5 are just searched then */
+	dc_strbuilder_t ret;
+	const char*     p = query;
+	const char*     word_start = NULL;
+	char*           word = NULL;
+
+	dc_strbuilder_init(&ret, 0);
+
+	while (*p)
+	{
+		while (isspace((unsigned char)*p)) {
+			p++;
+		}
+
+		if (*p)
+		{
+			word_start = p;
+			while (*p && !isspace((unsigned char)*p)) {
+				p++;
+			}
+
+			word = dc_null_terminate(word_start, p-word_start);
+			dc_str_replace(&word, "\"", "\"\"");
+			dc_strbuilder_catf(&ret, "%s\"%s\"*", ret.buf[0]? " " : "", word);
+			free(word);
+		}
+	}
+
+	return ret.buf;
+}
+
+
 /**
  * Search messages containing the given query string.
  * Searching can be done globally (chat_id=0) or in a specified chat only (chat_id
  * set).
  *
+ * If the full-text index is available, each word of the query must match the
+ * beginning of a word in the message text or in the sender name;
+ * otherwise, the query must be contained in the text or the sender name must
+ * start with the query.
+ *
  * Global chat results are typically displayed using dc_msg_get_summary(), chat
  * search results may just hilite the corresponding messages and present a
  * prev/next button.
@@ -940,6 +1104,8 @@ cleanup:
  *     Set this to 0 for a global search.
  * @param query The query to search for.
  * @return An array of message IDs. Must be freed using dc_array_unref() when no longer needed.
+ *     Chat results are sorted by date, oldest first;
+ *     global results are sorted by relevance if the full-text index is available, otherwise by date, newest first.
  *     If nothing can be found, the function returns NULL.
  */
 dc_array_t* dc_search_msgs(dc_context_t* context, uint32_t chat_id, const char* query)
@@ -950,8 +1116,10 @@ dc_array_t* dc_search_msgs(dc_context_t* context, uint32_t chat_id, const char*
 	dc_array_t*   ret = dc_array_new(context, 100);
 	char*         strLikeInText = NULL;
 	char*         strLikeBeg = NULL;
+	char*         strFts = NULL;
 	char*         real_query = NULL;
 	sqlite3_stmt* stmt = NULL;
+	int           show_deaddrop = 0;//dc_sqlite3_get_config_int(context->sql, "show_deaddrop", 0);
 
 	if (context==NULL || context->magic!=DC_CONTEXT_MAGIC || ret==NULL || query==NULL) {
 		goto cleanup;
@@ -964,17 +1132,64 @@ dc_array_t* dc_search_msgs(dc_context_t* context, uint32_t chat_id, const char*
 		goto cleanup;
 	}
 
+	/* Use the full-text index msgs_fts, if available, see open_search_index() in dc_sqlite3.c.
+	The index is built in the background when it is created; until it is complete, we search using LIKE below. */
+	if (context->sql->search_index_ready)
+	{
+		strFts = get_fts_query(real_query);
+
+		if (chat_id) {
+			stmt = dc_sqlite3_prepare_read(context->sql,
+				"SELECT m.id FROM msgs_fts"
+				" INNER JOIN msgs m ON m.id=msgs_fts.rowid"
+				" LEFT JOIN contacts ct ON m.from_id=ct.id"
+				" WHERE msgs_fts MATCH ? AND m.chat_id=?"
+					" AND m.hidden=0 "
+					" AND ct.blocked=0"
+				" ORDER BY m.timestamp,m.id;");
+			sqlite3_bind_text(stmt, 1, strFts, -1, SQLITE_STATIC);
+			sqlite3_bind_int (stmt, 2, chat_id);
+		}
+		else {
+			stmt = dc_sqlite3_prepare_read(context->sql,
+				"SELECT m.id FROM msgs_fts"
+				" INNER JOIN msgs m ON m.id=msgs_fts.rowid"
+				" LEFT JOIN contacts ct ON m.from_id=ct.id"
+				" LEFT JOIN chats c ON m.chat_id=c.id"
+				" WHERE msgs_fts MATCH ? AND m.chat_id>" DC_STRINGIFY(DC_CHAT_ID_LAST_SPECIAL)
+					" AND m.hidden=0 "
+					" AND (c.blocked=0 OR c.blocked=?)"
+					" AND ct.blocked=0"
+				" ORDER BY msgs_fts.rank, m.timestamp DESC,m.id DESC;");
+			sqlite3_bind_text(stmt, 1, strFts, -1, SQLITE_STATIC);
+			sqlite3_bind_int (stmt, 2, show_deaddrop? DC_CHAT_DEADDROP_BLOCKED : 0);
+		}
+
+		int sql_state = 0;
+		while ((sql_state=sqlite3_step(stmt))==SQLITE_ROW) {
+			dc_array_add_id(ret, sqlite3_column_int(stmt, 0));
+		}
+
+		if (sql_state==SQLITE_DONE) {
+			success = 1;
+			goto cleanup;
+		}
+
+		/* the query cannot be used for FTS5, search using LIKE */
+		dc_log_info(context, 0, "Full-text search for \"%s\" failed, searching without index.", real_query);
+		dc_array_empty(ret);
+		sqlite3_finalize(stmt);
+		stmt = NULL;
+	}
+
 	strLikeInText = dc_mprintf("%%%s%%", real_query);
 	strLikeBeg = dc_mprintf("%s%%", real_query); /*for the name search, we use "Name%" which is fast as it can use the index ("%Name%" could not). */
 
 	/* Incremental search with "LIKE %query%" cannot take advantages from any index
 	("query%" could for COLLATE NOCASE indexes, see http://www.sqlite.org/optoverview.html#like_opt)
-	An alternative may be the FULLTEXT sqlite stuff, however, this does not really help with incremental search.
-	An extra table with all words and a COLLATE NOCASE indexes may help, however,
-	this must be updated all the time and probably consumes more time than we can save in tenthousands of searches.
-	For now, we just expect the following query to be fast enough :-) */
+	We use this only if the full-text index is not available. */
 	if (chat_id) {
-		stmt = dc_sqlite3_prepare(context->sql,
+		stmt = dc_sqlite3_prepare_read(context->sql,
 			"SELECT m.id, m.timestamp FROM msgs m"
 			" LEFT JOIN contacts ct ON m.from_id=ct.id"
 			" WHERE m.chat_id=? "
@@ -986,8 +1201,7 @@ dc_array_t* dc_search_msgs(dc_context_t* context, uint32_t chat_id, const char*
 		sqlite3_bind_text(stmt, 3, strLikeBeg, -1, SQLITE_STATIC);
 	}
 	else {
-		int show_deaddrop = 0;//dc_sqlite3_get_config_int(context->sql, "show_deaddrop", 0);
-		stmt = dc_sqlite3_prepare(context->sql,
+		stmt = dc_sqlite3_prepare_read(context->sql,
 			"SELECT m.id, m.timestamp FROM msgs m"
 			" LEFT JOIN contacts ct ON m.from_id=ct.id"
 			" LEFT JOIN chats c ON m.chat_id=c.id"
@@ -1010,6 +1224,7 @@ dc_array_t* dc_search_msgs(dc_context_t* context, uint32_t chat_id, const char*
 cleanup:
 	free(strLikeInText);
 	free(strLikeBeg);
+	free(strFts);
 	free(real_query);
 	sqlite3_finalize(stmt);
 
@@ -87,6 +87,35 @@ struct _dc_context
 	// handling ongoing processes initiated by the user
 	int              ongoing_running;
 	int              shall_stop_ongoing;
+
+	// parsed keys used by dc_pgp_pk_encrypt() and dc_pgp_pk_decrypt()
+	pthread_mutex_t  key_cache_mutex;       /**< protects the following key_cache_* members */
+	dc_hash_t        key_cache;             /**< maps raw keys to parsed keys, see dc_pgp.c */
+	uint32_t         key_cache_clock;
+	int              key_cache_hits;
+	int              key_cache_misses;
+
+	// keys rendered for Autocrypt-Gossip headers, see dc_apeerstate_render_gossip_header()
+	pthread_mutex_t  key_render_cache_mutex; /**< protects the following key_render_cache_* members */
+	dc_hash_t        key_render_cache;      /**< maps raw public keys to the base64 rendered keys, see dc_apeerstate.c */
+	uint32_t         key_render_cache_clock;
+
+	// counters of the table decrypt_cache, see dc_e2ee.c
+	pthread_mutex_t  decrypt_cache_mutex;   /**< protects the following decrypt_cache_* members */
+	int              decrypt_cache_hits;
+	int              decrypt_cache_misses;
+
+	// generating the own keypair, see dc_start_keygen()
+	pthread_mutex_t  keygen_mutex;          /**< protects the following keygen_* members */
+	pthread_cond_t   keygen_cond;           /**< signalled when keygen_running is reset */
+	int              keygen_running;        /**< set while a keypair is generated or a spare keypair is taken */
+	#define          DC_KEYGEN_THREAD_NONE     0
+	#define          DC_KEYGEN_THREAD_RUNNING  1
+	#define          DC_KEYGEN_THREAD_DONE     2
+	int              keygen_thread_state;   /**< set to DC_KEYGEN_THREAD_DONE by the thread, all other changes also need keygen_thread_mutex */
+	pthread_mutex_t  keygen_thread_mutex;   /**< serializes dc_start_keygen() and dc_stop_keygen(), protects the following keygen_* members */
+	pthread_t        keygen_thread;
+	char*            keygen_addr;           /**< address the background thread generates the keypair for */
 };
 
 void            dc_log_event         (dc_context_t*, int event_code, int data1, const char* msg, ...);
@@ -133,6 +162,11 @@ int             dc_is_mvbox          (dc_context_t*, const char* folder);
 #define DC_SENTBOX_WATCH_DEFAULT  1
 #define DC_MVBOX_WATCH_DEFAULT    1
 #define DC_MVBOX_MOVE_DEFAULT     1
+#define DC_FETCH_BATCH_CNT_DEFAULT   50
+#define DC_FETCH_BATCH_BYTES_DEFAULT (5*1024*1024)
+#define DC_IMAP_COMPRESS_DEFAULT  1
+#define DC_SPARE_KEYPAIR_DEFAULT  0
+#define DC_GOSSIP_INTERVAL_DEFAULT (2*24*60*60)
 
 
 typedef struct _dc_e2ee_helper dc_e2ee_helper_t;
@@ -143,18 +177,30 @@ struct _dc_e2ee_helper {
 	// encryption
 	int        encryption_successfull;
 	void*      cdata_to_free;
+	dc_hash_t* gossiped_keys; // maps addresses to the fingerprints of the gossiped keys, see dc_e2ee_save_gossiped_keys()
+	int        gossiped_all;  // 1=the keys of all recipients were gossiped
 
 	// decryption
 	int        encrypted;  // encrypted without problems
 	dc_hash_t* signatures; // fingerprints of valid signatures
 	dc_hash_t* gossipped_addr;
+	void*      plain_to_free; // decrypted buffers and file mappings referenced by "mailmime"
+	const char* rfc724_mid;   // Message-ID of the decrypted message, points into "mailmime", the results of decryption are cached for this message
 
 };
 
-void            dc_e2ee_encrypt      (dc_context_t*, const clist* recipients_addr, int force_plaintext, int e2ee_guaranteed, int min_verified, struct mailmime* in_out_message, dc_e2ee_helper_t*);
+void            dc_e2ee_encrypt      (dc_context_t*, uint32_t chat_id, const clist* recipients_addr, int force_plaintext, int e2ee_guaranteed, int min_verified, struct mailmime* in_out_message, dc_e2ee_helper_t*);
 void            dc_e2ee_decrypt      (dc_context_t*, struct mailmime* in_out_message, dc_e2ee_helper_t*); /* returns 1 if sth. was decrypted, 0 in other cases */
 void            dc_e2ee_thanks       (dc_e2ee_helper_t*); /* frees data referenced by "mailmime" but not freed by mailmime_free(). After calling this function, in_out_message cannot be used any longer! */
+void            dc_e2ee_save_gossiped_keys (dc_context_t*, uint32_t chat_id, const dc_hash_t* gossiped_keys, int gossiped_all);
+void            dc_e2ee_reset_gossiped_keys (dc_context_t*, uint32_t chat_id);
+void            dc_e2ee_free_gossiped_keys (dc_hash_t*);
+#define         DC_DECRYPT_CACHE_MAX_BYTES (256*1024)
+#define         DC_DECRYPT_CACHE_DAYS 30
+char*           dc_e2ee_get_decrypt_cache_str (dc_context_t*);
 int             dc_ensure_secret_key_exists (dc_context_t*); /* makes sure, the private key exists, needed only for exporting keys and the case no message was sent before */
+void            dc_start_keygen      (dc_context_t*, const char* addr);
+void            dc_stop_keygen       (dc_context_t*);
 char*           dc_create_setup_code (dc_context_t*);
 char*           dc_normalize_setup_code(dc_context_t*, const char* passphrase);
 char*           dc_render_setup_file (dc_context_t*, const char* passphrase);
@@ -1,38 +1,96 @@
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "dc_context.h"
 #include "dc_dehtml.h"
 #include "dc_saxparser.h"
 #include "dc_tools.h"
-#include "dc_strbuilder.h"
 
 
 typedef struct dehtml_t
 {
-    dc_strbuilder_t strbuilder;
+    char*           buf; /* the text is not longer than the HTML, so the buffer is allocated only once */
+    size_t          bytes;
+    size_t          allocated;
+    int             last_is_lineend; /* the last character added that is not `\r` is `\n` or nothing is added yet */
 
     #define         DO_NOT_ADD               0
     #define         DO_ADD_REMOVE_LINEENDS   1
     #define         DO_ADD_PRESERVE_LINEENDS 2
     int             add_text;
 
-    char*           last_href;
+    char*           last_href; /* reused for all links */
+    size_t          last_href_allocated;
+    int             has_last_href;
 
 } dehtml_t;
 
 
+static void dehtml_add(dehtml_t* dehtml, const char* text, size_t text_bytes, int remove_lineends)
+{
+	char*  p = NULL;
+	char*  end = NULL;
+	char*  lineend = NULL;
+	size_t bytes = 0;
+
+	if (dehtml->bytes + text_bytes >= dehtml->allocated) {
+		dehtml->allocated = DC_MAX(dehtml->bytes + text_bytes + 1, dehtml->allocated*2);
+		if ((dehtml->buf=realloc(dehtml->buf, dehtml->allocated))==NULL) {
+			exit(76);
+		}
+	}
+
+	p = dehtml->buf + dehtml->bytes;
+	memcpy(p, text, text_bytes);
+	dehtml->bytes += text_bytes;
+	end = p + text_bytes;
+
+	while (p < end)
+	{
+		lineend = remove_lineends? memchr(p, '\n', end-p) : NULL;
+
+		bytes = (lineend? lineend : end) - p;
+		while (bytes > 0 && p[bytes-1]=='\r') {
+			bytes--;
+		}
+		if (bytes > 0) {
+			dehtml->last_is_lineend = (p[bytes-1]=='\n');
+		}
+
+		if (lineend==NULL) {
+			break;
+		}
+
+		/* avoid converting `text1<br>\ntext2` to `text1\n text2` (`\r` is removed later) */
+		if (dehtml->last_is_lineend) {
+			*lineend = '\r';
+		}
+		else {
+			*lineend = ' ';
+		}
+		p = lineend + 1;
+	}
+}
+
+
+static void dehtml_add_str(dehtml_t* dehtml, const char* str)
+{
+	dehtml_add(dehtml, str, strlen(str), 0);
+}
+
+
 static void dehtml_starttag_cb(void* userdata, const char* tag, char** attr)
 {
 	dehtml_t* dehtml = (dehtml_t*)userdata;
 
 	if (strcmp(tag, "p")==0 || strcmp(tag, "div")==0 || strcmp(tag, "table")==0 || strcmp(tag, "td")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "\n\n");
+		dehtml_add_str(dehtml, "\n\n");
 		dehtml->add_text = DO_ADD_REMOVE_LINEENDS;
 	}
 	else if (strcmp(tag, "br")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "\n");
+		dehtml_add_str(dehtml, "\n");
 		dehtml->add_text = DO_ADD_REMOVE_LINEENDS;
 	}
 	else if (strcmp(tag, "style")==0 || strcmp(tag, "script")==0 || strcmp(tag, "title")==0)
@@ -41,24 +99,33 @@ static void dehtml_starttag_cb(void* userdata, const char* tag, char** attr)
 	}
 	else if (strcmp(tag, "pre")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "\n\n");
+		dehtml_add_str(dehtml, "\n\n");
 		dehtml->add_text = DO_ADD_PRESERVE_LINEENDS;
 	}
 	else if (strcmp(tag, "a")==0)
 	{
-		free(dehtml->last_href);
-		dehtml->last_href = dc_strdup_keep_null(dc_attr_find(attr, "href"));
-		if (dehtml->last_href) {
-			dc_strbuilder_cat(&dehtml->strbuilder, "[");
+		const char* href = dc_attr_find(attr, "href");
+		dehtml->has_last_href = 0;
+		if (href) {
+			size_t href_bytes = strlen(href);
+			if (href_bytes >= dehtml->last_href_allocated) {
+				dehtml->last_href_allocated = href_bytes + 1;
+				if ((dehtml->last_href=realloc(dehtml->last_href, dehtml->last_href_allocated))==NULL) {
+					exit(77);
+				}
+			}
+			memcpy(dehtml->last_href, href, href_bytes + 1);
+			dehtml->has_last_href = 1;
+			dehtml_add_str(dehtml, "[");
 		}
 	}
 	else if (strcmp(tag, "b")==0 || strcmp(tag, "strong")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "*");
+		dehtml_add_str(dehtml, "*");
 	}
 	else if (strcmp(tag, "i")==0 || strcmp(tag, "em")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "_");
+		dehtml_add_str(dehtml, "_");
 	}
 }
 
@@ -69,32 +136,7 @@ static void dehtml_text_cb(void* userdata, const char* text, int len)
 
 	if (dehtml->add_text != DO_NOT_ADD)
 	{
-		char* last_added = dc_strbuilder_cat(&dehtml->strbuilder, text);
-
-		if (dehtml->add_text==DO_ADD_REMOVE_LINEENDS)
-		{
-			unsigned char* p = (unsigned char*)last_added;
-			while (*p) {
-				if (*p=='\n') {
-					int last_is_lineend = 1; /* avoid converting `text1<br>\ntext2` to `text1\n text2` (`\r` is removed later) */
-					const unsigned char* p2 = p-1;
-					while (p2>=(const unsigned char*)dehtml->strbuilder.buf) {
-						if (*p2=='\r') {
-						}
-						else if (*p2=='\n') {
-							break;
-						}
-						else {
-							last_is_lineend = 0;
-							break;
-						}
-						p2--;
-					}
-					*p = last_is_lineend? '\r' : ' ';
-				}
-				p++;
-			}
-		}
+		dehtml_add(dehtml, text, len, dehtml->add_text==DO_ADD_REMOVE_LINEENDS);
 	}
 }
 
@@ -107,34 +149,42 @@ static void dehtml_endtag_cb(void* userdata, const char* tag)
 	 || strcmp(tag, "style")==0 || strcmp(tag, "script")==0 || strcmp(tag, "title")==0
 	 || strcmp(tag, "pre")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "\n\n"); /* do not expect an starting block element (which, of course, should come right now) */
+		dehtml_add_str(dehtml, "\n\n"); /* do not expect an starting block element (which, of course, should come right now) */
 		dehtml->add_text = DO_ADD_REMOVE_LINEENDS;
 	}
 	else if (strcmp(tag, "a")==0)
 	{
-		if (dehtml->last_href) {
-			dc_strbuilder_cat(&dehtml->strbuilder, "](");
-			dc_strbuilder_cat(&dehtml->strbuilder, dehtml->last_href);
-			dc_strbuilder_cat(&dehtml->strbuilder, ")");
-			free(dehtml->last_href);
-			dehtml->last_href = NULL;
+		if (dehtml->has_last_href) {
+			dehtml_add_str(dehtml, "](");
+			dehtml_add_str(dehtml, dehtml->last_href);
+			dehtml_add_str(dehtml, ")");
+			dehtml->has_last_href = 0;
 		}
 	}
 	else if (strcmp(tag, "b")==0 || strcmp(tag, "strong")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "*");
+		dehtml_add_str(dehtml, "*");
 	}
 	else if (strcmp(tag, "i")==0 || strcmp(tag, "em")==0)
 	{
-		dc_strbuilder_cat(&dehtml->strbuilder, "_");
+		dehtml_add_str(dehtml, "_");
 	}
 }
 
 
-char* dc_dehtml(char* buf_terminated)
+char* dc_dehtml(const char* buf, size_t buf_bytes)
 {
-	dc_trim(buf_terminated);
-	if (buf_terminated[0]==0) {
+	/* skip leading and trailing whitespace */
+	while (buf_bytes > 0 && isspace((unsigned char)buf[0])) {
+		buf++;
+		buf_bytes--;
+	}
+
+	while (buf_bytes > 0 && isspace((unsigned char)buf[buf_bytes-1])) {
+		buf_bytes--;
+	}
+
+	if (buf_bytes==0) {
 		return dc_strdup(""); /* support at least empty HTML-messages; for empty messages, we'll replace the message by the subject later */
 	}
 	else {
@@ -142,17 +192,20 @@ char* dc_dehtml(char* buf_terminated)
 		dc_saxparser_t saxparser;
 
 		memset(&dehtml, 0, sizeof(dehtml_t));
-		dehtml.add_text   = DO_ADD_REMOVE_LINEENDS;
-		dc_strbuilder_init(&dehtml.strbuilder, strlen(buf_terminated));
+		dehtml.add_text        = DO_ADD_REMOVE_LINEENDS;
+		dehtml.last_is_lineend = 1;
+		dehtml.allocated       = buf_bytes + 1;
+		if ((dehtml.buf=malloc(dehtml.allocated))==NULL) {
+			exit(76);
+		}
 
 		dc_saxparser_init(&saxparser, &dehtml);
 		dc_saxparser_set_tag_handler(&saxparser, dehtml_starttag_cb, dehtml_endtag_cb);
 		dc_saxparser_set_text_handler(&saxparser, dehtml_text_cb);
-		dc_saxparser_parse(&saxparser, buf_terminated);
+		dc_saxparser_parse(&saxparser, buf, buf_bytes);
 
+		dehtml.buf[dehtml.bytes] = 0;
 		free(dehtml.last_href);
-		return dehtml.strbuilder.buf;
+		return dehtml.buf;
 	}
 }
-
-
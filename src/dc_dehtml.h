@@ -7,7 +7,7 @@ extern "C" {
 
 /*** library-internal *********************************************************/
 
-char* dc_dehtml(char* buf_terminated); /* dc_dehtml() returns way too many lineends; however, an optimisation on this issue is not needed as the lineends are typically remove in further processing by the caller */
+char* dc_dehtml(const char* buf, size_t buf_bytes); /* dc_dehtml() returns way too many lineends; however, an optimisation on this issue is not needed as the lineends are typically remove in further processing by the caller */
 
 
 #ifdef __cplusplus
@@ -1,3 +1,8 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
 #include "dc_context.h"
 #include "dc_pgp.h"
 #include "dc_aheader.h"
@@ -167,90 +172,153 @@ static int contains_report(struct mailmime* mime)
  ******************************************************************************/
 
 
+static int create_keypair(dc_context_t* context, const char* addr, dc_key_t* public_key, dc_key_t* private_key,
+                          struct mailmime* random_data_mime)
+{
+	/* seed the random generator */
+	{
+		uintptr_t seed[4];
+		seed[0] = (uintptr_t)time(NULL);     /* time */
+		seed[1] = (uintptr_t)seed;           /* stack */
+		seed[2] = (uintptr_t)public_key;     /* heap */
+		seed[3] = (uintptr_t)pthread_self(); /* thread ID */
+		dc_pgp_rand_seed(context, seed, sizeof(seed));
+
+		if (random_data_mime) {
+			MMAPString* random_data_mmap = NULL;
+			int col = 0;
+			if ((random_data_mmap=mmap_string_new(""))==NULL) {
+				return 0;
+			}
+			mailmime_write_mem(random_data_mmap, &col, random_data_mime);
+			dc_pgp_rand_seed(context, random_data_mmap->str, random_data_mmap->len);
+			mmap_string_free(random_data_mmap);
+		}
+	}
+
+	clock_t start = clock();
+	dc_log_info(context, 0, "Generating keypair with %i bits, e=%i ...", DC_KEYGEN_BITS, DC_KEYGEN_E);
+
+		/* The public key must contain the following:
+		- a signing-capable primary key Kp
+		- a user id
+		- a self signature
+		- an encryption-capable subkey Ke
+		- a binding signature over Ke by Kp
+		(see https://autocrypt.readthedocs.io/en/latest/level0.html#type-p-openpgp-based-key-data)*/
+		if (!dc_pgp_create_keypair(context, addr, public_key, private_key)) {
+			dc_log_warning(context, 0, "Cannot create keypair.");
+			return 0;
+		}
+
+	if (!dc_pgp_is_valid_key(context, public_key)
+	 || !dc_pgp_is_valid_key(context, private_key)) {
+		dc_log_warning(context, 0, "Generated keys are not valid.");
+		return 0;
+	}
+
+	dc_log_info(context, 0, "Keypair generated in %.3f s.", (double)(clock()-start)/CLOCKS_PER_SEC);
+	return 1;
+}
+
+
 static int load_or_generate_self_public_key(dc_context_t* context, dc_key_t* public_key, const char* self_addr,
                                               struct mailmime* random_data_mime /*for an extra-seed of the random generator. For speed reasons, only give _available_ pointers here, do not create any data - in very most cases, the key is not generated!*/)
 {
-	static int s_in_key_creation = 0; /* avoid double creation (we unlock the database during creation) */
-	int        key_created = 0;
 	int        success = 0, key_creation_here = 0;
+	dc_key_t*  private_key = dc_key_new();
 
 	if (context==NULL || context->magic!=DC_CONTEXT_MAGIC || public_key==NULL) {
 		goto cleanup;
 	}
 
-	if (!dc_key_load_self_public(public_key, self_addr, context->sql))
-	{
-		/* create the keypair - this may take a moment, however, as this is in a thread, this is no big deal */
-		if (s_in_key_creation) { goto cleanup; }
-		key_creation_here = 1;
-		s_in_key_creation = 1;
+	/* in most cases, the key exists; check this first, so that a spare keypair generated meanwhile does not block us */
+	if (dc_key_load_self_public(public_key, self_addr, context->sql)) {
+		success = 1;
+		goto cleanup;
+	}
 
-		/* seed the random generator */
-		{
-			uintptr_t seed[4];
-			seed[0] = (uintptr_t)time(NULL);     /* time */
-			seed[1] = (uintptr_t)seed;           /* stack */
-			seed[2] = (uintptr_t)public_key;     /* heap */
-			seed[3] = (uintptr_t)pthread_self(); /* thread ID */
-			dc_pgp_rand_seed(context, seed, sizeof(seed));
-
-			if (random_data_mime) {
-				MMAPString* random_data_mmap = NULL;
-				int col = 0;
-				if ((random_data_mmap=mmap_string_new(""))==NULL) {
-					goto cleanup;
-				}
-				mailmime_write_mem(random_data_mmap, &col, random_data_mime);
-				dc_pgp_rand_seed(context, random_data_mmap->str, random_data_mmap->len);
-				mmap_string_free(random_data_mmap);
-			}
+	pthread_mutex_lock(&context->keygen_mutex);
+		/* if another thread, typically the one started by dc_start_keygen(), is creating a keypair,
+		wait for it instead of creating a second one; we do not lock the database during creation */
+		while (context->keygen_running) {
+			pthread_cond_wait(&context->keygen_cond, &context->keygen_mutex);
 		}
 
-		{
-			dc_key_t* private_key = dc_key_new();
-
-			clock_t start = clock();
-			dc_log_info(context, 0, "Generating keypair with %i bits, e=%i ...", DC_KEYGEN_BITS, DC_KEYGEN_E);
-
-				/* The public key must contain the following:
-				- a signing-capable primary key Kp
-				- a user id
-				- a self signature
-				- an encryption-capable subkey Ke
-				- a binding signature over Ke by Kp
-				(see https://autocrypt.readthedocs.io/en/latest/level0.html#type-p-openpgp-based-key-data)*/
-				key_created = dc_pgp_create_keypair(context, self_addr, public_key, private_key);
-
-			if (!key_created) {
-				dc_log_warning(context, 0, "Cannot create keypair.");
-				goto cleanup;
-			}
+		if (!dc_key_load_self_public(public_key, self_addr, context->sql)) {
+			context->keygen_running = 1;
+			key_creation_here = 1;
+		}
+	pthread_mutex_unlock(&context->keygen_mutex);
 
-			if (!dc_pgp_is_valid_key(context, public_key)
-			 || !dc_pgp_is_valid_key(context, private_key)) {
-				dc_log_warning(context, 0, "Generated keys are not valid.");
-				goto cleanup;
-			}
+	if (key_creation_here)
+	{
+		context->cb(context, DC_EVENT_KEYGEN_PROGRESS, 10, 0);
 
-			if (!dc_key_save_self_keypair(public_key, private_key, self_addr, 1/*set default*/, context->sql)) {
-				dc_log_warning(context, 0, "Cannot save keypair.");
+		if (dc_key_take_spare_keypair(public_key, private_key, self_addr, context->sql)) {
+			dc_log_info(context, 0, "Using spare keypair for %s.", self_addr);
+		}
+		else {
+			/* create the keypair - this may take a moment, however, as this is in a thread, this is no big deal */
+			if (!create_keypair(context, self_addr, public_key, private_key, random_data_mime)) {
 				goto cleanup;
 			}
+		}
 
-			dc_log_info(context, 0, "Keypair generated in %.3f s.", (double)(clock()-start)/CLOCKS_PER_SEC);
-
-			dc_key_unref(private_key);
+		if (!dc_key_save_self_keypair(public_key, private_key, self_addr, 1/*set default*/, context->sql)) {
+			dc_log_warning(context, 0, "Cannot save keypair.");
+			goto cleanup;
 		}
 	}
 
 	success = 1;
 
 cleanup:
-	if (key_creation_here) { s_in_key_creation = 0; }
+	if (key_creation_here) {
+		context->cb(context, DC_EVENT_KEYGEN_PROGRESS, success? 1000 : 0, 0);
+
+		pthread_mutex_lock(&context->keygen_mutex);
+			context->keygen_running = 0;
+			pthread_cond_broadcast(&context->keygen_cond);
+		pthread_mutex_unlock(&context->keygen_mutex);
+	}
+	dc_key_unref(private_key);
 	return success;
 }
 
 
+static void create_spare_keypair(dc_context_t* context, const char* addr)
+{
+	int       key_creation_here = 0;
+	dc_key_t* public_key = dc_key_new();
+	dc_key_t* private_key = dc_key_new();
+
+	/* the spare keypair is created as any other keypair, so that waiting callers can take it */
+	pthread_mutex_lock(&context->keygen_mutex);
+		if (!context->keygen_running && !dc_key_has_spare_keypair(addr, context->sql)) {
+			context->keygen_running = 1;
+			key_creation_here = 1;
+		}
+	pthread_mutex_unlock(&context->keygen_mutex);
+
+	if (key_creation_here)
+	{
+		if (create_keypair(context, addr, public_key, private_key, NULL)
+		 && dc_key_save_spare_keypair(public_key, private_key, addr, context->sql)) {
+			dc_log_info(context, 0, "Spare keypair for %s created.", addr);
+		}
+
+		pthread_mutex_lock(&context->keygen_mutex);
+			context->keygen_running = 0;
+			pthread_cond_broadcast(&context->keygen_cond);
+		pthread_mutex_unlock(&context->keygen_mutex);
+	}
+
+	dc_key_unref(public_key);
+	dc_key_unref(private_key);
+}
+
+
 int dc_ensure_secret_key_exists(dc_context_t* context)
 {
 	/* normally, the key is generated as soon as the first mail is send
@@ -281,12 +349,287 @@ cleanup:
 }
 
 
+static void* keygen_thread_entry_point(void* entry_arg)
+{
+	dc_context_t* context = (dc_context_t*)entry_arg;
+	dc_key_t*     public_key = dc_key_new();
+
+	load_or_generate_self_public_key(context, public_key, context->keygen_addr, NULL);
+
+	if (dc_sqlite3_get_config_int(context->sql, "spare_keypair", DC_SPARE_KEYPAIR_DEFAULT)) {
+		create_spare_keypair(context, context->keygen_addr);
+	}
+
+	dc_key_unref(public_key);
+
+	pthread_mutex_lock(&context->keygen_mutex);
+		context->keygen_thread_state = DC_KEYGEN_THREAD_DONE;
+	pthread_mutex_unlock(&context->keygen_mutex);
+	return NULL;
+}
+
+
+static int get_keygen_thread_state(dc_context_t* context)
+{
+	int state = DC_KEYGEN_THREAD_NONE;
+	pthread_mutex_lock(&context->keygen_mutex);
+		state = context->keygen_thread_state;
+	pthread_mutex_unlock(&context->keygen_mutex);
+	return state;
+}
+
+
+static void set_keygen_thread_state(dc_context_t* context, int state)
+{
+	pthread_mutex_lock(&context->keygen_mutex);
+		context->keygen_thread_state = state;
+	pthread_mutex_unlock(&context->keygen_mutex);
+}
+
+
+static void join_keygen_thread(dc_context_t* context)
+{
+	/* the caller holds keygen_thread_mutex; the thread itself only needs keygen_mutex, so joining cannot deadlock */
+	if (get_keygen_thread_state(context)==DC_KEYGEN_THREAD_NONE) {
+		return;
+	}
+
+	pthread_join(context->keygen_thread, NULL);
+
+	set_keygen_thread_state(context, DC_KEYGEN_THREAD_NONE);
+	free(context->keygen_addr);
+	context->keygen_addr = NULL;
+}
+
+
+/**
+ * Start creating the own keypair in a background thread.
+ *
+ * Creating a keypair takes some seconds, so it is started as soon as the
+ * address is known, eg. at the beginning of dc_configure().
+ * Functions needing the keypair meanwhile wait for the thread
+ * instead of creating a second keypair.
+ * If the config-option `spare_keypair` is set, the thread also creates
+ * a spare keypair for the address that is used when the account is set up again.
+ *
+ * If the keypair and the spare keypair already exist, the function does nothing.
+ * If the thread is already running, the function does nothing.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @param addr The address to create the keypair for.
+ * @return None.
+ */
+void dc_start_keygen(dc_context_t* context, const char* addr)
+{
+	dc_key_t* public_key = dc_key_new();
+	int       spare_needed = 0;
+
+	if (context==NULL || context->magic!=DC_CONTEXT_MAGIC || addr==NULL || addr[0]==0) {
+		goto cleanup;
+	}
+
+	spare_needed = dc_sqlite3_get_config_int(context->sql, "spare_keypair", DC_SPARE_KEYPAIR_DEFAULT)
+		&& !dc_key_has_spare_keypair(addr, context->sql);
+	if (dc_key_load_self_public(public_key, addr, context->sql) && !spare_needed) {
+		goto cleanup;
+	}
+
+	pthread_mutex_lock(&context->keygen_thread_mutex);
+		if (get_keygen_thread_state(context)!=DC_KEYGEN_THREAD_RUNNING)
+		{
+			join_keygen_thread(context); /* join a finished thread */
+
+			context->keygen_addr = dc_strdup(addr);
+			set_keygen_thread_state(context, DC_KEYGEN_THREAD_RUNNING);
+			if (pthread_create(&context->keygen_thread, NULL, keygen_thread_entry_point, context)!=0) {
+				dc_log_warning(context, 0, "Cannot start key generation thread.");
+				set_keygen_thread_state(context, DC_KEYGEN_THREAD_NONE);
+				free(context->keygen_addr);
+				context->keygen_addr = NULL;
+			}
+		}
+	pthread_mutex_unlock(&context->keygen_thread_mutex);
+
+cleanup:
+	dc_key_unref(public_key);
+}
+
+
+/**
+ * Wait for the thread started by dc_start_keygen().
+ * Creating a keypair cannot be interrupted,
+ * so this function may block for some seconds.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @return None.
+ */
+void dc_stop_keygen(dc_context_t* context)
+{
+	if (context==NULL || context->magic!=DC_CONTEXT_MAGIC) {
+		return;
+	}
+
+	pthread_mutex_lock(&context->keygen_thread_mutex);
+		join_keygen_thread(context);
+	pthread_mutex_unlock(&context->keygen_thread_mutex);
+}
+
+
+/*******************************************************************************
+ * Gossip
+ ******************************************************************************/
+
+
+static const char* get_key_fingerprint(const dc_apeerstate_t* peerstate, const dc_key_t* key)
+{
+	/* key is one of the keys of the peerstate as returned by dc_apeerstate_peek_key() */
+	if (key==peerstate->verified_key) {
+		return peerstate->verified_key_fingerprint;
+	}
+	else if (key==peerstate->public_key) {
+		return peerstate->public_key_fingerprint;
+	}
+	return peerstate->gossip_key_fingerprint;
+}
+
+
+/* Get the keys gossiped to the chat, the returned hash maps addresses to fingerprints.
+NULL is returned if all keys should be gossiped, this is the case if the gossip interval has elapsed
+or if the keys were not gossiped to all recipients before, eg. if there are new members. */
+static dc_hash_t* load_gossiped_keys(dc_context_t* context, uint32_t chat_id, const dc_array_t* peerstates)
+{
+	dc_hash_t*    ret = NULL;
+	int           gossip_all = 0;
+	int           interval = dc_sqlite3_get_config_int(context->sql, "gossip_interval", DC_GOSSIP_INTERVAL_DEFAULT);
+	sqlite3_stmt* stmt = NULL;
+	int           i = 0;
+
+	if (chat_id<=DC_CHAT_ID_LAST_SPECIAL || interval<=0) {
+		return NULL;
+	}
+
+	if ((ret=calloc(1, sizeof(dc_hash_t)))==NULL) {
+		exit(66); /* cannot allocate little memory, unrecoverable error */
+	}
+	dc_hash_init(ret, DC_HASH_STRING, DC_HASH_COPY_KEY);
+
+	stmt = dc_sqlite3_prepare(context->sql,
+		"SELECT addr, fingerprint, timestamp FROM gossiped_keys WHERE chat_id=?;");
+	sqlite3_bind_int(stmt, 1, chat_id);
+	while (sqlite3_step(stmt)==SQLITE_ROW) {
+		dc_hash_insert_str(ret, (const char*)sqlite3_column_text(stmt, 0), dc_strdup((const char*)sqlite3_column_text(stmt, 1)));
+		if (sqlite3_column_int64(stmt, 2) < time(NULL)-interval) {
+			gossip_all = 1;
+		}
+	}
+	sqlite3_finalize(stmt);
+
+	for (i = 0; i < dc_array_get_cnt(peerstates) && !gossip_all; i++) {
+		if (dc_hash_find_str(ret, ((dc_apeerstate_t*)dc_array_get_ptr(peerstates, i))->addr)==NULL) {
+			gossip_all = 1;
+		}
+	}
+
+	if (gossip_all) {
+		dc_e2ee_free_gossiped_keys(ret);
+		ret = NULL;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Remember the keys gossiped by a message sent to a chat.
+ * As long as the keys do not change, they are not gossiped again to the chat
+ * until the interval set by the config-option `gossip_interval` elapses or
+ * until a member is added, see dc_e2ee_reset_gossiped_keys().
+ *
+ * The function must be called only after the message is sent.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @param chat_id The chat the message was sent to.
+ * @param gossiped_keys The keys gossiped, dc_e2ee_helper_t::gossiped_keys as set by dc_e2ee_encrypt().
+ * @param gossiped_all dc_e2ee_helper_t::gossiped_all as set by dc_e2ee_encrypt().
+ * @return None.
+ */
+void dc_e2ee_save_gossiped_keys(dc_context_t* context, uint32_t chat_id, const dc_hash_t* gossiped_keys, int gossiped_all)
+{
+	sqlite3_stmt*  stmt = NULL;
+	dc_hashelem_t* elem = NULL;
+
+	if (context==NULL || chat_id<=DC_CHAT_ID_LAST_SPECIAL || gossiped_keys==NULL) {
+		return;
+	}
+
+	if (gossiped_all) {
+		dc_e2ee_reset_gossiped_keys(context, chat_id); /* remove members not in the chat any longer */
+	}
+
+	stmt = dc_sqlite3_prepare(context->sql,
+		"INSERT OR REPLACE INTO gossiped_keys (chat_id, addr, fingerprint, timestamp) VALUES (?,?,?,?);");
+	for (elem=dc_hash_first(gossiped_keys); elem; elem=dc_hash_next(elem)) {
+		sqlite3_bind_int  (stmt, 1, chat_id);
+		sqlite3_bind_text (stmt, 2, (const char*)dc_hash_key(elem), dc_hash_keysize(elem), SQLITE_STATIC);
+		sqlite3_bind_text (stmt, 3, (const char*)dc_hash_data(elem), -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 4, time(NULL));
+		sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+}
+
+
+/**
+ * Forget the keys gossiped to a chat, so that the next message sent to
+ * the chat gossips all keys.  This is needed if members are added.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @param chat_id The chat to forget the gossiped keys for.
+ * @return None.
+ */
+void dc_e2ee_reset_gossiped_keys(dc_context_t* context, uint32_t chat_id)
+{
+	sqlite3_stmt* stmt = dc_sqlite3_prepare(context->sql, "DELETE FROM gossiped_keys WHERE chat_id=?;");
+	sqlite3_bind_int(stmt, 1, chat_id);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+}
+
+
+void dc_e2ee_free_gossiped_keys(dc_hash_t* gossiped_keys)
+{
+	dc_hashelem_t* elem = NULL;
+
+	if (gossiped_keys==NULL) {
+		return;
+	}
+
+	for (elem=dc_hash_first(gossiped_keys); elem; elem=dc_hash_next(elem)) {
+		free(dc_hash_data(elem));
+	}
+	dc_hash_clear(gossiped_keys);
+	free(gossiped_keys);
+}
+
+
 /*******************************************************************************
  * Encrypt
  ******************************************************************************/
 
 
-void dc_e2ee_encrypt(dc_context_t* context, const clist* recipients_addr,
+static int write_to_encrypt(void* enc, const char* str, size_t length)
+{
+	/* called by mailmime_write_driver(), returns the number of bytes written */
+	return dc_pgp_pk_encrypt_write((dc_pgp_encrypt_t*)enc, str, length)? (int)length : 0;
+}
+
+
+void dc_e2ee_encrypt(dc_context_t* context, uint32_t chat_id, const clist* recipients_addr,
                     int force_unencrypted,
                     int e2ee_guaranteed, /*set if e2ee was possible on sending time; we should not degrade to transport*/
                     int min_verified,
@@ -298,7 +641,7 @@ void dc_e2ee_encrypt(dc_context_t* context, const clist* recipients_addr,
 	struct mailimf_fields*  imffields_unprotected = NULL; /*just a pointer into mailmime structure, must not be freed*/
 	dc_keyring_t*           keyring = dc_keyring_new();
 	dc_key_t*               sign_key = dc_key_new();
-	MMAPString*             plain = mmap_string_new("");
+	dc_pgp_encrypt_t*       enc = NULL;
 	char*                   ctext = NULL;
 	size_t                  ctext_bytes = 0;
 	dc_array_t*             peerstates = dc_array_new(NULL, 10);
@@ -307,7 +650,7 @@ void dc_e2ee_encrypt(dc_context_t* context, const clist* recipients_addr,
 
 	if (context==NULL || context->magic!=DC_CONTEXT_MAGIC || recipients_addr==NULL || in_out_message==NULL
 	 || in_out_message->mm_parent /* libEtPan's pgp_encrypt_mime() takes the parent as the new root. We just expect the root as being given to this function. */
-	 || autocryptheader==NULL || keyring==NULL || sign_key==NULL || plain==NULL || helper==NULL) {
+	 || autocryptheader==NULL || keyring==NULL || sign_key==NULL || helper==NULL) {
 		goto cleanup;
 	}
 
@@ -382,15 +725,35 @@ void dc_e2ee_encrypt(dc_context_t* context, const clist* recipients_addr,
 		struct mailmime* message_to_encrypt = mailmime_new(MAILMIME_MESSAGE, NULL, 0, mailmime_fields_new_empty(), /* mailmime_new_message_data() calls mailmime_fields_new_with_version() which would add the unwanted MIME-Version:-header */
 			mailmime_get_content_message(), NULL, NULL, NULL, NULL, imffields_encrypted, part_to_encrypt);
 
-		/* gossip keys */
+		/* gossip keys; keys already gossiped to the chat are skipped */
 		int iCnt = dc_array_get_cnt(peerstates);
 		if (iCnt > 1) {
+			dc_hash_t* gossiped_before = load_gossiped_keys(context, chat_id, peerstates);
+
+			if ((helper->gossiped_keys=calloc(1, sizeof(dc_hash_t)))==NULL) {
+				exit(67);
+			}
+			dc_hash_init(helper->gossiped_keys, DC_HASH_STRING, DC_HASH_COPY_KEY);
+			helper->gossiped_all = (gossiped_before==NULL);
+
 			for (int i = 0; i < iCnt; i++) {
-				char* p = dc_apeerstate_render_gossip_header((dc_apeerstate_t*)dc_array_get_ptr(peerstates, i), min_verified);
+				dc_apeerstate_t* peerstate = (dc_apeerstate_t*)dc_array_get_ptr(peerstates, i);
+				const char* fingerprint = get_key_fingerprint(peerstate, dc_apeerstate_peek_key(peerstate, min_verified));
+				const char* fingerprint_before = gossiped_before? dc_hash_find_str(gossiped_before, peerstate->addr) : NULL;
+				if (fingerprint && fingerprint[0] && fingerprint_before && strcmp(fingerprint, fingerprint_before)==0) {
+					continue;
+				}
+
+				char* p = dc_apeerstate_render_gossip_header(peerstate, min_verified);
 				if (p) {
 					mailimf_fields_add(imffields_encrypted, mailimf_field_new_custom(strdup("Autocrypt-Gossip"), p/*takes ownership*/));
+					if (fingerprint && fingerprint[0]) {
+						dc_hash_insert_str(helper->gossiped_keys, peerstate->addr, dc_strdup(fingerprint));
+					}
 				}
 			}
+
+			dc_e2ee_free_gossiped_keys(gossiped_before);
 		}
 
 		/* memoryhole headers */
@@ -428,14 +791,19 @@ void dc_e2ee_encrypt(dc_context_t* context, const clist* recipients_addr,
 
 		clist_append(part_to_encrypt->mm_content_type->ct_parameters, mailmime_param_new_with_data("protected-headers", "v1"));
 
-		/* convert part to encrypt to plain text */
-		mailmime_write_mem(plain, &col, message_to_encrypt);
-		if (plain->str==NULL || plain->len<=0) {
+		/* convert part to encrypt to plain text; the text is signed and encrypted while it is rendered,
+		so that large messages are not held in memory several times */
+		if ((enc=dc_pgp_pk_encrypt_begin(context, keyring, sign_key, 1/*use_armor*/))==NULL) {
+			goto cleanup;
+		}
+
+		if (mailmime_write_driver(write_to_encrypt, enc, &col, message_to_encrypt)!=MAILIMF_NO_ERROR) {
 			goto cleanup;
 		}
-		//char* t1=dc_null_terminate(plain->str,plain->len);printf("PLAIN:\n%s\n",t1);free(t1); // DEBUG OUTPUT
 
-		if (!dc_pgp_pk_encrypt(context, plain->str, plain->len, keyring, sign_key, 1/*use_armor*/, (void**)&ctext, &ctext_bytes)) {
+		int ok = dc_pgp_pk_encrypt_end(enc, (void**)&ctext, &ctext_bytes);
+		enc = NULL;
+		if (!ok) {
 			goto cleanup;
 		}
 		helper->cdata_to_free = ctext;
@@ -473,13 +841,23 @@ cleanup:
 	dc_aheader_unref(autocryptheader);
 	dc_keyring_unref(keyring);
 	dc_key_unref(sign_key);
-	if (plain) { mmap_string_free(plain); }
+	if (enc) { dc_pgp_pk_encrypt_end(enc, NULL, NULL); }
 
 	for (int i=dc_array_get_cnt(peerstates)-1; i>=0; i--) { dc_apeerstate_unref((dc_apeerstate_t*)dc_array_get_ptr(peerstates, i)); }
 	dc_array_unref(peerstates);
 }
 
 
+typedef struct _dc_plain dc_plain_t;
+struct _dc_plain
+{
+	void*       buf;
+	size_t      bytes;
+	int         mapped; /* 1=buf is munmap()'d, 0=buf is free()'d */
+	dc_plain_t* next;
+};
+
+
 void dc_e2ee_thanks(dc_e2ee_helper_t* helper)
 {
 	if (helper==NULL) {
@@ -489,6 +867,22 @@ void dc_e2ee_thanks(dc_e2ee_helper_t* helper)
 	free(helper->cdata_to_free);
 	helper->cdata_to_free = NULL;
 
+	while (helper->plain_to_free)
+	{
+		dc_plain_t* plain = (dc_plain_t*)helper->plain_to_free;
+		helper->plain_to_free = plain->next;
+		if (plain->mapped) {
+			munmap(plain->buf, plain->bytes);
+		}
+		else {
+			free(plain->buf);
+		}
+		free(plain);
+	}
+
+	dc_e2ee_free_gossiped_keys(helper->gossiped_keys);
+	helper->gossiped_keys = NULL;
+
 	if (helper->gossipped_addr)
 	{
 		dc_hash_clear(helper->gossipped_addr);
@@ -528,23 +922,217 @@ static int has_decrypted_pgp_armor(const char* str__, int str_bytes)
 }
 
 
+/*******************************************************************************
+ * Cache of decryption results
+ ******************************************************************************/
+
+
+/* Messages are seen several times, eg. when they are moved to the DeltaChat folder
+or when the copies of sent messages are fetched.  The plaintext and the signers
+of decrypted messages are stored in the table decrypt_cache, keyed by the SHA-256
+of the ciphertext, so known messages are not decrypted and validated again.
+
+The entries are deleted together with the message given by rfc724_mid.
+Only results with a valid signature are cached: a cached result can only lose
+signers whose keys are gone, it cannot gain signers whose keys became known later. */
+
+
+static void count_decrypt_cache(dc_context_t* context, int hit)
+{
+	pthread_mutex_lock(&context->decrypt_cache_mutex);
+		if (hit) {
+			context->decrypt_cache_hits++;
+		}
+		else {
+			context->decrypt_cache_misses++;
+		}
+	pthread_mutex_unlock(&context->decrypt_cache_mutex);
+}
+
+
+static int load_from_decrypt_cache(dc_context_t* context, const uint8_t* ctext_hash,
+                                   const dc_keyring_t* public_keyring_for_validate,
+                                   dc_hash_t* ret_signature_fingerprints,
+                                   void** ret_plain, size_t* ret_plain_bytes)
+{
+	int           found = 0;
+	sqlite3_stmt* stmt = NULL;
+	clist*        fingerprints = NULL;
+	clistiter*    cur = NULL;
+	int           i = 0;
+
+	stmt = dc_sqlite3_prepare(context->sql,
+		"SELECT plain, fingerprints FROM decrypt_cache WHERE hash=?;");
+	sqlite3_bind_blob(stmt, 1, ctext_hash, SHA256_DIGEST_LENGTH, SQLITE_STATIC);
+	if (sqlite3_step(stmt)!=SQLITE_ROW || sqlite3_column_bytes(stmt, 0)<=0) {
+		goto cleanup;
+	}
+
+	*ret_plain_bytes = sqlite3_column_bytes(stmt, 0);
+	if ((*ret_plain=malloc(*ret_plain_bytes))==NULL) {
+		exit(68);
+	}
+	memcpy(*ret_plain, sqlite3_column_blob(stmt, 0), *ret_plain_bytes);
+
+	/* a signature is valid if it was valid before and if the signing key is still
+	one of the keys to validate against, so the result does not depend on the time of caching */
+	fingerprints = dc_str_to_clist((const char*)sqlite3_column_text(stmt, 1), " ");
+	if (clist_count(fingerprints)>0 && public_keyring_for_validate) {
+		for (i = 0; i < public_keyring_for_validate->count; i++) {
+			char* key_fingerprint = dc_key_get_fingerprint(public_keyring_for_validate->keys[i]);
+			for (cur=clist_begin(fingerprints); cur!=NULL; cur=clist_next(cur)) {
+				if (key_fingerprint[0] && strcmp((const char*)cur->data, key_fingerprint)==0) {
+					dc_hash_insert_str(ret_signature_fingerprints, key_fingerprint, (void*)1);
+				}
+			}
+			free(key_fingerprint);
+		}
+	}
+
+	found = 1;
+
+cleanup:
+	count_decrypt_cache(context, found);
+	if (fingerprints) { clist_free_content(fingerprints); clist_free(fingerprints); }
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+
+static void save_to_decrypt_cache(dc_context_t* context, const uint8_t* ctext_hash, const char* rfc724_mid,
+                                  const void* plain, size_t plain_bytes,
+                                  const dc_hash_t* signature_fingerprints)
+{
+	sqlite3_stmt*   stmt = NULL;
+	dc_hashelem_t*  elem = NULL;
+	dc_strbuilder_t fingerprints;
+
+	if (plain_bytes<=0 || plain_bytes>DC_DECRYPT_CACHE_MAX_BYTES) {
+		return; /* large messages are rarely seen twice and would bloat the database */
+	}
+
+	if (rfc724_mid==NULL || rfc724_mid[0]==0 || dc_hash_cnt(signature_fingerprints)<=0) {
+		return; /* the entry could not be deleted with the message resp. the signature may be validated later */
+	}
+
+	dc_strbuilder_init(&fingerprints, 0);
+	for (elem=dc_hash_first(signature_fingerprints); elem; elem=dc_hash_next(elem)) {
+		dc_strbuilder_catf(&fingerprints, "%s%.*s", fingerprints.buf[0]? " " : "",
+			dc_hash_keysize(elem), (const char*)dc_hash_key(elem));
+	}
+
+	stmt = dc_sqlite3_prepare(context->sql,
+		"INSERT OR REPLACE INTO decrypt_cache (hash, plain, fingerprints, created, rfc724_mid) VALUES (?,?,?,?,?);");
+	sqlite3_bind_blob (stmt, 1, ctext_hash, SHA256_DIGEST_LENGTH, SQLITE_STATIC);
+	sqlite3_bind_blob (stmt, 2, plain, plain_bytes, SQLITE_STATIC);
+	sqlite3_bind_text (stmt, 3, fingerprints.buf, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 4, time(NULL));
+	sqlite3_bind_text (stmt, 5, rfc724_mid, -1, SQLITE_STATIC);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+
+	free(fingerprints.buf);
+}
+
+
+char* dc_e2ee_get_decrypt_cache_str(dc_context_t* context)
+{
+	char* ret = NULL;
+	int   lookups = 0;
+
+	pthread_mutex_lock(&context->decrypt_cache_mutex);
+		lookups = context->decrypt_cache_hits + context->decrypt_cache_misses;
+		ret = dc_mprintf("%i hits, %i misses, %i%% hit rate",
+			context->decrypt_cache_hits, context->decrypt_cache_misses,
+			lookups>0? context->decrypt_cache_hits*100/lookups : 0);
+	pthread_mutex_unlock(&context->decrypt_cache_mutex);
+
+	return ret;
+}
+
+
+/* Decrypt to an unlinked file in the blobdir and map it into memory.
+The plaintext is never collected on the heap this way; the mapping is backed by the page cache
+and only the pages touched by the MIME parser are read. */
+static int decrypt_to_mapped_file(dc_context_t*       context,
+                                  const void*         ctext,
+                                  size_t              ctext_bytes,
+                                  const dc_keyring_t* private_keyring,
+                                  const dc_keyring_t* public_keyring_for_validate,
+                                  dc_hash_t*          ret_signature_fingerprints,
+                                  int*                ret_file_unavailable,
+                                  void**              ret_plain,
+                                  size_t*             ret_plain_bytes)
+{
+	int         success = 0;
+	char*       pathNfilename = NULL;
+	char*       pathNfilename_abs = NULL;
+	int         fd = -1;
+	struct stat st;
+	void*       map = MAP_FAILED;
+
+	*ret_file_unavailable = 0;
+
+	if ((pathNfilename=dc_get_fine_pathNfilename(context, "$BLOBDIR", "decrypted.eml"))==NULL
+	 || (pathNfilename_abs=dc_get_abs_path(context, pathNfilename))==NULL
+	 || (fd=open(pathNfilename_abs, O_RDWR|O_CREAT|O_EXCL, 0600)) < 0) {
+		*ret_file_unavailable = 1;
+		goto cleanup;
+	}
+
+	/* the file is not needed beyond the mapping; this way, no plaintext is left over on crashes */
+	remove(pathNfilename_abs);
+
+	if (!dc_pgp_pk_decrypt_to_fd(context, ctext, ctext_bytes, private_keyring, public_keyring_for_validate, 1, fd, ret_signature_fingerprints)) {
+		goto cleanup;
+	}
+
+	if (fstat(fd, &st)!=0 || st.st_size<=0) {
+		goto cleanup;
+	}
+
+	/* the mapping is private and writable as the MIME parser regards the data as a usual buffer */
+	if ((map=mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0))==MAP_FAILED) {
+		dc_log_warning(context, 0, "Cannot map decrypted data.");
+		goto cleanup;
+	}
+
+	*ret_plain       = map;
+	*ret_plain_bytes = (size_t)st.st_size;
+	success = 1;
+
+cleanup:
+	if (fd>=0) { close(fd); }
+	free(pathNfilename_abs);
+	free(pathNfilename);
+	return success;
+}
+
+
 static int decrypt_part(dc_context_t*       context,
                         struct mailmime*    mime,
                         const dc_keyring_t* private_keyring,
                         const dc_keyring_t* public_keyring_for_validate, /*may be NULL*/
                         dc_hash_t*          ret_valid_signatures,
+                        dc_e2ee_helper_t*   helper,
                         struct mailmime**   ret_decrypted_mime)
 {
 	struct mailmime_data*        mime_data = NULL;
-	int                          mime_transfer_encoding = MAILMIME_MECHANISM_BINARY;
 	char*                        transfer_decoding_buffer = NULL; /* mmap_string_unref()'d if set */
 	const char*                  decoded_data = NULL; /* must not be free()'d */
 	size_t                       decoded_data_bytes = 0;
 	void*                        plain_buf = NULL;
 	size_t                       plain_bytes = 0;
+	int                          plain_mapped = 0;
+	int                          file_unavailable = 0;
+	dc_plain_t*                  plain = NULL;
 	int                          sth_decrypted = 0;
+	uint8_t                      ctext_hash[SHA256_DIGEST_LENGTH];
+	dc_hash_t                    signatures;
+	dc_hashelem_t*               elem = NULL;
 
 	*ret_decrypted_mime = NULL;
+	dc_hash_init(&signatures, DC_HASH_STRING, DC_HASH_COPY_KEY);
 
 	/* get data pointer from `mime` */
 	mime_data = mime->mm_data.mm_single;
@@ -554,41 +1142,9 @@ static int decrypt_part(dc_context_t*       context,
 		goto cleanup;
 	}
 
-	/* check headers in `mime` */
-	if (mime->mm_mime_fields!=NULL) {
-		clistiter* cur;
-		for (cur = clist_begin(mime->mm_mime_fields->fld_list); cur!=NULL; cur = clist_next(cur)) {
-			struct mailmime_field* field = (struct mailmime_field*)clist_content(cur);
-			if (field) {
-				if (field->fld_type==MAILMIME_FIELD_TRANSFER_ENCODING && field->fld_data.fld_encoding) {
-					mime_transfer_encoding = field->fld_data.fld_encoding->enc_type;
-				}
-			}
-		}
-	}
-
 	/* regard `Content-Transfer-Encoding:` */
-	if (mime_transfer_encoding==MAILMIME_MECHANISM_7BIT
-	 || mime_transfer_encoding==MAILMIME_MECHANISM_8BIT
-	 || mime_transfer_encoding==MAILMIME_MECHANISM_BINARY)
-	{
-		decoded_data       = mime_data->dt_data.dt_text.dt_data;
-		decoded_data_bytes = mime_data->dt_data.dt_text.dt_length;
-		if (decoded_data==NULL || decoded_data_bytes <= 0) {
-			goto cleanup; /* no error - but no data */
-		}
-	}
-	else
-	{
-		int r;
-		size_t current_index = 0;
-		r = mailmime_part_parse(mime_data->dt_data.dt_text.dt_data, mime_data->dt_data.dt_text.dt_length,
-			&current_index, mime_transfer_encoding,
-			&transfer_decoding_buffer, &decoded_data_bytes);
-		if (r!=MAILIMF_NO_ERROR || transfer_decoding_buffer==NULL || decoded_data_bytes <= 0) {
-			goto cleanup;
-		}
-		decoded_data = transfer_decoding_buffer;
+	if (!mailmime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer)) {
+		goto cleanup; /* no error - but no data */
 	}
 
 	/* encrypted, decoded data in decoded_data now ... */
@@ -599,10 +1155,40 @@ static int decrypt_part(dc_context_t*       context,
 	dc_hash_t* add_signatures = dc_hash_cnt(ret_valid_signatures)<=0?
 		ret_valid_signatures : NULL; /*if we already have fingerprints, do not add more; this ensures, only the fingerprints from the outer-most part are collected */
 
-	if (!dc_pgp_pk_decrypt(context, decoded_data, decoded_data_bytes, private_keyring, public_keyring_for_validate, 1, &plain_buf, &plain_bytes, add_signatures)
-	 || plain_buf==NULL || plain_bytes<=0) {
-		goto cleanup;
+	SHA256((const unsigned char*)decoded_data, decoded_data_bytes, ctext_hash);
+
+	if (load_from_decrypt_cache(context, ctext_hash, public_keyring_for_validate, &signatures, &plain_buf, &plain_bytes)) {
+		; /* known message, only the MIME structure is parsed again */
 	}
+	else {
+		if (decrypt_to_mapped_file(context, decoded_data, decoded_data_bytes, private_keyring, public_keyring_for_validate, &signatures,
+				&file_unavailable, &plain_buf, &plain_bytes)) {
+			plain_mapped = 1;
+		}
+		else if (!file_unavailable
+		      || !dc_pgp_pk_decrypt(context, decoded_data, decoded_data_bytes, private_keyring, public_keyring_for_validate, 1, &plain_buf, &plain_bytes, &signatures)
+		      || plain_buf==NULL || plain_bytes<=0) {
+			goto cleanup;
+		}
+
+		save_to_decrypt_cache(context, ctext_hash, helper->rfc724_mid, plain_buf, plain_bytes, &signatures);
+	}
+
+	if (add_signatures) {
+		for (elem=dc_hash_first(&signatures); elem; elem=dc_hash_next(elem)) {
+			dc_hash_insert(add_signatures, dc_hash_key(elem), dc_hash_keysize(elem), (void*)1);
+		}
+	}
+
+	/* the decrypted mime structure points into the plaintext, so keep it until dc_e2ee_thanks() is called */
+	if ((plain=calloc(1, sizeof(dc_plain_t)))==NULL) {
+		exit(64);
+	}
+	plain->buf    = plain_buf;
+	plain->bytes  = plain_bytes;
+	plain->mapped = plain_mapped;
+	plain->next   = (dc_plain_t*)helper->plain_to_free;
+	helper->plain_to_free = plain;
 
 	//{char* t1=dc_null_terminate(plain_buf,plain_bytes);printf("\n**********\n%s\n**********\n",t1);free(t1);}
 
@@ -628,6 +1214,7 @@ cleanup:
 	if (transfer_decoding_buffer) {
 		mmap_string_unref(transfer_decoding_buffer);
 	}
+	dc_hash_clear(&signatures);
 	return sth_decrypted;
 }
 
@@ -637,6 +1224,7 @@ static int decrypt_recursive(dc_context_t*           context,
                              const dc_keyring_t*     private_keyring,
                              const dc_keyring_t*     public_keyring_for_validate,
                              dc_hash_t*              ret_valid_signatures,
+                             dc_e2ee_helper_t*       helper,
                              struct mailimf_fields** ret_gossip_headers,
                              int*                    ret_has_unencrypted_parts)
 {
@@ -655,7 +1243,7 @@ static int decrypt_recursive(dc_context_t*           context,
 			"application/octet-stream" (the interesting data part) and optional, unencrypted help files */
 			for (cur=clist_begin(mime->mm_data.mm_multipart.mm_mp_list); cur!=NULL; cur=clist_next(cur)) {
 				struct mailmime* decrypted_mime = NULL;
-				if (decrypt_part(context, (struct mailmime*)clist_content(cur), private_keyring, public_keyring_for_validate, ret_valid_signatures, &decrypted_mime))
+				if (decrypt_part(context, (struct mailmime*)clist_content(cur), private_keyring, public_keyring_for_validate, ret_valid_signatures, helper, &decrypted_mime))
 				{
 					/* remember the header containing potentially Autocrypt-Gossip */
 					if (*ret_gossip_headers==NULL /* use the outermost decrypted part */
@@ -679,7 +1267,7 @@ static int decrypt_recursive(dc_context_t*           context,
 		}
 		else {
 			for (cur=clist_begin(mime->mm_data.mm_multipart.mm_mp_list); cur!=NULL; cur=clist_next(cur)) {
-				if (decrypt_recursive(context, (struct mailmime*)clist_content(cur), private_keyring, public_keyring_for_validate, ret_valid_signatures, ret_gossip_headers, ret_has_unencrypted_parts)) {
+				if (decrypt_recursive(context, (struct mailmime*)clist_content(cur), private_keyring, public_keyring_for_validate, ret_valid_signatures, helper, ret_gossip_headers, ret_has_unencrypted_parts)) {
 					return 1; /* sth. decrypted, start over from root searching for encrypted parts */
 				}
 			}
@@ -687,7 +1275,7 @@ static int decrypt_recursive(dc_context_t*           context,
 	}
 	else if (mime->mm_type==MAILMIME_MESSAGE)
 	{
-		if (decrypt_recursive(context, mime->mm_data.mm_message.mm_msg_mime, private_keyring, public_keyring_for_validate, ret_valid_signatures, ret_gossip_headers, ret_has_unencrypted_parts)) {
+		if (decrypt_recursive(context, mime->mm_data.mm_message.mm_msg_mime, private_keyring, public_keyring_for_validate, ret_valid_signatures, helper, ret_gossip_headers, ret_has_unencrypted_parts)) {
 			return 1; /* sth. decrypted, start over from root searching for encrypted parts */
 		}
 	}
@@ -802,6 +1390,11 @@ void dc_e2ee_decrypt(dc_context_t* context, struct mailmime* in_out_message,
 			from = mailimf_find_first_addr(field->fld_data.fld_from->frm_mb_list);
 		}
 
+		field = mailimf_find_field(imffields, MAILIMF_FIELD_MESSAGE_ID);
+		if (field && field->fld_data.fld_message_id) {
+			helper->rfc724_mid = field->fld_data.fld_message_id->mid_value;
+		}
+
 		field = mailimf_find_field(imffields, MAILIMF_FIELD_ORIG_DATE);
 		if (field && field->fld_data.fld_orig_date) {
 			struct mailimf_orig_date* orig_date = field->fld_data.fld_orig_date;
@@ -879,7 +1472,7 @@ void dc_e2ee_decrypt(dc_context_t* context, struct mailmime* in_out_message,
 		int has_unencrypted_parts = 0;
 		if (!decrypt_recursive(context, in_out_message, private_keyring,
 		        public_keyring_for_validate,
-		        helper->signatures, &gossip_headers, &has_unencrypted_parts)) {
+		        helper->signatures, helper, &gossip_headers, &has_unencrypted_parts)) {
 			break;
 		}
 
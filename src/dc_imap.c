@@ -41,6 +41,15 @@ int dc_imap_is_error(dc_imap_t* imap, int code)
 }
 
 
+static int get_config_int(dc_imap_t* imap, const char* key, int def)
+{
+	char* str = imap->get_config(imap, key, NULL);
+	int   ret = str? atol(str) : def;
+	free(str);
+	return ret;
+}
+
+
 static char* get_error_msg(dc_imap_t* imap, const char* what_failed, int code)
 {
 	char*           stock = NULL;
@@ -110,6 +119,42 @@ static void set_config_lastseenuid(dc_imap_t* imap, const char* folder, uint32_t
 }
 
 
+static void get_config_modseq(dc_imap_t* imap, const char* folder, uint32_t uidvalidity, uint64_t* modseq)
+{
+	/* the modseq is stored together with the uidvalidity it belongs to; if the uidvalidity changes, the modseq is no longer valid */
+	*modseq = 0;
+
+	char* key = dc_mprintf("imap.modseq.%s", folder);
+	char* val1 = imap->get_config(imap, key, NULL), *val2 = NULL;
+	if (val1)
+	{
+		/* the entry has the format `imap.modseq.<folder>=<uidvalidity>:<modseq>` */
+		val2 = strchr(val1, ':');
+		if (val2)
+		{
+			*val2 = 0;
+			val2++;
+
+			if ((uint32_t)atol(val1)==uidvalidity) {
+				*modseq = strtoull(val2, NULL, 10);
+			}
+		}
+	}
+	free(val1); /* val2 is only a pointer inside val1 and MUST NOT be free()'d */
+	free(key);
+}
+
+
+static void set_config_modseq(dc_imap_t* imap, const char* folder, uint32_t uidvalidity, uint64_t modseq)
+{
+	char* key = dc_mprintf("imap.modseq.%s", folder);
+	char* val = dc_mprintf("%lu:%llu", (unsigned long)uidvalidity, (unsigned long long)modseq);
+	imap->set_config(imap, key, val);
+	free(val);
+	free(key);
+}
+
+
 /*******************************************************************************
  * Handle folders
  ******************************************************************************/
@@ -124,6 +169,8 @@ static int select_folder(dc_imap_t* imap, const char* folder /*may be NULL*/)
 	if (imap->etpan==NULL) {
 		imap->selected_folder[0] = 0;
 		imap->selected_folder_needs_expunge = 0;
+		imap->selected_modseq = 0;
+		imap->selected_expunged = 0;
 		return 0;
 	}
 
@@ -142,13 +189,17 @@ static int select_folder(dc_imap_t* imap, const char* folder /*may be NULL*/)
 		imap->selected_folder_needs_expunge = 0;
 	}
 
-	/* select new folder */
+	/* select new folder; `SELECT <folder> (CONDSTORE)` additionally returns the HIGHESTMODSEQ */
+	imap->selected_modseq = 0;
+	imap->selected_expunged = 0;
 	if (folder) {
-		int r = mailimap_select(imap->etpan, folder);
+		int r = imap->has_condstore?
+			mailimap_select_condstore(imap->etpan, folder, &imap->selected_modseq) : mailimap_select(imap->etpan, folder);
 		if (dc_imap_is_error(imap, r) || imap->etpan->imap_selection_info==NULL) {
 			dc_log_info(imap->context, 0, "Cannot select folder; code=%i, imap_response=%s", r,
 				imap->etpan->imap_response? imap->etpan->imap_response : "<none>");
 			imap->selected_folder[0] = 0;
+			imap->selected_modseq = 0;
 			return 0;
 		}
 	}
@@ -187,6 +238,108 @@ static uint32_t peek_uid(struct mailimap_msg_att* msg_att)
 }
 
 
+static uint32_t peek_size(struct mailimap_msg_att* msg_att)
+{
+	/* search the RFC822.SIZE in a list of attributes returned by a FETCH command */
+	clistiter* iter1;
+	for (iter1=clist_begin(msg_att->att_list); iter1!=NULL; iter1=clist_next(iter1))
+	{
+		struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(iter1);
+		if (item)
+		{
+			if (item->att_type==MAILIMAP_MSG_ATT_ITEM_STATIC)
+			{
+				if (item->att_data.att_static->att_type==MAILIMAP_MSG_ATT_RFC822_SIZE)
+				{
+					return item->att_data.att_static->att_data.att_rfc822_size;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+static uint64_t peek_modseq(struct mailimap_msg_att* msg_att)
+{
+	/* search the MODSEQ in a list of attributes returned by a FETCH command, the MODSEQ is returned eg. for `CHANGEDSINCE` */
+	clistiter* iter1;
+	for (iter1=clist_begin(msg_att->att_list); iter1!=NULL; iter1=clist_next(iter1))
+	{
+		struct mailimap_msg_att_item* item = (struct mailimap_msg_att_item*)clist_content(iter1);
+		if (item)
+		{
+			if (item->att_type==MAILIMAP_MSG_ATT_ITEM_EXTENSION && item->att_data.att_extension_data)
+			{
+				struct mailimap_extension_data* ext_data = item->att_data.att_extension_data;
+				if (ext_data->ext_extension->ext_id==MAILIMAP_EXTENSION_CONDSTORE
+				 && ext_data->ext_type==MAILIMAP_CONDSTORE_TYPE_FETCH_DATA)
+				{
+					return ((struct mailimap_condstore_fetch_mod_resp*)ext_data->ext_data)->cs_modseq_value;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+static void track_selected_modseq(dc_imap_t* imap, clist* fetch_result /*may be NULL*/)
+{
+	/* keep selected_modseq up to date with the untagged responses of the last command, eg. IDLE or FETCH;
+	this way, the flags need to be synced only if the server reports changes.
+	EXPUNGE and VANISHED responses do not carry a modseq, so they are only recorded as such. */
+	clistiter* cur;
+
+	if (imap==NULL || imap->etpan==NULL || !imap->has_condstore || imap->selected_modseq==0) {
+		return;
+	}
+
+	if (fetch_result==NULL && imap->etpan->imap_response_info) {
+		fetch_result = imap->etpan->imap_response_info->rsp_fetch_list; /* unsolicited FETCH responses, eg. during IDLE */
+	}
+
+	if (fetch_result) {
+		for (cur=clist_begin(fetch_result); cur!=NULL; cur=clist_next(cur)) {
+			uint64_t msg_modseq = peek_modseq((struct mailimap_msg_att*)clist_content(cur));
+			if (msg_modseq > imap->selected_modseq) {
+				imap->selected_modseq = msg_modseq;
+			}
+		}
+	}
+
+	if (imap->etpan->imap_response_info==NULL) {
+		return;
+	}
+
+	if (imap->etpan->imap_response_info->rsp_extension_list) {
+		for (cur=clist_begin(imap->etpan->imap_response_info->rsp_extension_list); cur!=NULL; cur=clist_next(cur)) {
+			struct mailimap_extension_data* ext_data = (struct mailimap_extension_data*)clist_content(cur);
+			if (ext_data->ext_extension->ext_id==MAILIMAP_EXTENSION_CONDSTORE
+			 && ext_data->ext_type==MAILIMAP_CONDSTORE_TYPE_RESP_TEXT_CODE && ext_data->ext_data) {
+				struct mailimap_condstore_resptextcode* resptextcode = (struct mailimap_condstore_resptextcode*)ext_data->ext_data;
+				if (resptextcode->cs_type==MAILIMAP_CONDSTORE_RESPTEXTCODE_HIGHESTMODSEQ
+				 && resptextcode->cs_data.cs_modseq_value > imap->selected_modseq) {
+					imap->selected_modseq = resptextcode->cs_data.cs_modseq_value;
+				}
+			}
+			else if (ext_data->ext_extension->ext_id==MAILIMAP_EXTENSION_QRESYNC
+			 && ext_data->ext_type==MAILIMAP_QRESYNC_TYPE_VANISHED) {
+				imap->selected_expunged = 1;
+			}
+		}
+	}
+
+	/* without QRESYNC, expunges are not synced at all, with QRESYNC, the server should send VANISHED instead */
+	if (imap->has_qresync && imap->etpan->imap_response_info->rsp_expunged
+	 && clist_count(imap->etpan->imap_response_info->rsp_expunged) > 0) {
+		imap->selected_expunged = 1;
+	}
+}
+
+
 static char* unquote_rfc724_mid(const char* in)
 {
 	/* remove < and > from the given message id */
@@ -319,21 +472,62 @@ static void peek_body(struct mailimap_msg_att* msg_att, char** p_msg, size_t* p_
 }
 
 
-static int fetch_single_msg(dc_imap_t* imap, const char* folder, uint32_t server_uid)
+typedef struct _dc_fetch_item
+{
+	uint32_t uid;
+	uint32_t bytes; /* RFC822.SIZE as returned by the prefetch, used to limit the size of a batch */
+} dc_fetch_item_t;
+
+
+static int cmp_fetch_items(const void* p1, const void* p2)
+{
+	uint32_t uid1 = ((const dc_fetch_item_t*)p1)->uid;
+	uint32_t uid2 = ((const dc_fetch_item_t*)p2)->uid;
+	return uid1<uid2? -1 : (uid1>uid2? 1 : 0);
+}
+
+
+static struct mailimap_set* create_uid_set(const dc_fetch_item_t* items, size_t cnt)
+{
+	/* the items must be sorted by UID; runs of consecutive UIDs are combined to intervals, eg. `3:7,9,12:13` */
+	struct mailimap_set* set = mailimap_set_new_empty();
+	size_t               first = 0, last = 0;
+
+	while (first < cnt) {
+		last = first;
+		while (last+1 < cnt && items[last+1].uid==items[last].uid+1) {
+			last++;
+		}
+
+		if (last==first) {
+			mailimap_set_add_single(set, items[first].uid);
+		}
+		else {
+			mailimap_set_add_interval(set, items[first].uid, items[last].uid);
+		}
+
+		first = last+1;
+	}
+
+	return set;
+}
+
+
+static int download_msg_batch(dc_imap_t* imap, const char* folder, const dc_fetch_item_t* items, size_t cnt, clist** ret_fetch_result)
 {
-	/* the function returns:
+	/* fetch the bodies of all given messages using a single `UID FETCH <set> BODY.PEEK[]`; the items must be sorted by UID.
+	the function returns:
 	    0  the caller should try over again later
-	or  1  if the messages should be treated as received, the caller should not try to read the message again (even if no database entries are returned) */
-	char*       msg_content = NULL;
-	size_t      msg_bytes = 0;
-	int         r = 0;
-	int         retry_later = 0;
-	int         deleted = 0;
-	uint32_t    flags = 0;
-	clist*      fetch_result = NULL;
-	clistiter*  cur;
+	or  1  if the messages should be treated as received, the caller should not try to read them again;
+	       if *ret_fetch_result is set, it must be passed to receive_msg_batch() which takes the ownership */
+	int                  retry_later = 0;
+	int                  r = 0;
+	clist*               fetch_result = NULL;
+	struct mailimap_set* set = NULL;
 
-	if (imap==NULL) {
+	*ret_fetch_result = NULL;
+
+	if (imap==NULL || items==NULL || cnt==0) {
 		goto cleanup;
 	}
 
@@ -341,39 +535,317 @@ static int fetch_single_msg(dc_imap_t* imap, const char* folder, uint32_t server
 		goto cleanup;
 	}
 
-
-	{
-		struct mailimap_set* set = mailimap_set_new_single(server_uid);
-			r = mailimap_uid_fetch(imap->etpan, set, imap->fetch_type_body, &fetch_result);
-		FREE_SET(set);
-	}
+	set = create_uid_set(items, cnt);
+		r = mailimap_uid_fetch(imap->etpan, set, imap->fetch_type_body, &fetch_result);
+	FREE_SET(set);
+	track_selected_modseq(imap, fetch_result);
 
 	if (dc_imap_is_error(imap, r) || fetch_result==NULL) {
 		fetch_result = NULL;
-		dc_log_warning(imap->context, 0, "Error #%i on fetching message #%i from folder \"%s\"; retry=%i.", (int)r, (int)server_uid, folder, (int)imap->should_reconnect);
+		dc_log_warning(imap->context, 0, "Error #%i on fetching %i message(s) #%i..#%i from folder \"%s\"; retry=%i.", (int)r, (int)cnt, (int)items[0].uid, (int)items[cnt-1].uid, folder, (int)imap->should_reconnect);
 		if (imap->should_reconnect) {
 			retry_later = 1; /* maybe we should also retry on other errors, however, we should check this carefully, as this may result in a dead lock! */
 		}
-		goto cleanup; /* this is an error that should be recovered; the caller should try over later to fetch the message again (if there is no such message, we simply get an empty result) */
+		goto cleanup; /* this is an error that should be recovered; the caller should try over later to fetch the messages again (if there is no such message, we simply get an empty result) */
+	}
+
+	*ret_fetch_result = fetch_result;
+
+cleanup:
+	return retry_later? 0 : 1;
+}
+
+
+static void receive_msg_batch(dc_imap_t* imap, const char* folder, const dc_fetch_item_t* items, size_t cnt, clist* fetch_result)
+{
+	/* pass the bodies returned by download_msg_batch() to receive_imf() in UID order and free the fetch result.
+	the function does not use the IMAP connection and may be called from another thread than download_msg_batch() */
+	size_t                    i = 0;
+	clistiter*                cur = NULL;
+	struct mailimap_msg_att** msg_atts = NULL;
+
+	/* assign the returned attributes to the requested UIDs - the server may answer in any order
+	and may add unsolicited FETCH responses (eg. flag changes) which are ignored here */
+	if ((msg_atts=calloc(cnt, sizeof(struct mailimap_msg_att*)))==NULL) {
+		exit(55); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	for (cur=clist_begin(fetch_result); cur!=NULL; cur=clist_next(cur))
+	{
+		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
+		dc_fetch_item_t          key;
+		key.uid = peek_uid(msg_att);
+		const dc_fetch_item_t* item = bsearch(&key, items, cnt, sizeof(dc_fetch_item_t), cmp_fetch_items);
+		if (item) {
+			msg_atts[item-items] = msg_att;
+		}
+	}
+
+	for (i = 0; i < cnt; i++)
+	{
+		char*    msg_content = NULL;
+		size_t   msg_bytes = 0;
+		uint32_t flags = 0;
+		int      deleted = 0;
+
+		if (msg_atts[i]==NULL) {
+			dc_log_warning(imap->context, 0, "Message #%i does not exist in folder \"%s\".", (int)items[i].uid, folder);
+			continue; /* server response is fine, however, there is no such message, do not try to fetch the message again */
+		}
+
+		peek_body(msg_atts[i], &msg_content, &msg_bytes, &flags, &deleted);
+		if (msg_content==NULL  || msg_bytes <= 0 || deleted) {
+			/* dc_log_warning(imap->context, 0, "Message #%i in folder \"%s\" is empty or deleted.", (int)items[i].uid, folder); -- this is a quite usual situation, do not print a warning */
+			continue;
+		}
+
+		imap->receive_imf(imap, msg_content, msg_bytes, folder, items[i].uid, flags);
+	}
+
+	free(msg_atts);
+	FREE_FETCH_LIST(fetch_result);
+}
+
+
+/* The receive pipeline lets the IMAP thread download the next batch while the
+previous batches are parsed, decrypted and added to the database.
+
+Downloaded batches are put to a small ring buffer, a single receiver thread
+takes them from there in order and calls receive_imf() - so messages are
+still received in UID order and one after another.  If the ring buffer is
+full, the IMAP thread waits; this limits the memory to a few batches.
+
+The thread is only started if a folder needs more than one batch,
+dc_receive_pipeline_finish() waits until all batches are received. */
+
+
+#define DC_RECEIVE_PIPELINE_BATCHES 2
+
+
+typedef struct _dc_pipeline_batch
+{
+	const dc_fetch_item_t* items;
+	size_t                 cnt;
+	clist*                 fetch_result;
+} dc_pipeline_batch_t;
+
+
+typedef struct _dc_receive_pipeline
+{
+	dc_imap_t*          imap;
+	const char*         folder;
+
+	int                 thread_started;
+	pthread_t           thread;
+	pthread_mutex_t     mutex;
+	pthread_cond_t      cond;
+
+	dc_pipeline_batch_t ring[DC_RECEIVE_PIPELINE_BATCHES];
+	size_t              ring_first;
+	size_t              ring_cnt;
+	int                 finished;
+} dc_receive_pipeline_t;
+
+
+static void* receive_pipeline_thread(void* arg)
+{
+	dc_receive_pipeline_t* pipeline = (dc_receive_pipeline_t*)arg;
+	dc_pipeline_batch_t    batch;
+
+	while (1)
+	{
+		pthread_mutex_lock(&pipeline->mutex);
+			while (pipeline->ring_cnt==0 && !pipeline->finished) {
+				pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+			}
+
+			if (pipeline->ring_cnt==0) {
+				pthread_mutex_unlock(&pipeline->mutex);
+				break; /* finished and all batches received */
+			}
+
+			batch = pipeline->ring[pipeline->ring_first];
+			pipeline->ring_first = (pipeline->ring_first+1) % DC_RECEIVE_PIPELINE_BATCHES;
+			pipeline->ring_cnt--;
+			pthread_cond_broadcast(&pipeline->cond); /* wake up the IMAP thread if it is waiting for a free slot */
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		receive_msg_batch(pipeline->imap, pipeline->folder, batch.items, batch.cnt, batch.fetch_result);
+	}
+
+	return NULL;
+}
+
+
+static void dc_receive_pipeline_init(dc_receive_pipeline_t* pipeline, dc_imap_t* imap, const char* folder)
+{
+	memset(pipeline, 0, sizeof(dc_receive_pipeline_t));
+	pipeline->imap   = imap;
+	pipeline->folder = folder;
+	pthread_mutex_init(&pipeline->mutex, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+}
+
+
+static void dc_receive_pipeline_add(dc_receive_pipeline_t* pipeline, const dc_fetch_item_t* items, size_t cnt, clist* fetch_result, int is_last_batch)
+{
+	if (!pipeline->thread_started)
+	{
+		if (is_last_batch) {
+			/* nothing to overlap with, receive directly without starting a thread */
+			receive_msg_batch(pipeline->imap, pipeline->folder, items, cnt, fetch_result);
+			return;
+		}
+
+		if (pthread_create(&pipeline->thread, NULL, receive_pipeline_thread, pipeline)!=0) {
+			dc_log_warning(pipeline->imap->context, 0, "Cannot start receive thread, receiving messages directly.");
+			receive_msg_batch(pipeline->imap, pipeline->folder, items, cnt, fetch_result);
+			return;
+		}
+		pipeline->thread_started = 1;
+	}
+
+	pthread_mutex_lock(&pipeline->mutex);
+		while (pipeline->ring_cnt==DC_RECEIVE_PIPELINE_BATCHES) {
+			pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+		}
+
+		dc_pipeline_batch_t* batch = &pipeline->ring[(pipeline->ring_first+pipeline->ring_cnt) % DC_RECEIVE_PIPELINE_BATCHES];
+		batch->items        = items;
+		batch->cnt          = cnt;
+		batch->fetch_result = fetch_result;
+		pipeline->ring_cnt++;
+		pthread_cond_broadcast(&pipeline->cond);
+	pthread_mutex_unlock(&pipeline->mutex);
+}
+
+
+static void dc_receive_pipeline_finish(dc_receive_pipeline_t* pipeline)
+{
+	if (pipeline->thread_started)
+	{
+		pthread_mutex_lock(&pipeline->mutex);
+			pipeline->finished = 1;
+			pthread_cond_broadcast(&pipeline->cond);
+		pthread_mutex_unlock(&pipeline->mutex);
+
+		pthread_join(pipeline->thread, NULL);
+		pipeline->thread_started = 0;
+	}
+
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->mutex);
+}
+
+
+static void report_vanished(dc_imap_t* imap, const char* folder, struct mailimap_qresync_vanished* vanished)
+{
+	clistiter* cur;
+
+	if (vanished==NULL || vanished->qr_known_uids==NULL) {
+		return;
+	}
+
+	for (cur=clist_begin(vanished->qr_known_uids->set_list); cur!=NULL; cur=clist_next(cur))
+	{
+		struct mailimap_set_item* item = (struct mailimap_set_item*)clist_content(cur);
+		uint32_t first_uid = item->set_first, last_uid = item->set_last;
+		if (first_uid==0 /* `*` */) { first_uid = UINT32_MAX; }
+		if (last_uid==0)            { last_uid = UINT32_MAX; }
+		if (first_uid > last_uid)   { uint32_t tmp = first_uid; first_uid = last_uid; last_uid = tmp; }
+		imap->receive_vanished(imap, folder, first_uid, last_uid);
 	}
+}
 
-	if ((cur=clist_begin(fetch_result))==NULL) {
-		dc_log_warning(imap->context, 0, "Message #%i does not exist in folder \"%s\".", (int)server_uid, folder);
-		goto cleanup; /* server response is fine, however, there is no such message, do not try to fetch the message again */
+
+static void sync_flags_from_single_folder(dc_imap_t* imap, const char* folder, uint32_t uidvalidity, int just_selected)
+{
+	/* report flag changes and (with QRESYNC) expunges done by other devices since the last sync;
+	for this purpose, the HIGHESTMODSEQ of the last sync is stored per folder.
+	the folder must be selected; the function does nothing if the server does not support CONDSTORE */
+	int                               r = 0;
+	uint64_t                          modseq = 0;
+	uint64_t                          new_modseq = 0;
+	clist*                            fetch_result = NULL;
+	struct mailimap_qresync_vanished* vanished = NULL;
+	struct mailimap_set*              set = NULL;
+	clistiter*                        cur;
+	int                               changed_cnt = 0;
+
+	if (!imap->has_condstore || imap->selected_modseq==0 /* NOMODSEQ, the mailbox does not support modseqs */) {
+		goto cleanup;
 	}
 
-	struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
-	peek_body(msg_att, &msg_content, &msg_bytes, &flags, &deleted);
-	if (msg_content==NULL  || msg_bytes <= 0 || deleted) {
-		/* dc_log_warning(imap->context, 0, "Message #%i in folder \"%s\" is empty or deleted.", (int)server_uid, folder); -- this is a quite usual situation, do not print a warning */
+	get_config_modseq(imap, folder, uidvalidity, &modseq);
+	if (modseq==0) {
+		/* first sync or UIDVALIDITY changed: start with the HIGHESTMODSEQ from SELECT,
+		the flags of the messages received so far were fetched together with the messages */
+		if (just_selected) {
+			set_config_modseq(imap, folder, uidvalidity, imap->selected_modseq);
+		}
 		goto cleanup;
 	}
 
-	imap->receive_imf(imap, msg_content, msg_bytes, folder, server_uid, flags);
+	if (imap->selected_modseq <= modseq && !imap->selected_expunged) {
+		goto cleanup; /* nothing changed since the last sync as far as we know from SELECT and the untagged responses since then */
+	}
+
+	/* `UID FETCH 1:* (FLAGS) (CHANGEDSINCE <modseq> [VANISHED])`, see RFC 7162;
+	the whole folder is requested as new messages may get flags before we have seen them */
+	set = mailimap_set_new_interval(1, 0);
+		if (imap->has_qresync) {
+			r = mailimap_uid_fetch_qresync(imap->etpan, set, imap->fetch_type_flags, modseq, &fetch_result, &vanished);
+		}
+		else {
+			r = mailimap_uid_fetch_changedsince(imap->etpan, set, imap->fetch_type_flags, modseq, &fetch_result);
+		}
+	FREE_SET(set);
+
+	if (dc_imap_is_error(imap, r) || fetch_result==NULL) {
+		fetch_result = NULL;
+		vanished = NULL;
+		dc_log_warning(imap->context, 0, "Cannot sync flags for folder \"%s\".", folder);
+		goto cleanup; /* the modseq is not updated, we'll try over on the next fetch */
+	}
+
+	/* store the server's HIGHESTMODSEQ as known before the fetch plus the modseqs from the result, all changes up to it are synced now;
+	using the changed messages alone would not advance the modseq eg. for VANISHED-only responses */
+	track_selected_modseq(imap, fetch_result);
+	imap->selected_expunged = 0;
+	new_modseq = imap->selected_modseq;
+
+	for (cur=clist_begin(fetch_result); cur!=NULL; cur=clist_next(cur))
+	{
+		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur);
+		uint32_t uid = peek_uid(msg_att);
+		uint64_t msg_modseq = peek_modseq(msg_att);
+		uint32_t flags = 0;
+		int      deleted = 0;
+		char*    dummy_msg = NULL;
+		size_t   dummy_bytes = 0;
+
+		if (uid==0 || msg_modseq==0) {
+			continue; /* unsolicited FETCH response, eg. during IDLE */
+		}
+
+		peek_body(msg_att, &dummy_msg, &dummy_bytes, &flags, &deleted);
+		if (!deleted) {
+			imap->receive_flags(imap, folder, uid, flags);
+			changed_cnt++;
+		}
+	}
+
+	report_vanished(imap, folder, vanished);
+
+	if (new_modseq > modseq) {
+		set_config_modseq(imap, folder, uidvalidity, new_modseq);
+	}
+
+	dc_log_info(imap->context, 0, "%i flag changes synced from \"%s\", modseq %llu.", changed_cnt, folder, (unsigned long long)new_modseq);
 
 cleanup:
+	if (vanished) { mailimap_qresync_vanished_free(vanished); }
 	FREE_FETCH_LIST(fetch_result);
-	return retry_later? 0 : 1;
 }
 
 
@@ -383,11 +855,20 @@ static int fetch_from_single_folder(dc_imap_t* imap, const char* folder)
 	uint32_t             uidvalidity = 0;
 	uint32_t             lastseenuid = 0;
 	uint32_t             new_lastseenuid = 0;
+	uint32_t             first_error_uid = 0;
 	clist*               fetch_result = NULL;
 	size_t               read_cnt = 0;
 	size_t               read_errors = 0;
 	clistiter*           cur;
 	struct mailimap_set* set = NULL;
+	dc_fetch_item_t*     items = NULL;
+	size_t               items_cnt = 0;
+	size_t               batch_start = 0;
+	size_t               batch_end = 0;
+	int                  batch_max_cnt = 0;
+	int                  batch_max_bytes = 0;
+	dc_receive_pipeline_t pipeline;
+	int                  just_selected = 0;
 
 	if (imap==NULL) {
 		goto cleanup;
@@ -398,6 +879,7 @@ static int fetch_from_single_folder(dc_imap_t* imap, const char* folder)
 		goto cleanup;
 	}
 
+	just_selected = (strcmp(imap->selected_folder, folder)!=0);
 	if (select_folder(imap, folder)==0) {
 		dc_log_warning(imap->context, 0, "Cannot select folder %s for fetching.", folder);
 		goto cleanup;
@@ -472,6 +954,7 @@ static int fetch_from_single_folder(dc_imap_t* imap, const char* folder)
 	set = mailimap_set_new_interval(lastseenuid+1, 0);
 		r = mailimap_uid_fetch(imap->etpan, set, imap->fetch_type_prefetch, &fetch_result);
 	FREE_SET(set);
+	track_selected_modseq(imap, fetch_result);
 
 	if (dc_imap_is_error(imap, r) || fetch_result==NULL)
 	{
@@ -484,7 +967,12 @@ static int fetch_from_single_folder(dc_imap_t* imap, const char* folder)
 		goto cleanup;
 	}
 
-	/* go through all mails in folder (this is typically _fast_ as we already have the whole list) */
+	/* go through all mails in folder (this is typically _fast_ as we already have the whole list);
+	the messages not skipped by the precheck are collected and their bodies are fetched in batches below */
+	if ((items=calloc(clist_count(fetch_result)+1, sizeof(dc_fetch_item_t)))==NULL) {
+		exit(56); /* cannot allocate little memory, unrecoverable error */
+	}
+
 	for (cur = clist_begin(fetch_result); cur!=NULL ; cur = clist_next(cur))
 	{
 		struct mailimap_msg_att* msg_att = (struct mailimap_msg_att*)clist_content(cur); /* mailimap_msg_att is a list of attributes: list is a list of message attributes */
@@ -495,10 +983,9 @@ static int fetch_from_single_folder(dc_imap_t* imap, const char* folder)
 
 			read_cnt++;
 			if (!imap->precheck_imf(imap, rfc724_mid, folder, cur_uid)) {
-				if (fetch_single_msg(imap, folder, cur_uid)==0/* 0=try again later*/) {
-					dc_log_info(imap->context, 0, "Read error for message %s from \"%s\", trying over later.", rfc724_mid, folder);
-					read_errors++; // with read_errors, lastseenuid is not written
-				}
+				items[items_cnt].uid   = cur_uid;
+				items[items_cnt].bytes = peek_size(msg_att);
+				items_cnt++;
 			}
 			else {
 				dc_log_info(imap->context, 0, "Skipping message %s from \"%s\" by precheck.", rfc724_mid, folder);
@@ -512,11 +999,65 @@ static int fetch_from_single_folder(dc_imap_t* imap, const char* folder)
 		}
 	}
 
+	/* the list returned by the server is not guaranteed to be sorted or free of duplicates */
+	qsort(items, items_cnt, sizeof(dc_fetch_item_t), cmp_fetch_items);
+	if (items_cnt > 1) {
+		size_t i, unique_cnt = 1;
+		for (i = 1; i < items_cnt; i++) {
+			if (items[i].uid!=items[unique_cnt-1].uid) {
+				items[unique_cnt++] = items[i];
+			}
+		}
+		items_cnt = unique_cnt;
+	}
+
+	/* fetch the bodies; each batch is limited by the number of messages and by the sum of their sizes,
+	however, a single message exceeding the size limit is fetched alone */
+	batch_max_cnt   = get_config_int(imap, "fetch_batch_cnt", DC_FETCH_BATCH_CNT_DEFAULT);
+	batch_max_bytes = get_config_int(imap, "fetch_batch_bytes", DC_FETCH_BATCH_BYTES_DEFAULT);
+	if (batch_max_cnt < 1)   { batch_max_cnt = 1; }
+	if (batch_max_bytes < 1) { batch_max_bytes = 1; }
+	dc_receive_pipeline_init(&pipeline, imap, folder);
+	for (batch_start = 0; batch_start < items_cnt; batch_start = batch_end)
+	{
+		size_t batch_bytes = 0;
+		for (batch_end = batch_start; batch_end < items_cnt; batch_end++) {
+			if (batch_end > batch_start /* the first message is always added */
+			 && (batch_end-batch_start >= (size_t)batch_max_cnt || batch_bytes+items[batch_end].bytes > (size_t)batch_max_bytes)) {
+				break;
+			}
+			batch_bytes += items[batch_end].bytes;
+		}
+
+		clist* batch_result = NULL;
+		if (download_msg_batch(imap, folder, &items[batch_start], batch_end-batch_start, &batch_result)==0) {
+			/* the connection is lost, do not try the remaining batches */
+			dc_log_info(imap->context, 0, "Read error for messages #%i..#%i from \"%s\", trying over later.", (int)items[batch_start].uid, (int)items[items_cnt-1].uid, folder);
+			read_errors = items_cnt-batch_start;
+			first_error_uid = items[batch_start].uid;
+			break;
+		}
+
+		if (batch_result) {
+			dc_receive_pipeline_add(&pipeline, &items[batch_start], batch_end-batch_start, batch_result, batch_end==items_cnt);
+		}
+	}
+
+	/* lastseenuid must not be written before the messages are in the database */
+	dc_receive_pipeline_finish(&pipeline);
+
 	if (!read_errors && new_lastseenuid > 0) {
-		// TODO: it might be better to increase the lastseenuid also on partial errors.
-		// however, this requires to sort the list before going through it above.
 		set_config_lastseenuid(imap, folder, uidvalidity, new_lastseenuid);
 	}
+	else if (read_errors && first_error_uid-1 > lastseenuid) {
+		// as the messages are fetched in UID order, all messages before the first error are done;
+		// the other messages are checked again on the next fetch (the precheck skips the ones already received)
+		set_config_lastseenuid(imap, folder, uidvalidity, first_error_uid-1);
+	}
+
+	if (!read_errors) {
+		sync_flags_from_single_folder(imap, folder, uidvalidity, just_selected);
+	}
 
 	/* done */
 cleanup:
@@ -528,6 +1069,7 @@ cleanup:
 		dc_log_info(imap->context, 0, "%i mails read from \"%s\".", (int)read_cnt, folder);
 	}
 
+	free(items);
 	FREE_FETCH_LIST(fetch_result);
 	return read_cnt;
 }
@@ -658,6 +1200,7 @@ void dc_imap_idle(dc_imap_t* imap)
 
 		r = mailstream_wait_idle(imap->etpan->imap_stream, IDLE_DELAY_SECONDS);
 		r2 = mailimap_idle_done(imap->etpan);
+		track_selected_modseq(imap, NULL);
 
 		if (r==MAILSTREAM_IDLE_ERROR /*0*/ || r==MAILSTREAM_IDLE_CANCELLED /*4*/) {
 			dc_log_info(imap->context, 0, "IMAP-IDLE wait cancelled, r=%i, r2=%i; we'll reconnect soon.", r, r2);
@@ -707,11 +1250,237 @@ void dc_imap_interrupt_idle(dc_imap_t* imap)
 }
 
 
+/*******************************************************************************
+ * Compression and traffic counters
+ ******************************************************************************/
+
+
+/* the counting stream sits on top of another mailstream_low and sums up the
+bytes read from and written to it.  one counting stream is put directly on
+the network connection and counts the wire bytes - and the payload bytes as long
+as the connection is not compressed.  if COMPRESS=DEFLATE is enabled, a second
+counting stream is put on top of the compressing stream to count the payload
+bytes. */
+
+
+typedef struct _dc_counting_stream
+{
+	mailstream_low* inner;
+	dc_imap_t*      imap;
+	int             counts_wire;
+} dc_counting_stream_t;
+
+
+static ssize_t counting_read(mailstream_low* s, void* buf, size_t count)
+{
+	dc_counting_stream_t* data = (dc_counting_stream_t*)s->data;
+	ssize_t r = mailstream_low_read(data->inner, buf, count);
+	if (r > 0) {
+		if (data->counts_wire) { data->imap->wire_bytes_received += r; }
+		if (!data->counts_wire || !data->imap->compressed) { data->imap->payload_bytes_received += r; }
+	}
+	return r;
+}
+
+
+static ssize_t counting_write(mailstream_low* s, const void* buf, size_t count)
+{
+	dc_counting_stream_t* data = (dc_counting_stream_t*)s->data;
+	ssize_t r = mailstream_low_write(data->inner, buf, count);
+	if (r > 0) {
+		if (data->counts_wire) { data->imap->wire_bytes_sent += r; }
+		if (!data->counts_wire || !data->imap->compressed) { data->imap->payload_bytes_sent += r; }
+	}
+	return r;
+}
+
+
+static int counting_close(mailstream_low* s)
+{
+	return mailstream_low_close(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static int counting_get_fd(mailstream_low* s)
+{
+	return mailstream_low_get_fd(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static void counting_free(mailstream_low* s)
+{
+	dc_counting_stream_t* data = (dc_counting_stream_t*)s->data;
+	mailstream_low_free(data->inner);
+	free(data);
+	free(s);
+}
+
+
+static void counting_cancel(mailstream_low* s)
+{
+	mailstream_low_cancel(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static struct mailstream_cancel* counting_get_cancel(mailstream_low* s)
+{
+	return mailstream_low_get_cancel(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static carray* counting_get_certificate_chain(mailstream_low* s)
+{
+	return mailstream_low_get_certificate_chain(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static int counting_setup_idle(mailstream_low* s)
+{
+	return mailstream_low_setup_idle(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static int counting_unsetup_idle(mailstream_low* s)
+{
+	return mailstream_low_unsetup_idle(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static int counting_interrupt_idle(mailstream_low* s)
+{
+	return mailstream_low_interrupt_idle(((dc_counting_stream_t*)s->data)->inner);
+}
+
+
+static mailstream_low_driver s_counting_driver = {
+	counting_read,
+	counting_write,
+	counting_close,
+	counting_get_fd,
+	counting_free,
+	counting_cancel,
+	counting_get_cancel,
+	counting_get_certificate_chain,
+	counting_setup_idle,
+	counting_unsetup_idle,
+	counting_interrupt_idle
+};
+
+
+static void add_counting_stream(dc_imap_t* imap, int counts_wire)
+{
+	dc_counting_stream_t* data = NULL;
+	mailstream_low*       low = NULL;
+
+	if ((data=calloc(1, sizeof(dc_counting_stream_t)))==NULL) {
+		exit(57); /* cannot allocate little memory, unrecoverable error */
+	}
+
+	data->inner       = mailstream_get_low(imap->etpan->imap_stream);
+	data->imap        = imap;
+	data->counts_wire = counts_wire;
+
+	if ((low=mailstream_low_new(data, &s_counting_driver))==NULL) {
+		exit(58);
+	}
+	mailstream_low_set_timeout(low, mailstream_low_get_timeout(data->inner));
+	mailstream_set_low(imap->etpan->imap_stream, low);
+}
+
+
+static void compress_if_possible(dc_imap_t* imap)
+{
+	/* `COMPRESS DEFLATE`, see RFC 4978; must be done after login and before any other command that may be compressed */
+	imap->compressed = 0;
+
+	if (!get_config_int(imap, "imap_compress", DC_IMAP_COMPRESS_DEFAULT)
+	 || !mailimap_has_compress_deflate(imap->etpan)) {
+		return;
+	}
+
+	int r = mailimap_compress(imap->etpan);
+	if (dc_imap_is_error(imap, r)) {
+		dc_log_info(imap->context, 0, "Cannot enable IMAP compression; code=%i.", (int)r);
+		return;
+	}
+
+	imap->compressed = 1;
+	add_counting_stream(imap, 0);
+	dc_log_info(imap->context, 0, "IMAP compression enabled.");
+}
+
+
+static void log_traffic(dc_imap_t* imap)
+{
+	char* traffic = dc_imap_get_traffic_str(imap);
+	dc_log_info(imap->context, 0, "IMAP traffic: %s", traffic);
+	free(traffic);
+}
+
+
+/**
+ * Get a human readable description of the traffic of all connections
+ * done by this IMAP object so far.  Used for debugging and statistics.
+ *
+ * @private @memberof dc_imap_t
+ * @param imap The IMAP object.
+ * @return String to be free()'d by the caller.
+ */
+char* dc_imap_get_traffic_str(const dc_imap_t* imap)
+{
+	if (imap==NULL) {
+		return dc_strdup("");
+	}
+
+	#define DC_PERCENT_SAVED(wire, payload) ((payload)>(wire)? (int)(((payload)-(wire))*100/(payload)) : 0)
+	char* ret = dc_mprintf("received %llu bytes (%llu bytes uncompressed, %i%% saved), sent %llu bytes (%llu bytes uncompressed, %i%% saved)",
+		(unsigned long long)imap->wire_bytes_received, (unsigned long long)imap->payload_bytes_received,
+		DC_PERCENT_SAVED(imap->wire_bytes_received, imap->payload_bytes_received),
+		(unsigned long long)imap->wire_bytes_sent, (unsigned long long)imap->payload_bytes_sent,
+		DC_PERCENT_SAVED(imap->wire_bytes_sent, imap->payload_bytes_sent));
+	#undef DC_PERCENT_SAVED
+
+	return ret;
+}
+
+
 /*******************************************************************************
  * Setup handle
  ******************************************************************************/
 
 
+static void enable_qresync_if_possible(dc_imap_t* imap)
+{
+	/* QRESYNC must be enabled for each session, it implies CONDSTORE, see RFC 7162 */
+	struct mailimap_capability_data* capabilities = NULL;
+	struct mailimap_capability_data* result = NULL;
+	clist*                           cap_list = NULL;
+
+	imap->has_condstore = mailimap_has_condstore(imap->etpan);
+	imap->has_qresync   = 0;
+
+	if (!mailimap_has_qresync(imap->etpan) || !mailimap_has_enable(imap->etpan)) {
+		return;
+	}
+
+	cap_list = clist_new();
+	clist_append(cap_list, mailimap_capability_new(MAILIMAP_CAPABILITY_NAME, NULL, dc_strdup("QRESYNC")));
+	capabilities = mailimap_capability_data_new(cap_list);
+
+	int r = mailimap_enable(imap->etpan, capabilities, &result);
+	if (dc_imap_is_error(imap, r)) {
+		dc_log_info(imap->context, 0, "Cannot enable QRESYNC.");
+	}
+	else {
+		imap->has_qresync   = 1;
+		imap->has_condstore = 1;
+	}
+
+	mailimap_capability_data_free(capabilities);
+	if (result) { mailimap_capability_data_free(result); }
+}
+
+
 static int setup_handle_if_needed(dc_imap_t* imap)
 {
 	int r = 0;
@@ -769,6 +1538,8 @@ static int setup_handle_if_needed(dc_imap_t* imap)
 		dc_log_info(imap->context, 0, "IMAP-server %s:%i SSL-connected.", imap->imap_server, (int)imap->imap_port);
 	}
 
+	add_counting_stream(imap, 1);
+
 	/* TODO: There are more authorisation types, see mailcore2/MCIMAPSession.cpp, however, I'm not sure of they are really all needed */
 	/*if (imap->server_flags&DC_LP_AUTH_XOAUTH2)
 	{
@@ -795,6 +1566,9 @@ static int setup_handle_if_needed(dc_imap_t* imap)
 		goto cleanup;
 	}
 
+	compress_if_possible(imap);
+	enable_qresync_if_possible(imap);
+
 	dc_log_event(imap->context, DC_EVENT_IMAP_CONNECTED, 0,
                  "IMAP-login as %s ok.", imap->imap_user);
 
@@ -832,9 +1606,15 @@ static void unsetup_handle(dc_imap_t* imap)
 		imap->etpan = NULL;
 
 		dc_log_info(imap->context, 0, "IMAP disconnected.");
+		log_traffic(imap);
 	}
 
+	imap->compressed = 0;
+
 	imap->selected_folder[0] = 0;
+	imap->selected_modseq = 0;
+	imap->has_condstore = 0;
+	imap->has_qresync = 0;
 
 	/* we leave sent_folder set; normally this does not change in a normal reconnect; we'll update this folder if we get errors */
 }
@@ -972,6 +1752,7 @@ void dc_imap_set_watch_folder(dc_imap_t* imap, const char* watch_folder)
 
 dc_imap_t* dc_imap_new(dc_get_config_t get_config, dc_set_config_t set_config,
                        dc_precheck_imf_t precheck_imf, dc_receive_imf_t receive_imf,
+                       dc_receive_flags_t receive_flags, dc_receive_vanished_t receive_vanished,
                        void* userData, dc_context_t* context)
 {
 	dc_imap_t* imap = NULL;
@@ -987,6 +1768,8 @@ dc_imap_t* dc_imap_new(dc_get_config_t get_config, dc_set_config_t set_config,
 	imap->set_config     = set_config;
 	imap->precheck_imf   = precheck_imf;
 	imap->receive_imf    = receive_imf;
+	imap->receive_flags  = receive_flags;
+	imap->receive_vanished = receive_vanished;
 	imap->userData       = userData;
 
 	pthread_mutex_init(&imap->watch_condmutex, NULL);
@@ -1009,6 +1792,7 @@ dc_imap_t* dc_imap_new(dc_get_config_t get_config, dc_set_config_t set_config,
 	imap->fetch_type_prefetch = mailimap_fetch_type_new_fetch_att_list_empty();
 	mailimap_fetch_type_new_fetch_att_list_add(imap->fetch_type_prefetch, mailimap_fetch_att_new_uid());
 	mailimap_fetch_type_new_fetch_att_list_add(imap->fetch_type_prefetch, mailimap_fetch_att_new_envelope());
+	mailimap_fetch_type_new_fetch_att_list_add(imap->fetch_type_prefetch, mailimap_fetch_att_new_rfc822_size());
 
 	// object to fetch flags and body
 	imap->fetch_type_body = mailimap_fetch_type_new_fetch_att_list_empty();
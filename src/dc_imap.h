@@ -24,8 +24,15 @@ typedef int      (*dc_precheck_imf_t)  (dc_imap_t*, const char* rfc724_mid,
                                         uint32_t server_uid);
 
 #define DC_IMAP_SEEN 0x0001L
+/* receive_imf() may be called from a receiver thread while the IMAP thread downloads the next messages;
+calls are never done in parallel and are done in UID order for each folder */
 typedef void     (*dc_receive_imf_t)   (dc_imap_t*, const char* imf_raw_not_terminated, size_t imf_raw_bytes, const char* server_folder, uint32_t server_uid, uint32_t flags);
 
+/* flag changes and expunges of already received messages, only reported by servers supporting CONDSTORE resp. QRESYNC;
+the UID range passed to receive_vanished() may contain UIDs never seen before */
+typedef void     (*dc_receive_flags_t)    (dc_imap_t*, const char* server_folder, uint32_t server_uid, uint32_t flags);
+typedef void     (*dc_receive_vanished_t) (dc_imap_t*, const char* server_folder, uint32_t first_uid, uint32_t last_uid);
+
 
 /**
  * Library-internal.
@@ -50,6 +57,10 @@ struct _dc_imap
 
 	int                   can_idle;
 	int                   has_xlist;
+	int                   has_condstore;
+	int                   has_qresync;   /* QRESYNC is ENABLEd on login if supported, implies has_condstore */
+	uint64_t              selected_modseq; /* HIGHESTMODSEQ of selected_folder as known from SELECT and later untagged responses, 0 if unknown */
+	int                   selected_expunged; /* 1=EXPUNGE or VANISHED received for selected_folder since the last flag sync */
 	char                  imap_delimiter;/* IMAP Path separator. Set as a side-effect during configure() */
 
 	char*                 watch_folder;
@@ -65,12 +76,20 @@ struct _dc_imap
 	dc_set_config_t       set_config;
 	dc_precheck_imf_t     precheck_imf;
 	dc_receive_imf_t      receive_imf;
+	dc_receive_flags_t    receive_flags;
+	dc_receive_vanished_t receive_vanished;
 	void*                 userData;
 	dc_context_t*         context;
 
 	int                   log_connect_errors;
 	int                   skip_log_capabilities;
 
+	int                   compressed;  /* COMPRESS=DEFLATE is active on the current connection */
+	uint64_t              wire_bytes_received;    /* bytes transferred over the network, summed up over all connections, */
+	uint64_t              wire_bytes_sent;        /* if the connection is compressed, these are the compressed bytes */
+	uint64_t              payload_bytes_received; /* bytes exchanged with the IMAP protocol, */
+	uint64_t              payload_bytes_sent;     /* without compression, these are equal to the wire bytes */
+
 };
 
 
@@ -84,6 +103,7 @@ typedef enum {
 
 dc_imap_t* dc_imap_new               (dc_get_config_t, dc_set_config_t,
                                       dc_precheck_imf_t, dc_receive_imf_t,
+                                      dc_receive_flags_t, dc_receive_vanished_t,
                                       void* userData, dc_context_t*);
 void       dc_imap_unref             (dc_imap_t*);
 
@@ -104,6 +124,7 @@ dc_imap_res dc_imap_set_mdnsent  (dc_imap_t*, const char* folder, uint32_t uid);
 int        dc_imap_delete_msg        (dc_imap_t*, const char* rfc724_mid, const char* folder, uint32_t server_uid); /* only returns 0 on connection problems; we should try later again in this case */
 
 int        dc_imap_is_error          (dc_imap_t* imap, int code);
+char*      dc_imap_get_traffic_str   (const dc_imap_t*);
 
 
 #ifdef __cplusplus
@@ -557,6 +557,7 @@ static int set_self_key(dc_context_t* context, const char* armored, int set_defa
 	sqlite3_step(stmt);
 	sqlite3_finalize(stmt);
 	stmt = NULL;
+	dc_pgp_clear_key_cache(context); /* the deleted keys may still be in memory */
 
 	if (set_default) {
 		dc_sqlite3_execute(context->sql, "UPDATE keypairs SET is_default=0;"); /* if the new key should be the default key, all other should not */
@@ -830,7 +831,6 @@ The macro avoids weird values of 0% or 100% while still working. */
 static int export_backup(dc_context_t* context, const char* dir)
 {
 	int            success = 0;
-	int            closed = 0;
 	char*          dest_pathNfilename = NULL;
 	dc_sqlite3_t*  dest_sql = NULL;
 	time_t         now = time(NULL);
@@ -865,17 +865,13 @@ static int export_backup(dc_context_t* context, const char* dir)
 	/* vacuum before export; this fixed failed vacuum's on previous import */
 	dc_sqlite3_try_execute(context->sql, "VACUUM;");
 
-	/* temporary lock and close the source (we just make a copy of the whole file, this is the fastest and easiest approach) */
-	dc_sqlite3_close(context->sql);
-	closed = 1;
-
-		dc_log_info(context, 0, "Backup \"%s\" to \"%s\".", context->dbfile, dest_pathNfilename);
-		if (!dc_copy_file(context, context->dbfile, dest_pathNfilename)) {
-			goto cleanup; /* error already logged */
-		}
-
-	dc_sqlite3_open(context->sql, context->dbfile, 0);
-	closed = 0;
+	/* copy the database using the online backup, this also copies changes that are not yet checkpointed from the WAL file
+	and does not require closing the source */
+	dc_log_info(context, 0, "Backup \"%s\" to \"%s\".", context->dbfile, dest_pathNfilename);
+	if (!dc_sqlite3_backup(context->sql, dest_pathNfilename)) {
+		delete_dest_file = 1;
+		goto cleanup; /* error already logged */
+	}
 
 	/* add all files as blobs to the database copy (this does not require the source to be locked, neigher the destination as it is used only here) */
 	if ((dest_sql=dc_sqlite3_new(context/*for logging only*/))==NULL
@@ -955,13 +951,14 @@ static int export_backup(dc_context_t* context, const char* dir)
 	/* done - set some special config values (do this last to avoid importing crashed backups) */
 	dc_sqlite3_set_config_int(dest_sql, "backup_time", now);
 
+	/* dc_sqlite3_open() has switched the copy to WAL mode, switch back so that the backup is a single file */
+	dc_sqlite3_execute(dest_sql, "PRAGMA journal_mode=DELETE;");
+
 	context->cb(context, DC_EVENT_IMEX_FILE_WRITTEN, (uintptr_t)dest_pathNfilename, 0);
 	success = 1;
 
 cleanup:
 	if (dir_handle) { closedir(dir_handle); }
-	if (closed) { dc_sqlite3_open(context->sql, context->dbfile, 0); }
-
 	sqlite3_finalize(stmt);
 	dc_sqlite3_close(dest_sql);
 	dc_sqlite3_unref(dest_sql);
@@ -1004,6 +1001,16 @@ static int import_backup(dc_context_t* context, const char* backup_to_import)
 
 	dc_delete_file(context, context->dbfile);
 
+	/* normally, the WAL files are deleted on close, however, they may be left after a crash */
+	{
+		char* wal_file = dc_mprintf("%s-wal", context->dbfile);
+		char* shm_file = dc_mprintf("%s-shm", context->dbfile);
+		if (dc_file_exist(context, wal_file)) { dc_delete_file(context, wal_file); }
+		if (dc_file_exist(context, shm_file)) { dc_delete_file(context, shm_file); }
+		free(wal_file);
+		free(shm_file);
+	}
+
 	if (dc_file_exist(context, context->dbfile)) {
 		dc_log_error(context, 0, "Cannot import backups: Cannot delete the old file.");
 		goto cleanup;
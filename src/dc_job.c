@@ -288,6 +288,8 @@ static void dc_job_do_DC_JOB_SEND_MSG_TO_SMTP(dc_context_t* context, dc_job_t* j
 			dc_msg_save_param_to_disk(mimefactory.msg);
 		}
 
+		dc_e2ee_save_gossiped_keys(context, mimefactory.msg->chat_id, mimefactory.out_gossiped_keys, mimefactory.out_gossiped_all);
+
 		// TODO: add to keyhistory
 		dc_add_to_keyhistory(context, NULL, 0, NULL, NULL);
 
@@ -440,7 +442,11 @@ void dc_job_add(dc_context_t* context, int action, int foreign_id, const char* p
 	sqlite3_step(stmt);
 	sqlite3_finalize(stmt);
 
-	if (thread==DC_IMAP_THREAD) {
+	if (dc_sqlite3_owns_transaction(context->sql)) {
+		/* the job is not visible to the job threads before commit, dc_sqlite3_commit() interrupts them */
+		context->sql->transaction_interrupts |= (thread==DC_IMAP_THREAD)? DC_INTERRUPT_IMAP : DC_INTERRUPT_SMTP;
+	}
+	else if (thread==DC_IMAP_THREAD) {
 		dc_interrupt_imap_idle(context);
 	}
 	else {
@@ -519,7 +525,7 @@ static void dc_job_perform(dc_context_t* context, int thread, int probe_network)
 		// processing for first-try and after backoff-timeouts:
 		// process jobs in the order they were added.
 		#define FIELDS "id, action, foreign_id, param, added_timestamp, desired_timestamp, tries"
-		select_stmt = dc_sqlite3_prepare(context->sql,
+		select_stmt = dc_sqlite3_borrow_stmt(context->sql,
 			"SELECT " FIELDS " FROM jobs"
 			" WHERE thread=? AND desired_timestamp<=?"
 			" ORDER BY action DESC, added_timestamp;");
@@ -530,7 +536,7 @@ static void dc_job_perform(dc_context_t* context, int thread, int probe_network)
 		// processing after call to dc_maybe_network():
 		// process _all_ pending jobs that failed before
 		// in the order of their backoff-times.
-		select_stmt = dc_sqlite3_prepare(context->sql,
+		select_stmt = dc_sqlite3_borrow_stmt(context->sql,
 			"SELECT " FIELDS " FROM jobs"
 			" WHERE thread=? AND tries>0"
 			" ORDER BY desired_timestamp, action DESC;");
@@ -555,7 +561,7 @@ static void dc_job_perform(dc_context_t* context, int thread, int probe_network)
 		// - they can be re-executed one time AT_ONCE, but they are not save in the database for later execution
 		if (IS_EXCLUSIVE_JOB) {
 			dc_job_kill_action(context, job.action);
-			sqlite3_finalize(select_stmt);
+			dc_sqlite3_return_stmt(context->sql, select_stmt);
 			select_stmt = NULL;
 			dc_jobthread_suspend(&context->sentbox_thread, 1);
 			dc_jobthread_suspend(&context->mvbox_thread, 1);
@@ -576,6 +582,8 @@ static void dc_job_perform(dc_context_t* context, int thread, int probe_network)
 				case DC_JOB_CONFIGURE_IMAP:       dc_job_do_DC_JOB_CONFIGURE_IMAP       (context, &job); break;
 				case DC_JOB_IMEX_IMAP:            dc_job_do_DC_JOB_IMEX_IMAP            (context, &job); break;
 				case DC_JOB_HOUSEKEEPING:         dc_housekeeping                       (context);       break;
+				case DC_JOB_BUILD_SEARCH_INDEX:   dc_build_search_index                 (context);       break;
+				case DC_JOB_COMPACT_MSGS:         dc_compact_msgs                       (context);       break;
 			}
 
 			if (job.try_again!=DC_AT_ONCE) {
@@ -638,7 +646,7 @@ static void dc_job_perform(dc_context_t* context, int thread, int probe_network)
 cleanup:
 	dc_param_unref(job.param);
 	free(job.pending_error);
-	sqlite3_finalize(select_stmt);
+	if (context) { dc_sqlite3_return_stmt(context->sql, select_stmt); }
 }
 
 
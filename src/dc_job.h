@@ -12,6 +12,8 @@ extern "C" {
 
 // jobs in the INBOX-thread
 #define DC_JOB_HOUSEKEEPING           105    // low priority ...
+#define DC_JOB_BUILD_SEARCH_INDEX     106
+#define DC_JOB_COMPACT_MSGS           107
 #define DC_JOB_DELETE_MSG_ON_IMAP     110
 #define DC_JOB_MARKSEEN_MDN_ON_IMAP   120
 #define DC_JOB_MARKSEEN_MSG_ON_IMAP   130
@@ -111,8 +111,8 @@ int dc_key_set_from_stmt(dc_key_t* key, sqlite3_stmt* stmt, int index, int type)
 
 int dc_key_set_from_base64(dc_key_t* key, const char* base64, int type)
 {
-	size_t indx = 0, result_len = 0;
-	char* result = NULL;
+	size_t base64_bytes = 0, result_len = 0;
+	char*  result = NULL;
 
 	dc_key_empty(key);
 
@@ -120,13 +120,18 @@ int dc_key_set_from_base64(dc_key_t* key, const char* base64, int type)
 		return 0;
 	}
 
-	if (mailmime_base64_body_parse(base64, strlen(base64), &indx, &result/*must be freed using mmap_string_unref()*/, &result_len)!=MAILIMF_NO_ERROR
-	 || result==NULL || result_len==0) {
+	base64_bytes = strlen(base64);
+	if ((result=malloc(DC_DECODE_BASE64_MAX_BYTES(base64_bytes)))==NULL) {
+		exit(73);
+	}
+
+	if ((result_len=dc_decode_base64(base64, base64_bytes, result, NULL))==0) {
+		free(result);
 		return 0; /* bad key */
 	}
 
 	dc_key_set_from_binary(key, result, result_len, type);
-	mmap_string_unref(result);
+	free(result);
 
 	return 1;
 }
@@ -284,6 +289,96 @@ cleanup:
 }
 
 
+int dc_key_save_spare_keypair(const dc_key_t* public_key, const dc_key_t* private_key, const char* addr, dc_sqlite3_t* sql)
+{
+	int           success = 0;
+	sqlite3_stmt* stmt = NULL;
+
+	if (public_key==NULL || private_key==NULL || addr==NULL || sql==NULL
+	 || public_key->binary==NULL || private_key->binary==NULL) {
+		goto cleanup;
+	}
+
+	stmt = dc_sqlite3_prepare(sql,
+		"INSERT INTO spare_keypairs (addr, public_key, private_key, created) VALUES (?,?,?,?);");
+	sqlite3_bind_text (stmt, 1, addr, -1, SQLITE_STATIC);
+	sqlite3_bind_blob (stmt, 2, public_key->binary, public_key->bytes, SQLITE_STATIC);
+	sqlite3_bind_blob (stmt, 3, private_key->binary, private_key->bytes, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 4, time(NULL));
+	if (sqlite3_step(stmt)!=SQLITE_DONE) {
+		goto cleanup;
+	}
+
+	success = 1;
+
+cleanup:
+	sqlite3_finalize(stmt);
+	return success;
+}
+
+
+/* load the oldest spare keypair generated for the given address and remove it from the spare keypairs;
+the caller is responsible for saving the keypair using dc_key_save_self_keypair() */
+int dc_key_take_spare_keypair(dc_key_t* public_key, dc_key_t* private_key, const char* addr, dc_sqlite3_t* sql)
+{
+	int           success = 0;
+	sqlite3_stmt* stmt = NULL;
+	int           id = 0;
+
+	if (public_key==NULL || private_key==NULL || addr==NULL || sql==NULL) {
+		goto cleanup;
+	}
+
+	dc_key_empty(public_key);
+	dc_key_empty(private_key);
+	stmt = dc_sqlite3_prepare(sql,
+		"SELECT id, public_key, private_key FROM spare_keypairs WHERE addr=? ORDER BY id LIMIT 1;");
+	sqlite3_bind_text (stmt, 1, addr, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt)!=SQLITE_ROW) {
+		goto cleanup;
+	}
+	id = sqlite3_column_int(stmt, 0);
+	dc_key_set_from_stmt(public_key, stmt, 1, DC_KEY_PUBLIC);
+	dc_key_set_from_stmt(private_key, stmt, 2, DC_KEY_PRIVATE);
+	sqlite3_finalize(stmt);
+
+	stmt = dc_sqlite3_prepare(sql,
+		"DELETE FROM spare_keypairs WHERE id=?;");
+	sqlite3_bind_int  (stmt, 1, id);
+	if (sqlite3_step(stmt)!=SQLITE_DONE) {
+		goto cleanup;
+	}
+
+	success = 1;
+
+cleanup:
+	sqlite3_finalize(stmt);
+	return success;
+}
+
+
+int dc_key_has_spare_keypair(const char* addr, dc_sqlite3_t* sql)
+{
+	int           has_spare = 0;
+	sqlite3_stmt* stmt = NULL;
+
+	if (addr==NULL || sql==NULL) {
+		goto cleanup;
+	}
+
+	stmt = dc_sqlite3_prepare(sql,
+		"SELECT id FROM spare_keypairs WHERE addr=?;");
+	sqlite3_bind_text (stmt, 1, addr, -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt)==SQLITE_ROW) {
+		has_spare = 1;
+	}
+
+cleanup:
+	sqlite3_finalize(stmt);
+	return has_spare;
+}
+
+
 /*******************************************************************************
  * Render keys
  ******************************************************************************/
@@ -315,9 +410,7 @@ char* dc_render_base64(const void* buf, size_t buf_bytes, int break_every, const
 		goto cleanup;
 	}
 
-	if ((ret = encode_base64((const char*)buf, buf_bytes))==NULL) {
-		goto cleanup;
-	}
+	ret = dc_encode_base64(buf, buf_bytes, break_every, break_chars);
 
 	#if 0
 	if (add_checksum==1/*appended checksum*/) {
@@ -334,12 +427,6 @@ char* dc_render_base64(const void* buf, size_t buf_bytes, int break_every, const
 	}
 	#endif
 
-	if (break_every>0) {
-		char* temp = ret;
-			ret = dc_insert_breaks(temp, break_every, break_chars);
-		free(temp);
-	}
-
 	if (add_checksum==2/*checksum with break character*/) {
 		long checksum = crc_octets(buf, buf_bytes);
 		uint8_t c[3];
@@ -56,7 +56,8 @@ int dc_keyring_load_self_private_for_decrypting(dc_keyring_t* keyring, const cha
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = dc_sqlite3_prepare(sql,
+	/* called for each encrypted message, the parsing of the keys is avoided by the key cache in dc_pgp.c */
+	sqlite3_stmt* stmt = dc_sqlite3_borrow_stmt(sql,
 		"SELECT private_key FROM keypairs ORDER BY addr=? DESC, is_default DESC;");
 	sqlite3_bind_text (stmt, 1, self_addr, -1, SQLITE_STATIC);
 	while (sqlite3_step(stmt) == SQLITE_ROW) {
@@ -66,7 +67,7 @@ int dc_keyring_load_self_private_for_decrypting(dc_keyring_t* keyring, const cha
 			}
 		dc_key_unref(key); /* unref in any case, dc_keyring_add() adds its own reference */
 	}
-	sqlite3_finalize(stmt);
+	dc_sqlite3_return_stmt(sql, stmt);
 
 	return 1;
 }
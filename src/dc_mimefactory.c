@@ -69,6 +69,9 @@ void dc_mimefactory_empty(dc_mimefactory_t* factory)
 		factory->out = NULL;
 	}
 	factory->out_encrypted = 0;
+	dc_e2ee_free_gossiped_keys(factory->out_gossiped_keys);
+	factory->out_gossiped_keys = NULL;
+	factory->out_gossiped_all = 0;
 	factory->loaded = DC_MF_NOTHING_LOADED;
 
 	free(factory->error);
@@ -761,11 +764,15 @@ int dc_mimefactory_render(dc_mimefactory_t* factory)
 	mailimf_fields_add(imf_fields, mailimf_field_new(MAILIMF_FIELD_SUBJECT, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, subject, NULL, NULL, NULL));
 
 	if (force_plaintext!=DC_FP_NO_AUTOCRYPT_HEADER) {
-		dc_e2ee_encrypt(factory->context, factory->recipients_addr, force_plaintext, e2ee_guaranteed, min_verified, message, &e2ee_helper);
+		dc_e2ee_encrypt(factory->context, factory->loaded==DC_MF_MSG_LOADED? factory->msg->chat_id : 0,
+			factory->recipients_addr, force_plaintext, e2ee_guaranteed, min_verified, message, &e2ee_helper);
 	}
 
 	if (e2ee_helper.encryption_successfull) {
 		factory->out_encrypted = 1;
+		factory->out_gossiped_keys = e2ee_helper.gossiped_keys; // takes ownership
+		factory->out_gossiped_all = e2ee_helper.gossiped_all;
+		e2ee_helper.gossiped_keys = NULL;
 	}
 
 	/* create the full mail and return */
@@ -52,6 +52,8 @@ struct _dc_mimefactory {
 	// out: after a call to dc_mimefactory_render(), here's the data or the error
 	MMAPString*   out;
 	int           out_encrypted;
+	dc_hash_t*    out_gossiped_keys; // keys gossiped by the message, see dc_e2ee_save_gossiped_keys()
+	int           out_gossiped_all;
 	char*         error;
 
 	/* private */
@@ -1,8 +1,13 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "dc_context.h"
 #include "dc_mimeparser.h"
 #include "dc_mimefactory.h"
 #include "dc_pgp.h"
 #include "dc_simplify.h"
+#include "dc_strencode.h"
 
 
 static void hash_header(dc_hash_t* out, const struct mailimf_fields* in, dc_context_t* context);
@@ -487,6 +492,44 @@ struct mailmime_parameter* mailmime_find_ct_parameter(struct mailmime* mime, con
 }
 
 
+static int mailmime_get_transfer_encoding(struct mailmime* mime)
+{
+	if (mime->mm_mime_fields!=NULL) {
+		clistiter* cur;
+		for (cur = clist_begin(mime->mm_mime_fields->fld_list); cur!=NULL; cur = clist_next(cur)) {
+			struct mailmime_field* field = (struct mailmime_field*)clist_content(cur);
+			if (field && field->fld_type==MAILMIME_FIELD_TRANSFER_ENCODING && field->fld_data.fld_encoding) {
+				return field->fld_data.fld_encoding->enc_type;
+			}
+		}
+	}
+	return MAILMIME_MECHANISM_BINARY;
+}
+
+
+/* Decode data using the given transfer encoding; out must be TRANSFER_DECODE_MAX_BYTES() large.
+If ret_in_used is set, incomplete sequences at the end are not decoded, see dc_decode_base64(). */
+#define TRANSFER_DECODE_MAX_BYTES(in_bytes) DC_MAX(DC_DECODE_BASE64_MAX_BYTES(in_bytes), DC_DECODE_QUOTED_PRINTABLE_MAX_BYTES(in_bytes))
+static size_t transfer_decode(const char* in, size_t in_bytes, int mime_transfer_encoding, char* out, size_t* ret_in_used)
+{
+	switch (mime_transfer_encoding)
+	{
+		case MAILMIME_MECHANISM_BASE64:
+			return dc_decode_base64(in, in_bytes, out, ret_in_used);
+
+		case MAILMIME_MECHANISM_QUOTED_PRINTABLE:
+			return dc_decode_quoted_printable(in, in_bytes, out, ret_in_used);
+
+		default:
+			memcpy(out, in, in_bytes);
+			if (ret_in_used) {
+				*ret_in_used = in_bytes;
+			}
+			return in_bytes;
+	}
+}
+
+
 int mailmime_transfer_decode(struct mailmime* mime, const char** ret_decoded_data, size_t* ret_decoded_data_bytes, char** ret_to_mmap_string_unref)
 {
 	int                   mime_transfer_encoding = MAILMIME_MECHANISM_BINARY;
@@ -501,17 +544,7 @@ int mailmime_transfer_decode(struct mailmime* mime, const char** ret_decoded_dat
 	}
 
 	mime_data = mime->mm_data.mm_single;
-
-	if (mime->mm_mime_fields!=NULL) {
-		clistiter* cur;
-		for (cur = clist_begin(mime->mm_mime_fields->fld_list); cur!=NULL; cur = clist_next(cur)) {
-			struct mailmime_field* field = (struct mailmime_field*)clist_content(cur);
-			if (field && field->fld_type==MAILMIME_FIELD_TRANSFER_ENCODING && field->fld_data.fld_encoding) {
-				mime_transfer_encoding = field->fld_data.fld_encoding->enc_type;
-				break;
-			}
-		}
-	}
+	mime_transfer_encoding = mailmime_get_transfer_encoding(mime);
 
 	/* regard `Content-Transfer-Encoding:` */
 	if (mime_transfer_encoding==MAILMIME_MECHANISM_7BIT
@@ -526,15 +559,24 @@ int mailmime_transfer_decode(struct mailmime* mime, const char** ret_decoded_dat
 	}
 	else
 	{
-		int r;
-		size_t current_index = 0;
-		r = mailmime_part_parse(mime_data->dt_data.dt_text.dt_data, mime_data->dt_data.dt_text.dt_length,
-			&current_index, mime_transfer_encoding,
-			&transfer_decoding_buffer, &decoded_data_bytes);
-		if (r!=MAILIMF_NO_ERROR || transfer_decoding_buffer==NULL || decoded_data_bytes <= 0) {
+		/* same result as mailmime_part_parse(), but faster */
+		MMAPString* decoded = NULL;
+		if (mime_data->dt_data.dt_text.dt_data==NULL
+		 || (decoded=mmap_string_sized_new(TRANSFER_DECODE_MAX_BYTES(mime_data->dt_data.dt_text.dt_length)))==NULL) {
 			return 0;
 		}
-		decoded_data = transfer_decoding_buffer;
+
+		decoded->len = transfer_decode(mime_data->dt_data.dt_text.dt_data, mime_data->dt_data.dt_text.dt_length,
+			mime_transfer_encoding, decoded->str, NULL);
+		decoded->str[decoded->len] = 0;
+		if (decoded->len <= 0 || mmap_string_ref(decoded)!=0) {
+			mmap_string_free(decoded);
+			return 0;
+		}
+
+		transfer_decoding_buffer = decoded->str;
+		decoded_data = decoded->str;
+		decoded_data_bytes = decoded->len;
 	}
 
 	*ret_decoded_data         = decoded_data;
@@ -812,8 +854,8 @@ static void dc_mimepart_unref(dc_mimepart_t* mimepart)
 	free(mimepart->msg);
 	mimepart->msg = NULL;
 
-	free(mimepart->msg_raw);
-	mimepart->msg_raw = NULL;
+	mimepart->msg_raw = NULL; /* not owned by the part, see dc_mimeparser_t::buffers */
+	mimepart->msg_raw_bytes = 0;
 
 	dc_param_unref(mimepart->param);
 	free(mimepart);
@@ -845,6 +887,7 @@ dc_mimeparser_t* dc_mimeparser_new(const char* blobdir, dc_context_t* context)
 	mimeparser->parts   = carray_new(16);
 	mimeparser->blobdir = blobdir; /* no need to copy the string at the moment */
 	mimeparser->reports = carray_new(16);
+	mimeparser->buffers = carray_new(16);
 	mimeparser->e2ee_helper = calloc(1, sizeof(dc_e2ee_helper_t));
 
 	dc_hash_init(&mimeparser->header, DC_HASH_STRING, 0/* do not copy key */);
@@ -878,6 +921,10 @@ void dc_mimeparser_unref(dc_mimeparser_t* mimeparser)
 		carray_free(mimeparser->reports);
 	}
 
+	if (mimeparser->buffers) {
+		carray_free(mimeparser->buffers);
+	}
+
 	free(mimeparser->e2ee_helper);
 	free(mimeparser);
 }
@@ -911,6 +958,16 @@ void dc_mimeparser_empty(dc_mimeparser_t* mimeparser)
 		carray_set_size(mimeparser->parts, 0);
 	}
 
+	if (mimeparser->buffers)
+	{
+		/* free the buffers after the parts pointing to them */
+		int i, cnt = carray_count(mimeparser->buffers);
+		for (i = 0; i < cnt; i++) {
+			mmap_string_unref((char*)carray_get(mimeparser->buffers, i));
+		}
+		carray_set_size(mimeparser->buffers, 0);
+	}
+
 	mimeparser->header_root  = NULL; /* a pointer somewhere to the MIME data, must NOT be freed */
 	dc_hash_clear(&mimeparser->header);
 
@@ -972,6 +1029,15 @@ void dc_mimeparser_repl_msg_by_error(dc_mimeparser_t* mimeparser,
 }
 
 
+/* Let the parser own a buffer created by libetpan until dc_mimeparser_empty() is called,
+so that parts can point to it instead of copying it. */
+static const char* keep_buffer(dc_mimeparser_t* parser, char* to_mmap_string_unref)
+{
+	carray_add(parser->buffers, (void*)to_mmap_string_unref, NULL);
+	return to_mmap_string_unref;
+}
+
+
 static void do_add_single_part(dc_mimeparser_t* parser, dc_mimepart_t* part)
 {
 	/* add a single part to the list of parts, the parser takes the ownership of the part, so you MUST NOT unref it after calling this function. */
@@ -985,24 +1051,145 @@ static void do_add_single_part(dc_mimeparser_t* parser, dc_mimepart_t* part)
 }
 
 
+/* Decode data using the given transfer encoding and write the result to a file.
+The data are decoded in chunks of DC_DECODE_CHUNK_BYTES, so that the decoded file is never held in memory completely. */
+#define DC_DECODE_CHUNK_BYTES (64*1024)
+static int write_transfer_decoded_file(dc_context_t* context, const char* pathNfilename,
+                                       const char* data, size_t data_bytes, int mime_transfer_encoding,
+                                       size_t* ret_decoded_bytes)
+{
+	int    success = 0;
+	char*  pathNfilename_abs = NULL;
+	FILE*  f = NULL;
+	char*  chunk = NULL;
+	size_t index = 0;
+	size_t decoded_bytes = 0;
+
+	*ret_decoded_bytes = 0;
+
+	if ((pathNfilename_abs=dc_get_abs_path(context, pathNfilename))==NULL) {
+		goto cleanup;
+	}
+
+	if ((f=fopen(pathNfilename_abs, "wb"))==NULL) {
+		dc_log_warning(context, 0, "Cannot open \"%s\" for writing.", pathNfilename);
+		goto cleanup;
+	}
+
+	if (mime_transfer_encoding==MAILMIME_MECHANISM_7BIT
+	 || mime_transfer_encoding==MAILMIME_MECHANISM_8BIT
+	 || mime_transfer_encoding==MAILMIME_MECHANISM_BINARY)
+	{
+		if (fwrite(data, 1, data_bytes, f)!=data_bytes) {
+			dc_log_warning(context, 0, "Cannot write %lu bytes to \"%s\".", (unsigned long)data_bytes, pathNfilename);
+			goto cleanup;
+		}
+		decoded_bytes = data_bytes;
+		index = data_bytes;
+	}
+
+	if (index < data_bytes && (chunk=malloc(TRANSFER_DECODE_MAX_BYTES(DC_MIN(data_bytes, DC_DECODE_CHUNK_BYTES))))==NULL) {
+		exit(72);
+	}
+
+	while (index < data_bytes)
+	{
+		size_t chunk_bytes = 0;
+		size_t chunk_end = data_bytes - index > DC_DECODE_CHUNK_BYTES? index + DC_DECODE_CHUNK_BYTES : data_bytes;
+		size_t used = 0;
+
+		if (chunk_end < data_bytes) {
+			/* decode only complete sequences, the rest is decoded with the next chunk */
+			chunk_bytes = transfer_decode(data+index, chunk_end-index, mime_transfer_encoding, chunk, &used);
+		}
+
+		if (used==0) {
+			/* last chunk or not even a complete sequence in the chunk, decode the rest at once */
+			if (chunk_end < data_bytes) {
+				free(chunk);
+				if ((chunk=malloc(TRANSFER_DECODE_MAX_BYTES(data_bytes-index)))==NULL) {
+					exit(72);
+				}
+			}
+			chunk_bytes = transfer_decode(data+index, data_bytes-index, mime_transfer_encoding, chunk, NULL);
+			used = data_bytes-index;
+		}
+
+		if (chunk_bytes > 0 && fwrite(chunk, 1, chunk_bytes, f)!=chunk_bytes) {
+			dc_log_warning(context, 0, "Cannot write %lu bytes to \"%s\".", (unsigned long)chunk_bytes, pathNfilename);
+			goto cleanup;
+		}
+		decoded_bytes += chunk_bytes;
+		index += used;
+	}
+
+	if (fclose(f)!=0) {
+		f = NULL;
+		goto cleanup;
+	}
+	f = NULL;
+
+	*ret_decoded_bytes = decoded_bytes;
+	success = 1;
+
+cleanup:
+	if (f) { fclose(f); }
+	if (!success && pathNfilename_abs) { remove(pathNfilename_abs); }
+	free(pathNfilename_abs);
+	free(chunk);
+	return success;
+}
+
+
+static int get_filemeta_from_file(dc_context_t* context, const char* pathNfilename, uint32_t* ret_width, uint32_t* ret_height)
+{
+	int         success = 0;
+	char*       pathNfilename_abs = NULL;
+	int         fd = -1;
+	struct stat st;
+	void*       map = MAP_FAILED;
+
+	if ((pathNfilename_abs=dc_get_abs_path(context, pathNfilename))==NULL
+	 || (fd=open(pathNfilename_abs, O_RDONLY)) < 0
+	 || fstat(fd, &st)!=0 || st.st_size<=0
+	 || (map=mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))==MAP_FAILED) {
+		goto cleanup;
+	}
+
+	success = dc_get_filemeta(map, (size_t)st.st_size, ret_width, ret_height);
+
+cleanup:
+	if (map!=MAP_FAILED) { munmap(map, (size_t)st.st_size); }
+	if (fd>=0) { close(fd); }
+	free(pathNfilename_abs);
+	return success;
+}
+
+
 static void do_add_single_file_part(dc_mimeparser_t* parser, int msg_type, int mime_type,
                                     const char* raw_mime,
-                                    const char* decoded_data, size_t decoded_data_bytes,
+                                    const char* data, size_t data_bytes, int mime_transfer_encoding,
                                     const char* desired_filename)
 {
 	dc_mimepart_t* part = NULL;
 	char*          pathNfilename = NULL;
+	size_t         decoded_data_bytes = 0;
 
 	/* create a free file name to use */
 	if ((pathNfilename=dc_get_fine_pathNfilename(parser->context, "$BLOBDIR", desired_filename))==NULL) {
 		goto cleanup;
 	}
 
-	/* copy data to file */
-	if (dc_write_file(parser->context, pathNfilename, decoded_data, decoded_data_bytes)==0) {
+	/* decode data to file */
+	if (!write_transfer_decoded_file(parser->context, pathNfilename, data, data_bytes, mime_transfer_encoding, &decoded_data_bytes)) {
 		goto cleanup;
 	}
 
+	if (decoded_data_bytes <= 0) {
+		dc_delete_file(parser->context, pathNfilename);
+		goto cleanup; /* no error - but no data */
+	}
+
 	part = dc_mimepart_new();
 	part->type  = msg_type;
 	part->int_mimetype = mime_type;
@@ -1012,7 +1199,7 @@ static void do_add_single_file_part(dc_mimeparser_t* parser, int msg_type, int m
 
 	if (mime_type==DC_MIMETYPE_IMAGE) {
 		uint32_t w = 0, h = 0;
-		if (dc_get_filemeta(decoded_data, decoded_data_bytes, &w, &h)) {
+		if (get_filemeta_from_file(parser->context, pathNfilename, &w, &h)) {
 			dc_param_set_int(part->param, DC_PARAM_WIDTH, w);
 			dc_param_set_int(part->param, DC_PARAM_HEIGHT, h);
 		}
@@ -1061,9 +1248,12 @@ static int dc_mimeparser_add_single_part_if_known(dc_mimeparser_t* mimeparser, s
 	}
 
 
-	/* regard `Content-Transfer-Encoding:` */
-	if (!mailmime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer)) {
-		goto cleanup; /* no always error - but no data */
+	/* regard `Content-Transfer-Encoding:`; files are decoded while they are written, see do_add_single_file_part().
+	7bit and 8bit texts are not copied: decoded_data points into the parsed message then. */
+	if (mime_type==DC_MIMETYPE_TEXT_PLAIN || mime_type==DC_MIMETYPE_TEXT_HTML) {
+		if (!mailmime_transfer_decode(mime, &decoded_data, &decoded_data_bytes, &transfer_decoding_buffer)) {
+			goto cleanup; /* no always error - but no data */
+		}
 	}
 
 	switch (mime_type)
@@ -1078,8 +1268,10 @@ static int dc_mimeparser_add_single_part_if_known(dc_mimeparser_t* mimeparser, s
 					}
 				}
 
-				const char* charset = mailmime_content_charset_get(mime->mm_content_type); /* get from `Content-Type: text/...; charset=utf-8`; must not be free()'d */
-				if (charset!=NULL && strcmp(charset, "utf-8")!=0 && strcmp(charset, "UTF-8")!=0) {
+				/* get from `Content-Type: text/...; charset=utf-8`; must not be free()'d.
+				us-ascii, which is also the default, is not converted: converting it either returns the same bytes or fails, and on failures, the unconverted text is used anyway */
+				const char* charset = mailmime_content_charset_get(mime->mm_content_type);
+				if (charset!=NULL && strcasecmp(charset, "utf-8")!=0 && strcasecmp(charset, "us-ascii")!=0) {
 					size_t ret_bytes = 0;
 					int r = charconv_buffer("utf-8", charset, decoded_data, decoded_data_bytes, &charset_buffer, &ret_bytes);
 					if (r!=MAIL_CHARCONV_NO_ERROR) {
@@ -1108,7 +1300,16 @@ static int dc_mimeparser_add_single_part_if_known(dc_mimeparser_t* mimeparser, s
 					part->type = DC_MSG_TEXT;
 					part->int_mimetype = mime_type;
 					part->msg = simplified_txt;
-					part->msg_raw = strndup(decoded_data, decoded_data_bytes);
+					part->msg_raw = decoded_data;
+					part->msg_raw_bytes = decoded_data_bytes;
+					if (decoded_data==charset_buffer) {
+						keep_buffer(mimeparser, charset_buffer);
+						charset_buffer = NULL;
+					}
+					else if (decoded_data==transfer_decoding_buffer) {
+						keep_buffer(mimeparser, transfer_decoding_buffer);
+						transfer_decoding_buffer = NULL;
+					}
 					do_add_single_part(mimeparser, part);
 					part = NULL;
 				}
@@ -1193,7 +1394,9 @@ static int dc_mimeparser_add_single_part_if_known(dc_mimeparser_t* mimeparser, s
 
 				dc_replace_bad_utf8_chars(desired_filename);
 
-				do_add_single_file_part(mimeparser, msg_type, mime_type, raw_mime, decoded_data, decoded_data_bytes, desired_filename);
+				do_add_single_file_part(mimeparser, msg_type, mime_type, raw_mime,
+					mime_data->dt_data.dt_text.dt_data, mime_data->dt_data.dt_text.dt_length, mailmime_get_transfer_encoding(mime),
+					desired_filename);
 			}
 			break;
 
@@ -1307,9 +1510,15 @@ static int dc_mimeparser_parse_mime_recursive(dc_mimeparser_t* mimeparser, struc
 
 						char* msg_body = dc_stock_str(mimeparser->context, DC_STR_CANTDECRYPT_MSG_BODY);
 						part->msg = dc_mprintf(DC_EDITORIAL_OPEN "%s" DC_EDITORIAL_CLOSE, msg_body);
-						part->msg_raw = dc_strdup(part->msg);
 						free(msg_body);
 
+						MMAPString* msg_raw = mmap_string_new(part->msg); /* part->msg may be replaced, see dc_mimeparser_repl_msg_by_error() */
+						if (msg_raw==NULL || mmap_string_ref(msg_raw)!=0) {
+							exit(70);
+						}
+						part->msg_raw = keep_buffer(mimeparser, msg_raw->str);
+						part->msg_raw_bytes = msg_raw->len;
+
 						carray_add(mimeparser->parts, (void*)part, NULL);
 						any_part_added = 1;
 						mimeparser->decrypting_failed = 1;
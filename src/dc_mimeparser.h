@@ -25,7 +25,8 @@ struct _dc_mimepart
 	int                 is_meta; /*meta parts contain eg. profile or group images and are only present if there is at least one "normal" part*/
 	int                 int_mimetype;
 	char*               msg;
-	char*               msg_raw;
+	const char*         msg_raw;       /* the text before simplification, not null-terminated; points into the parsed message, the decrypted message or one of the parser's buffers */
+	size_t              msg_raw_bytes;
 	int                 bytes;
 	dc_param_t*          param;
 
@@ -62,6 +63,8 @@ struct _dc_mimeparser
 
 	carray*                reports;           /* array of mailmime objects */
 
+	carray*                buffers;           /* decoded texts msg_raw of the parts may point to, mmap_string_unref()'d */
+
 	int                    is_system_message;
 
 };
@@ -808,12 +808,7 @@ cleanup:
 }
 
 
-#define DC_MSG_FIELDS " m.id,rfc724_mid,m.mime_in_reply_to,m.server_folder,m.server_uid,m.move_state,m.chat_id, " \
-                      " m.from_id,m.to_id,m.timestamp,m.timestamp_sent,m.timestamp_rcvd, m.type,m.state,m.msgrmsg,m.txt, " \
-                      " m.param,m.starred,m.hidden,c.blocked "
-
-
-static int dc_msg_set_from_stmt(dc_msg_t* msg, sqlite3_stmt* row, int row_offset) /* field order must be DC_MSG_FIELDS */
+int dc_msg_set_from_stmt(dc_msg_t* msg, sqlite3_stmt* row, int row_offset) /* field order must be DC_MSG_FIELDS, returns the next row offset */
 {
 	dc_msg_empty(msg);
 
@@ -846,7 +841,7 @@ static int dc_msg_set_from_stmt(dc_msg_t* msg, sqlite3_stmt* row, int row_offset
 			0/*unwrap*/);
 	}
 
-	return 1;
+	return row_offset;
 }
 
 
@@ -864,7 +859,7 @@ int dc_msg_load_from_db(dc_msg_t* msg, dc_context_t* context, uint32_t id)
 		goto cleanup;
 	}
 
-	stmt = dc_sqlite3_prepare(context->sql,
+	stmt = dc_sqlite3_borrow_stmt(context->sql,
 		"SELECT " DC_MSG_FIELDS
 		" FROM msgs m LEFT JOIN chats c ON c.id=m.chat_id"
 		" WHERE m.id=?;");
@@ -883,7 +878,7 @@ int dc_msg_load_from_db(dc_msg_t* msg, dc_context_t* context, uint32_t id)
 	success = 1;
 
 cleanup:
-	sqlite3_finalize(stmt);
+	if (context && context->sql) { dc_sqlite3_return_stmt(context->sql, stmt); }
 	return success;
 }
 
@@ -1207,12 +1202,25 @@ cleanup:
 
 void dc_update_msg_chat_id(dc_context_t* context, uint32_t msg_id, uint32_t chat_id)
 {
+	/* the chat caches of the old and of the new chat are updated */
 	sqlite3_stmt* stmt = dc_sqlite3_prepare(context->sql,
+		"SELECT chat_id FROM msgs WHERE id=?;");
+	sqlite3_bind_int(stmt, 1, msg_id);
+	uint32_t old_chat_id = (sqlite3_step(stmt)==SQLITE_ROW)? sqlite3_column_int(stmt, 0) : 0;
+	sqlite3_finalize(stmt);
+
+	stmt = dc_sqlite3_prepare(context->sql,
 		"UPDATE msgs SET chat_id=? WHERE id=?;");
 	sqlite3_bind_int(stmt, 1, chat_id);
 	sqlite3_bind_int(stmt, 2, msg_id);
 	sqlite3_step(stmt);
 	sqlite3_finalize(stmt);
+
+	if (old_chat_id && old_chat_id!=chat_id) {
+		dc_update_chat_cache(context->sql, old_chat_id);
+	}
+	dc_update_chat_cache(context->sql, chat_id);
+	dc_update_search_index(context->sql, msg_id); /* trashed messages are removed from the index */
 }
 
 
@@ -1224,6 +1232,11 @@ void dc_update_msg_state(dc_context_t* context, uint32_t msg_id, int state)
 	sqlite3_bind_int(stmt, 2, msg_id);
 	sqlite3_step(stmt);
 	sqlite3_finalize(stmt);
+
+	/* the states of outgoing messages are never DC_STATE_IN_FRESH, so only incoming messages may change chats.fresh_cnt */
+	if (state < DC_STATE_OUT_PENDING) {
+		dc_update_chat_cache_by_msg(context->sql, msg_id);
+	}
 }
 
 
@@ -1374,7 +1387,7 @@ uint32_t dc_rfc724_mid_exists(dc_context_t* context, const char* rfc724_mid, cha
 		goto cleanup;
 	}
 
-	stmt = dc_sqlite3_prepare(context->sql,
+	stmt = dc_sqlite3_borrow_stmt(context->sql,
 		"SELECT server_folder, server_uid, id FROM msgs WHERE rfc724_mid=?;");
 	sqlite3_bind_text(stmt, 1, rfc724_mid, -1, SQLITE_STATIC);
 	if (sqlite3_step(stmt)!=SQLITE_ROW) {
@@ -1388,7 +1401,7 @@ uint32_t dc_rfc724_mid_exists(dc_context_t* context, const char* rfc724_mid, cha
 	ret = sqlite3_column_int(stmt, 2);
 
 cleanup:
-	sqlite3_finalize(stmt);
+	if (context) { dc_sqlite3_return_stmt(context->sql, stmt); }
 	return ret;
 }
 
@@ -1405,6 +1418,72 @@ void dc_update_server_uid(dc_context_t* context, const char* rfc724_mid, const c
 }
 
 
+/**
+ * Mark the messages at the given server position as seen because they were
+ * seen on another device.  Unlike dc_markseen_msgs(), no IMAP jobs are added
+ * and no MDNs are sent, this is already done by the other device.
+ *
+ * @private @memberof dc_context_t
+ */
+int dc_markseen_msgs_by_server_uid(dc_context_t* context, const char* server_folder, uint32_t server_uid)
+{
+	int           send_event = 0;
+	sqlite3_stmt* stmt = NULL;
+
+	if (context==NULL || context->magic!=DC_CONTEXT_MAGIC || server_folder==NULL || server_uid==0) {
+		goto cleanup;
+	}
+
+	stmt = dc_sqlite3_prepare(context->sql,
+		"SELECT m.id, m.state, c.blocked "
+		" FROM msgs m "
+		" LEFT JOIN chats c ON c.id=m.chat_id "
+		" WHERE m.server_folder=? AND m.server_uid=? AND m.chat_id>" DC_STRINGIFY(DC_CHAT_ID_LAST_SPECIAL)
+		" AND m.state IN (" DC_STRINGIFY(DC_STATE_IN_FRESH) "," DC_STRINGIFY(DC_STATE_IN_NOTICED) ");");
+	sqlite3_bind_text(stmt, 1, server_folder, -1, SQLITE_STATIC);
+	sqlite3_bind_int (stmt, 2, server_uid);
+	while (sqlite3_step(stmt)==SQLITE_ROW)
+	{
+		uint32_t msg_id    = sqlite3_column_int(stmt, 0);
+		int curr_state     = sqlite3_column_int(stmt, 1);
+		int curr_blocked   = sqlite3_column_int(stmt, 2);
+		if (curr_blocked==0) {
+			dc_update_msg_state(context, msg_id, DC_STATE_IN_SEEN);
+			dc_log_info(context, 0, "Seen message #%i on another device.", (int)msg_id);
+			send_event = 1;
+		}
+		else if (curr_state==DC_STATE_IN_FRESH) {
+			/* message may be in contact requests, mark as NOTICED only, as dc_markseen_msgs() does */
+			dc_update_msg_state(context, msg_id, DC_STATE_IN_NOTICED);
+			send_event = 1;
+		}
+	}
+
+cleanup:
+	sqlite3_finalize(stmt);
+	return send_event;
+}
+
+
+/**
+ * Forget the server position of messages that were expunged from the server,
+ * eg. deleted or moved by another device.  The server_folder is kept, so that
+ * the messages are not mistaken for BCC-self messages if they pop up again.
+ *
+ * @private @memberof dc_context_t
+ */
+void dc_forget_server_uids(dc_context_t* context, const char* server_folder, uint32_t first_uid, uint32_t last_uid)
+{
+	sqlite3_stmt* stmt = dc_sqlite3_prepare(context->sql,
+		"UPDATE msgs SET server_uid=0 WHERE server_folder=? AND server_uid BETWEEN ? AND ?;");
+	sqlite3_bind_text (stmt, 1, server_folder, -1, SQLITE_STATIC);
+	sqlite3_bind_int64(stmt, 2, first_uid);
+	sqlite3_bind_int64(stmt, 3, last_uid);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+}
+
+
 /**
  * Get a single message object of the type dc_msg_t.
  * For a list of messages in a chat, see dc_get_chat_msgs()
@@ -1479,7 +1558,10 @@ char* dc_get_msg_info(dc_context_t* context, uint32_t msg_id)
 		p = dc_mprintf("Cannot load message #%i.", (int)msg_id); dc_strbuilder_cat(&ret, p); free(p);
 		goto cleanup;
 	}
-	rawtxt = dc_strdup((char*)sqlite3_column_text(stmt, 0));
+	rawtxt = dc_sqlite3_column_uncompressed(stmt, 0);
+	if (rawtxt==NULL) {
+		rawtxt = dc_strdup(NULL);
+	}
 	sqlite3_finalize(stmt);
 	stmt = NULL;
 
@@ -1646,7 +1728,7 @@ char* dc_get_mime_headers(dc_context_t* context, uint32_t msg_id)
 		"SELECT mime_headers FROM msgs WHERE id=?;");
 	sqlite3_bind_int(stmt, 1, msg_id);
 	if (sqlite3_step(stmt)==SQLITE_ROW) {
-		eml = dc_strdup_keep_null((const char*)sqlite3_column_text(stmt, 0));
+		eml = dc_sqlite3_column_uncompressed(stmt, 0);
 	}
 
 cleanup:
@@ -1724,6 +1806,16 @@ void dc_delete_msg_from_db(dc_context_t* context, uint32_t msg_id)
 	sqlite3_finalize(stmt);
 	stmt = NULL;
 
+	stmt = dc_sqlite3_prepare(context->sql,
+		"DELETE FROM decrypt_cache WHERE rfc724_mid=?;");
+	sqlite3_bind_text(stmt, 1, msg->rfc724_mid, -1, SQLITE_STATIC);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+
+	dc_update_chat_cache(context->sql, msg->chat_id);
+	dc_update_search_index(context->sql, msg->id);
+
 cleanup:
 	sqlite3_finalize(stmt);
 	dc_msg_unref(msg);
@@ -1742,6 +1834,8 @@ cleanup:
  */
 void dc_delete_msgs(dc_context_t* context, const uint32_t* msg_ids, int msg_cnt)
 {
+	sqlite3_stmt* stmt = NULL;
+
 	if (context==NULL || context->magic!=DC_CONTEXT_MAGIC || msg_ids==NULL || msg_cnt<=0) {
 		return;
 	}
@@ -1750,6 +1844,13 @@ void dc_delete_msgs(dc_context_t* context, const uint32_t* msg_ids, int msg_cnt)
 
 		for (int i = 0; i < msg_cnt; i++)
 		{
+			/* the plaintext of encrypted messages is not kept until the message is deleted on the server */
+			stmt = dc_sqlite3_prepare(context->sql,
+				"DELETE FROM decrypt_cache WHERE rfc724_mid=(SELECT rfc724_mid FROM msgs WHERE id=?);");
+			sqlite3_bind_int(stmt, 1, msg_ids[i]);
+			sqlite3_step(stmt);
+			sqlite3_finalize(stmt);
+
 			dc_update_msg_chat_id(context, msg_ids[i], DC_CHAT_ID_TRASH);
 			dc_job_add(context, DC_JOB_DELETE_MSG_ON_IMAP, msg_ids[i], NULL, 0);
 		}
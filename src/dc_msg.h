@@ -78,6 +78,12 @@ struct _dc_msg
 dc_msg_t*       dc_msg_new_untyped                    (dc_context_t*);
 dc_msg_t*       dc_msg_new_load                       (dc_context_t*, uint32_t id);
 int             dc_msg_load_from_db                   (dc_msg_t*, dc_context_t*, uint32_t id);
+
+#define DC_MSG_FIELDS " m.id,rfc724_mid,m.mime_in_reply_to,m.server_folder,m.server_uid,m.move_state,m.chat_id, " \
+                      " m.from_id,m.to_id,m.timestamp,m.timestamp_sent,m.timestamp_rcvd, m.type,m.state,m.msgrmsg,m.txt, " \
+                      " m.param,m.starred,m.hidden,c.blocked "
+#define DC_MSG_FIELDS_CNT 20
+int             dc_msg_set_from_stmt                  (dc_msg_t*, sqlite3_stmt* row, int row_offset); /* field order must be DC_MSG_FIELDS */
 int             dc_msg_is_increation                  (const dc_msg_t*);
 char*           dc_msg_get_summarytext_by_raw         (int type, const char* text, dc_param_t*, int approx_bytes, dc_context_t*); /* the returned value must be free()'d */
 void            dc_msg_save_param_to_disk             (dc_msg_t*);
@@ -106,6 +112,8 @@ size_t          dc_get_deaddrop_msg_cnt                    (dc_context_t*);
 int             dc_rfc724_mid_cnt                          (dc_context_t*, const char* rfc724_mid);
 uint32_t        dc_rfc724_mid_exists                       (dc_context_t*, const char* rfc724_mid, char** ret_server_folder, uint32_t* ret_server_uid);
 void            dc_update_server_uid                       (dc_context_t*, const char* rfc724_mid, const char* server_folder, uint32_t server_uid);
+int             dc_markseen_msgs_by_server_uid             (dc_context_t*, const char* server_folder, uint32_t server_uid); /* returns 1 if an event should be send */
+void            dc_forget_server_uids                      (dc_context_t*, const char* server_folder, uint32_t first_uid, uint32_t last_uid);
 
 
 #ifdef __cplusplus
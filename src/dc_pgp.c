@@ -14,6 +14,7 @@ So, we do not see a simple alternative - but everyone is welcome to implement
 one :-) */
 
 
+#include <unistd.h>
 #include <netpgp-extra.h>
 #include <openssl/rand.h>
 #include "dc_context.h"
@@ -23,22 +24,26 @@ one :-) */
 #include "dc_hash.h"
 
 
-static int      s_io_initialized = 0;
-static pgp_io_t s_io;
+/* The functions of this file are reentrant and may be called by several threads
+at the same time, eg. by dc_pgp_pk_decrypt_batch(). There is no shared state
+except of the cache of parsed keys which is protected by a mutex. */
 
 
-void dc_pgp_init(void)
+static pgp_io_t new_io(void)
 {
-	if (s_io_initialized) {
-		return;
-	}
+	/* netpgp uses the i/o structure for diagnostics only;
+	each call gets its own one, so there is no static state to initialize */
+	pgp_io_t io;
+	memset(&io, 0, sizeof(pgp_io_t));
+	io.outs = stdout;
+	io.errs = stderr;
+	io.res  = stderr;
+	return io;
+}
 
-	memset(&s_io, 0, sizeof(pgp_io_t));
-	s_io.outs = stdout;
-	s_io.errs = stderr;
-	s_io.res  = stderr;
 
-	s_io_initialized = 1;
+void dc_pgp_init(void)
+{
 }
 
 
@@ -53,7 +58,7 @@ void dc_pgp_rand_seed(dc_context_t* context, const void* buf, size_t bytes)
 		return;
 	}
 
-	RAND_seed(buf, bytes);
+	RAND_seed(buf, bytes); /* thread-safe since OpenSSL 1.1.0, older versions need locking callbacks set up by the application */
 }
 
 
@@ -394,6 +399,7 @@ int dc_pgp_is_valid_key(dc_context_t* context, const dc_key_t* raw_key)
 	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_memory_t*   keysmem = pgp_memory_new();
+	pgp_io_t        io = new_io();
 
 	if (context==NULL || raw_key==NULL
 	 || raw_key->binary==NULL || raw_key->bytes <= 0
@@ -402,7 +408,7 @@ int dc_pgp_is_valid_key(dc_context_t* context, const dc_key_t* raw_key)
 	}
 
 	pgp_memory_add(keysmem, raw_key->binary, raw_key->bytes);
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem); /* function returns 0 on any error in any packet - this does not mean, we cannot use the key. We check the details below therefore. */
+	pgp_filter_keys_from_mem(&io, public_keys, private_keys, NULL, 0, keysmem); /* function returns 0 on any error in any packet - this does not mean, we cannot use the key. We check the details below therefore. */
 
 	if (raw_key->type==DC_KEY_PUBLIC && public_keys->keyc >= 1) {
 		key_is_valid = 1;
@@ -425,6 +431,7 @@ int dc_pgp_calc_fingerprint(const dc_key_t* raw_key, uint8_t** ret_fingerprint,
 	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
 	pgp_memory_t*   keysmem = pgp_memory_new();
+	pgp_io_t        io = new_io();
 
 	if (raw_key==NULL || ret_fingerprint==NULL || *ret_fingerprint!=NULL || ret_fingerprint_bytes==NULL || *ret_fingerprint_bytes!=0
 	 || raw_key->binary==NULL || raw_key->bytes <= 0
@@ -433,7 +440,7 @@ int dc_pgp_calc_fingerprint(const dc_key_t* raw_key, uint8_t** ret_fingerprint,
 	}
 
 	pgp_memory_add(keysmem, raw_key->binary, raw_key->bytes);
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem);
+	pgp_filter_keys_from_mem(&io, public_keys, private_keys, NULL, 0, keysmem);
 
 	if (raw_key->type != DC_KEY_PUBLIC || public_keys->keyc <= 0) {
 		goto cleanup;
@@ -467,6 +474,7 @@ int dc_pgp_split_key(dc_context_t* context, const dc_key_t* private_in, dc_key_t
 	pgp_memory_t*   keysmem = pgp_memory_new();
 	pgp_memory_t*   pubmem = pgp_memory_new();
 	pgp_output_t*   pubout = pgp_output_new();
+	pgp_io_t        io = new_io();
 
 	if (context==NULL || private_in==NULL || ret_public_key==NULL
 	 || public_keys==NULL || private_keys==NULL || keysmem==NULL || pubmem==NULL || pubout==NULL) {
@@ -474,7 +482,7 @@ int dc_pgp_split_key(dc_context_t* context, const dc_key_t* private_in, dc_key_t
 	}
 
 	pgp_memory_add(keysmem, private_in->binary, private_in->bytes);
-	pgp_filter_keys_from_mem(&s_io, public_keys, private_keys, NULL, 0, keysmem);
+	pgp_filter_keys_from_mem(&io, public_keys, private_keys, NULL, 0, keysmem);
 
 	if (private_in->type!=DC_KEY_PRIVATE || private_keys->keyc <= 0) {
 		dc_log_warning(context, 0, "Split key: Given key is no private key.");
@@ -507,150 +515,540 @@ cleanup:
 
 
 /*******************************************************************************
- * Public key encrypt/decrypt
+ * Cache of parsed keys
  ******************************************************************************/
 
 
-int dc_pgp_pk_encrypt( dc_context_t*       context,
-                       const void*         plain_text,
-                       size_t              plain_bytes,
-                       const dc_keyring_t* raw_public_keys_for_encryption,
-                       const dc_key_t*     raw_private_key_for_signing,
-                       int                 use_armor,
-                       void**              ret_ctext,
-                       size_t*             ret_ctext_bytes)
+typedef struct _dc_cached_key
 {
-	pgp_keyring_t*  public_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*  dummy_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_memory_t*   keysmem = pgp_memory_new();
-	pgp_memory_t*   signedmem = NULL;
-	int             i = 0;
-	int             success = 0;
+	void*         binary;         /* copy of the raw key, used as the key in dc_context_t::key_cache */
+	size_t        bytes;
+	int           type;
+	pgp_keyring_t public_keys;    /* the parsed keys, not modified after the entry is added to the cache */
+	pgp_keyring_t private_keys;
+	uint32_t      last_used;
+	int           users;          /* number of running operations using the parsed keys */
+	int           removed;        /* 1=removed from the cache, the entry is freed by the last user */
+} dc_cached_key_t;
+
+
+static void wipe_seckey(pgp_seckey_t* seckey)
+{
+	/* BN_free() as used by pgp_seckey_free() does not overwrite the numbers */
+	#define WIPE_BN(a) if ((a)) { BN_clear((a)); }
+	switch (seckey->pubkey.alg) {
+		case PGP_PKA_RSA:
+		case PGP_PKA_RSA_ENCRYPT_ONLY:
+		case PGP_PKA_RSA_SIGN_ONLY:
+			WIPE_BN(seckey->key.rsa.d);
+			WIPE_BN(seckey->key.rsa.p);
+			WIPE_BN(seckey->key.rsa.q);
+			WIPE_BN(seckey->key.rsa.u);
+			break;
+
+		case PGP_PKA_DSA:
+			WIPE_BN(seckey->key.dsa.x);
+			break;
+
+		case PGP_PKA_ELGAMAL:
+			WIPE_BN(seckey->key.elgamal.x);
+			break;
+
+		default:
+			break;
+	}
+	#undef WIPE_BN
+}
 
-	if (context==NULL || plain_text==NULL || plain_bytes==0 || ret_ctext==NULL || ret_ctext_bytes==NULL
-	 || raw_public_keys_for_encryption==NULL || raw_public_keys_for_encryption->count<=0
-	 || keysmem==NULL || public_keys==NULL || private_keys==NULL || dummy_keys==NULL) {
-		goto cleanup;
+
+static void free_cached_key(dc_cached_key_t* entry)
+{
+	unsigned i = 0, j = 0;
+
+	if (entry==NULL) {
+		return;
 	}
 
-	*ret_ctext       = NULL;
-	*ret_ctext_bytes = 0;
+	for (i = 0; i < entry->private_keys.keyc; i++) {
+		pgp_key_t* key = &entry->private_keys.keys[i];
+		if (key->type!=PGP_PTAG_CT_PUBLIC_KEY) {
+			wipe_seckey(&key->key.seckey);
+			for (j = 0; j < key->subkeyc; j++) {
+				wipe_seckey(&key->subkeys[j].key.seckey);
+			}
+		}
+	}
 
-	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
-	for (i = 0; i < raw_public_keys_for_encryption->count; i++) {
-		pgp_memory_clear(keysmem);
-		pgp_memory_add(keysmem, raw_public_keys_for_encryption->keys[i]->binary, raw_public_keys_for_encryption->keys[i]->bytes);
-		pgp_filter_keys_from_mem(&s_io, public_keys, private_keys/*should stay empty*/, NULL, 0, keysmem);
+	pgp_keyring_purge(&entry->public_keys);
+	pgp_keyring_purge(&entry->private_keys);
+
+	if (entry->type==DC_KEY_PRIVATE) {
+		dc_wipe_secret_mem(entry->binary, entry->bytes);
 	}
+	free(entry->binary);
+	free(entry);
+}
 
-	if (public_keys->keyc <=0 || private_keys->keyc!=0) {
-		dc_log_warning(context, 0, "Encryption-keyring contains unexpected data (%i/%i)", public_keys->keyc, private_keys->keyc);
-		goto cleanup;
+
+static dc_cached_key_t* parse_key(const dc_key_t* raw_key)
+{
+	dc_cached_key_t* entry = NULL;
+	pgp_memory_t*    keysmem = pgp_memory_new();
+	pgp_io_t         io = new_io();
+
+	if ((entry=calloc(1, sizeof(dc_cached_key_t)))==NULL
+	 || (entry->binary=malloc(raw_key->bytes))==NULL
+	 || keysmem==NULL) {
+		exit(61); /* cannot allocate little memory, unrecoverable error */
 	}
 
-	/* encrypt */
-	{
-		const void* signed_text = NULL;
-		size_t      signed_bytes = 0;
-		int         encrypt_raw_packet = 0;
-		clock_t     sign_clocks = 0;
-		clock_t     encrypt_clocks = 0;
-
-		if (raw_private_key_for_signing) {
-			pgp_memory_clear(keysmem);
-			pgp_memory_add(keysmem, raw_private_key_for_signing->binary, raw_private_key_for_signing->bytes);
-			pgp_filter_keys_from_mem(&s_io, dummy_keys, private_keys, NULL, 0, keysmem);
-			if (private_keys->keyc <= 0) {
-				dc_log_warning(context, 0, "No key for signing found.");
-				goto cleanup;
+	memcpy(entry->binary, raw_key->binary, raw_key->bytes);
+	entry->bytes = raw_key->bytes;
+	entry->type  = raw_key->type;
+
+	pgp_memory_add(keysmem, raw_key->binary, raw_key->bytes);
+	pgp_filter_keys_from_mem(&io, &entry->public_keys, &entry->private_keys, NULL, 0, keysmem);
+
+	if (raw_key->type==DC_KEY_PRIVATE) {
+		dc_wipe_secret_mem(keysmem->buf, keysmem->length);
+	}
+	pgp_memory_free(keysmem);
+
+	return entry;
+}
+
+
+static void evict_least_recently_used(dc_context_t* context)
+{
+	/* the cache is small and this is only done if it is full, so a linear search is fine */
+	dc_hashelem_t*   elem = NULL;
+	dc_cached_key_t* lru_entry = NULL;
+
+	for (elem=dc_hash_first(&context->key_cache); elem; elem=dc_hash_next(elem)) {
+		dc_cached_key_t* entry = (dc_cached_key_t*)dc_hash_data(elem);
+		if (entry->users==0 /*keys in use cannot be evicted*/
+		 && (lru_entry==NULL || entry->last_used < lru_entry->last_used)) {
+			lru_entry = entry;
+		}
+	}
+
+	if (lru_entry) {
+		dc_hash_insert(&context->key_cache, lru_entry->binary, lru_entry->bytes, NULL);
+		free_cached_key(lru_entry);
+	}
+}
+
+
+/* Get the parsed keys for the given raw key, the raw key is parsed only if it is not in the cache.
+The parsed keys must not be modified and must be given back using release_key() */
+static dc_cached_key_t* acquire_key(dc_context_t* context, const dc_key_t* raw_key)
+{
+	dc_cached_key_t* entry = NULL;
+	dc_cached_key_t* parsed = NULL;
+
+	if (raw_key==NULL || raw_key->binary==NULL || raw_key->bytes<=0) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&context->key_cache_mutex);
+		if ((entry=dc_hash_find(&context->key_cache, raw_key->binary, raw_key->bytes))!=NULL) {
+			entry->users++;
+			entry->last_used = ++context->key_cache_clock;
+			context->key_cache_hits++;
+		}
+		else {
+			context->key_cache_misses++;
+		}
+	pthread_mutex_unlock(&context->key_cache_mutex);
+
+	if (entry) {
+		return entry;
+	}
+
+	/* parse without holding the lock, this is the expensive part */
+	parsed = parse_key(raw_key);
+
+	pthread_mutex_lock(&context->key_cache_mutex);
+		if ((entry=dc_hash_find(&context->key_cache, raw_key->binary, raw_key->bytes))!=NULL) {
+			/* added by another thread in between */
+			entry->users++;
+			entry->last_used = ++context->key_cache_clock;
+		}
+		else {
+			entry = parsed;
+			parsed = NULL;
+			entry->users = 1;
+			entry->last_used = ++context->key_cache_clock;
+
+			if (dc_hash_cnt(&context->key_cache) >= DC_KEY_CACHE_SIZE) {
+				evict_least_recently_used(context);
 			}
 
-			clock_t start = clock();
+			if (dc_hash_cnt(&context->key_cache) < DC_KEY_CACHE_SIZE) {
+				dc_hash_insert(&context->key_cache, entry->binary, entry->bytes, entry);
+			}
+			else {
+				entry->removed = 1; /* all cached keys are in use, the entry is freed after usage */
+			}
+		}
+	pthread_mutex_unlock(&context->key_cache_mutex);
 
-			pgp_key_t* sk0 = &private_keys->keys[0];
-			signedmem = pgp_sign_buf(&s_io, plain_text, plain_bytes, &sk0->key.seckey, time(NULL)/*birthtime*/, 0/*duration*/,
-				NULL/*hash, defaults to sha256*/, 0/*armored*/, 0/*cleartext*/);
+	free_cached_key(parsed);
+	return entry;
+}
 
-			sign_clocks = clock()-start;
 
-			if (signedmem==NULL) {
-				dc_log_warning(context, 0, "Signing failed.");
-				goto cleanup;
+static void release_key(dc_context_t* context, dc_cached_key_t* entry)
+{
+	int do_free = 0;
+
+	if (entry==NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&context->key_cache_mutex);
+		entry->users--;
+		do_free = (entry->removed && entry->users==0);
+	pthread_mutex_unlock(&context->key_cache_mutex);
+
+	if (do_free) {
+		free_cached_key(entry);
+	}
+}
+
+
+/**
+ * Remove all parsed keys from the cache used by dc_pgp_pk_encrypt() and dc_pgp_pk_decrypt().
+ * Secret keys are overwritten before they are freed.
+ *
+ * As the cache is keyed by the raw key data, changed keys are never
+ * confused with old ones.  However, the cache should be cleared if the own
+ * keypairs are changed or when the database is closed, so that secret keys
+ * not used any longer do not stay in memory.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @return None.
+ */
+void dc_pgp_clear_key_cache(dc_context_t* context)
+{
+	dc_hashelem_t* elem = NULL;
+
+	if (context==NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&context->key_cache_mutex);
+		for (elem=dc_hash_first(&context->key_cache); elem; elem=dc_hash_next(elem)) {
+			dc_cached_key_t* entry = (dc_cached_key_t*)dc_hash_data(elem);
+			if (entry->users==0) {
+				free_cached_key(entry);
+			}
+			else {
+				entry->removed = 1; /* freed by release_key() */
 			}
-			signed_text        = signedmem->buf;
-			signed_bytes       = signedmem->length;
-			encrypt_raw_packet = 1;
 		}
-		else {
-			signed_text        = plain_text;
-			signed_bytes       = plain_bytes;
-			encrypt_raw_packet = 0;
+		dc_hash_clear(&context->key_cache);
+	pthread_mutex_unlock(&context->key_cache_mutex);
+}
+
+
+char* dc_pgp_get_key_cache_str(dc_context_t* context)
+{
+	char* ret = NULL;
+
+	if (context==NULL) {
+		return dc_strdup("");
+	}
+
+	pthread_mutex_lock(&context->key_cache_mutex);
+		ret = dc_mprintf("%i keys, %i hits, %i misses",
+			dc_hash_cnt(&context->key_cache), context->key_cache_hits, context->key_cache_misses);
+	pthread_mutex_unlock(&context->key_cache_mutex);
+
+	return ret;
+}
+
+
+/*******************************************************************************
+ * Public key encrypt/decrypt
+ ******************************************************************************/
+
+
+struct _dc_pgp_encrypt
+{
+	dc_context_t*     context;
+	pgp_keyring_t*    public_keys;  /* the keys are borrowed from the cache, free using pgp_keyring_free() */
+	dc_cached_key_t** used_keys;
+	int               used_cnt;
+	dc_cached_key_t*  signing_key;
+	pgp_output_t*     output;
+	pgp_memory_t*     outmem;
+	int               failed;
+	clock_t           clocks;
+};
+
+
+static void free_encrypt(dc_pgp_encrypt_t* enc)
+{
+	int i = 0;
+
+	if (enc->output)      { pgp_teardown_memory_write(enc->output, enc->outmem); }
+	if (enc->public_keys) { pgp_keyring_free(enc->public_keys); free(enc->public_keys); } /* do not purge, the keys belong to the cache */
+	if (enc->used_keys) {
+		for (i = 0; i < enc->used_cnt; i++) {
+			release_key(enc->context, enc->used_keys[i]);
 		}
+		free(enc->used_keys);
+	}
+	release_key(enc->context, enc->signing_key);
+	free(enc);
+}
 
-		clock_t start = clock();
 
-		pgp_memory_t* outmem = pgp_encrypt_buf(&s_io, signed_text, signed_bytes, public_keys, use_armor, NULL/*cipher*/, encrypt_raw_packet);
+/**
+ * Start encrypting and optionally signing data that is passed piecewise
+ * using dc_pgp_pk_encrypt_write().
+ *
+ * The data is signed, compressed and encrypted as it is written using the
+ * streaming writers of netpgp; only the result is held in memory.
+ * For this purpose, the packets are written with partial body lengths.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @param raw_public_keys_for_encryption The keys to encrypt for.
+ * @param raw_private_key_for_signing The key to sign with, NULL to not sign.
+ * @param use_armor 1=create ASCII-armored output, 0=create binary output.
+ * @return An encryption object that must be passed to dc_pgp_pk_encrypt_end().
+ *     NULL on errors.
+ */
+dc_pgp_encrypt_t* dc_pgp_pk_encrypt_begin(dc_context_t*       context,
+                                          const dc_keyring_t* raw_public_keys_for_encryption,
+                                          const dc_key_t*     raw_private_key_for_signing,
+                                          int                 use_armor)
+{
+	dc_pgp_encrypt_t* enc = NULL;
+	int               private_cnt = 0;
+	unsigned          j = 0;
+	clock_t           start = clock();
+
+	if (context==NULL || raw_public_keys_for_encryption==NULL || raw_public_keys_for_encryption->count<=0) {
+		return NULL;
+	}
+
+	if ((enc=calloc(1, sizeof(dc_pgp_encrypt_t)))==NULL
+	 || (enc->public_keys=calloc(1, sizeof(pgp_keyring_t)))==NULL
+	 || (enc->used_keys=calloc(raw_public_keys_for_encryption->count, sizeof(dc_cached_key_t*)))==NULL) {
+		exit(62);
+	}
+	enc->context = context;
+
+	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
+	for (enc->used_cnt = 0; enc->used_cnt < raw_public_keys_for_encryption->count; enc->used_cnt++) {
+		dc_cached_key_t* key = acquire_key(context, raw_public_keys_for_encryption->keys[enc->used_cnt]);
+		enc->used_keys[enc->used_cnt] = key;
+		if (key) {
+			for (j = 0; j < key->public_keys.keyc; j++) {
+				pgp_keyring_add(enc->public_keys, &key->public_keys.keys[j]);
+			}
+			private_cnt += key->private_keys.keyc; /* should stay 0 */
+		}
+	}
+
+	if (enc->public_keys->keyc <=0 || private_cnt!=0) {
+		dc_log_warning(context, 0, "Encryption-keyring contains unexpected data (%i/%i)", enc->public_keys->keyc, private_cnt);
+		goto cleanup;
+	}
+
+	if (raw_private_key_for_signing) {
+		enc->signing_key = acquire_key(context, raw_private_key_for_signing);
+		if (enc->signing_key==NULL || enc->signing_key->private_keys.keyc <= 0) {
+			dc_log_warning(context, 0, "No key for signing found.");
+			goto cleanup;
+		}
+	}
+
+	/* the writers are stacked, the data flows from the signing writer through the encrypting writer to the memory;
+	the size of the output is unknown, the memory grows as needed */
+	pgp_setup_memory_write(&enc->output, &enc->outmem, 64*1024);
 
-		encrypt_clocks = clock()-start;
+	if (use_armor) {
+		pgp_writer_push_armor_msg(enc->output);
+	}
 
-		dc_log_info(context, 0, "Message signed in %.3f ms and encrypted in %.3f ms.", (double)(sign_clocks)*1000.0/CLOCKS_PER_SEC, (double)(encrypt_clocks)*1000.0/CLOCKS_PER_SEC);
+	if (!pgp_push_stream_enc_se_ip(enc->output, enc->public_keys, NULL/*cipher*/, enc->signing_key? 1/*raw, the signing writer writes packets*/ : 0)) {
+		dc_log_warning(context, 0, "Encryption failed.");
+		goto cleanup;
+	}
 
-		if (outmem==NULL) {
-			dc_log_warning(context, 0, "Encryption failed.");
+	if (enc->signing_key) {
+		pgp_key_t* sk0 = &enc->signing_key->private_keys.keys[0];
+		if (!pgp_push_stream_sign(enc->output, &sk0->key.seckey, PGP_HASH_SHA256, time(NULL)/*birthtime*/, 0/*duration*/)) {
+			dc_log_warning(context, 0, "Signing failed.");
 			goto cleanup;
 		}
-		*ret_ctext       = outmem->buf;
-		*ret_ctext_bytes = outmem->length;
-		free(outmem); /* do not use pgp_memory_free() as we took ownership of the buffer */
 	}
 
+	enc->clocks = clock()-start;
+	return enc;
+
+cleanup:
+	free_encrypt(enc);
+	return NULL;
+}
+
+
+/**
+ * Sign and encrypt the next part of the data.
+ *
+ * @private @memberof dc_context_t
+ * @param enc The encryption object as returned by dc_pgp_pk_encrypt_begin().
+ * @param data The data to encrypt.
+ * @param bytes The number of bytes in data.
+ * @return 1=success, 0=error; on errors, dc_pgp_pk_encrypt_end() fails.
+ */
+int dc_pgp_pk_encrypt_write(dc_pgp_encrypt_t* enc, const void* data, size_t bytes)
+{
+	clock_t start = clock();
+
+	if (enc==NULL || enc->failed || (data==NULL && bytes>0)) {
+		return 0;
+	}
+
+	if (bytes>0 && !pgp_write(enc->output, data, (unsigned)bytes)) {
+		enc->failed = 1;
+	}
+
+	enc->clocks += clock()-start;
+	return enc->failed? 0 : 1;
+}
+
+
+/**
+ * Finish signing and encrypting and free the encryption object.
+ *
+ * @private @memberof dc_context_t
+ * @param enc The encryption object as returned by dc_pgp_pk_encrypt_begin().
+ *     The object is freed in any case.
+ * @param ret_ctext Pointer to a buffer that will receive the encrypted data.
+ *     The buffer must be free()'d. Set to NULL to discard the encrypted data.
+ * @param ret_ctext_bytes The number of bytes in ret_ctext.
+ * @return 1=success, 0=error.
+ */
+int dc_pgp_pk_encrypt_end(dc_pgp_encrypt_t* enc, void** ret_ctext, size_t* ret_ctext_bytes)
+{
+	int     success = 0;
+	clock_t start = clock();
+
+	if (enc==NULL) {
+		return 0;
+	}
+
+	if (ret_ctext==NULL || ret_ctext_bytes==NULL || enc->failed) {
+		goto cleanup;
+	}
+
+	*ret_ctext       = NULL;
+	*ret_ctext_bytes = 0;
+
+	/* write the last chunks and the signature */
+	if (!pgp_writer_close(enc->output)) {
+		dc_log_warning(enc->context, 0, "Encryption failed.");
+		pgp_output_delete(enc->output);
+		enc->output = NULL;
+		pgp_memory_free(enc->outmem);
+		goto cleanup;
+	}
+	pgp_output_delete(enc->output);
+	enc->output = NULL;
+
+	*ret_ctext       = enc->outmem->buf;
+	*ret_ctext_bytes = enc->outmem->length;
+	free(enc->outmem); /* do not use pgp_memory_free() as we took ownership of the buffer */
+
+	dc_log_info(enc->context, 0, "Message signed and encrypted in %.3f ms.", (double)(enc->clocks+clock()-start)*1000.0/CLOCKS_PER_SEC);
+
 	success = 1;
 
 cleanup:
-	if (keysmem)      { pgp_memory_free(keysmem); }
-	if (signedmem)    { pgp_memory_free(signedmem); }
-	if (public_keys)  { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if (private_keys) { pgp_keyring_purge(private_keys); free(private_keys); }
-	if (dummy_keys)   { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
+	free_encrypt(enc);
 	return success;
 }
 
 
-int dc_pgp_pk_decrypt( dc_context_t*       context,
-                       const void*         ctext,
-                       size_t              ctext_bytes,
-                       const dc_keyring_t* raw_private_keys_for_decryption,
-                       const dc_keyring_t* raw_public_keys_for_validation,
+int dc_pgp_pk_encrypt( dc_context_t*       context,
+                       const void*         plain_text,
+                       size_t              plain_bytes,
+                       const dc_keyring_t* raw_public_keys_for_encryption,
+                       const dc_key_t*     raw_private_key_for_signing,
                        int                 use_armor,
-                       void**              ret_plain,
-                       size_t*             ret_plain_bytes,
-                       dc_hash_t*          ret_signature_fingerprints)
+                       void**              ret_ctext,
+                       size_t*             ret_ctext_bytes)
 {
-	pgp_keyring_t*    public_keys = calloc(1, sizeof(pgp_keyring_t)); /*should be 0 after parsing*/
+	dc_pgp_encrypt_t* enc = NULL;
+
+	if (context==NULL || plain_text==NULL || plain_bytes==0 || ret_ctext==NULL || ret_ctext_bytes==NULL) {
+		return 0;
+	}
+
+	if ((enc=dc_pgp_pk_encrypt_begin(context, raw_public_keys_for_encryption, raw_private_key_for_signing, use_armor))==NULL) {
+		return 0;
+	}
+
+	dc_pgp_pk_encrypt_write(enc, plain_text, plain_bytes);
+
+	return dc_pgp_pk_encrypt_end(enc, ret_ctext, ret_ctext_bytes);
+}
+
+
+static int pk_decrypt(dc_context_t*       context,
+                      const void*         ctext,
+                      size_t              ctext_bytes,
+                      const dc_keyring_t* raw_private_keys_for_decryption,
+                      const dc_keyring_t* raw_public_keys_for_validation,
+                      int                 use_armor,
+                      int                 fd, /* if >=0, the plaintext is written to this file instead of ret_plain */
+                      void**              ret_plain,
+                      size_t*             ret_plain_bytes,
+                      dc_hash_t*          ret_signature_fingerprints)
+{
+	pgp_keyring_t*    public_keys = calloc(1, sizeof(pgp_keyring_t)); /* the keys are borrowed from the cache, free using pgp_keyring_free() */
 	pgp_keyring_t*    private_keys = calloc(1, sizeof(pgp_keyring_t));
-	pgp_keyring_t*    dummy_keys = calloc(1, sizeof(pgp_keyring_t));
+	dc_cached_key_t** used_keys = NULL;
+	int               used_cnt = 0;
 	pgp_validation_t* vresult = calloc(1, sizeof(pgp_validation_t));
 	key_id_t*         recipients_key_ids = NULL;
 	unsigned          recipients_cnt = 0;
-	pgp_memory_t*     keysmem = pgp_memory_new();
 	int               i = 0;
+	unsigned          j = 0;
 	int               success = 0;
+	pgp_io_t          io = new_io();
 
-	if (context==NULL || ctext==NULL || ctext_bytes==0 || ret_plain==NULL || ret_plain_bytes==NULL
+	if (context==NULL || ctext==NULL || ctext_bytes==0 || (fd<0 && (ret_plain==NULL || ret_plain_bytes==NULL))
 	 || raw_private_keys_for_decryption==NULL || raw_private_keys_for_decryption->count<=0
-	 || vresult==NULL || keysmem==NULL || public_keys==NULL || private_keys==NULL) {
+	 || vresult==NULL || public_keys==NULL || private_keys==NULL) {
 		goto cleanup;
 	}
 
-	*ret_plain             = NULL;
-	*ret_plain_bytes       = 0;
+	if (fd<0) {
+		*ret_plain             = NULL;
+		*ret_plain_bytes       = 0;
+	}
 
 	/* setup keys (the keys may come from pgp_filter_keys_fileread(), see also pgp_keyring_add(rcpts, key)) */
+	if ((used_keys=calloc(raw_private_keys_for_decryption->count
+			+ (raw_public_keys_for_validation? raw_public_keys_for_validation->count : 0), sizeof(dc_cached_key_t*)))==NULL) {
+		exit(63);
+	}
+
 	for (i = 0; i < raw_private_keys_for_decryption->count; i++) {
-		pgp_memory_clear(keysmem); /* a simple concatenate of private binary keys fails (works for public keys, however, we don't do it there either) */
-		pgp_memory_add(keysmem, raw_private_keys_for_decryption->keys[i]->binary, raw_private_keys_for_decryption->keys[i]->bytes);
-		pgp_filter_keys_from_mem(&s_io, dummy_keys/*should stay empty*/, private_keys, NULL, 0, keysmem);
+		dc_cached_key_t* entry = acquire_key(context, raw_private_keys_for_decryption->keys[i]);
+		if (entry) {
+			used_keys[used_cnt++] = entry;
+			for (j = 0; j < entry->private_keys.keyc; j++) {
+				pgp_keyring_add(private_keys, &entry->private_keys.keys[j]);
+			}
+		}
 	}
 
 	if (private_keys->keyc<=0) {
@@ -660,23 +1058,36 @@ int dc_pgp_pk_decrypt( dc_context_t*       context,
 
 	if (raw_public_keys_for_validation) {
 		for (i = 0; i < raw_public_keys_for_validation->count; i++) {
-			pgp_memory_clear(keysmem);
-			pgp_memory_add(keysmem, raw_public_keys_for_validation->keys[i]->binary, raw_public_keys_for_validation->keys[i]->bytes);
-			pgp_filter_keys_from_mem(&s_io, public_keys, dummy_keys/*should stay empty*/, NULL, 0, keysmem);
+			dc_cached_key_t* entry = acquire_key(context, raw_public_keys_for_validation->keys[i]);
+			if (entry) {
+				used_keys[used_cnt++] = entry;
+				for (j = 0; j < entry->public_keys.keyc; j++) {
+					pgp_keyring_add(public_keys, &entry->public_keys.keys[j]);
+				}
+			}
 		}
 	}
 
 	/* decrypt */
 	{
-		pgp_memory_t* outmem = pgp_decrypt_and_validate_buf(&s_io, vresult, ctext, ctext_bytes, private_keys, public_keys,
-			use_armor, &recipients_key_ids, &recipients_cnt);
-		if (outmem==NULL) {
-			dc_log_warning(context, 0, "Decryption failed.");
-			goto cleanup;
+		if (fd>=0) {
+			if (!pgp_decrypt_and_validate_fd(&io, vresult, ctext, ctext_bytes, private_keys, public_keys,
+					use_armor, fd, &recipients_key_ids, &recipients_cnt)) {
+				dc_log_warning(context, 0, "Decryption to file failed.");
+				goto cleanup;
+			}
+		}
+		else {
+			pgp_memory_t* outmem = pgp_decrypt_and_validate_buf(&io, vresult, ctext, ctext_bytes, private_keys, public_keys,
+				use_armor, &recipients_key_ids, &recipients_cnt);
+			if (outmem==NULL) {
+				dc_log_warning(context, 0, "Decryption failed.");
+				goto cleanup;
+			}
+			*ret_plain       = outmem->buf;
+			*ret_plain_bytes = outmem->length;
+			free(outmem); /* do not use pgp_memory_free() as we took ownership of the buffer */
 		}
-		*ret_plain       = outmem->buf;
-		*ret_plain_bytes = outmem->length;
-		free(outmem); /* do not use pgp_memory_free() as we took ownership of the buffer */
 
 		// collect the keys of the valid signatures
 		if (ret_signature_fingerprints)
@@ -684,14 +1095,14 @@ int dc_pgp_pk_decrypt( dc_context_t*       context,
 			for (i = 0; i < vresult->validc; i++)
 			{
 				unsigned from = 0;
-				pgp_key_t* key0 = pgp_getkeybyid(&s_io, public_keys, vresult->valid_sigs[i].signer_id, &from, NULL, NULL, 0, 0);
+				pgp_key_t* key0 = pgp_getkeybyid(&io, public_keys, vresult->valid_sigs[i].signer_id, &from, NULL, NULL, 0, 0);
 				if (key0) {
-					pgp_pubkey_t* pubkey0 = &key0->key.pubkey;
-					if (!pgp_fingerprint(&key0->pubkeyfpr, pubkey0, 0)) {
+					pgp_fingerprint_t fingerprint; /* calculated locally as the key belongs to the cache and may be used by other threads */
+					if (!pgp_fingerprint(&fingerprint, &key0->key.pubkey, 0)) {
 						goto cleanup;
 					}
 
-					char* fingerprint_hex = dc_binary_to_uc_hex(key0->pubkeyfpr.fingerprint, key0->pubkeyfpr.length);
+					char* fingerprint_hex = dc_binary_to_uc_hex(fingerprint.fingerprint, fingerprint.length);
 					if (fingerprint_hex) {
 						dc_hash_insert(ret_signature_fingerprints, fingerprint_hex, strlen(fingerprint_hex), (void*)1);
 					}
@@ -704,11 +1115,179 @@ int dc_pgp_pk_decrypt( dc_context_t*       context,
 	success = 1;
 
 cleanup:
-	if (keysmem)            { pgp_memory_free(keysmem); }
-	if (public_keys)        { pgp_keyring_purge(public_keys); free(public_keys); } /*pgp_keyring_free() frees the content, not the pointer itself*/
-	if (private_keys)       { pgp_keyring_purge(private_keys); free(private_keys); }
-	if (dummy_keys)         { pgp_keyring_purge(dummy_keys); free(dummy_keys); }
+	if (public_keys)        { pgp_keyring_free(public_keys); free(public_keys); } /* do not purge, the keys belong to the cache */
+	if (private_keys)       { pgp_keyring_free(private_keys); free(private_keys); }
+	for (i = 0; i < used_cnt; i++) {
+		release_key(context, used_keys[i]);
+	}
+	free(used_keys);
 	if (vresult)            { pgp_validate_result_free(vresult); }
 	free(recipients_key_ids);
 	return success;
 }
+
+
+int dc_pgp_pk_decrypt( dc_context_t*       context,
+                       const void*         ctext,
+                       size_t              ctext_bytes,
+                       const dc_keyring_t* raw_private_keys_for_decryption,
+                       const dc_keyring_t* raw_public_keys_for_validation,
+                       int                 use_armor,
+                       void**              ret_plain,
+                       size_t*             ret_plain_bytes,
+                       dc_hash_t*          ret_signature_fingerprints)
+{
+	if (ret_plain==NULL || ret_plain_bytes==NULL) {
+		return 0;
+	}
+
+	return pk_decrypt(context, ctext, ctext_bytes, raw_private_keys_for_decryption, raw_public_keys_for_validation,
+		use_armor, -1, ret_plain, ret_plain_bytes, ret_signature_fingerprints);
+}
+
+
+/**
+ * Decrypt data and write the plaintext to a file.
+ *
+ * Other than dc_pgp_pk_decrypt(), the plaintext is not collected in memory,
+ * the literal data are written to the file as they are decrypted and
+ * the signatures of one-pass signed messages are checked using a hash
+ * calculated along the way.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @param ctext The data to decrypt.
+ * @param ctext_bytes The number of bytes in ctext.
+ * @param raw_private_keys_for_decryption The keys to try for decryption.
+ * @param raw_public_keys_for_validation The keys to check signatures against, may be NULL.
+ * @param use_armor 1=ctext is ASCII-armored, 0=ctext is binary.
+ * @param fd A file descriptor opened for writing. The plaintext is written
+ *     at the current position, the descriptor is not closed.
+ *     On errors, parts of the plaintext may have been written.
+ * @param ret_signature_fingerprints If set, the fingerprints of valid signatures are added here.
+ * @return 1=success, 0=error.
+ */
+int dc_pgp_pk_decrypt_to_fd(dc_context_t*       context,
+                            const void*         ctext,
+                            size_t              ctext_bytes,
+                            const dc_keyring_t* raw_private_keys_for_decryption,
+                            const dc_keyring_t* raw_public_keys_for_validation,
+                            int                 use_armor,
+                            int                 fd,
+                            dc_hash_t*          ret_signature_fingerprints)
+{
+	if (fd<0) {
+		return 0;
+	}
+
+	return pk_decrypt(context, ctext, ctext_bytes, raw_private_keys_for_decryption, raw_public_keys_for_validation,
+		use_armor, fd, NULL, NULL, ret_signature_fingerprints);
+}
+
+
+/*******************************************************************************
+ * Batch decryption
+ ******************************************************************************/
+
+
+typedef struct _dc_pgp_batch
+{
+	dc_context_t*         context;
+	dc_pgp_decrypt_job_t* jobs;
+	int                   cnt;
+	pthread_mutex_t       mutex;          /* protects next */
+	int                   next;           /* index of the next job to run */
+} dc_pgp_batch_t;
+
+
+static void* batch_thread_entry_point(void* arg)
+{
+	dc_pgp_batch_t* batch = (dc_pgp_batch_t*)arg;
+
+	while (1)
+	{
+		pthread_mutex_lock(&batch->mutex);
+			int i = batch->next++;
+		pthread_mutex_unlock(&batch->mutex);
+
+		if (i >= batch->cnt) {
+			break;
+		}
+
+		dc_pgp_decrypt_job_t* job = &batch->jobs[i];
+		job->success = pk_decrypt(batch->context, job->ctext, job->ctext_bytes, job->private_keys, job->validate_keys,
+			job->use_armor, -1, &job->plain, &job->plain_bytes, job->signature_fingerprints);
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Decrypt several independent messages using all cores.
+ *
+ * The jobs are distributed to a pool of threads sized to the number of
+ * cores, the calling thread is one of them; the function returns after all
+ * jobs are done.  Each job is processed as by dc_pgp_pk_decrypt(), the keys
+ * are parsed only once as they are shared by the cache of parsed keys.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @param jobs The messages to decrypt. For each job, set ctext, ctext_bytes,
+ *     private_keys, use_armor and optionally validate_keys and signature_fingerprints;
+ *     on return, success, plain and plain_bytes are set.  plain must be free()'d.
+ *     Different jobs must not share the same signature_fingerprints hash.
+ * @param cnt The number of jobs.
+ * @return The number of jobs decrypted successfully.
+ */
+int dc_pgp_pk_decrypt_batch(dc_context_t* context, dc_pgp_decrypt_job_t* jobs, int cnt)
+{
+	dc_pgp_batch_t batch;
+	pthread_t      threads[DC_PGP_MAX_THREADS];
+	int            threads_cnt = 0;
+	int            wanted_cnt = 0;
+	int            success_cnt = 0;
+	int            i = 0;
+
+	if (context==NULL || jobs==NULL || cnt<=0) {
+		return 0;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		jobs[i].plain       = NULL;
+		jobs[i].plain_bytes = 0;
+		jobs[i].success     = 0;
+	}
+
+	memset(&batch, 0, sizeof(dc_pgp_batch_t));
+	batch.context = context;
+	batch.jobs    = jobs;
+	batch.cnt     = cnt;
+	pthread_mutex_init(&batch.mutex, NULL);
+
+	wanted_cnt = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (wanted_cnt > DC_PGP_MAX_THREADS) { wanted_cnt = DC_PGP_MAX_THREADS; }
+	if (wanted_cnt > cnt)                { wanted_cnt = cnt; }
+
+	for (threads_cnt = 0; threads_cnt < wanted_cnt-1 /*the calling thread is also used*/; threads_cnt++) {
+		if (pthread_create(&threads[threads_cnt], NULL, batch_thread_entry_point, &batch)!=0) {
+			dc_log_warning(context, 0, "Cannot start decryption thread, using %i threads.", threads_cnt+1);
+			break;
+		}
+	}
+
+	batch_thread_entry_point(&batch);
+
+	for (i = 0; i < threads_cnt; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&batch.mutex);
+
+	for (i = 0; i < cnt; i++) {
+		if (jobs[i].success) {
+			success_cnt++;
+		}
+	}
+
+	return success_cnt;
+}
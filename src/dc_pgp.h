@@ -30,7 +30,36 @@ int  dc_pgp_calc_fingerprint (const dc_key_t*, uint8_t** fingerprint, size_t* fi
 int  dc_pgp_split_key        (dc_context_t*, const dc_key_t* private_in, dc_key_t* public_out);
 
 int  dc_pgp_pk_encrypt       (dc_context_t*, const void* plain, size_t plain_bytes, const dc_keyring_t*, const dc_key_t* sign_key, int use_armor, void** ret_ctext, size_t* ret_ctext_bytes);
+
+typedef struct _dc_pgp_encrypt dc_pgp_encrypt_t;
+dc_pgp_encrypt_t* dc_pgp_pk_encrypt_begin (dc_context_t*, const dc_keyring_t*, const dc_key_t* sign_key, int use_armor);
+int  dc_pgp_pk_encrypt_write (dc_pgp_encrypt_t*, const void* data, size_t bytes);
+int  dc_pgp_pk_encrypt_end   (dc_pgp_encrypt_t*, void** ret_ctext, size_t* ret_ctext_bytes);
+
 int  dc_pgp_pk_decrypt       (dc_context_t*, const void* ctext, size_t ctext_bytes, const dc_keyring_t*, const dc_keyring_t* validate_keys, int use_armor, void** plain, size_t* plain_bytes, dc_hash_t* ret_signature_fingerprints);
+int  dc_pgp_pk_decrypt_to_fd (dc_context_t*, const void* ctext, size_t ctext_bytes, const dc_keyring_t*, const dc_keyring_t* validate_keys, int use_armor, int fd, dc_hash_t* ret_signature_fingerprints);
+
+typedef struct _dc_pgp_decrypt_job
+{
+	const void*         ctext;
+	size_t              ctext_bytes;
+	const dc_keyring_t* private_keys;
+	const dc_keyring_t* validate_keys;          /* may be NULL */
+	int                 use_armor;
+	dc_hash_t*          signature_fingerprints; /* may be NULL, if set, the fingerprints of valid signatures are added here */
+
+	int                 success;                /* the results, set by dc_pgp_pk_decrypt_batch() */
+	void*               plain;
+	size_t              plain_bytes;
+} dc_pgp_decrypt_job_t;
+
+#define DC_PGP_MAX_THREADS 16
+int  dc_pgp_pk_decrypt_batch (dc_context_t*, dc_pgp_decrypt_job_t* jobs, int cnt);
+
+/* cache of parsed keys */
+#define DC_KEY_CACHE_SIZE 32
+void dc_pgp_clear_key_cache  (dc_context_t*);
+char* dc_pgp_get_key_cache_str (dc_context_t*);
 
 
 #ifdef __cplusplus
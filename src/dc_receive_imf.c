@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <ctype.h>
 #include <netpgp-extra.h>
 #include "dc_context.h"
 #include "dc_mimeparser.h"
@@ -105,7 +106,7 @@ static int is_known_rfc724_mid(dc_context_t* context, const char* rfc724_mid)
 {
 	int is_known = 0;
 	if (rfc724_mid) {
-		sqlite3_stmt* stmt = dc_sqlite3_prepare(context->sql,
+		sqlite3_stmt* stmt = dc_sqlite3_borrow_stmt(context->sql,
 			"SELECT m.id FROM msgs m "
 			" LEFT JOIN chats c ON m.chat_id=c.id "
 			" WHERE m.rfc724_mid=? "
@@ -115,7 +116,7 @@ static int is_known_rfc724_mid(dc_context_t* context, const char* rfc724_mid)
 		if (sqlite3_step(stmt)==SQLITE_ROW) {
 			is_known = 1;
 		}
-		sqlite3_finalize(stmt);
+		dc_sqlite3_return_stmt(context->sql, stmt);
 	}
 	return is_known;
 }
@@ -535,8 +536,11 @@ static int check_verified_properties(dc_context_t* context, dc_mimeparser_t* mim
 
 	// check that all members are verified.
 	// if a verification is missing, check if this was just gossiped - as we've verified the sender, we verify the member then.
+	// the fingerprints are compared by the database using the binary columns covered by acpeerstates_index6,
+	// so peerstates are loaded only if they are changed.
 	to_ids_str = dc_array_get_string(to_ids, ",");
-	q3 = sqlite3_mprintf("SELECT c.addr, LENGTH(ps.verified_key_fingerprint) "
+	q3 = sqlite3_mprintf("SELECT c.addr, ps.verified_key_fingerprint_bin IS NOT NULL, "
+						 "       ps.verified_key_fingerprint_bin IN (ps.public_key_fingerprint_bin, ps.gossip_key_fingerprint_bin) "
 						 " FROM contacts c "
 						 " LEFT JOIN acpeerstates ps ON c.addr=ps.addr "
 						 " WHERE c.id IN(%s) ",
@@ -546,24 +550,21 @@ static int check_verified_properties(dc_context_t* context, dc_mimeparser_t* mim
 	{
 		const char* to_addr     = (const char*)sqlite3_column_text(stmt, 0);
 		int is_verified         =              sqlite3_column_int (stmt, 1);
-
-		if (dc_hash_find_str(mimeparser->e2ee_helper->gossipped_addr, to_addr)
+		int verified_key_known  =              sqlite3_column_int (stmt, 2);
+
+		// if the member was gossiped, we know the gossip key is verified:
+		// - use the gossip-key as verified-key if there is no verified-key
+		// - OR if the verified-key does not match public-key or gossip-key
+		//   (otherwise a verified key can _only_ be updated through QR scan which might be annoying,
+		//   see https://github.com/nextleap-project/countermitm/issues/46 for a discussion about this point)
+		if ((!is_verified || !verified_key_known)
+		 && dc_hash_find_str(mimeparser->e2ee_helper->gossipped_addr, to_addr)
 		 && dc_apeerstate_load_by_addr(peerstate, context->sql, to_addr))
 		{
-			// if we're here, we know the gossip key is verified:
-			// - use the gossip-key as verified-key if there is no verified-key
-			// - OR if the verified-key does not match public-key or gossip-key
-			//   (otherwise a verified key can _only_ be updated through QR scan which might be annoying,
-			//   see https://github.com/nextleap-project/countermitm/issues/46 for a discussion about this point)
-			if (!is_verified
-			 ||   (strcmp(peerstate->verified_key_fingerprint, peerstate->public_key_fingerprint)!=0
-			    && strcmp(peerstate->verified_key_fingerprint, peerstate->gossip_key_fingerprint)!=0))
-			{
-				dc_log_info(context, 0, "%s has verfied %s.", contact->addr, to_addr);
-				dc_apeerstate_set_verified(peerstate, DC_PS_GOSSIP_KEY, peerstate->gossip_key_fingerprint, DC_BIDIRECT_VERIFIED);
-				dc_apeerstate_save_to_db(peerstate, context->sql, 0);
-				is_verified = 1;
-			}
+			dc_log_info(context, 0, "%s has verfied %s.", contact->addr, to_addr);
+			dc_apeerstate_set_verified(peerstate, DC_PS_GOSSIP_KEY, peerstate->gossip_key_fingerprint, DC_BIDIRECT_VERIFIED);
+			dc_apeerstate_save_to_db(peerstate, context->sql, 0);
+			is_verified = 1;
 		}
 
 		if (!is_verified)
@@ -882,6 +883,41 @@ cleanup:
  ******************************************************************************/
 
 
+static int is_txt_raw_needed(const dc_mimeparser_t* mime_parser, const dc_mimepart_t* part)
+{
+	/* for messages sent by messengers, the raw text is mostly the same as the simplified text;
+	it is saved only if the simplifier has changed more than line ends and surrounding whitespace */
+	const char* raw = part->msg_raw;
+	const char* raw_end = part->msg_raw + part->msg_raw_bytes;
+	const char* p = part->msg;
+
+	if (!mime_parser->is_send_by_messenger || raw==NULL || p==NULL) {
+		return 1;
+	}
+
+	while (raw < raw_end && isspace((unsigned char)raw[0])) {
+		raw++;
+	}
+
+	while (raw_end > raw && isspace((unsigned char)raw_end[-1])) {
+		raw_end--;
+	}
+
+	for (; raw < raw_end; raw++) {
+		if (*raw=='\r') {
+			continue;
+		}
+		if (*p==0 || *p!=*raw) {
+			return 1;
+		}
+		p++;
+	}
+
+	return *p!=0;
+}
+
+
+
 void dc_receive_imf(dc_context_t* context, const char* imf_raw_not_terminated, size_t imf_raw_bytes,
                            const char* server_folder, uint32_t server_uid, uint32_t flags)
 {
@@ -1261,8 +1297,8 @@ void dc_receive_imf(dc_context_t* context, const char* imf_raw_not_terminated, s
 					continue;
 				}
 
-				if (part->type==DC_MSG_TEXT) {
-					txt_raw = dc_mprintf("%s\n\n%s", mime_parser->subject? mime_parser->subject : "", part->msg_raw);
+				if (part->type==DC_MSG_TEXT && is_txt_raw_needed(mime_parser, part)) {
+					txt_raw = dc_mprintf("%s\n\n%.*s", mime_parser->subject? mime_parser->subject : "", (int)part->msg_raw_bytes, part->msg_raw? part->msg_raw : "");
 				}
 
 				if (mime_parser->is_system_message) {
@@ -1283,11 +1319,11 @@ void dc_receive_imf(dc_context_t* context, const char* imf_raw_not_terminated, s
 				sqlite3_bind_int  (stmt, 11, state);
 				sqlite3_bind_int  (stmt, 12, mime_parser->is_send_by_messenger);
 				sqlite3_bind_text (stmt, 13, part->msg? part->msg : "", -1, SQLITE_STATIC);
-				sqlite3_bind_text (stmt, 14, txt_raw? txt_raw : "", -1, SQLITE_STATIC);
+				dc_sqlite3_bind_compressed(stmt, 14, txt_raw? txt_raw : "", -1);
 				sqlite3_bind_text (stmt, 15, part->param->packed, -1, SQLITE_STATIC);
 				sqlite3_bind_int  (stmt, 16, part->bytes);
 				sqlite3_bind_int  (stmt, 17, hidden);
-				sqlite3_bind_text (stmt, 18, save_mime_headers? imf_raw_not_terminated : NULL, header_bytes, SQLITE_STATIC);
+				dc_sqlite3_bind_compressed(stmt, 18, save_mime_headers? imf_raw_not_terminated : NULL, header_bytes);
 				sqlite3_bind_text (stmt, 19, mime_in_reply_to, -1, SQLITE_STATIC);
 				sqlite3_bind_text (stmt, 20, mime_references, -1, SQLITE_STATIC);
 				if (sqlite3_step(stmt)!=SQLITE_DONE) {
@@ -1299,12 +1335,14 @@ void dc_receive_imf(dc_context_t* context, const char* imf_raw_not_terminated, s
 				txt_raw = NULL;
 
 				insert_msg_id = dc_sqlite3_get_rowid(context->sql, "msgs", "rfc724_mid", rfc724_mid);
+				dc_update_search_index(context->sql, insert_msg_id);
 
 				carray_add(created_db_entries, (void*)(uintptr_t)chat_id, NULL);
 				carray_add(created_db_entries, (void*)(uintptr_t)insert_msg_id, NULL);
 			}
 
 			dc_log_info(context, 0, "Message has %i parts and is assigned to chat #%i.", icnt, chat_id);
+			dc_update_chat_cache(context->sql, chat_id);
 
 			/* check event to send */
 			if (chat_id==DC_CHAT_ID_TRASH)
@@ -1438,7 +1476,12 @@ void dc_receive_imf(dc_context_t* context, const char* imf_raw_not_terminated, s
 	transaction_pending = 0;
 
 cleanup:
-	if (transaction_pending) { dc_sqlite3_rollback(context->sql); }
+	if (transaction_pending) {
+		dc_sqlite3_rollback(context->sql);
+		/* the messages and read receipts written so far are gone, do not send events for them */
+		if (created_db_entries) { carray_set_size(created_db_entries, 0); }
+		if (rr_event_to_send) { carray_set_size(rr_event_to_send, 0); }
+	}
 
 	dc_mimeparser_unref(mime_parser);
 	free(rfc724_mid);
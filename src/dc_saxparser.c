@@ -21,6 +21,7 @@ NB: SAX = Simple API for XML */
 #include "dc_context.h"
 #include "dc_tools.h"
 #include "dc_saxparser.h"
+#include "dc_vectors.h"
 
 
 /*******************************************************************************
@@ -108,103 +109,84 @@ static const char* s_ent[] = {
 };
 
 
-/* Recursively decodes entity and character references and normalizes new lines.
-set "type" to ...
-'&' for general entity decoding,
-'%' for parameter entity decoding (currently not needed),
-'c' for cdata sections,
-' ' for attribute normalization, or
-'*' for non-cdata attribute normalization (currently not needed).
-Returns s, or if the decoded string is longer than s, returns a malloced string
-that must be freed.
-Function based upon ezxml_decode() from the "ezxml" parser which is
-Copyright 2004-2006 Aaron Voisine <aaron@voisine.org> */
-static char* xml_decode(char* s, char type)
+/* the longest name in s_ent, including the `;` */
+#define MAX_ENTITY_BYTES 9
+
+
+/* Decode the entity or character reference at *s, which points to a `&`;
+returns the number of bytes written to out, this is never more than the reference is long.
+*s is set behind the reference; if there is no known reference, the `&` is copied and *s is set behind it. */
+static size_t decode_reference(const char** s, const char* s_end, char* out)
 {
-	char*       e = NULL;
-	char*       r = s;
-	const char* original_buf = s;
-	long        b = 0;
-	long        c = 0;
-	long        d = 0;
-	long        l = 0;
-
-	for (; *s; s++) { /* normalize line endings */
-		while (*s == '\r') {
-			*(s++) = '\n';
-			if (*s == '\n') memmove(s, (s + 1), strlen(s));
-		}
+	const char* p = *s + 1;
+	int64_t     c = 0;
+	int         b = 0;
+	int64_t     d = 0;
+	size_t      out_bytes = 0;
+
+	/* `&amp;` is decoded to `&`, which may start another reference, eg. `&amp;lt;` is decoded to `<` */
+	while (s_end-p >= 4 && memcmp(p, "amp;", 4)==0) {
+		p += 4;
 	}
 
-	for (s = r; ;) {
-		while (*s && *s != '&' /*&& (*s != '%' || type != '%')*/ && !isspace(*s)) s++;
+	if (p < s_end && *p=='#')
+	{
+		/* character reference, base 10 or base 16 */
+		const char* digits = ++p;
+		int         base = 10;
+		if (p < s_end && *p=='x') {
+			base = 16;
+			digits = ++p;
+		}
 
-		if (! *s)
-		{
-			break;
+		while (p < s_end && c <= 0x7FFFFFFF) {
+			if (*p>='0' && *p<='9')                { d = *p-'0'; }
+			else if (base==16 && *p>='a' && *p<='f') { d = *p-'a'+10; }
+			else if (base==16 && *p>='A' && *p<='F') { d = *p-'A'+10; }
+			else                                     { break; }
+			c = c*base + d;
+			p++;
 		}
-		else if (type != 'c' && ! strncmp(s, "&#", 2))
-		{
-			/* character reference */
-			if (s[2] == 'x') c = strtol(s + 3, &e, 16); /* base 16 */
-			else c = strtol(s + 2, &e, 10); /* base 10 */
-			if (! c || *e != ';') { s++; continue; } /* not a character ref */
 
-			if (c < 0x80) *(s++) = c; /* US-ASCII subset */
+		if (p!=digits && p < s_end && *p==';' && c > 0 && c <= 0x7FFFFFFF)
+		{
+			if (c < 0x80) { /* US-ASCII subset */
+				out[out_bytes++] = c;
+			}
 			else { /* multi-byte UTF-8 sequence */
 				for (b = 0, d = c; d; d /= 2) b++; /* number of bits in c */
 				b = (b - 2) / 5; /* number of bytes in payload */
-				*(s++) = (0xFF << (7 - b)) | (c >> (6 * b)); /* head */
-				while (b) *(s++) = 0x80 | ((c >> (6 * --b)) & 0x3F); /* payload */
+				out[out_bytes++] = (0xFF << (7 - b)) | (c >> (6 * b)); /* head */
+				while (b) out[out_bytes++] = 0x80 | ((c >> (6 * --b)) & 0x3F); /* payload */
 			}
-
-			memmove(s, strchr(s, ';') + 1, strlen(strchr(s, ';')));
+			*s = p + 1;
+			return out_bytes;
 		}
-		else if ((*s == '&' && (type == '&' || type == ' ' /*|| type == '*'*/))
-		    /*|| (*s == '%' && type == '%')*/)
+
+		p = digits - (base==16? 2 : 1);
+	}
+	else
+	{
+		/* entity reference */
+		const char* semicolon = memchr(p, ';', DC_MIN(s_end-p, MAX_ENTITY_BYTES));
+		if (semicolon)
 		{
-			/* entity reference */
-			for (b = 0; s_ent[b] && strncmp(s + 1, s_ent[b], strlen(s_ent[b])); b += 2)
-				; /* find entity in entity list */
-
-			if (s_ent[b++]) { /* found a match */
-				if ((c = strlen(s_ent[b])) - 1 > (e = strchr(s, ';')) - s) {
-					/* the replacement is larger than the entity: enlarge buffer */
-					l = (d = (s - r)) + c + strlen(e); /* new length */
-					if (r == original_buf) {
-						char* new_ret = malloc(l); if (new_ret == NULL) { return r; }
-						strcpy(new_ret, r);
-						r = new_ret;
-					}
-					else {
-						char* new_ret = realloc(r, l); if (new_ret == NULL) { return r; }
-						r = new_ret;
-					}
-					e = strchr((s = r + d), ';'); /* fix up pointers */
+			size_t name_bytes = semicolon + 1 - p;
+			for (b = 0; s_ent[b]; b += 2) {
+				if (s_ent[b][0]==p[0] && strlen(s_ent[b])==name_bytes && memcmp(s_ent[b], p, name_bytes)==0) {
+					out_bytes = strlen(s_ent[b+1]);
+					memcpy(out, s_ent[b+1], out_bytes);
+					*s = semicolon + 1;
+					return out_bytes;
 				}
-
-				memmove(s + c, e + 1, strlen(e)); /* shift rest of string */
-				strncpy(s, s_ent[b], c); /* copy in replacement text */
 			}
-			else s++; /* not a known entity */
-		}
-		else if ((type == ' ' /*|| type == '*'*/) && isspace(*s))
-		{
-			*(s++) = ' ';
 		}
-		else s++; /* no decoding needed */
 	}
 
-	/* normalize spaces for non-cdata attributes
-	if (type == '*') {
-		for (s = r; *s; s++) {
-			if ((l = strspn(s, " "))) memmove(s, s + l, strlen(s + l) + 1);
-			while (*s && *s != ' ') s++;
-		}
-		if (--s >= r && *s == ' ') *s = '\0';
-	}*/
-
-	return r;
+	/* not a known reference, the characters following the `&` are decoded as usual */
+	out[0] = '&';
+	*s = p;
+	return 1;
 }
 
 
@@ -221,35 +203,223 @@ static void def_endtag_cb   (void* userdata, const char* tag) { }
 static void def_text_cb     (void* userdata, const char* text, int len) { }
 
 
-static void call_text_cb(dc_saxparser_t* saxparser, char* text, size_t len, char type)
+static int is_xml_ws(char c)
+{
+	return (c=='\t' || c=='\r' || c=='\n' || c==' ');
+}
+
+
+static const char* skip_xml_ws(const char* p, const char* p_end)
+{
+	while (p < p_end && is_xml_ws(*p)) { p++; }
+	return p;
+}
+
+
+static const char* skip_isspace(const char* p, const char* p_end)
+{
+	while (p < p_end && isspace((unsigned char)*p)) { p++; }
+	return p;
+}
+
+
+/* Find the end of a name or an unquoted value, which is ended by whitespace, `/`, `>` or the characters in more_stops. */
+static const char* find_name_end(const char* p, const char* p_end, const char* more_stops)
+{
+	while (p < p_end && !is_xml_ws(*p) && *p!='/' && *p!='>' && strchr(more_stops, *p)==NULL) { p++; }
+	return p;
+}
+
+
+static int starts_with(const char* p, const char* p_end, const char* str)
+{
+	size_t str_bytes = strlen(str);
+	return ((size_t)(p_end-p) >= str_bytes && memcmp(p, str, str_bytes)==0);
+}
+
+
+/* Search a string; returns NULL if it is not found. */
+static const char* find_str(const char* p, const char* p_end, const char* str)
 {
-	if (text && len)
+	size_t str_bytes = strlen(str);
+	while ((size_t)(p_end-p) >= str_bytes
+	    && (p=memchr(p, str[0], p_end-p-str_bytes+1))!=NULL) {
+		if (memcmp(p, str, str_bytes)==0) {
+			return p;
+		}
+		p++;
+	}
+	return NULL;
+}
+
+
+#ifdef DC_USE_VECTORS
+
+#define FIND_MARKUP_BLOCKS(s8v, u64v) { \
+	size_t i = 0; \
+	while (buf_bytes-i >= sizeof(s8v)) { \
+		s8v    c; \
+		size_t offset; \
+		memcpy(&c, buf+i, sizeof(s8v)); \
+		DC_FIRST_SET_BYTE(u64v, (c=='<') | (c=='&') | (c=='\r'), offset); \
+		i += offset; \
+		if (offset < sizeof(s8v)) { \
+			break; \
+		} \
+	} \
+	return i; \
+}
+
+
+static size_t find_markup_blocks16(const char* buf, size_t buf_bytes)
+FIND_MARKUP_BLOCKS(dc_s8x16_t, dc_u64x2_t)
+
+
+#ifdef DC_USE_AVX2
+__attribute__((target("avx2")))
+static size_t find_markup_blocks32(const char* buf, size_t buf_bytes)
+FIND_MARKUP_BLOCKS(dc_s8x32_t, dc_u64x4_t)
+#endif
+
+#endif /* DC_USE_VECTORS */
+
+
+/* Offset of the first `<`, `&` or `\r`, these are the only characters that need to be handled in texts;
+buf_bytes if there is none of them. */
+static size_t find_markup(const char* buf, size_t buf_bytes)
+{
+	size_t i = 0;
+
+	#ifdef DC_USE_VECTORS
+		#ifdef DC_USE_AVX2
+		if (dc_use_avx2()) {
+			i = find_markup_blocks32(buf, buf_bytes);
+		}
+		#endif
+		i += find_markup_blocks16(buf+i, buf_bytes-i);
+	#endif
+
+	while (i < buf_bytes && buf[i]!='<' && buf[i]!='&' && buf[i]!='\r') {
+		i++;
+	}
+	return i;
+}
+
+
+/* Tag names, attributes and decoded texts are written to a scratch buffer that is reused for every tag and text.
+Unless a tag or a text needs more than the space on the stack, nothing is allocated. */
+typedef struct scratch_t
+{
+	char*  buf;
+	size_t allocated;
+	size_t used;
+	char   stack_buf[4096];
+} scratch_t;
+
+
+static void scratch_reserve(scratch_t* scratch, size_t add_bytes)
+{
+	if (scratch->used + add_bytes > scratch->allocated)
 	{
-		char bak = text[len], *text_new;
+		size_t allocated = DC_MAX(scratch->used + add_bytes, scratch->allocated*2);
+		char*  buf = malloc(allocated);
+		if (buf==NULL) {
+			exit(75);
+		}
+		memcpy(buf, scratch->buf, scratch->used);
+		if (scratch->buf!=scratch->stack_buf) {
+			free(scratch->buf);
+		}
+		scratch->buf       = buf;
+		scratch->allocated = allocated;
+	}
+}
+
 
-		text[len] = '\0';
-		text_new = xml_decode(text, type);
-		saxparser->text_cb(saxparser->userdata, text_new, len);
-		if (text != text_new) { free(text_new); }
+/* Add a tag or an attribute name, converted to lower case; returns the offset of the null-terminated name. */
+static size_t scratch_add_name(scratch_t* scratch, const char* name, const char* name_end)
+{
+	size_t offset = scratch->used;
+	scratch_reserve(scratch, name_end-name+1);
+	memcpy(scratch->buf+offset, name, name_end-name);
+	scratch->buf[offset + (name_end-name)] = 0;
+	dc_strlower_in_place(scratch->buf+offset);
+	scratch->used += name_end-name+1;
+	return offset;
+}
+
+
+/* Decode entity and character references and normalize line ends.
+The result is added null-terminated to the scratch buffer, its offset is returned.
+Set type to ...
+'&' for text,
+'c' for cdata sections or
+' ' for attribute values, whitespace is converted to spaces then.
+Function based upon ezxml_decode() from the "ezxml" parser which is
+Copyright 2004-2006 Aaron Voisine <aaron@voisine.org> */
+static size_t scratch_add_decoded(scratch_t* scratch, const char* s, const char* s_end, char type)
+{
+	size_t offset = scratch->used;
+	char*  o = NULL;
+
+	scratch_reserve(scratch, s_end-s+1); /* the decoded text is never longer */
+	o = scratch->buf + offset;
+
+	while (s < s_end)
+	{
+		if (type!=' ') {
+			size_t plain_bytes = find_markup(s, s_end-s);
+			memcpy(o, s, plain_bytes);
+			o += plain_bytes;
+			s += plain_bytes;
+			if (s==s_end) {
+				break;
+			}
+		}
 
-		text[len] = bak;
+		if (*s=='\r')
+		{
+			/* normalize line endings */
+			*o++ = (type==' ')? ' ' : '\n';
+			s++;
+			if (s < s_end && *s=='\n') {
+				s++;
+			}
+		}
+		else if (*s=='&' && type!='c')
+		{
+			o += decode_reference(&s, s_end, o);
+		}
+		else if (type==' ' && isspace((unsigned char)*s))
+		{
+			*o++ = ' ';
+			s++;
+		}
+		else
+		{
+			*o++ = *s++;
+		}
 	}
+
+	*o = 0;
+	scratch->used = (o+1) - scratch->buf;
+	return offset;
 }
 
 
-static void do_free_attr(char** attr, int* free_attr)
+static void call_text_cb(dc_saxparser_t* saxparser, scratch_t* scratch, const char* text, const char* text_end, char type)
 {
-	/* "attr" are key/value pairs; the function frees the data if the corresponding bit in "free_attr" is set.
-	(we need this as we try to use the strings from the "main" document instead of allocating small strings) */
-	#define FREE_KEY    0x01
-	#define FREE_VALUE  0x02
-	int i = 0;
-	while (attr[i]) {
-		if (free_attr[i>>1]&FREE_KEY   && attr[i])   { free(attr[i]); }
-		if (free_attr[i>>1]&FREE_VALUE && attr[i+1]) { free(attr[i+1]); }
-		i += 2;
+	if (text < text_end)
+	{
+		if (type==0) {
+			saxparser->text_cb(saxparser->userdata, text, text_end-text); /* nothing to decode */
+		}
+		else {
+			scratch->used = 0;
+			scratch_add_decoded(scratch, text, text_end, type);
+			saxparser->text_cb(saxparser->userdata, scratch->buf, scratch->used-1);
+		}
 	}
-	attr[0] = NULL; /* set list to zero-length */
 }
 
 
@@ -304,240 +474,220 @@ void dc_saxparser_set_text_handler (dc_saxparser_t* saxparser, dc_saxparser_text
 }
 
 
-void dc_saxparser_parse(dc_saxparser_t* saxparser, const char* buf_start__)
+void dc_saxparser_parse(dc_saxparser_t* saxparser, const char* buf, size_t buf_bytes)
 {
-	char  bak = 0;
-	char* buf_start = NULL;
-	char* last_text_start = NULL;
-	char* p = NULL;
+	/* the document is not modified and does not need to be null-terminated;
+	tag names, attributes and texts that need decoding are written to a scratch buffer */
+	const char* buf_end = buf + buf_bytes;
+	const char* last_text_start = buf;
+	char        last_text_type = 0; /* 0=the text can be passed as is, '&'=the text contains references or `\r` */
+	const char* p = buf;
+	scratch_t   scratch;
 
 	#define MAX_ATTR 100 /* attributes per tag - a fixed border here is a security feature, not a limit */
 	char*   attr[(MAX_ATTR+1)*2]; /* attributes as key/value pairs, +1 for terminating the list */
-	int     free_attr[MAX_ATTR]; /* free the value at attr[i*2+1]? */
+	size_t  attr_offset[MAX_ATTR]; /* the offsets of attr in the scratch buffer, which may be moved while the tag is parsed */
 
-	attr[0] = NULL; /* null-terminate list, this also terminates "free_values" */
-
-	if (saxparser==NULL) {
+	if (saxparser==NULL || buf==NULL) {
 		return;
 	}
 
-	buf_start = dc_strdup(buf_start__); /* we make a copy as we can easily null-terminate tag names and attributes "in place" */
-	last_text_start = buf_start;
-	p               = buf_start;
-	while (*p)
+	scratch.buf       = scratch.stack_buf;
+	scratch.allocated = sizeof(scratch.stack_buf);
+	scratch.used      = 0;
+
+	while (p < buf_end)
 	{
-		if (*p=='<')
+		p += find_markup(p, buf_end-p);
+		if (p < buf_end && *p!='<') {
+			last_text_type = '&';
+			if ((p = memchr(p, '<', buf_end-p))==NULL) {
+				p = buf_end;
+			}
+		}
+
+		if (p==buf_end) {
+			break;
+		}
+
+		call_text_cb(saxparser, &scratch, last_text_start, p, last_text_type); /* flush pending text */
+
+		p++;
+		if (starts_with(p, buf_end, "!--"))
 		{
-			call_text_cb(saxparser, last_text_start, p - last_text_start, '&'); /* flush pending text */
+			/* skip <!-- ... --> comment
+			 **************************************************************/
 
-			p++;
-			if (strncmp(p, "!--", 3)==0)
-			{
-				/* skip <!-- ... --> comment
-				 **************************************************************/
+			p = find_str(p, buf_end, "-->");
+			if (p==NULL) { goto cleanup; }
+			p += 3;
+		}
+		else if (starts_with(p, buf_end, "![CDATA["))
+		{
+			/* process <![CDATA[ ... ]]> text
+			 **************************************************************/
 
-				p = strstr(p, "-->");
-				if (p==NULL) { goto cleanup; }
+			const char* text_beg = p + 8;
+			if ((p = find_str(p, buf_end, "]]>"))!=NULL) /* `]]>` itself is not allowed in CDATA and must be escaped by dividing into two CDATA parts  */ {
+				call_text_cb(saxparser, &scratch, text_beg, p, 'c');
 				p += 3;
 			}
-			else if (strncmp(p, "![CDATA[", 8)==0)
-			{
-				/* process <![CDATA[ ... ]]> text
-				 **************************************************************/
+			else {
+				call_text_cb(saxparser, &scratch, text_beg, buf_end, 'c'); /* CDATA not closed, add all remaining text */
+				goto cleanup;
+			}
+		}
+		else if (starts_with(p, buf_end, "!DOCTYPE"))
+		{
+			/* skip <!DOCTYPE ...> or <!DOCTYPE name [ ... ]>
+			 **************************************************************/
 
-				char* text_beg = p + 8;
-				if ((p = strstr(p, "]]>"))!=NULL) /* `]]>` itself is not allowed in CDATA and must be escaped by dividing into two CDATA parts  */ {
-					call_text_cb(saxparser, text_beg, p-text_beg, 'c');
-					p += 3;
+			while (p < buf_end && *p != '[' && *p != '>' ) p++; /* search for [ or >, whatever comes first */
+			if (p==buf_end) {
+				goto cleanup; /* unclosed doctype */
+			}
+			else if (*p=='[') {
+				p = find_str(p, buf_end, "]>"); /* search end of inline doctype */
+				if (p==NULL) {
+					goto cleanup; /* unclosed inline doctype */
 				}
 				else {
-					call_text_cb(saxparser, text_beg, strlen(text_beg), 'c'); /* CDATA not closed, add all remaining text */
-					goto cleanup;
+					p += 2;
 				}
 			}
-			else if (strncmp(p, "!DOCTYPE", 8)==0)
+			else {
+				p++;
+			}
+		}
+		else if (p < buf_end && *p=='?')
+		{
+			/* skip <? ... ?> processing instruction
+			 **************************************************************/
+
+			p = find_str(p, buf_end, "?>");
+			if (p==NULL) { goto cleanup; } /* unclosed processing instruction */
+			p += 2;
+		}
+		else
+		{
+			p = skip_xml_ws(p, buf_end); /* skip whitespace between `<` and tagname */
+			if (p < buf_end && *p=='/')
 			{
-				/* skip <!DOCTYPE ...> or <!DOCTYPE name [ ... ]>
+				/* process </tag> end tag
 				 **************************************************************/
 
-				while (*p && *p != '[' && *p != '>' ) p++; /* search for [ or >, whatever comes first */
-				if (*p==0) {
-					goto cleanup; /* unclosed doctype */
-				}
-				else if (*p=='[') {
-					p = strstr(p, "]>"); /* search end of inline doctype */
-					if (p==NULL) {
-						goto cleanup; /* unclosed inline doctype */
-					}
-					else {
-						p += 2;
-					}
-				}
-				else {
-					p++;
+				p++;
+				p = skip_xml_ws(p, buf_end); /* skip whitespace between `/` and tagname */
+				const char* beg_tag_name = p;
+				p = find_name_end(p, buf_end, ""); /* find character after tagname */
+				if (p != beg_tag_name)
+				{
+					scratch.used = 0;
+					scratch_add_name(&scratch, beg_tag_name, p);
+					saxparser->endtag_cb(saxparser->userdata, scratch.buf);
 				}
 			}
-			else if (*p=='?')
+			else
 			{
-				/* skip <? ... ?> processing instruction
+				/* process <tag attr1="val" attr2='val' attr3=val ..>
 				 **************************************************************/
 
-				p = strstr(p, "?>");
-				if (p==NULL) { goto cleanup; } /* unclosed processing instruction */
-				p += 2;
-			}
-			else
-			{
-				p += strspn(p, XML_WS); /* skip whitespace between `<` and tagname */
-				if (*p=='/')
-				{
-					/* process </tag> end tag
-					 **************************************************************/
-
-					p++;
-					p += strspn(p, XML_WS); /* skip whitespace between `/` and tagname */
-					char* beg_tag_name = p;
-					p += strcspn(p, XML_WS "/>"); /* find character after tagname */
-					if (p != beg_tag_name)
-					{
-						bak = *p;
-						*p = '\0'; /* null-terminate tag name temporary, eg. a covered `>` may get important downwards */
-						dc_strlower_in_place(beg_tag_name);
-						saxparser->endtag_cb(saxparser->userdata, beg_tag_name);
-						*p = bak;
-					}
-				}
-				else
+				const char* beg_tag_name = p;
+				p = find_name_end(p, buf_end, ""); /* find character after tagname */
+				if (p != beg_tag_name)
 				{
-					/* process <tag attr1="val" attr2='val' attr3=val ..>
-					 **************************************************************/
+					int i = 0;
+					int attr_index = 0;
 
-					do_free_attr(attr, free_attr);
+					scratch.used = 0;
+					scratch_add_name(&scratch, beg_tag_name, p); /* the tag name is at offset 0 */
 
-					char* beg_tag_name = p;
-					p += strcspn(p, XML_WS "/>"); /* find character after tagname */
-					if (p != beg_tag_name)
+					/* scan for attributes */
+					p = skip_isspace(p, buf_end); /* forward to first attribute name beginning */
+					while (p < buf_end && *p!='/' && *p!='>')
 					{
-						char* after_tag_name = p;
+						const char* beg_attr_name = p;
+						const char* beg_attr_value = "";
+						const char* end_attr_value = beg_attr_value;
+						if ('='==*beg_attr_name) {
+							p++; // otherwise eg. `"val"=` causes a deadlock as the second `=` is no exit condition and is not skipped by find_name_end()
+							continue;
+						}
 
-						/* scan for attributes */
-						int attr_index = 0;
-						while (isspace(*p)) { p++; } /* forward to first attribute name beginning */
-						while (*p && *p!='/' && *p!='>')
+						p = find_name_end(p, buf_end, "="); /* get end of attribute name */
+						if (p != beg_attr_name)
 						{
-							char *beg_attr_name = p, *beg_attr_value = NULL, *beg_attr_value_new = NULL;
-							if ('='==*beg_attr_name) {
-								p++; // otherwise eg. `"val"=` causes a deadlock as the second `=` is no exit condition and is not skipped by strcspn()
-								continue;
-							}
-
-							p += strcspn(p, XML_WS "=/>"); /* get end of attribute name */
-							if (p != beg_attr_name)
+							/* attribute found */
+							const char* after_attr_name = p;
+							p = skip_xml_ws(p, buf_end); /* skip whitespace between attribute name and possible `=` */
+							if (p < buf_end && *p=='=')
 							{
-								/* attribute found */
-								char* after_attr_name = p;
-								p += strspn(p, XML_WS); /* skip whitespace between attribute name and possible `=` */
-								if (*p=='=')
+								while (p < buf_end && (is_xml_ws(*p) || *p=='=')) { p++; } /* skip spaces and equal signs */
+								char quote = (p < buf_end)? *p : 0;
+								if (quote=='"' || quote=='\'')
 								{
-									p += strspn(p, XML_WS "="); /* skip spaces and equal signs */
-									char quote = *p;
-									if (quote=='"' || quote=='\'')
-									{
-										/* quoted attribute value */
+									/* quoted attribute value */
+									p++;
+									beg_attr_value = p;
+									while (p < buf_end && *p != quote) { p++; }
+									end_attr_value = p;
+									if (p < buf_end) {
 										p++;
-										beg_attr_value = p;
-
-										while (*p && *p != quote) { p++; }
-										if (*p) {
-											*p = '\0'; /* null terminate attribute val */
-											p++;
-										}
-
-										beg_attr_value_new = xml_decode(beg_attr_value, ' ');
-									}
-									else
-									{
-										/* unquoted attribute value, as the needed null-terminated may overwrite important characters, we'll create a copy */
-										beg_attr_value = p;
-										p += strcspn(p, XML_WS "/>"); /* get end of attribute value */
-										bak = *p;
-										*p = '\0';
-											char* temp = dc_strdup(beg_attr_value);
-											beg_attr_value_new = xml_decode(temp, ' ');
-											if (beg_attr_value_new!=temp) { free(temp); }
-										*p = bak;
 									}
 								}
 								else
 								{
-									beg_attr_value_new = dc_strdup(NULL);
-								}
-
-								/* add attribute */
-								if (attr_index < MAX_ATTR)
-								{
-									char* beg_attr_name_new = beg_attr_name;
-									int   free_bits = (beg_attr_value_new != beg_attr_value)? FREE_VALUE : 0;
-									if (after_attr_name==p) {
-										/* take care not to overwrite the current pointer (happens eg. for `<tag attrWithoutValue>` */
-										bak = *after_attr_name;
-										*after_attr_name = '\0';
-										beg_attr_name_new = dc_strdup(beg_attr_name);
-										*after_attr_name = bak;
-										free_bits |= FREE_KEY;
-									}
-									else {
-										*after_attr_name = '\0';
-									}
-
-									dc_strlower_in_place(beg_attr_name_new);
-									attr[attr_index]         = beg_attr_name_new;
-									attr[attr_index+1]       = beg_attr_value_new;
-									attr[attr_index+2]       = NULL; /* null-terminate list */
-									free_attr[attr_index>>1] = free_bits;
-									attr_index += 2;
+									/* unquoted attribute value */
+									beg_attr_value = p;
+									p = find_name_end(p, buf_end, ""); /* get end of attribute value */
+									end_attr_value = p;
 								}
 							}
 
-							while (isspace(*p)) { p++; } /* forward to attribute name beginning */
+							/* add attribute */
+							if (attr_index < MAX_ATTR)
+							{
+								attr_offset[attr_index]   = scratch_add_name(&scratch, beg_attr_name, after_attr_name);
+								attr_offset[attr_index+1] = scratch_add_decoded(&scratch, beg_attr_value, end_attr_value, ' ');
+								attr_index += 2;
+							}
 						}
 
-						char bak = *after_tag_name; /* backup the character as it may be `/` or `>` which gets important downwards */
-						*after_tag_name = 0;
-						dc_strlower_in_place(beg_tag_name);
-						saxparser->starttag_cb(saxparser->userdata, beg_tag_name, attr);
-						*after_tag_name = bak;
+						p = skip_isspace(p, buf_end); /* forward to attribute name beginning */
+					}
 
-						/* self-closing tag */
-						p += strspn(p, XML_WS); /* skip whitespace before possible `/` */
-						if (*p=='/')
-						{
-							p++;
-							*after_tag_name = 0;
-							saxparser->endtag_cb(saxparser->userdata, beg_tag_name); /* already lowercase from starttag_cb()-call */
-						}
+					for (i = 0; i < attr_index; i++) {
+						attr[i] = scratch.buf + attr_offset[i];
 					}
+					attr[attr_index] = NULL; /* null-terminate list */
 
-				} /* end of processing start-tag */
+					saxparser->starttag_cb(saxparser->userdata, scratch.buf, attr);
 
-				p = strchr(p, '>');
-				if (p==NULL) { goto cleanup; } /* unclosed start-tag or end-tag */
-				p++;
+					/* self-closing tag */
+					p = skip_xml_ws(p, buf_end); /* skip whitespace before possible `/` */
+					if (p < buf_end && *p=='/')
+					{
+						p++;
+						saxparser->endtag_cb(saxparser->userdata, scratch.buf); /* already lowercase from starttag_cb()-call */
+					}
+				}
 
-			} /* end of processing start-tag or end-tag */
+			} /* end of processing start-tag */
 
-			last_text_start = p;
-		}
-		else
-		{
+			p = memchr(p, '>', buf_end-p);
+			if (p==NULL) { goto cleanup; } /* unclosed start-tag or end-tag */
 			p++;
-		}
+
+		} /* end of processing start-tag or end-tag */
+
+		last_text_start = p;
+		last_text_type  = 0;
 	}
 
-	call_text_cb(saxparser, last_text_start, p - last_text_start, '&'); /* flush pending text */
+	call_text_cb(saxparser, &scratch, last_text_start, buf_end, last_text_type); /* flush pending text */
 
 cleanup:
-	do_free_attr(attr, free_attr);
-	free(buf_start);
+	if (scratch.buf!=scratch.stack_buf) {
+		free(scratch.buf);
+	}
 }
-
@@ -10,7 +10,7 @@ typedef struct _dc_saxparser dc_saxparser_t;
 
 typedef void (*dc_saxparser_starttag_cb_t) (void* userdata, const char* tag, char** attr);
 typedef void (*dc_saxparser_endtag_cb_t)   (void* userdata, const char* tag);
-typedef void (*dc_saxparser_text_cb_t)     (void* userdata, const char* text, int len); /* len is only informational, text is already null-terminated */
+typedef void (*dc_saxparser_text_cb_t)     (void* userdata, const char* text, int len); /* text is not null-terminated, use len */
 
 
 struct _dc_saxparser
@@ -26,7 +26,7 @@ void           dc_saxparser_init             (dc_saxparser_t*, void* userData);
 void           dc_saxparser_set_tag_handler  (dc_saxparser_t*, dc_saxparser_starttag_cb_t, dc_saxparser_endtag_cb_t);
 void           dc_saxparser_set_text_handler (dc_saxparser_t*, dc_saxparser_text_cb_t);
 
-void           dc_saxparser_parse            (dc_saxparser_t*, const char* text);
+void           dc_saxparser_parse            (dc_saxparser_t*, const char* buf, size_t buf_bytes);
 
 const char*    dc_attr_find                  (char** attr, const char* key);
 
@@ -5,7 +5,6 @@
 #include "dc_tools.h"
 #include "dc_dehtml.h"
 #include "dc_mimeparser.h"
-#include "dc_strbuilder.h"
 
 
 /*******************************************************************************
@@ -13,10 +12,11 @@
  ******************************************************************************/
 
 
-static int is_empty_line(const char* buf)
+static int is_empty_line(const char* buf, size_t buf_bytes)
 {
 	const unsigned char* p1 = (const unsigned char*)buf; /* force unsigned - otherwise the `> ' '` comparison will fail */
-	while (*p1) {
+	const unsigned char* end = p1 + buf_bytes;
+	while (p1 < end) {
 		if (*p1 > ' ') {
 			return 0; /* at least one character found - buffer is not empty */
 		}
@@ -26,30 +26,28 @@ static int is_empty_line(const char* buf)
 }
 
 
-static int is_plain_quote(const char* buf)
+static int is_plain_quote(const char* buf, size_t buf_bytes)
 {
-	if (buf[0]=='>') {
+	if (buf_bytes > 0 && buf[0]=='>') {
 		return 1;
 	}
 	return 0;
 }
 
 
-static int is_quoted_headline(const char* buf)
+static int is_quoted_headline(const char* buf, size_t buf_bytes)
 {
 	/* This function may be called for the line _directly_ before a quote.
 	The function checks if the line contains sth. like "On 01.02.2016, xy@z wrote:" in various languages.
 	- Currently, we simply check if the last character is a ':'.
 	- Checking for the existance of an email address may fail (headlines may show the user's name instead of the address) */
 
-	int buf_len = strlen(buf);
-
-	if (buf_len > 80) {
+	if (buf_bytes > 80) {
 		return 0; /* the buffer is too long to be a quoted headline (some mailprograms (eg. "Mail" from Stock Android)
 		          forget to insert a line break between the answer and the quoted headline ...)) */
 	}
 
-	if (buf_len > 0 && buf[buf_len-1]==':') {
+	if (buf_bytes > 0 && buf[buf_bytes-1]==':') {
 		return 1; /* the buffer is a quoting headline in the meaning described above) */
 	}
 
@@ -57,6 +55,61 @@ static int is_quoted_headline(const char* buf)
 }
 
 
+static int is_line(const char* buf, size_t buf_bytes, const char* str)
+{
+	size_t str_bytes = strlen(str);
+	return (buf_bytes==str_bytes && memcmp(buf, str, str_bytes)==0);
+}
+
+
+static int line_starts_with(const char* buf, size_t buf_bytes, const char* str)
+{
+	size_t str_bytes = strlen(str);
+	return (buf_bytes>=str_bytes && memcmp(buf, str, str_bytes)==0);
+}
+
+
+/* Get the line starting at buf; the returned line does not contain the line end
+and no `\r` before it. Returns the start of the next line, NULL if there is none. */
+static const char* get_line(const char* buf, const char* buf_end, size_t* ret_line_bytes)
+{
+	const char* line_end = memchr(buf, '\n', buf_end-buf);
+	const char* next = NULL;
+
+	if (line_end) {
+		next = line_end + 1;
+	}
+	else {
+		line_end = buf_end;
+	}
+
+	while (line_end > buf && line_end[-1]=='\r') {
+		line_end--;
+	}
+
+	*ret_line_bytes = line_end - buf;
+	return next;
+}
+
+
+/* Check if there are `\r` that are not directly before a line end;
+these cannot be skipped by get_line() and must be removed from the text beforehand. */
+static int has_inner_cr_chars(const char* buf, size_t buf_bytes)
+{
+	const char* buf_end = buf + buf_bytes;
+	const char* p1 = buf;
+	while ((p1=memchr(p1, '\r', buf_end-p1))!=NULL) {
+		while (p1 < buf_end && *p1=='\r') {
+			p1++;
+		}
+		if (p1 < buf_end && *p1!='\n') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
 
 /*******************************************************************************
  * Main interface
@@ -91,160 +144,197 @@ void dc_simplify_unref(dc_simplify_t* simplify)
 
 
 static char* dc_simplify_simplify_plain_text(dc_simplify_t* simplify,
-                                             const char* buf_terminated,
+                                             const char* buf, size_t buf_bytes,
                                              int is_msgrmsg)
 {
 	/* This function ...
 	... removes all text after the line `-- ` (footer mark)
 	... removes full quotes at the beginning and at the end of the text -
 	    these are all lines starting with the character `>`
-	... remove a non-empty line before the removed quote (contains sth. like "On 2.9.2016, Bjoern wrote:" in different formats and lanugages) */
-
-	/* split the given buffer into lines */
-	carray* lines = dc_split_into_lines(buf_terminated);
-	int     l = 0;
-	int     l_first = 0;
-	int     l_last = carray_count(lines)-1; /* if l_last is -1, there are no lines */
-	char*   line = NULL;
-
-	/* search for the line `-- ` and ignore this and all following lines
-	If the line contains more characters, it is _not_ treated as the footer start mark (hi, Thorsten) */
+	... remove a non-empty line before the removed quote (contains sth. like "On 2.9.2016, Bjoern wrote:" in different formats and lanugages)
+
+	The lines are scanned only once; the lines to keep are recorded as line numbers
+	and as the range of the buffer they're found in, so that no line needs to be copied before the result is created. */
+
+	const char* buf_end = buf + buf_bytes;
+	const char* line = NULL;
+	size_t      line_bytes = 0;
+	const char* next = buf;
+	int         l = 0;
+	int         l_first = 0;
+	int         l_last = -1; /* if l_last is less than l_first, there are no lines */
+	const char* first_start = buf_end;
+	const char* last_end = buf;
+
+	const char* prev_line[2] = { NULL, NULL }; /* the two lines before the current one */
+	size_t      prev_line_bytes[2] = { 0, 0 };
+
+	/* state of the search for full quotes at the end of the text:
+	the first quote after the last line that is neither empty nor a quote, and the two lines before it */
+	int         bottom_quote = -1;
+	const char* bottom_quote_start = NULL;
+	const char* bottom_prev_line[2] = { NULL, NULL };
+	size_t      bottom_prev_line_bytes[2] = { 0, 0 };
+
+	/* state of the search for full quotes at the beginning of the text */
+	int         top_done = 0;
+	int         top_has_headline = 0;
+	int         top_quote = -1;
+	const char* top_quote_next = NULL;
+
+	char*       ret = NULL;
+	char*       p1 = NULL;
+
+	for (l = 0; next; l++)
 	{
-		int footer_mark = 0;
-		for (l = l_first; l <= l_last; l++)
-		{
-			/* hide standard footer, "-- " - we do not set is_cut_at_end if we find this mark */
-			line = (char*)carray_get(lines, l);
-			if (strcmp(line, "-- ")==0
-			 || strcmp(line, "--  ")==0) { /* quoted-printable may encode `-- ` to `-- =20` which is converted back to `--  ` ... */
-				footer_mark = 1;
-			}
+		line = next;
+		next = get_line(line, buf_end, &line_bytes);
 
-			/* also hide some non-standard footers - they got is_cut_at_end set, however  */
-			if (strcmp(line, "--")==0
-			 || strcmp(line, "---")==0
-			 || strcmp(line, "----")==0) {
-				footer_mark = 1;
-				simplify->is_cut_at_end = 1;
-			}
-
-			if (footer_mark) {
-				l_last = l - 1; /* if l_last is -1, there are no lines */
-				break; /* done */
+		/* check for "forwarding header" */
+		if (l==0 && is_line(line, line_bytes, "---------- Forwarded message ----------")) /* do not chage this! sent exactly in this form in dc_chat.c! */
+		{
+			size_t      line1_bytes = 0, line2_bytes = 0;
+			const char* line1 = next;
+			const char* line2 = line1? get_line(line1, buf_end, &line1_bytes) : NULL;
+			if (line2
+			 && line_starts_with(line1, line1_bytes, "From: ")) {
+				get_line(line2, buf_end, &line2_bytes);
+				if (line2_bytes==0) {
+					simplify->is_forwarded = 1; /* nothing is cutted, the forward state should displayed explicitly in the ui */
+					l_first = 3;
+				}
 			}
 		}
-	}
 
-	/* check for "forwarding header" */
-	if ((l_last-l_first+1) >= 3) {
-		char* line0 = (char*)carray_get(lines, l_first);
-		char* line1 = (char*)carray_get(lines, l_first+1);
-		char* line2 = (char*)carray_get(lines, l_first+2);
-		if (strcmp(line0, "---------- Forwarded message ----------")==0 /* do not chage this! sent exactly in this form in dc_chat.c! */
-		 && strncmp(line1, "From: ", 6)==0
-		 && line2[0]==0)
-		{
-            simplify->is_forwarded = 1; /* nothing is cutted, the forward state should displayed explicitly in the ui */
-            l_first += 3;
+		/* search for the line `-- ` and ignore this and all following lines
+		If the line contains more characters, it is _not_ treated as the footer start mark (hi, Thorsten) */
+		if (is_line(line, line_bytes, "-- ")
+		 || is_line(line, line_bytes, "--  ")) { /* quoted-printable may encode `-- ` to `-- =20` which is converted back to `--  ` ... */
+			break; /* we do not set is_cut_at_end if we find this mark */
 		}
-	}
 
-	/* remove lines that typically introduce a full quote (eg. `----- Original message -----` - as we do not parse the text 100%, we may
-	also loose forwarded messages, however, the user has always the option to show the full mail text. */
-	for (l = l_first; l <= l_last; l++)
-	{
-		line = (char*)carray_get(lines, l);
-		if (strncmp(line, "-----", 5)==0
-		 || strncmp(line, "_____", 5)==0
-		 || strncmp(line, "=====", 5)==0
-		 || strncmp(line, "*****", 5)==0
-		 || strncmp(line, "~~~~~", 5)==0)
-		{
-			l_last = l - 1; /* if l_last is -1, there are no lines */
+		/* also hide some non-standard footers - they got is_cut_at_end set, however  */
+		if (is_line(line, line_bytes, "--")
+		 || is_line(line, line_bytes, "---")
+		 || is_line(line, line_bytes, "----")) {
 			simplify->is_cut_at_end = 1;
-			break; /* done */
+			break;
 		}
-	}
 
-	/* remove full quotes at the end of the text */
-	if (!is_msgrmsg)
-	{
-		int l_lastQuotedLine = -1;
-
-		for (l = l_last; l >= l_first; l--) {
-			line = (char*)carray_get(lines, l);
-			if (is_plain_quote(line)) {
-				l_lastQuotedLine = l;
-			}
-			else if (!is_empty_line(line)) {
+		if (l >= l_first)
+		{
+			/* remove lines that typically introduce a full quote (eg. `----- Original message -----` - as we do not parse the text 100%, we may
+			also loose forwarded messages, however, the user has always the option to show the full mail text. */
+			if (line_starts_with(line, line_bytes, "-----")
+			 || line_starts_with(line, line_bytes, "_____")
+			 || line_starts_with(line, line_bytes, "=====")
+			 || line_starts_with(line, line_bytes, "*****")
+			 || line_starts_with(line, line_bytes, "~~~~~"))
+			{
+				simplify->is_cut_at_end = 1;
 				break;
 			}
-		}
 
-		if (l_lastQuotedLine != -1)
-		{
-			l_last = l_lastQuotedLine-1; /* if l_last is -1, there are no lines */
-			simplify->is_cut_at_end = 1;
+			if (l==l_first) {
+				first_start = line;
+			}
+			l_last = l;
+			last_end = line + line_bytes;
 
-			if (l_last > 0) {
-				if (is_empty_line((char*)carray_get(lines, l_last))) { /* allow one empty line between quote and quote headline (eg. mails from Jürgen) */
-					l_last--;
+			if (!is_msgrmsg)
+			{
+				int is_quote = is_plain_quote(line, line_bytes);
+				int is_empty = is_empty_line(line, line_bytes);
+
+				if (is_quote) {
+					if (bottom_quote==-1) {
+						bottom_quote = l;
+						bottom_quote_start = line;
+						memcpy(bottom_prev_line, prev_line, sizeof(prev_line));
+						memcpy(bottom_prev_line_bytes, prev_line_bytes, sizeof(prev_line_bytes));
+					}
+				}
+				else if (!is_empty) {
+					bottom_quote = -1; /* the quote, if any, is not at the end */
 				}
-			}
 
-			if (l_last > 0) {
-				line = (char*)carray_get(lines, l_last);
-				if (is_quoted_headline(line)) {
-					l_last--;
+				if (!top_done) {
+					if (is_quote) {
+						top_quote = l;
+						top_quote_next = next;
+					}
+					else if (!is_empty) {
+						if (is_quoted_headline(line, line_bytes) && !top_has_headline && top_quote==-1) {
+							top_has_headline = 1; /* continue, the line may be a headline */
+						}
+						else {
+							top_done = 1; /* non-quoting line found */
+						}
+					}
 				}
 			}
 		}
+
+		prev_line[1] = prev_line[0];
+		prev_line_bytes[1] = prev_line_bytes[0];
+		prev_line[0] = line;
+		prev_line_bytes[0] = line_bytes;
 	}
 
-	/* remove full quotes at the beginning of the text */
-	if (!is_msgrmsg)
+	/* remove full quotes at the end of the text */
+	if (bottom_quote != -1)
 	{
-		int l_lastQuotedLine = -1;
-		int hasQuotedHeadline = 0;
-
-		for (l = l_first; l <= l_last; l++) {
-			line = (char*)carray_get(lines, l);
-			if (is_plain_quote(line)) {
-				l_lastQuotedLine = l;
-			}
-			else if (!is_empty_line(line)) {
-				if (is_quoted_headline(line) && !hasQuotedHeadline && l_lastQuotedLine==-1) {
-					hasQuotedHeadline = 1; /* continue, the line may be a headline */
-				}
-				else {
-					break; /* non-quoting line found */
-				}
+		l_last = bottom_quote-1;
+		last_end = bottom_quote>0? bottom_quote_start-1 : buf;
+		simplify->is_cut_at_end = 1;
+
+		if (l_last > 0) {
+			if (is_empty_line(bottom_prev_line[0], bottom_prev_line_bytes[0])) { /* allow one empty line between quote and quote headline (eg. mails from Jürgen) */
+				l_last--;
+				last_end = bottom_prev_line[0]-1;
+				bottom_prev_line[0] = bottom_prev_line[1];
+				bottom_prev_line_bytes[0] = bottom_prev_line_bytes[1];
 			}
 		}
 
-		if (l_lastQuotedLine != -1)
-		{
-			l_first = l_lastQuotedLine + 1;
-			simplify->is_cut_at_begin = 1;
+		if (l_last > 0) {
+			if (is_quoted_headline(bottom_prev_line[0], bottom_prev_line_bytes[0])) {
+				l_last--;
+				last_end = bottom_prev_line[0]-1;
+			}
 		}
 	}
 
-	/* re-create buffer from the remaining lines */
-	dc_strbuilder_t ret;
-	dc_strbuilder_init(&ret, strlen(buf_terminated));
+	/* remove full quotes at the beginning of the text;
+	if all lines are quotes, empty lines or a headline, the quotes are removed from the end already */
+	if (top_done && top_quote != -1)
+	{
+		l_first = top_quote + 1;
+		first_start = top_quote_next;
+		simplify->is_cut_at_begin = 1;
+	}
+
+	/* create the result from the remaining lines,
+	this is never longer than the lines plus the ellipses */
+	if ((ret=malloc((l_first<=l_last? last_end-first_start : 0) + 2*strlen(" " DC_EDITORIAL_ELLIPSE) + 1))==NULL) {
+		exit(74);
+	}
+	p1 = ret;
 
 	if (simplify->is_cut_at_begin) {
-		dc_strbuilder_cat(&ret, DC_EDITORIAL_ELLIPSE " ");
+		memcpy(p1, DC_EDITORIAL_ELLIPSE " ", strlen(DC_EDITORIAL_ELLIPSE " "));
+		p1 += strlen(DC_EDITORIAL_ELLIPSE " ");
 	}
 
 	int pending_linebreaks = 0; /* we write empty lines only in case and non-empty line follows */
 	int content_lines_added = 0;
 
-	for (l = l_first; l <= l_last; l++)
+	for (next = (l_first<=l_last? first_start : NULL); next; )
 	{
-		line = (char*)carray_get(lines, l);
+		line = next;
+		next = get_line(line, last_end, &line_bytes);
 
-		if (is_empty_line(line))
+		if (is_empty_line(line, line_bytes))
 		{
 			pending_linebreaks++;
 		}
@@ -254,12 +344,13 @@ static char* dc_simplify_simplify_plain_text(dc_simplify_t* simplify,
 			{
 				if (pending_linebreaks > 2) { pending_linebreaks = 2; } /* ignore more than one empty line (however, regard normal line ends) */
 				while (pending_linebreaks) {
-					dc_strbuilder_cat(&ret, "\n");
+					*p1++ = '\n';
 					pending_linebreaks--;
 				}
 			}
 
-			dc_strbuilder_cat(&ret, line);
+			memcpy(p1, line, line_bytes);
+			p1 += line_bytes;
 			content_lines_added++;
 			pending_linebreaks = 1;
 		}
@@ -267,12 +358,12 @@ static char* dc_simplify_simplify_plain_text(dc_simplify_t* simplify,
 
 	if (simplify->is_cut_at_end
 	 && (!simplify->is_cut_at_begin || content_lines_added) /* avoid two `[...]` without content */) {
-		dc_strbuilder_cat(&ret, " " DC_EDITORIAL_ELLIPSE);
+		memcpy(p1, " " DC_EDITORIAL_ELLIPSE, strlen(" " DC_EDITORIAL_ELLIPSE));
+		p1 += strlen(" " DC_EDITORIAL_ELLIPSE);
 	}
 
-	dc_free_splitted_lines(lines);
-
-	return ret.buf;
+	*p1 = 0;
+	return ret;
 }
 
 
@@ -284,9 +375,11 @@ static char* dc_simplify_simplify_plain_text(dc_simplify_t* simplify,
 char* dc_simplify_simplify(dc_simplify_t* simplify, const char* in_unterminated,
                            int in_bytes, int is_html, int is_msgrmsg)
 {
-	/* create a copy of the given buffer */
-	char* out = NULL;
-	char* temp = NULL;
+	/* the lines are read from the given buffer; a copy is needed only for converting HTML or removing stray `\r` */
+	char*       out = NULL;
+	char*       temp = NULL;
+	const char* text = in_unterminated;
+	size_t      text_bytes = 0;
 
 	if (simplify==NULL || in_unterminated==NULL || in_bytes <= 0) {
 		return dc_strdup("");
@@ -296,28 +389,29 @@ char* dc_simplify_simplify(dc_simplify_t* simplify, const char* in_unterminated,
 	simplify->is_cut_at_begin = 0;
 	simplify->is_cut_at_end   = 0;
 
-	out = strndup((char*)in_unterminated, in_bytes); /* strndup() makes sure, the string is null-terminated */
-	if (out==NULL) {
-		return dc_strdup("");
-	}
+	text_bytes = strnlen(in_unterminated, in_bytes); /* the text ends at the first null-byte, if any */
 
 	/* convert HTML to text, if needed */
 	if (is_html) {
-		if ((temp = dc_dehtml(out)) != NULL) { /* dc_dehtml() returns way too much lineends, however they're removed in the simplification below */
-			free(out);
-			out = temp;
-		}
+		temp = dc_dehtml(in_unterminated, text_bytes); /* dc_dehtml() returns way too much lineends, however they're removed in the simplification below */
+		text = temp;
+		text_bytes = strlen(temp);
 	}
 
-	/* simplify the text in the buffer (characters to remove may be marked by `\r`) */
-	dc_remove_cr_chars(out); /* make comparisons easier, eg. for line `-- ` */
-	if ((temp = dc_simplify_simplify_plain_text(simplify, out, is_msgrmsg)) != NULL) {
-		free(out);
-		out = temp;
+	/* `\r` before line ends are skipped when the lines are scanned,
+	others are removed to make comparisons easier, eg. for line `-- ` */
+	if (has_inner_cr_chars(text, text_bytes)) {
+		if (temp==NULL && (temp = strndup(text, text_bytes))==NULL) {
+			return dc_strdup("");
+		}
+
+		dc_remove_cr_chars(temp);
+		text = temp;
+		text_bytes = strlen(temp);
 	}
 
-	/* remove all `\r` from string */
-	dc_remove_cr_chars(out);
+	out = dc_simplify_simplify_plain_text(simplify, text, text_bytes, is_msgrmsg);
 
+	free(temp);
 	return out;
 }
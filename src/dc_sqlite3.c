@@ -1,8 +1,10 @@
 #include <assert.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <zlib.h>
 #include "dc_context.h"
 #include "dc_apeerstate.h"
+#include "dc_job.h"
 
 
 /* This class wraps around SQLite.
@@ -18,15 +20,41 @@ safe. However, there are some points to keep in mind:
    is halted until the first has finished writing, at most the timespan set
    by sqlite3_busy_timeout().
 
-2. Transactions are possible using `BEGIN IMMEDIATE` (this causes the first
-   thread trying to write to block the others as described in 1.
-   Transaction cannot be nested, we recommend to use them only in the
-   top-level functions or not to use them.
+2. Transactions are possible using dc_sqlite3_begin_transaction(), only one
+   thread can own a transaction at the same time, other threads wait.
+   The owning thread uses a second connection, so statements of other threads
+   never become part of the transaction.  Nested transactions are mapped to
+   savepoints, see the comments at dc_sqlite3_begin_transaction().
 
 3. Using sqlite3_last_insert_rowid() and sqlite3_changes() cause race conditions
    (between the query and the call another thread may insert or update a row.
    These functions MUST NOT be used;
-   dc_sqlite3_get_rowid() provides an alternative. */
+   dc_sqlite3_get_rowid() provides an alternative.
+
+4. Frequently used statements should be got by dc_sqlite3_borrow_stmt()
+   and given back by dc_sqlite3_return_stmt(); this avoids parsing the SQL
+   again and again.  A borrowed statement is removed from the cache, so it is
+   never used by two threads at the same time.
+
+5. The database is opened in WAL mode, if possible.  Lists shown by the UI
+   should be read using dc_sqlite3_prepare_read(), which uses a few additional
+   read-only connections; these do not wait for other threads writing.
+   For consistency, everything else uses the single handle.
+
+6. If the linked SQLite supports FTS5, the text of the messages is copied to
+   the full-text index msgs_fts; functions changing messages must call
+   dc_update_search_index() then.
+
+7. The large texts msgs.txt_raw and msgs.mime_headers are stored compressed,
+   they must be written using dc_sqlite3_bind_compressed() and read using
+   dc_sqlite3_column_uncompressed(). */
+
+
+static void clear_stmt_cache(dc_sqlite3_t*);
+static void close_readers(dc_sqlite3_t*);
+static void open_search_index(dc_sqlite3_t*);
+static sqlite3* get_cobj(dc_sqlite3_t*);
+static uint32_t get_max_msg_id(dc_sqlite3_t*);
 
 
 void dc_sqlite3_log_error(dc_sqlite3_t* sql, const char* msg_format, ...)
@@ -39,7 +67,7 @@ void dc_sqlite3_log_error(dc_sqlite3_t* sql, const char* msg_format, ...)
 
 	dc_log_error(sql->context, 0, "%s SQLite says: %s",
 		msg? msg : "",
-		sql->cobj? sqlite3_errmsg(sql->cobj) : "SQLite object not set up.");
+		sql->cobj? sqlite3_errmsg(get_cobj(sql)) : "SQLite object not set up.");
 
 	sqlite3_free(msg);
 	va_end(va);
@@ -54,7 +82,7 @@ sqlite3_stmt* dc_sqlite3_prepare(dc_sqlite3_t* sql, const char* querystr)
 		return NULL;
 	}
 
-	if (sqlite3_prepare_v2(sql->cobj,
+	if (sqlite3_prepare_v2(get_cobj(sql),
 	         querystr, -1 /*read `querystr` up to the first null-byte*/,
 	         &stmt,
 	         NULL /*tail not interesting, we use only single statements*/) != SQLITE_OK)
@@ -83,7 +111,7 @@ int dc_sqlite3_try_execute(dc_sqlite3_t* sql, const char* querystr)
 	sql_state = sqlite3_step(stmt);
 	if (sql_state != SQLITE_DONE && sql_state != SQLITE_ROW)  {
 		dc_log_warning(sql->context, 0, "Try-execute for \"%s\" failed: %s",
-			querystr, sqlite3_errmsg(sql->cobj));
+			querystr, sqlite3_errmsg(get_cobj(sql)));
 		goto cleanup;
 	}
 
@@ -147,6 +175,22 @@ dc_sqlite3_t* dc_sqlite3_new(dc_context_t* context)
 
 	sql->context          = context;
 
+	pthread_mutex_init(&sql->stmt_cache_mutex, NULL);
+	dc_hash_init(&sql->stmt_cache, DC_HASH_BINARY, DC_HASH_COPY_KEY);
+	dc_hash_init(&sql->transaction_stmt_cache, DC_HASH_BINARY, DC_HASH_COPY_KEY);
+
+	pthread_mutex_init(&sql->peerstate_cache_mutex, NULL);
+	dc_hash_init(&sql->peerstate_cache, DC_HASH_STRING, DC_HASH_COPY_KEY);
+	dc_hash_init(&sql->peerstate_cache_fp, DC_HASH_STRING, DC_HASH_COPY_KEY);
+
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&sql->transaction_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	pthread_mutex_init(&sql->readers_mutex, NULL);
+
 	return sql;
 }
 
@@ -161,6 +205,12 @@ void dc_sqlite3_unref(dc_sqlite3_t* sql)
 		dc_sqlite3_close(sql);
 	}
 
+	clear_stmt_cache(sql);
+	pthread_mutex_destroy(&sql->stmt_cache_mutex);
+	dc_apeerstate_clear_cache(sql);
+	pthread_mutex_destroy(&sql->peerstate_cache_mutex);
+	pthread_mutex_destroy(&sql->transaction_mutex);
+	pthread_mutex_destroy(&sql->readers_mutex);
 	free(sql);
 }
 
@@ -211,6 +261,48 @@ int dc_sqlite3_open(dc_sqlite3_t* sql, const char* dbfile, int flags)
 	// (without a busy_timeout, sqlite3_step() would return SQLITE_BUSY at once)
 	sqlite3_busy_timeout(sql->cobj, 10*1000);
 
+	if (!(flags&DC_OPEN_READONLY))
+	{
+		// In WAL mode, readers do not block writers and a writer does not block readers,
+		// this allows the UI to read using the read-only connections while messages are received, see dc_sqlite3_prepare_read().
+		// WAL may be unsupported eg. for in-memory databases or on some network file systems, we stay in the default mode then.
+		sqlite3_stmt* stmt = dc_sqlite3_prepare(sql, "PRAGMA journal_mode=WAL;");
+		if (sqlite3_step(stmt)==SQLITE_ROW
+		 && strcmp((const char*)sqlite3_column_text(stmt, 0), "wal")==0) {
+			sql->wal = 1;
+		}
+		sqlite3_finalize(stmt);
+
+		if (sql->wal) {
+			// the WAL file is checkpointed to the database by the writing thread when it exceeds the given number of pages;
+			// additionally, dc_housekeeping() truncates the WAL file from time to time.
+			// `synchronous=NORMAL` is safe in WAL mode, a power loss may rollback the last transactions, but does not corrupt the database.
+			sqlite3_wal_autocheckpoint(sql->cobj, DC_WAL_AUTOCHECKPOINT_PAGES);
+			dc_sqlite3_execute(sql, "PRAGMA synchronous=NORMAL;");
+		}
+
+		// transactions use a connection of their own, so statements that other threads execute meanwhile
+		// are not part of a transaction and are not discarded by a rollback, see dc_sqlite3_begin_transaction().
+		// in-memory databases cannot be opened twice; transactions use the normal connection then.
+		const char* filename = sqlite3_db_filename(sql->cobj, "main");
+		if (filename && filename[0]) {
+			if (sqlite3_open_v2(filename, &sql->transaction_cobj,
+					SQLITE_OPEN_FULLMUTEX | SQLITE_OPEN_READWRITE, NULL)!=SQLITE_OK) {
+				dc_log_warning(sql->context, 0, "Cannot open connection for transactions.");
+				sqlite3_close(sql->transaction_cobj);
+				sql->transaction_cobj = NULL;
+			}
+			else {
+				sqlite3_busy_timeout(sql->transaction_cobj, 10*1000);
+				sqlite3_exec(sql->transaction_cobj, "PRAGMA secure_delete=on;", NULL, NULL, NULL);
+				if (sql->wal) {
+					sqlite3_wal_autocheckpoint(sql->transaction_cobj, DC_WAL_AUTOCHECKPOINT_PAGES);
+					sqlite3_exec(sql->transaction_cobj, "PRAGMA synchronous=NORMAL;", NULL, NULL, NULL);
+				}
+			}
+		}
+	}
+
 	if (!(flags&DC_OPEN_READONLY))
 	{
 		int dbversion_before_update = 0;
@@ -311,6 +403,7 @@ int dc_sqlite3_open(dc_sqlite3_t* sql, const char* dbfile, int flags)
 
 		int dbversion = dbversion_before_update;
 		int recalc_fingerprints = 0;
+		int fill_fingerprints_bin = 0;
 		int update_file_paths = 0;
 
 		#define NEW_DB_VERSION 1
@@ -539,6 +632,135 @@ int dc_sqlite3_open(dc_sqlite3_t* sql, const char* dbfile, int flags)
 			}
 		#undef NEW_DB_VERSION
 
+		#define NEW_DB_VERSION 49
+			if (dbversion < NEW_DB_VERSION)
+			{
+				dc_sqlite3_execute(sql, "CREATE INDEX msgs_index6 ON msgs (server_folder, server_uid);"); /* needed to apply flag changes and expunges reported by the server */
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 50
+			if (dbversion < NEW_DB_VERSION)
+			{
+				/* copies of the last message and of the number of fresh messages, updated by dc_update_chat_cache(),
+				so that the chatlist can be loaded without looking at the messages */
+				dc_sqlite3_execute(sql, "ALTER TABLE chats ADD COLUMN last_msg_id INTEGER DEFAULT 0;");
+				dc_sqlite3_execute(sql, "ALTER TABLE chats ADD COLUMN last_timestamp INTEGER DEFAULT 0;");
+				dc_sqlite3_execute(sql, "ALTER TABLE chats ADD COLUMN fresh_cnt INTEGER DEFAULT 0;");
+				dc_sqlite3_execute(sql, "CREATE INDEX chats_index3 ON chats (archived, last_timestamp);"); /* for sorting the chatlist */
+				dc_sqlite3_execute(sql, "CREATE INDEX msgs_index7 ON msgs (chat_id, timestamp);");    /* for finding the last message of a chat */
+				dc_update_chat_cache(sql, 0);
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 51
+			if (dbversion < NEW_DB_VERSION)
+			{
+				/* keypairs generated in advance if the config-option "spare_keypair" is set,
+				a spare keypair is moved to the table keypairs when the account is set up again */
+				dc_sqlite3_execute(sql, "CREATE TABLE spare_keypairs ("
+							" id INTEGER PRIMARY KEY,"
+							" addr TEXT DEFAULT '' COLLATE NOCASE,"
+							" private_key,"
+							" public_key,"
+							" created INTEGER DEFAULT 0);");
+				dc_sqlite3_execute(sql, "CREATE INDEX spare_keypairs_index1 ON spare_keypairs (addr);");
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 52
+			if (dbversion < NEW_DB_VERSION)
+			{
+				/* the keys gossiped to a group, a key is not gossiped again to the group
+				until it changes or until the config-option "gossip_interval" elapses */
+				dc_sqlite3_execute(sql, "CREATE TABLE gossiped_keys ("
+							" id INTEGER PRIMARY KEY,"
+							" chat_id INTEGER DEFAULT 0,"
+							" addr TEXT DEFAULT '' COLLATE NOCASE,"
+							" fingerprint TEXT DEFAULT '',"
+							" timestamp INTEGER DEFAULT 0);");
+				dc_sqlite3_execute(sql, "CREATE UNIQUE INDEX gossiped_keys_index1 ON gossiped_keys (chat_id, addr);");
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 53
+			if (dbversion < NEW_DB_VERSION)
+			{
+				/* plaintext and valid signatures of decrypted messages by the SHA-256 of the ciphertext,
+				so messages seen again are not decrypted again, see dc_e2ee.c */
+				dc_sqlite3_execute(sql, "CREATE TABLE decrypt_cache ("
+							" id INTEGER PRIMARY KEY,"
+							" hash BLOB,"
+							" plain BLOB,"
+							" fingerprints TEXT DEFAULT '',"
+							" created INTEGER DEFAULT 0);");
+				dc_sqlite3_execute(sql, "CREATE UNIQUE INDEX decrypt_cache_index1 ON decrypt_cache (hash);");
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 54
+			if (dbversion < NEW_DB_VERSION)
+			{
+				/* the fingerprints as 20 byte binaries; the indexes on the hex columns were not used
+				as the lookups were done using `COLLATE NOCASE`. acpeerstates_index6 covers the columns needed
+				to check the members of verified groups, see check_verified_properties() */
+				dc_sqlite3_execute(sql, "ALTER TABLE acpeerstates ADD COLUMN public_key_fingerprint_bin BLOB;");
+				dc_sqlite3_execute(sql, "ALTER TABLE acpeerstates ADD COLUMN gossip_key_fingerprint_bin BLOB;");
+				dc_sqlite3_execute(sql, "ALTER TABLE acpeerstates ADD COLUMN verified_key_fingerprint_bin BLOB;");
+				dc_sqlite3_execute(sql, "DROP INDEX IF EXISTS acpeerstates_index3;");
+				dc_sqlite3_execute(sql, "DROP INDEX IF EXISTS acpeerstates_index4;");
+				dc_sqlite3_execute(sql, "DROP INDEX IF EXISTS acpeerstates_index5;");
+				dc_sqlite3_execute(sql, "CREATE INDEX acpeerstates_index6 ON acpeerstates (addr, verified_key_fingerprint_bin, public_key_fingerprint_bin, gossip_key_fingerprint_bin);");
+				dc_sqlite3_execute(sql, "CREATE INDEX acpeerstates_index7 ON acpeerstates (public_key_fingerprint_bin);");
+				dc_sqlite3_execute(sql, "CREATE INDEX acpeerstates_index8 ON acpeerstates (gossip_key_fingerprint_bin);");
+				fill_fingerprints_bin = 1;
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 55
+			if (dbversion < NEW_DB_VERSION)
+			{
+				/* the existing msgs.txt_raw and msgs.mime_headers are compressed in chunks by dc_compact_msgs() in the background;
+				the config-value "compact_todo" is the largest message-id that is not yet compacted, 0 if all messages are compacted */
+				dc_sqlite3_set_config_int(sql, "compact_todo", get_max_msg_id(sql));
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
+		#define NEW_DB_VERSION 56
+			if (dbversion < NEW_DB_VERSION)
+			{
+				/* the results of decryption are deleted together with the messages they belong to;
+				existing results cannot be assigned to messages, so they are dropped */
+				dc_sqlite3_execute(sql, "DELETE FROM decrypt_cache;");
+				dc_sqlite3_execute(sql, "ALTER TABLE decrypt_cache ADD COLUMN rfc724_mid TEXT DEFAULT '';");
+				dc_sqlite3_execute(sql, "CREATE INDEX decrypt_cache_index2 ON decrypt_cache (rfc724_mid);");
+
+				dbversion = NEW_DB_VERSION;
+				dc_sqlite3_set_config_int(sql, "dbversion", NEW_DB_VERSION);
+			}
+		#undef NEW_DB_VERSION
+
 		// (2) updates that require high-level objects
 		// (the structure is complete now and all objects are usable)
 		// --------------------------------------------------------------------
@@ -557,6 +779,21 @@ int dc_sqlite3_open(dc_sqlite3_t* sql, const char* dbfile, int flags)
 			sqlite3_finalize(stmt);
 		}
 
+		if (fill_fingerprints_bin)
+		{
+			/* write the binary fingerprints, dc_apeerstate_save_to_db() writes them along with the hex ones */
+			sqlite3_stmt* stmt = dc_sqlite3_prepare(sql, "SELECT addr FROM acpeerstates;");
+				while (sqlite3_step(stmt)==SQLITE_ROW) {
+					dc_apeerstate_t* peerstate = dc_apeerstate_new(sql->context);
+						if (dc_apeerstate_load_by_addr(peerstate, sql, (const char*)sqlite3_column_text(stmt, 0))) {
+							peerstate->to_save = DC_SAVE_ALL;
+							dc_apeerstate_save_to_db(peerstate, sql, 0/*don't create*/);
+						}
+					dc_apeerstate_unref(peerstate);
+				}
+			sqlite3_finalize(stmt);
+		}
+
 		if (update_file_paths)
 		{
 			// versions before 2018-08 save the absolute paths in the database files at "param.f=";
@@ -578,6 +815,13 @@ int dc_sqlite3_open(dc_sqlite3_t* sql, const char* dbfile, int flags)
 			free(repl_from);
 			dc_sqlite3_set_config(sql, "backup_for", NULL);
 		}
+
+		open_search_index(sql);
+
+		if (dc_sqlite3_get_config_int(sql, "compact_todo", 0) && sql->context->sql==sql) {
+			dc_job_kill_action(sql->context, DC_JOB_COMPACT_MSGS);
+			dc_job_add(sql->context, DC_JOB_COMPACT_MSGS, 0, NULL, 0);
+		}
 	}
 
 	dc_log_info(sql->context, 0, "Opened \"%s\".", dbfile);
@@ -595,12 +839,25 @@ void dc_sqlite3_close(dc_sqlite3_t* sql)
 		return;
 	}
 
+	clear_stmt_cache(sql);
+	dc_apeerstate_clear_cache(sql);
+	close_readers(sql);
+
+	if (sql->transaction_cobj) {
+		sqlite3_close(sql->transaction_cobj);
+		sql->transaction_cobj = NULL;
+	}
+
 	if (sql->cobj)
 	{
 		sqlite3_close(sql->cobj);
 		sql->cobj = NULL;
 	}
 
+	sql->wal = 0;
+	sql->search_index = 0;
+	sql->search_index_ready = 0;
+
 	dc_log_info(sql->context, 0, "Database closed."); /* We log the information even if not real closing took place; this is to detect logic errors. */
 }
 
@@ -652,6 +909,715 @@ cleanup:
 }
 
 
+/*******************************************************************************
+ * Statement cache
+ ******************************************************************************/
+
+
+typedef struct _dc_cached_stmt
+{
+	sqlite3_stmt* stmt;      /* NULL while the statement is borrowed */
+	uint32_t      last_used;
+} dc_cached_stmt_t;
+
+
+/**
+ * Get a prepared statement for the given SQL from the cache or prepare a new one.
+ * The statement is ready for binding and stepping as a statement
+ * returned by dc_sqlite3_prepare(), however, it must not be finalized by the caller
+ * but given back using dc_sqlite3_return_stmt().
+ *
+ * The SQL text is used as the key, so it should not contain variable data;
+ * use bindings instead.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param sql The database object.
+ * @param querystr The SQL statement.
+ * @return The prepared statement or NULL on errors.
+ */
+sqlite3_stmt* dc_sqlite3_borrow_stmt(dc_sqlite3_t* sql, const char* querystr)
+{
+	sqlite3_stmt*     stmt = NULL;
+	dc_cached_stmt_t* entry = NULL;
+	dc_hash_t*        cache = NULL;
+
+	if (sql==NULL || querystr==NULL || sql->cobj==NULL) {
+		return NULL;
+	}
+
+	/* statements belong to a connection, so each connection has its own cache */
+	cache = (get_cobj(sql)==sql->transaction_cobj)? &sql->transaction_stmt_cache : &sql->stmt_cache;
+
+	pthread_mutex_lock(&sql->stmt_cache_mutex);
+		entry = dc_hash_find(cache, querystr, strlen(querystr));
+		if (entry && entry->stmt) {
+			stmt = entry->stmt;
+			entry->stmt = NULL;
+			sql->stmt_cache_hits++;
+		}
+		else {
+			sql->stmt_cache_misses++;
+		}
+	pthread_mutex_unlock(&sql->stmt_cache_mutex);
+
+	if (stmt==NULL) {
+		stmt = dc_sqlite3_prepare(sql, querystr);
+	}
+
+	return stmt;
+}
+
+
+static void evict_least_recently_used(dc_hash_t* cache)
+{
+	/* the cache is small and this is only done if it is full, so a linear search is fine */
+	dc_hashelem_t* elem = NULL;
+	dc_hashelem_t* lru_elem = NULL;
+
+	for (elem=dc_hash_first(cache); elem; elem=dc_hash_next(elem)) {
+		dc_cached_stmt_t* entry = (dc_cached_stmt_t*)dc_hash_data(elem);
+		if (entry->stmt /*borrowed statements cannot be evicted*/
+		 && (lru_elem==NULL || entry->last_used < ((dc_cached_stmt_t*)dc_hash_data(lru_elem))->last_used)) {
+			lru_elem = elem;
+		}
+	}
+
+	if (lru_elem) {
+		dc_cached_stmt_t* entry = (dc_cached_stmt_t*)dc_hash_data(lru_elem);
+		sqlite3_finalize(entry->stmt);
+		free(entry);
+		dc_hash_insert(cache, dc_hash_key(lru_elem), dc_hash_keysize(lru_elem), NULL);
+	}
+}
+
+
+/**
+ * Give back a statement borrowed by dc_sqlite3_borrow_stmt().
+ * The statement is reset and its bindings are cleared; if the cache is full
+ * or if the database was closed in between, the statement is finalized.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param sql The database object.
+ * @param stmt The statement to give back, may be NULL.
+ * @return None.
+ */
+void dc_sqlite3_return_stmt(dc_sqlite3_t* sql, sqlite3_stmt* stmt)
+{
+	const char*       querystr = NULL;
+	dc_cached_stmt_t* entry = NULL;
+	dc_hash_t*        cache = NULL;
+
+	if (stmt==NULL) {
+		return;
+	}
+
+	if (sql==NULL || sql->cobj==NULL
+	 || (querystr=sqlite3_sql(stmt))==NULL) {
+		sqlite3_finalize(stmt);
+		return;
+	}
+
+	if (sqlite3_db_handle(stmt)==sql->cobj) {
+		cache = &sql->stmt_cache;
+	}
+	else if (sql->transaction_cobj && sqlite3_db_handle(stmt)==sql->transaction_cobj) {
+		cache = &sql->transaction_stmt_cache;
+	}
+	else {
+		sqlite3_finalize(stmt);
+		return;
+	}
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	pthread_mutex_lock(&sql->stmt_cache_mutex);
+		entry = dc_hash_find(cache, querystr, strlen(querystr));
+		if (entry==NULL)
+		{
+			if (dc_hash_cnt(cache) >= DC_STMT_CACHE_SIZE) {
+				evict_least_recently_used(cache);
+			}
+
+			if (dc_hash_cnt(cache) < DC_STMT_CACHE_SIZE) {
+				if ((entry=calloc(1, sizeof(dc_cached_stmt_t)))==NULL) {
+					exit(59); /* cannot allocate little memory, unrecoverable error */
+				}
+				dc_hash_insert(cache, querystr, strlen(querystr), entry);
+			}
+		}
+
+		if (entry && entry->stmt==NULL) {
+			entry->stmt = stmt;
+			entry->last_used = ++sql->stmt_cache_clock;
+			stmt = NULL;
+		}
+	pthread_mutex_unlock(&sql->stmt_cache_mutex);
+
+	/* the cache is full or another thread has given back the same statement before */
+	sqlite3_finalize(stmt);
+}
+
+
+static void clear_stmt_cache(dc_sqlite3_t* sql)
+{
+	/* must be called before the database is closed; statements borrowed at this time are finalized on return */
+	dc_hash_t*     caches[2] = { &sql->stmt_cache, &sql->transaction_stmt_cache };
+	dc_hashelem_t* elem = NULL;
+	int            i = 0;
+
+	pthread_mutex_lock(&sql->stmt_cache_mutex);
+		for (i = 0; i < 2; i++) {
+			for (elem=dc_hash_first(caches[i]); elem; elem=dc_hash_next(elem)) {
+				dc_cached_stmt_t* entry = (dc_cached_stmt_t*)dc_hash_data(elem);
+				sqlite3_finalize(entry->stmt);
+				free(entry);
+			}
+			dc_hash_clear(caches[i]);
+		}
+	pthread_mutex_unlock(&sql->stmt_cache_mutex);
+}
+
+
+char* dc_sqlite3_get_stmt_cache_str(dc_sqlite3_t* sql)
+{
+	char* ret = NULL;
+
+	if (sql==NULL) {
+		return dc_strdup("");
+	}
+
+	pthread_mutex_lock(&sql->stmt_cache_mutex);
+		ret = dc_mprintf("%i statements, %i hits, %i misses",
+			dc_hash_cnt(&sql->stmt_cache)+dc_hash_cnt(&sql->transaction_stmt_cache), sql->stmt_cache_hits, sql->stmt_cache_misses);
+	pthread_mutex_unlock(&sql->stmt_cache_mutex);
+
+	return ret;
+}
+
+
+/*******************************************************************************
+ * Read-only connections
+ ******************************************************************************/
+
+
+static void close_readers(dc_sqlite3_t* sql)
+{
+	int i;
+	pthread_mutex_lock(&sql->readers_mutex);
+		for (i = 0; i < DC_SQLITE3_READERS; i++) {
+			if (sql->readers[i]) {
+				/* statements prepared by dc_sqlite3_prepare_read() may still be used by other threads;
+				sqlite3_close_v2() closes the connection when they are finalized instead of leaking it */
+				if (sqlite3_close(sql->readers[i])==SQLITE_BUSY) {
+					dc_log_warning(sql->context, 0, "Read-only connection closed while statements are in use.");
+					sqlite3_close_v2(sql->readers[i]);
+				}
+				sql->readers[i] = NULL;
+			}
+		}
+	pthread_mutex_unlock(&sql->readers_mutex);
+}
+
+
+/**
+ * Prepare a statement that only reads from the database.
+ *
+ * If the database is in WAL mode, the statement is prepared using one of
+ * DC_SQLITE3_READERS read-only connections, so reading does not wait for other
+ * threads writing to the database, eg. while messages are received.
+ * The statement sees the database as of the last commit; changes of
+ * a transaction not yet committed are not visible.
+ *
+ * If no read-only connection is available or if the calling thread owns a
+ * transaction, the statement is prepared using the normal connection.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param sql The database object.
+ * @param querystr The SQL statement, must not modify the database.
+ * @return The prepared statement, must be freed using sqlite3_finalize(),
+ *     which also gives back the read-only connection. NULL on errors.
+ */
+sqlite3_stmt* dc_sqlite3_prepare_read(dc_sqlite3_t* sql, const char* querystr)
+{
+	int           i = 0;
+	sqlite3_stmt* stmt = NULL;
+
+	if (sql==NULL || querystr==NULL || sql->cobj==NULL) {
+		return NULL;
+	}
+
+	if (!sql->wal || dc_sqlite3_owns_transaction(sql)) {
+		return dc_sqlite3_prepare(sql, querystr);
+	}
+
+	pthread_mutex_lock(&sql->readers_mutex);
+		/* a connection is free if there are no statements prepared on it */
+		for (i = 0; i < DC_SQLITE3_READERS; i++) {
+			if (sql->readers[i]==NULL || sqlite3_next_stmt(sql->readers[i], NULL)==NULL) {
+				break;
+			}
+		}
+
+		if (i < DC_SQLITE3_READERS && sql->readers[i]==NULL) {
+			/* the connections are opened on first use, so databases opened eg. only for a backup do not get any */
+			if (sqlite3_open_v2(sqlite3_db_filename(sql->cobj, "main"), &sql->readers[i],
+					SQLITE_OPEN_READONLY | SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK) {
+				dc_log_warning(sql->context, 0, "Cannot open read-only connection.");
+				sqlite3_close(sql->readers[i]);
+				sql->readers[i] = NULL;
+			}
+			else {
+				sqlite3_busy_timeout(sql->readers[i], 10*1000);
+			}
+		}
+
+		if (i < DC_SQLITE3_READERS && sql->readers[i]) {
+			if (sqlite3_prepare_v2(sql->readers[i], querystr, -1, &stmt, NULL)!=SQLITE_OK) {
+				sqlite3_finalize(stmt);
+				stmt = NULL;
+			}
+		}
+	pthread_mutex_unlock(&sql->readers_mutex);
+
+	if (stmt==NULL) {
+		/* all read-only connections are in use or cannot be used */
+		stmt = dc_sqlite3_prepare(sql, querystr);
+	}
+
+	return stmt;
+}
+
+
+/*******************************************************************************
+ * Backup
+ ******************************************************************************/
+
+
+/**
+ * Copy the database to a new file using the SQLite online backup API.
+ * Unlike copying the database file, this works while the database is open
+ * and includes the changes not yet checkpointed from the WAL file.
+ * The copy is not in WAL mode, so it consists of a single file.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param sql The database object to copy.
+ * @param dest_file The file to copy the database to, an existing file is overwritten.
+ * @return 1=success, 0=error.
+ */
+int dc_sqlite3_backup(dc_sqlite3_t* sql, const char* dest_file)
+{
+	int             success = 0;
+	sqlite3*        dest = NULL;
+	sqlite3_backup* backup = NULL;
+
+	if (sql==NULL || sql->cobj==NULL || dest_file==NULL) {
+		goto cleanup;
+	}
+
+	if (sqlite3_open_v2(dest_file, &dest, SQLITE_OPEN_READWRITE|SQLITE_OPEN_CREATE, NULL)!=SQLITE_OK) {
+		dc_log_error(sql->context, 0, "Cannot open backup file \"%s\".", dest_file);
+		goto cleanup;
+	}
+
+	if ((backup=sqlite3_backup_init(dest, "main", sql->cobj, "main"))==NULL) {
+		dc_log_error(sql->context, 0, "Cannot init backup to \"%s\": %s", dest_file, sqlite3_errmsg(dest));
+		goto cleanup;
+	}
+
+	/* copy all pages in one step; in WAL mode, this does not block other threads writing to the database */
+	if (sqlite3_backup_step(backup, -1)!=SQLITE_DONE) {
+		dc_log_error(sql->context, 0, "Cannot backup to \"%s\": %s", dest_file, sqlite3_errmsg(dest));
+		goto cleanup;
+	}
+
+	sqlite3_backup_finish(backup);
+	backup = NULL;
+
+	/* the copied pages contain the WAL mode of the source */
+	if (sqlite3_exec(dest, "PRAGMA journal_mode=DELETE;", NULL, NULL, NULL)!=SQLITE_OK) {
+		dc_log_error(sql->context, 0, "Cannot set journal mode of \"%s\".", dest_file);
+		goto cleanup;
+	}
+
+	success = 1;
+
+cleanup:
+	if (backup) { sqlite3_backup_finish(backup); }
+	sqlite3_close(dest);
+	return success;
+}
+
+
+/*******************************************************************************
+ * Full-text search index
+ ******************************************************************************/
+
+
+static uint32_t get_max_msg_id(dc_sqlite3_t* sql)
+{
+	uint32_t      max_id = 0;
+	sqlite3_stmt* stmt = dc_sqlite3_prepare(sql, "SELECT MAX(id) FROM msgs;");
+	if (sqlite3_step(stmt)==SQLITE_ROW) {
+		max_id = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+	return max_id>DC_MSG_ID_LAST_SPECIAL? max_id : 0;
+}
+
+
+static void open_search_index(dc_sqlite3_t* sql)
+{
+	// the index is created on the first open with a SQLite supporting FTS5;
+	// the existing messages are added in chunks by dc_build_search_index() in the background.
+	// the config-value "search_index_todo" is the largest message-id that is not yet added, 0 if all messages are added.
+	sqlite3_stmt* stmt = NULL;
+
+	if (!dc_sqlite3_table_exists(sql, "msgs_fts"))
+	{
+		if (sqlite3_exec(sql->cobj,
+				"CREATE VIRTUAL TABLE msgs_fts USING fts5(txt, name, prefix='2 3', tokenize='unicode61 remove_diacritics 1');",
+				NULL, NULL, NULL)!=SQLITE_OK) {
+			dc_log_info(sql->context, 0, "Full-text search not available: %s", sqlite3_errmsg(sql->cobj));
+			return;
+		}
+		dc_sqlite3_set_config_int(sql, "search_index_todo", get_max_msg_id(sql));
+	}
+
+	// the table is unusable if the database was created with FTS5 but the linked SQLite does not support it;
+	// the index gets outdated then and is rebuilt when FTS5 is available again.
+	if (sqlite3_prepare_v2(sql->cobj, "SELECT rowid FROM msgs_fts LIMIT 0;", -1, &stmt, NULL)!=SQLITE_OK) {
+		dc_log_info(sql->context, 0, "Full-text search not available: %s", sqlite3_errmsg(sql->cobj));
+		dc_sqlite3_set_config_int(sql, "search_index_todo", get_max_msg_id(sql));
+		return;
+	}
+	sqlite3_finalize(stmt);
+
+	sql->search_index = 1;
+	if (dc_sqlite3_get_config_int(sql, "search_index_todo", 0)==0) {
+		sql->search_index_ready = 1;
+	}
+	else if (sql->context->sql==sql) {
+		dc_job_kill_action(sql->context, DC_JOB_BUILD_SEARCH_INDEX);
+		dc_job_add(sql->context, DC_JOB_BUILD_SEARCH_INDEX, 0, NULL, 0);
+	}
+}
+
+
+/**
+ * Update the full-text index after a message is added, changed or deleted.
+ * Messages that are hidden, trashed or have no text are not added to the index.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param sql The database object.
+ * @param msg_id The message to update.
+ * @return None.
+ */
+void dc_update_search_index(dc_sqlite3_t* sql, uint32_t msg_id)
+{
+	sqlite3_stmt* stmt = NULL;
+
+	if (sql==NULL || !sql->search_index || msg_id<=DC_MSG_ID_LAST_SPECIAL) {
+		return;
+	}
+
+	stmt = dc_sqlite3_borrow_stmt(sql,
+		"DELETE FROM msgs_fts WHERE rowid=?;");
+	sqlite3_bind_int(stmt, 1, msg_id);
+	sqlite3_step(stmt);
+	dc_sqlite3_return_stmt(sql, stmt);
+
+	stmt = dc_sqlite3_borrow_stmt(sql,
+		"INSERT INTO msgs_fts (rowid, txt, name)"
+		" SELECT m.id, m.txt, ct.name FROM msgs m"
+		" LEFT JOIN contacts ct ON m.from_id=ct.id"
+		" WHERE m.id=? AND m.txt!='' AND m.hidden=0 AND m.chat_id!=" DC_STRINGIFY(DC_CHAT_ID_TRASH) ";");
+	sqlite3_bind_int(stmt, 1, msg_id);
+	sqlite3_step(stmt);
+	dc_sqlite3_return_stmt(sql, stmt);
+}
+
+
+/**
+ * Update the sender name in the full-text index after a contact was renamed.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param sql The database object.
+ * @param contact_id The renamed contact.
+ * @return None.
+ */
+void dc_update_search_index_by_contact(dc_sqlite3_t* sql, uint32_t contact_id)
+{
+	sqlite3_stmt* stmt = NULL;
+
+	if (sql==NULL || !sql->search_index) {
+		return;
+	}
+
+	stmt = dc_sqlite3_prepare(sql,
+		"UPDATE msgs_fts SET name=(SELECT name FROM contacts WHERE id=?)"
+		" WHERE rowid IN (SELECT id FROM msgs WHERE from_id=?);");
+	sqlite3_bind_int(stmt, 1, contact_id);
+	sqlite3_bind_int(stmt, 2, contact_id);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+}
+
+
+/**
+ * Add the next DC_SEARCH_INDEX_CHUNK messages to the full-text index.
+ * Executed by the job DC_JOB_BUILD_SEARCH_INDEX, which is added again until all
+ * messages are added, so that building the index of a large database
+ * does not block other jobs.  Until the index is complete, dc_search_msgs() does not use it.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @return None.
+ */
+void dc_build_search_index(dc_context_t* context)
+{
+	dc_sqlite3_t* sql = context->sql;
+	sqlite3_stmt* stmt = NULL;
+	uint32_t      todo = 0;
+	uint32_t      below = 0;
+
+	if (!sql->search_index || sql->search_index_ready) {
+		return;
+	}
+
+	dc_sqlite3_begin_transaction(sql);
+
+		todo = dc_sqlite3_get_config_int(sql, "search_index_todo", 0);
+
+		// the messages in the range below..todo are (re-)added, the following chunk starts below this range
+		stmt = dc_sqlite3_prepare(sql,
+			"SELECT id FROM msgs WHERE id<=? ORDER BY id DESC LIMIT 1 OFFSET ?;");
+		sqlite3_bind_int(stmt, 1, todo);
+		sqlite3_bind_int(stmt, 2, DC_SEARCH_INDEX_CHUNK);
+		if (sqlite3_step(stmt)==SQLITE_ROW) {
+			below = sqlite3_column_int(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+
+		stmt = dc_sqlite3_prepare(sql,
+			"DELETE FROM msgs_fts WHERE rowid>? AND rowid<=?;");
+		sqlite3_bind_int(stmt, 1, below);
+		sqlite3_bind_int(stmt, 2, todo);
+		sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+
+		stmt = dc_sqlite3_prepare(sql,
+			"INSERT INTO msgs_fts (rowid, txt, name)"
+			" SELECT m.id, m.txt, ct.name FROM msgs m"
+			" LEFT JOIN contacts ct ON m.from_id=ct.id"
+			" WHERE m.id>? AND m.id<=? AND m.id>" DC_STRINGIFY(DC_MSG_ID_LAST_SPECIAL)
+			"   AND m.txt!='' AND m.hidden=0 AND m.chat_id!=" DC_STRINGIFY(DC_CHAT_ID_TRASH) ";");
+		sqlite3_bind_int(stmt, 1, below);
+		sqlite3_bind_int(stmt, 2, todo);
+		sqlite3_step(stmt);
+		sqlite3_finalize(stmt);
+
+		dc_sqlite3_set_config_int(sql, "search_index_todo", below);
+
+	dc_sqlite3_commit(sql);
+
+	if (below) {
+		dc_log_info(context, 0, "Messages #%i..#%i added to the full-text index.", (int)below+1, (int)todo);
+		dc_job_add(context, DC_JOB_BUILD_SEARCH_INDEX, 0, NULL, 0);
+	}
+	else {
+		dc_log_info(context, 0, "Full-text index built.");
+		sql->search_index_ready = 1;
+	}
+}
+
+
+/*******************************************************************************
+ * Compressed texts
+ ******************************************************************************/
+
+
+/**
+ * Bind a text that may be stored compressed.
+ * If the text has at least DC_COMPRESS_MIN_BYTES and the compressed text is
+ * shorter, a blob with the length of the text as 4 bytes big-endian followed by
+ * the zlib-compressed text is bound; otherwise, the text itself is bound.
+ * The value must be read using dc_sqlite3_column_uncompressed().
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param stmt The statement to bind the text to.
+ * @param idx The index of the parameter, the leftmost parameter has the index 1.
+ * @param text The text to bind, must be valid until the statement is stepped.
+ *     If NULL, SQL NULL is bound.
+ * @param bytes The length of the text in bytes; if negative, the text must be null-terminated.
+ * @return None.
+ */
+void dc_sqlite3_bind_compressed(sqlite3_stmt* stmt, int idx, const char* text, int bytes)
+{
+	uint8_t* compressed = NULL;
+	uLongf   compressed_bytes = 0;
+
+	if (text==NULL) {
+		sqlite3_bind_null(stmt, idx);
+		return;
+	}
+
+	if (bytes < 0) {
+		bytes = strlen(text);
+	}
+
+	if (bytes >= DC_COMPRESS_MIN_BYTES)
+	{
+		compressed_bytes = compressBound(bytes);
+		if ((compressed=malloc(4+compressed_bytes))==NULL) {
+			exit(78);
+		}
+
+		compressed[0] = (uint8_t)(bytes>>24);
+		compressed[1] = (uint8_t)(bytes>>16);
+		compressed[2] = (uint8_t)(bytes>>8);
+		compressed[3] = (uint8_t)(bytes);
+		if (compress2(compressed+4, &compressed_bytes, (const Bytef*)text, bytes, Z_DEFAULT_COMPRESSION)==Z_OK
+		 && 4+compressed_bytes < (uLongf)bytes) {
+			sqlite3_bind_blob(stmt, idx, compressed, 4+compressed_bytes, free);
+			return;
+		}
+
+		free(compressed);
+	}
+
+	sqlite3_bind_text(stmt, idx, text, bytes, SQLITE_STATIC);
+}
+
+
+/**
+ * Get a text written by dc_sqlite3_bind_compressed().
+ * Texts written before compression was added are returned as they are.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param stmt The statement to get the text from, sqlite3_step() must have returned SQLITE_ROW.
+ * @param idx The index of the column, the leftmost column has the index 0.
+ * @return The text, must be free()'d. NULL if the column is NULL or cannot be uncompressed.
+ */
+char* dc_sqlite3_column_uncompressed(sqlite3_stmt* stmt, int idx)
+{
+	const uint8_t* compressed = NULL;
+	int            compressed_bytes = 0;
+	uLongf         bytes = 0;
+	char*          text = NULL;
+
+	if (sqlite3_column_type(stmt, idx)!=SQLITE_BLOB) {
+		return dc_strdup_keep_null((const char*)sqlite3_column_text(stmt, idx));
+	}
+
+	compressed = sqlite3_column_blob(stmt, idx);
+	compressed_bytes = sqlite3_column_bytes(stmt, idx);
+	if (compressed==NULL || compressed_bytes < 4) {
+		return NULL;
+	}
+
+	bytes = ((uLongf)compressed[0]<<24) | ((uLongf)compressed[1]<<16) | ((uLongf)compressed[2]<<8) | (uLongf)compressed[3];
+	if (bytes > (uLongf)compressed_bytes*1032) { /* deflate does not compress better, the blob is damaged */
+		return NULL;
+	}
+
+	if ((text=malloc(bytes+1))==NULL) {
+		exit(78);
+	}
+
+	if (uncompress((Bytef*)text, &bytes, compressed+4, compressed_bytes-4)!=Z_OK) {
+		free(text);
+		return NULL;
+	}
+
+	text[bytes] = 0;
+	return text;
+}
+
+
+/**
+ * Compress msgs.txt_raw and msgs.mime_headers of the next DC_COMPACT_CHUNK messages
+ * stored before the texts were compressed.
+ * Executed by the job DC_JOB_COMPACT_MSGS, which is added again until all
+ * messages are compacted, so that a large database does not block other jobs.
+ * The space freed is reused by new messages.
+ *
+ * @private @memberof dc_context_t
+ * @param context The context object.
+ * @return None.
+ */
+void dc_compact_msgs(dc_context_t* context)
+{
+	dc_sqlite3_t* sql = context->sql;
+	sqlite3_stmt* stmt = NULL;
+	sqlite3_stmt* update_stmt = NULL;
+	uint32_t      todo = 0;
+	uint32_t      below = 0;
+	int           compacted_cnt = 0;
+
+	dc_sqlite3_begin_transaction(sql);
+
+		todo = dc_sqlite3_get_config_int(sql, "compact_todo", 0);
+		if (todo==0) {
+			goto cleanup;
+		}
+
+		// the messages in the range below..todo are compacted, the following chunk starts below this range
+		stmt = dc_sqlite3_prepare(sql,
+			"SELECT id FROM msgs WHERE id<=? ORDER BY id DESC LIMIT 1 OFFSET ?;");
+		sqlite3_bind_int(stmt, 1, todo);
+		sqlite3_bind_int(stmt, 2, DC_COMPACT_CHUNK);
+		if (sqlite3_step(stmt)==SQLITE_ROW) {
+			below = sqlite3_column_int(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+
+		update_stmt = dc_sqlite3_prepare(sql,
+			"UPDATE msgs SET txt_raw=?, mime_headers=? WHERE id=?;");
+		stmt = dc_sqlite3_prepare(sql,
+			"SELECT id, txt_raw, mime_headers FROM msgs"
+			" WHERE id>? AND id<=?"
+			"   AND ((typeof(txt_raw)='text' AND length(CAST(txt_raw AS BLOB))>=" DC_STRINGIFY(DC_COMPRESS_MIN_BYTES) ")"
+			"     OR (typeof(mime_headers)='text' AND length(CAST(mime_headers AS BLOB))>=" DC_STRINGIFY(DC_COMPRESS_MIN_BYTES) "));");
+		sqlite3_bind_int(stmt, 1, below);
+		sqlite3_bind_int(stmt, 2, todo);
+		while (sqlite3_step(stmt)==SQLITE_ROW)
+		{
+			sqlite3_reset(update_stmt);
+			if (sqlite3_column_type(stmt, 1)==SQLITE_BLOB) {
+				sqlite3_bind_value(update_stmt, 1, sqlite3_column_value(stmt, 1));
+			}
+			else {
+				dc_sqlite3_bind_compressed(update_stmt, 1, (const char*)sqlite3_column_text(stmt, 1), sqlite3_column_bytes(stmt, 1));
+			}
+			if (sqlite3_column_type(stmt, 2)==SQLITE_BLOB) {
+				sqlite3_bind_value(update_stmt, 2, sqlite3_column_value(stmt, 2));
+			}
+			else {
+				dc_sqlite3_bind_compressed(update_stmt, 2, (const char*)sqlite3_column_text(stmt, 2), sqlite3_column_bytes(stmt, 2));
+			}
+			sqlite3_bind_int(update_stmt, 3, sqlite3_column_int(stmt, 0));
+			sqlite3_step(update_stmt);
+			compacted_cnt++;
+		}
+
+		dc_sqlite3_set_config_int(sql, "compact_todo", below);
+
+cleanup:
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(update_stmt);
+	dc_sqlite3_commit(sql);
+
+	if (below) {
+		dc_log_info(context, 0, "Messages #%i..#%i compacted, %i rewritten.", (int)below+1, (int)todo, compacted_cnt);
+		dc_job_add(context, DC_JOB_COMPACT_MSGS, 0, NULL, 0);
+	}
+	else if (todo) {
+		dc_log_info(context, 0, "Messages compacted.");
+	}
+}
+
+
 /*******************************************************************************
  * Handle configuration
  ******************************************************************************/
@@ -676,24 +1642,24 @@ int dc_sqlite3_set_config(dc_sqlite3_t* sql, const char* key, const char* value)
 	{
 		/* insert/update key=value */
 		#define SELECT_v_FROM_config_k_STATEMENT "SELECT value FROM config WHERE keyname=?;"
-		stmt = dc_sqlite3_prepare(sql, SELECT_v_FROM_config_k_STATEMENT);
+		stmt = dc_sqlite3_borrow_stmt(sql, SELECT_v_FROM_config_k_STATEMENT);
 		sqlite3_bind_text (stmt, 1, key, -1, SQLITE_STATIC);
 		state = sqlite3_step(stmt);
-		sqlite3_finalize(stmt);
+		dc_sqlite3_return_stmt(sql, stmt);
 
 		if (state==SQLITE_DONE) {
-			stmt = dc_sqlite3_prepare(sql, "INSERT INTO config (keyname, value) VALUES (?, ?);");
+			stmt = dc_sqlite3_borrow_stmt(sql, "INSERT INTO config (keyname, value) VALUES (?, ?);");
 			sqlite3_bind_text (stmt, 1, key,   -1, SQLITE_STATIC);
 			sqlite3_bind_text (stmt, 2, value, -1, SQLITE_STATIC);
 			state = sqlite3_step(stmt);
-			sqlite3_finalize(stmt);
+			dc_sqlite3_return_stmt(sql, stmt);
 		}
 		else if (state==SQLITE_ROW) {
-			stmt = dc_sqlite3_prepare(sql, "UPDATE config SET value=? WHERE keyname=?;");
+			stmt = dc_sqlite3_borrow_stmt(sql, "UPDATE config SET value=? WHERE keyname=?;");
 			sqlite3_bind_text (stmt, 1, value, -1, SQLITE_STATIC);
 			sqlite3_bind_text (stmt, 2, key,   -1, SQLITE_STATIC);
 			state = sqlite3_step(stmt);
-			sqlite3_finalize(stmt);
+			dc_sqlite3_return_stmt(sql, stmt);
 		}
 		else {
 			dc_log_error(sql->context, 0, "dc_sqlite3_set_config(): Cannot read value.");
@@ -726,7 +1692,7 @@ char* dc_sqlite3_get_config(dc_sqlite3_t* sql, const char* key, const char* def)
 		return dc_strdup_keep_null(def);
 	}
 
-	stmt = dc_sqlite3_prepare(sql, SELECT_v_FROM_config_k_STATEMENT);
+	stmt = dc_sqlite3_borrow_stmt(sql, SELECT_v_FROM_config_k_STATEMENT);
 	sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
 	if (sqlite3_step(stmt)==SQLITE_ROW)
 	{
@@ -735,13 +1701,13 @@ char* dc_sqlite3_get_config(dc_sqlite3_t* sql, const char* key, const char* def)
 		{
 			/* success, fall through below to free objects */
 			char* ret = dc_strdup((const char*)ptr);
-			sqlite3_finalize(stmt);
+			dc_sqlite3_return_stmt(sql, stmt);
 			return ret;
 		}
 	}
 
 	/* return the default value */
-	sqlite3_finalize(stmt);
+	dc_sqlite3_return_stmt(sql, stmt);
 	return dc_strdup_keep_null(def);
 }
 
@@ -775,45 +1741,186 @@ int dc_sqlite3_set_config_int(dc_sqlite3_t* sql, const char* key, int32_t value)
  ******************************************************************************/
 
 
-#undef USE_TRANSACTIONS
+/* Transactions are guarded by a recursive mutex that is held by the thread
+owning the transaction from BEGIN to COMMIT/ROLLBACK; other threads calling
+dc_sqlite3_begin_transaction() wait until the transaction is finished.
 
+The owning thread uses the connection transaction_cobj for all its statements,
+so statements of other threads, which use the normal connection, never become
+part of the transaction and are never discarded by its rollback.  Other threads
+writing meanwhile wait for the commit, see sqlite3_busy_timeout(),
+so transactions should be short.  If transaction_cobj cannot be opened, eg. for
+in-memory databases, all threads use the normal connection.
 
-void dc_sqlite3_begin_transaction(dc_sqlite3_t* sql)
+If the owning thread begins another transaction, eg. because a function using
+a transaction is called from a function that already uses one, the inner
+transaction is mapped to a SAVEPOINT; so the inner transaction can be rolled
+back without affecting the outer one.
+
+If BEGIN fails, eg. as the database is locked for too long, the statements are
+executed without a transaction and the matching COMMIT/ROLLBACK does nothing.
+If COMMIT fails, eg. with SQLITE_FULL, the transaction is rolled back, so that
+it does not keep the write lock. */
+
+
+static int execute_transaction_stmt(dc_sqlite3_t* sql, const char* querystr, const char* error)
 {
-#ifdef USE_TRANSACTIONS
-	// `BEGIN IMMEDIATE` ensures, only one thread may write.
-	// all other calls to `BEGIN IMMEDIATE` will try over until sqlite3_busy_timeout() is reached.
-	// CAVE: This also implies that transactions MUST NOT be nested.
-	sqlite3_stmt* stmt = dc_sqlite3_prepare(sql, "BEGIN IMMEDIATE;");
+	int           success = 0;
+	sqlite3_stmt* stmt = dc_sqlite3_borrow_stmt(sql, querystr);
 	if (sqlite3_step(stmt) != SQLITE_DONE) {
-		dc_sqlite3_log_error(sql, "Cannot begin transaction.");
+		dc_sqlite3_log_error(sql, "%s", error);
+	}
+	else {
+		success = 1;
+	}
+	dc_sqlite3_return_stmt(sql, stmt);
+	return success;
+}
+
+
+/**
+ * Check if the calling thread owns a transaction.
+ *
+ * @private @memberof dc_sqlite3_t
+ * @param sql The database object.
+ * @return 1=the calling thread is between dc_sqlite3_begin_transaction() and
+ *     the corresponding dc_sqlite3_commit() or dc_sqlite3_rollback(), 0=otherwise.
+ */
+int dc_sqlite3_owns_transaction(dc_sqlite3_t* sql)
+{
+	/* trylock succeeds only if the transaction mutex is free or owned by the calling thread */
+	int owns = 0;
+	if (pthread_mutex_trylock(&sql->transaction_mutex)==0) {
+		owns = (sql->transaction_depth > 0);
+		pthread_mutex_unlock(&sql->transaction_mutex);
+	}
+	return owns;
+}
+
+
+static sqlite3* get_cobj(dc_sqlite3_t* sql)
+{
+	if (sql->transaction_cobj && dc_sqlite3_owns_transaction(sql)) {
+		return sql->transaction_cobj;
+	}
+	return sql->cobj;
+}
+
+
+void dc_sqlite3_begin_transaction(dc_sqlite3_t* sql)
+{
+	if (sql==NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&sql->transaction_mutex);
+	sql->transaction_depth++;
+
+	if (sql->transaction_depth==1) {
+		// `BEGIN IMMEDIATE` ensures, only one connection may write.
+		sql->transaction_failed = !execute_transaction_stmt(sql, "BEGIN IMMEDIATE;", "Cannot begin transaction.");
+		sql->transaction_interrupts = 0;
+	}
+	else if (!sql->transaction_failed) { /* a SAVEPOINT outside a transaction would begin one */
+		char* q3 = sqlite3_mprintf("SAVEPOINT dc_sp%i;", sql->transaction_depth);
+		dc_sqlite3_execute(sql, q3);
+		sqlite3_free(q3);
 	}
-	sqlite3_finalize(stmt);
-#endif
 }
 
 
 void dc_sqlite3_rollback(dc_sqlite3_t* sql)
 {
-#ifdef USE_TRANSACTIONS
-	sqlite3_stmt* stmt = dc_sqlite3_prepare(sql, "ROLLBACK;");
-	if (sqlite3_step(stmt) != SQLITE_DONE) {
-		dc_sqlite3_log_error(sql, "Cannot rollback transaction.");
+	int interrupts = 0;
+
+	if (sql==NULL) {
+		return;
+	}
+
+	if (sql->transaction_depth<=0) {
+		dc_log_error(sql->context, 0, "Rollback without transaction.");
+		return;
+	}
+
+	if (sql->transaction_depth==1) {
+		if (sql->transaction_failed) {
+			dc_log_warning(sql->context, 0, "Cannot rollback, the transaction was not begun.");
+			sql->transaction_failed = 0;
+			interrupts = sql->transaction_interrupts; /* the added jobs are already written */
+		}
+		else {
+			execute_transaction_stmt(sql, "ROLLBACK;", "Cannot rollback transaction.");
+		}
+		sql->transaction_interrupts = 0;
+	}
+	else if (!sql->transaction_failed) {
+		char* q3 = sqlite3_mprintf("ROLLBACK TO dc_sp%i;", sql->transaction_depth);
+		dc_sqlite3_execute(sql, q3);
+		sqlite3_free(q3);
+
+		q3 = sqlite3_mprintf("RELEASE dc_sp%i;", sql->transaction_depth);
+		dc_sqlite3_execute(sql, q3);
+		sqlite3_free(q3);
+	}
+
+	dc_apeerstate_clear_cache(sql); /* cached peerstates may have been written by the transaction */
+
+	sql->transaction_depth--;
+	pthread_mutex_unlock(&sql->transaction_mutex);
+
+	if (interrupts & DC_INTERRUPT_IMAP) {
+		dc_interrupt_imap_idle(sql->context);
+	}
+	if (interrupts & DC_INTERRUPT_SMTP) {
+		dc_interrupt_smtp_idle(sql->context);
 	}
-	sqlite3_finalize(stmt);
-#endif
 }
 
 
 void dc_sqlite3_commit(dc_sqlite3_t* sql)
 {
-#ifdef USE_TRANSACTIONS
-	sqlite3_stmt* stmt = dc_sqlite3_prepare(sql, "COMMIT;");
-	if (sqlite3_step(stmt) != SQLITE_DONE) {
-		dc_sqlite3_log_error(sql, "Cannot commit transaction.");
+	int interrupts = 0;
+
+	if (sql==NULL) {
+		return;
+	}
+
+	if (sql->transaction_depth<=0) {
+		dc_log_error(sql->context, 0, "Commit without transaction.");
+		return;
+	}
+
+	if (sql->transaction_depth==1) {
+		if (sql->transaction_failed) {
+			sql->transaction_failed = 0; /* the statements are already written */
+		}
+		else if (!execute_transaction_stmt(sql, "COMMIT;", "Cannot commit transaction.")
+		      && !sqlite3_get_autocommit(get_cobj(sql))) {
+			/* the transaction is still open; roll it back, otherwise it would keep the write lock
+			and all following transactions would fail */
+			execute_transaction_stmt(sql, "ROLLBACK;", "Cannot rollback transaction.");
+			dc_apeerstate_clear_cache(sql);
+			sql->transaction_interrupts = 0; /* the added jobs are discarded */
+		}
+		interrupts = sql->transaction_interrupts;
+		sql->transaction_interrupts = 0;
+	}
+	else if (!sql->transaction_failed) {
+		char* q3 = sqlite3_mprintf("RELEASE dc_sp%i;", sql->transaction_depth);
+		dc_sqlite3_execute(sql, q3);
+		sqlite3_free(q3);
+	}
+
+	sql->transaction_depth--;
+	pthread_mutex_unlock(&sql->transaction_mutex);
+
+	/* jobs added by the transaction are visible to the job threads only now */
+	if (interrupts & DC_INTERRUPT_IMAP) {
+		dc_interrupt_imap_idle(sql->context);
+	}
+	if (interrupts & DC_INTERRUPT_SMTP) {
+		dc_interrupt_smtp_idle(sql->context);
 	}
-	sqlite3_finalize(stmt);
-#endif
 }
 
 
@@ -888,6 +1995,15 @@ void dc_housekeeping(dc_context_t* context)
 
 	dc_log_info(context, 0, "Start housekeeping...");
 
+	/* remove old results of decryption and those of deleted messages, see dc_e2ee.c */
+	stmt = dc_sqlite3_prepare(context->sql,
+		"DELETE FROM decrypt_cache WHERE created<?"
+		" OR rfc724_mid IN (SELECT rfc724_mid FROM msgs WHERE chat_id=" DC_STRINGIFY(DC_CHAT_ID_TRASH) ");");
+	sqlite3_bind_int64(stmt, 1, time(NULL)-DC_DECRYPT_CACHE_DAYS*24*60*60);
+	sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	stmt = NULL;
+
 	/* collect all files in use */
 	maybe_add_from_param(context, &files_in_use,
 		"SELECT param FROM msgs "
@@ -965,5 +2081,11 @@ cleanup:
 	sqlite3_finalize(stmt);
 	dc_hash_clear(&files_in_use);
 	free(path);
+	/* move the content of the WAL file to the database and truncate the WAL file;
+	the automatic checkpoints do not shrink the file */
+	if (context->sql->wal) {
+		dc_sqlite3_execute(context->sql, "PRAGMA wal_checkpoint(TRUNCATE);");
+	}
+
 	dc_log_info(context, 0, "Housekeeping done.");
 }
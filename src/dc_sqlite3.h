@@ -10,11 +10,19 @@ extern "C" {
 #include <sqlite3.h>
 #include <libetpan/libetpan.h>
 #include <pthread.h>
+#include "dc_hash.h"
 
 
 typedef struct _dc_sqlite3 dc_sqlite3_t;
 
 
+#define DC_SQLITE3_READERS          2
+#define DC_WAL_AUTOCHECKPOINT_PAGES 1000
+#define DC_SEARCH_INDEX_CHUNK       500
+#define DC_COMPACT_CHUNK            500
+#define DC_COMPRESS_MIN_BYTES       128
+
+
 /**
  * Library-internal.
  */
@@ -24,6 +32,35 @@ struct _dc_sqlite3
 	sqlite3*        cobj;               /**< is the database given as dbfile to Open() */
 	dc_context_t*   context;            /**< used for logging and to acquire wakelocks, there may be N dc_sqlite3_t objects per context! In practise, we use 2 on backup, 1 otherwise. */
 
+	pthread_mutex_t stmt_cache_mutex;   /**< protects the following stmt_cache_* members, the statements themselves are protected by SQLite */
+	dc_hash_t       stmt_cache;         /**< maps SQL text to prepared statements, see dc_sqlite3_borrow_stmt() */
+	uint32_t        stmt_cache_clock;
+	int             stmt_cache_hits;
+	int             stmt_cache_misses;
+
+	pthread_mutex_t peerstate_cache_mutex; /**< protects the following peerstate_cache_* members */
+	dc_hash_t       peerstate_cache;    /**< maps addresses to peerstates, see dc_apeerstate_load_by_addr() */
+	dc_hash_t       peerstate_cache_fp; /**< maps fingerprints to entries of peerstate_cache, see dc_apeerstate_load_by_fingerprint() */
+	uint32_t        peerstate_cache_clock;
+	uint32_t        peerstate_cache_version; /**< incremented on each modification of acpeerstates */
+	int             peerstate_cache_hits;
+	int             peerstate_cache_misses;
+
+	pthread_mutex_t transaction_mutex;  /**< recursive, held by the thread owning the transaction */
+	sqlite3*        transaction_cobj;   /**< connection used by the thread owning the transaction, see dc_sqlite3_begin_transaction() */
+	dc_hash_t       transaction_stmt_cache; /**< as stmt_cache, for statements of transaction_cobj */
+	int             transaction_depth;  /**< the following members may only be accessed by the thread owning the transaction */
+	#define         DC_INTERRUPT_IMAP   0x01
+	#define         DC_INTERRUPT_SMTP   0x02
+	int             transaction_interrupts; /**< job threads to interrupt on commit as jobs were added, see dc_job_add() */
+	int             transaction_failed; /**< 1=BEGIN failed, the statements of the transaction are executed without one */
+
+	int             wal;                /**< 1=the database is in WAL mode, read-only connections are used then */
+	pthread_mutex_t readers_mutex;      /**< protects readers */
+	sqlite3*        readers[DC_SQLITE3_READERS]; /**< read-only connections, opened on first use, see dc_sqlite3_prepare_read() */
+
+	int             search_index;       /**< 1=the full-text index msgs_fts is usable and must be updated, see dc_update_search_index() */
+	int             search_index_ready; /**< 1=all messages are added to the full-text index, it is used by dc_search_msgs() then */
 };
 
 
@@ -45,6 +82,15 @@ int32_t       dc_sqlite3_get_config_int   (dc_sqlite3_t*, const char* key, int32
 /* tools, these functions are compatible to the corresponding sqlite3_* functions */
 sqlite3_stmt* dc_sqlite3_prepare          (dc_sqlite3_t*, const char* sql); /* the result mus be freed using sqlite3_finalize() */
 int           dc_sqlite3_execute          (dc_sqlite3_t*, const char* sql);
+
+/* statements only reading from the database, may use a read-only connection, the result must be freed using sqlite3_finalize() */
+sqlite3_stmt* dc_sqlite3_prepare_read     (dc_sqlite3_t*, const char* sql);
+
+/* cached statements, the result of dc_sqlite3_borrow_stmt() must be given back using dc_sqlite3_return_stmt() instead of sqlite3_finalize() */
+#define       DC_STMT_CACHE_SIZE          64
+sqlite3_stmt* dc_sqlite3_borrow_stmt      (dc_sqlite3_t*, const char* sql);
+void          dc_sqlite3_return_stmt      (dc_sqlite3_t*, sqlite3_stmt*);
+char*         dc_sqlite3_get_stmt_cache_str(dc_sqlite3_t*);
 int           dc_sqlite3_try_execute      (dc_sqlite3_t*, const char* sql);
 int           dc_sqlite3_table_exists     (dc_sqlite3_t*, const char* name);
 void          dc_sqlite3_log_error        (dc_sqlite3_t*, const char* msg, ...);
@@ -53,6 +99,19 @@ uint32_t      dc_sqlite3_get_rowid        (dc_sqlite3_t*, const char* table, con
 void          dc_sqlite3_begin_transaction(dc_sqlite3_t*);
 void          dc_sqlite3_commit           (dc_sqlite3_t*);
 void          dc_sqlite3_rollback         (dc_sqlite3_t*);
+int           dc_sqlite3_owns_transaction (dc_sqlite3_t*);
+
+int           dc_sqlite3_backup           (dc_sqlite3_t*, const char* dest_file);
+
+/* large text columns as msgs.txt_raw and msgs.mime_headers, stored compressed if this saves space */
+void          dc_sqlite3_bind_compressed  (sqlite3_stmt*, int idx, const char* text, int bytes);
+char*         dc_sqlite3_column_uncompressed (sqlite3_stmt*, int idx); /* the result must be free()'d, returns NULL for NULL-values */
+void          dc_compact_msgs             (dc_context_t*);
+
+/* full-text search index */
+void          dc_update_search_index      (dc_sqlite3_t*, uint32_t msg_id);
+void          dc_update_search_index_by_contact (dc_sqlite3_t*, uint32_t contact_id);
+void          dc_build_search_index       (dc_context_t*);
 
 /* housekeeping */
 #define       DC_HOUSEKEEPING_DELAY_SEC   10
@@ -2,6 +2,7 @@
 #include <libetpan/libetpan.h>
 #include "dc_context.h"
 #include "dc_strencode.h"
+#include "dc_vectors.h"
 
 
 /*******************************************************************************
@@ -858,3 +859,489 @@ cleanup:
 	free(charset);
 	return decoded? decoded : dc_strdup(to_decode);
 }
+
+
+/*******************************************************************************
+ * Base64 and quoted-printable bodies, RFC 2045
+ ******************************************************************************/
+
+
+/* The following functions return exactly the same as libetpan's encode_base64()
+and mailmime_part_parse(), but process blocks of 16 or 32 characters at once,
+see dc_vectors.h. For line breaks, padding etc., the characters are processed one by one. */
+
+
+static const int8_t base64_values[256] = {
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63, 52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+	-1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10,11,12,13,14, 15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+	-1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40, 41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+#ifdef DC_USE_VECTORS
+
+
+/* Decode blocks of base64 characters; 3/4 of a block are written plus two bytes.
+Stops at the first block containing other characters, the complete groups of 4 characters
+in front of them are decoded and *ret_invalid is set to the number of characters left in front of them.
+Stops also if there are less bytes than a block left, *ret_invalid is set to the number of bytes left then.
+The characters are compared as signed values, so that characters above 127 are never in range. */
+#define DECODE_BASE64_BLOCKS(s8v, u8v, u32v, u64v) { \
+	size_t in_used = 0, out_bytes = 0; \
+	while (in_bytes-in_used >= sizeof(s8v)) { \
+		s8v    c, upper, lower, digit, plus, slash; \
+		u8v    v; \
+		u32v   w; \
+		u64v   x; \
+		size_t offset; \
+		int    k_; \
+		memcpy(&c, in+in_used, sizeof(s8v)); \
+		upper = (c>'A'-1) & (c<'Z'+1); \
+		lower = (c>'a'-1) & (c<'z'+1); \
+		digit = (c>'0'-1) & (c<'9'+1); \
+		plus  = (c=='+'); \
+		slash = (c=='/'); \
+		v = (u8v)c; \
+		v = ((u8v)upper & (v-65)) | ((u8v)lower & (v-71)) | ((u8v)digit & (v+4)) | ((u8v)plus & 62) | ((u8v)slash & 63); \
+		/* every 32 bits contain 4 values of 6 bits, convert them to 3 bytes in the lower 24 bits */ \
+		w = (u32v)v; \
+		w = ((w & 0x3f) << 2) | ((w >> 12) & 0x3) | ((w & 0xf00) << 4) | ((w >> 10) & 0xf00) \
+		  | ((w & 0x30000) << 6) | ((w >> 8) & 0x3f0000); \
+		/* every 64 bits contain 6 bytes then, write them overlapping */ \
+		x = (u64v)w; \
+		x = (x & 0xffffff) | ((x >> 8) & 0xffffff000000ULL); \
+		for (k_ = 0; k_ < (int)(sizeof(u64v)/8); k_++) { \
+			memcpy(out+out_bytes+k_*6, &x[k_], 8); \
+		} \
+		DC_FIRST_SET_BYTE(u64v, ~(upper|lower|digit|plus|slash), offset); \
+		if (offset < sizeof(s8v)) { \
+			*ret_invalid = offset%4; \
+			*ret_in_used = in_used + offset/4*4; \
+			return out_bytes + offset/4*3; \
+		} \
+		in_used += sizeof(s8v); \
+		out_bytes += sizeof(s8v)/4*3; \
+	} \
+	*ret_invalid = in_bytes-in_used; \
+	*ret_in_used = in_used; \
+	return out_bytes; \
+}
+
+
+static size_t decode_base64_blocks16(const uint8_t* in, size_t in_bytes, uint8_t* out, size_t* ret_in_used, size_t* ret_invalid)
+DECODE_BASE64_BLOCKS(dc_s8x16_t, dc_u8x16_t, dc_u32x4_t, dc_u64x2_t)
+
+
+#ifdef DC_USE_AVX2
+__attribute__((target("avx2")))
+static size_t decode_base64_blocks32(const uint8_t* in, size_t in_bytes, uint8_t* out, size_t* ret_in_used, size_t* ret_invalid)
+DECODE_BASE64_BLOCKS(dc_s8x32_t, dc_u8x32_t, dc_u32x8_t, dc_u64x4_t)
+#endif
+
+
+/* Encode blocks of 3/4 of the vector size, two bytes more than that are read. */
+#define ENCODE_BASE64_BLOCKS(s8v, u8v, u32v, u64v) { \
+	size_t in_used = 0, out_bytes = 0; \
+	while (in_bytes-in_used >= sizeof(s8v)/4*3+2) { \
+		s8v  v; \
+		u8v  c; \
+		u32v w; \
+		u64v x; \
+		int  k_; \
+		/* read 6 bytes to every 64 bits, 3 bytes to the lower 24 bits of every 32 bits */ \
+		for (k_ = 0; k_ < (int)(sizeof(u64v)/8); k_++) { \
+			uint64_t y; \
+			memcpy(&y, in+in_used+k_*6, 8); \
+			x[k_] = (y & 0xffffff) | ((y << 8) & 0xffffff00000000ULL); \
+		} \
+		/* convert the 3 bytes to 4 values of 6 bits */ \
+		w = (u32v)x; \
+		w = ((w >> 2) & 0x3f) | ((w & 0x3) << 12) | ((w >> 4) & 0xf00) \
+		  | ((w << 10) & 0x3c0000) | ((w >> 6) & 0x30000) | ((w << 8) & 0x3f000000); \
+		v = (s8v)w; \
+		c = (u8v)v + 'A'; \
+		c += (u8v)(v>25) & 6; \
+		c -= (u8v)(v>51) & 75; \
+		c -= (u8v)(v==62) & 15; \
+		c -= (u8v)(v==63) & 12; \
+		memcpy(out+out_bytes, &c, sizeof(s8v)); \
+		in_used += sizeof(s8v)/4*3; \
+		out_bytes += sizeof(s8v); \
+	} \
+	*ret_in_used = in_used; \
+	return out_bytes; \
+}
+
+
+static size_t encode_base64_blocks16(const uint8_t* in, size_t in_bytes, char* out, size_t* ret_in_used)
+ENCODE_BASE64_BLOCKS(dc_s8x16_t, dc_u8x16_t, dc_u32x4_t, dc_u64x2_t)
+
+
+#ifdef DC_USE_AVX2
+__attribute__((target("avx2")))
+static size_t encode_base64_blocks32(const uint8_t* in, size_t in_bytes, char* out, size_t* ret_in_used)
+ENCODE_BASE64_BLOCKS(dc_s8x32_t, dc_u8x32_t, dc_u32x8_t, dc_u64x4_t)
+#endif
+
+
+/* Copy blocks not containing `=`, CR or LF; the first block containing them is copied completely,
+however, only the number of bytes before the first of the characters is returned. */
+#define COPY_QUOTED_PRINTABLE_BLOCKS(s8v, u64v) { \
+	size_t in_used = 0; \
+	while (in_bytes-in_used >= sizeof(s8v)) { \
+		s8v    c; \
+		size_t offset; \
+		memcpy(&c, in+in_used, sizeof(s8v)); \
+		memcpy(out+in_used, &c, sizeof(s8v)); \
+		DC_FIRST_SET_BYTE(u64v, (c=='=') | (c=='\r') | (c=='\n'), offset); \
+		in_used += offset; \
+		if (offset < sizeof(s8v)) { \
+			break; \
+		} \
+	} \
+	return in_used; \
+}
+
+
+static size_t copy_quoted_printable_blocks16(const uint8_t* in, size_t in_bytes, uint8_t* out)
+COPY_QUOTED_PRINTABLE_BLOCKS(dc_s8x16_t, dc_u64x2_t)
+
+
+#ifdef DC_USE_AVX2
+__attribute__((target("avx2")))
+static size_t copy_quoted_printable_blocks32(const uint8_t* in, size_t in_bytes, uint8_t* out)
+COPY_QUOTED_PRINTABLE_BLOCKS(dc_s8x32_t, dc_u64x4_t)
+#endif
+
+
+#endif /* DC_USE_VECTORS */
+
+
+/* Encode data to base64 without line breaks; returns the number of characters written, no null-byte is added. */
+static size_t encode_base64_line(const uint8_t* in, size_t in_bytes, char* out)
+{
+	size_t in_used = 0;
+	size_t o = 0;
+
+	#ifdef DC_USE_VECTORS
+	{
+		size_t used = 0;
+		#ifdef DC_USE_AVX2
+		if (dc_use_avx2()) {
+			o += encode_base64_blocks32(in, in_bytes, out, &used);
+			in_used += used;
+		}
+		#endif
+		o += encode_base64_blocks16(in+in_used, in_bytes-in_used, out+o, &used);
+		in_used += used;
+	}
+	#endif
+
+	for (; in_bytes-in_used >= 3; in_used += 3) {
+		const uint8_t* c = in+in_used;
+		out[o++] = base64_chars[c[0] >> 2];
+		out[o++] = base64_chars[((c[0] << 4) & 0x30) | (c[1] >> 4)];
+		out[o++] = base64_chars[((c[1] << 2) & 0x3c) | (c[2] >> 6)];
+		out[o++] = base64_chars[c[2] & 0x3f];
+	}
+
+	if (in_bytes-in_used > 0) {
+		const uint8_t* c = in+in_used;
+		int            two = in_bytes-in_used > 1;
+		out[o++] = base64_chars[c[0] >> 2];
+		out[o++] = base64_chars[((c[0] << 4) & 0x30) | (two? c[1] >> 4 : 0)];
+		out[o++] = two? base64_chars[(c[1] << 2) & 0x3c] : '=';
+		out[o++] = '=';
+	}
+
+	return o;
+}
+
+
+/**
+ * Encode binary data to base64.
+ *
+ * The result is the same as the result of encode_base64() followed by
+ * dc_insert_breaks(), but it is calculated much faster.
+ *
+ * @param buf The data to encode.
+ * @param buf_bytes The number of bytes in buf.
+ * @param break_every Insert break_chars every break_every characters; 0=no line breaks.
+ * @param break_chars The characters to insert, eg. `\r\n`.
+ * @return Null-terminated base64 string, padded by `=`. Must be free()'d after usage.
+ *     Halts the program on memory allocation errors.
+ */
+char* dc_encode_base64(const void* buf, size_t buf_bytes, int break_every, const char* break_chars)
+{
+	const uint8_t* in = (const uint8_t*)buf;
+	size_t         encoded_bytes = (buf_bytes+2)/3*4;
+	size_t         break_chars_len = (break_every>0 && break_chars)? strlen(break_chars) : 0;
+	size_t         breaks = (break_chars_len>0 && encoded_bytes>0)? (encoded_bytes-1)/break_every : 0;
+	char*          encoded = NULL;
+	char*          p = NULL;
+	size_t         i = 0;
+
+	if ((encoded=malloc(encoded_bytes + breaks*break_chars_len + 1))==NULL) {
+		exit(71);
+	}
+
+	if (breaks==0 || break_every%4!=0)
+	{
+		encode_base64_line(in, buf_bytes, encoded);
+	}
+	else
+	{
+		/* break_every is a multiple of 4, so every line can be encoded on its own */
+		size_t line_bytes = break_every/4*3;
+		p = encoded;
+		for (i = 0; i < buf_bytes; i += line_bytes) {
+			if (i > 0) {
+				memcpy(p, break_chars, break_chars_len);
+				p += break_chars_len;
+			}
+			p += encode_base64_line(in+i, DC_MIN(line_bytes, buf_bytes-i), p);
+		}
+		breaks = 0;
+	}
+
+	if (breaks > 0)
+	{
+		/* insert the breaks from the end, so that no other buffer is needed */
+		size_t o = encoded_bytes;
+		p = encoded + encoded_bytes + breaks*break_chars_len;
+		while (breaks > 0) {
+			size_t line_bytes = o - (breaks*break_every);
+			o -= line_bytes;
+			p -= line_bytes;
+			memmove(p, encoded+o, line_bytes);
+			p -= break_chars_len;
+			memcpy(p, break_chars, break_chars_len);
+			breaks--;
+		}
+	}
+
+	encoded[encoded_bytes + ((encoded_bytes>0 && break_chars_len>0)? (encoded_bytes-1)/break_every : 0)*break_chars_len] = 0;
+	return encoded;
+}
+
+
+/**
+ * Decode a base64 body.
+ *
+ * The result is the same as the result of mailmime_base64_body_parse():
+ * all characters not used by base64, including line breaks and the padding `=`,
+ * are skipped, incomplete blocks at the end are decoded as far as possible.
+ *
+ * @param in The base64 data to decode, no need to be null-terminated.
+ * @param in_bytes The number of bytes in in.
+ * @param out Buffer to write the decoded data to,
+ *     must be at least DC_DECODE_BASE64_MAX_BYTES(in_bytes) bytes large.
+ *     The result is not null-terminated.
+ * @param ret_in_used If set, characters belonging to an incomplete block
+ *     at the end of in are not decoded and the number of the bytes used from in is returned here;
+ *     this is useful to decode large data in chunks.
+ *     If NULL, all characters are decoded.
+ * @return The number of bytes written to out.
+ */
+size_t dc_decode_base64(const char* in, size_t in_bytes, char* out, size_t* ret_in_used)
+{
+	const uint8_t* uin = (const uint8_t*)in;
+	uint8_t*       uout = (uint8_t*)out;
+	size_t         i = 0;
+	size_t         o = 0;
+	size_t         block_start = 0;
+	uint32_t       block = 0;
+	int            block_chars = 0;
+	#ifdef DC_USE_VECTORS
+	int            avx2 = dc_use_avx2();
+	#endif
+
+	while (i < in_bytes)
+	{
+		size_t scalar_end = in_bytes;
+
+		#ifdef DC_USE_VECTORS
+		if (block_chars==0) {
+			size_t used = 0, invalid = 0;
+			#ifdef DC_USE_AVX2
+			if (avx2) {
+				o += decode_base64_blocks32(uin+i, in_bytes-i, uout+o, &used, &invalid);
+				i += used;
+				if (invalid==in_bytes-i) {
+					o += decode_base64_blocks16(uin+i, in_bytes-i, uout+o, &used, &invalid);
+					i += used;
+				}
+			}
+			else
+			#endif
+			{
+				o += decode_base64_blocks16(uin+i, in_bytes-i, uout+o, &used, &invalid);
+				i += used;
+			}
+			scalar_end = i + invalid + 1; /* the invalid character is skipped by the loop below */
+		}
+		#endif
+
+		/* process the characters that could not be handled as blocks one by one,
+		continue until a block is complete and the next character may start a new block of base64 characters */
+		while (i < in_bytes && (i < scalar_end || block_chars!=0 || base64_values[uin[i]]<0))
+		{
+			int8_t value = base64_values[uin[i++]];
+			if (value < 0) {
+				continue;
+			}
+
+			if (block_chars==0) {
+				block_start = i-1;
+			}
+
+			block = (block << 6) | value;
+			if (++block_chars==4) {
+				uout[o++] = (uint8_t)(block >> 16);
+				uout[o++] = (uint8_t)(block >> 8);
+				uout[o++] = (uint8_t)block;
+				block = 0;
+				block_chars = 0;
+			}
+		}
+	}
+
+	if (block_chars!=0)
+	{
+		if (ret_in_used) {
+			*ret_in_used = block_start;
+			return o;
+		}
+
+		block <<= 6*(4-block_chars);
+		uout[o++] = (uint8_t)(block >> 16);
+		if (block_chars>=3) {
+			uout[o++] = (uint8_t)(block >> 8);
+		}
+	}
+
+	if (ret_in_used) {
+		*ret_in_used = in_bytes;
+	}
+	return o;
+}
+
+
+static int hex_value(uint8_t ch)
+{
+	if (ch>='0' && ch<='9') { return ch-'0'; }
+	if (ch>='a' && ch<='f') { return ch-'a'+10; }
+	if (ch>='A' && ch<='F') { return ch-'A'+10; }
+	return 0;
+}
+
+
+/**
+ * Decode a quoted-printable body.
+ *
+ * The result is the same as the result of mailmime_quoted_printable_body_parse():
+ * soft line breaks are removed, all line breaks are converted to CRLF
+ * and bad encodings are decoded as far as possible.
+ *
+ * @param in The quoted-printable data to decode, no need to be null-terminated.
+ * @param in_bytes The number of bytes in in.
+ * @param out Buffer to write the decoded data to,
+ *     must be at least DC_DECODE_QUOTED_PRINTABLE_MAX_BYTES(in_bytes) bytes large.
+ *     The result is not null-terminated.
+ * @param ret_in_used If set, incomplete encodings and line breaks at the end of in are not decoded
+ *     and the number of the bytes used from in is returned here;
+ *     this is useful to decode large data in chunks.
+ *     If NULL, all characters are decoded.
+ * @return The number of bytes written to out.
+ */
+size_t dc_decode_quoted_printable(const char* in, size_t in_bytes, char* out, size_t* ret_in_used)
+{
+	const uint8_t* uin = (const uint8_t*)in;
+	uint8_t*       uout = (uint8_t*)out;
+	size_t         i = 0;
+	size_t         o = 0;
+	#ifdef DC_USE_VECTORS
+	int            avx2 = dc_use_avx2();
+	#endif
+
+	while (i < in_bytes)
+	{
+		uint8_t c;
+
+		#ifdef DC_USE_VECTORS
+		{
+			size_t copied = 0;
+			#ifdef DC_USE_AVX2
+			if (avx2) {
+				copied = copy_quoted_printable_blocks32(uin+i, in_bytes-i, uout+o);
+			}
+			else
+			#endif
+			{
+				copied = copy_quoted_printable_blocks16(uin+i, in_bytes-i, uout+o);
+			}
+			i += copied;
+			o += copied;
+			if (i >= in_bytes) {
+				break;
+			}
+		}
+		#endif
+
+		c = uin[i];
+		if (c=='=')
+		{
+			if (i+1 >= in_bytes || (i+2 >= in_bytes && uin[i+1]!='\n' && uin[i+1]!='\r')) {
+				if (ret_in_used) {
+					break; /* the encoding may be completed by the next chunk */
+				}
+				uout[o++] = '='; /* bad encoding, keep the `=` */
+				i++;
+			}
+			else if (uin[i+1]=='\n') {
+				i += 2; /* soft line break */
+			}
+			else if (uin[i+1]=='\r') {
+				if (i+2 >= in_bytes) {
+					break; /* soft line break at the end, ignored */
+				}
+				i += uin[i+2]=='\n'? 3 : 2;
+			}
+			else {
+				uout[o++] = (uint8_t)((hex_value(uin[i+1]) << 4) | hex_value(uin[i+2]));
+				i += 3;
+			}
+		}
+		else if (c=='\n' || c=='\r')
+		{
+			if (c=='\r' && i+1 >= in_bytes) {
+				if (ret_in_used) {
+					break; /* the line break may be completed by the next chunk */
+				}
+				i++; /* CR at the end, ignored */
+				continue;
+			}
+			uout[o++] = '\r';
+			uout[o++] = '\n';
+			i += (c=='\r' && uin[i+1]=='\n')? 2 : 1;
+		}
+		else
+		{
+			uout[o++] = c;
+			i++;
+		}
+	}
+
+	if (ret_in_used) {
+		*ret_in_used = i;
+	}
+	return o;
+}
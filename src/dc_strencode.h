@@ -18,6 +18,12 @@ int     dc_needs_ext_header       (const char*);
 char*   dc_encode_ext_header      (const char*);
 char*   dc_decode_ext_header      (const char*);
 
+char*   dc_encode_base64          (const void* buf, size_t buf_bytes, int break_every, const char* break_chars);
+size_t  dc_decode_base64          (const char* in, size_t in_bytes, char* out, size_t* ret_in_used);
+size_t  dc_decode_quoted_printable(const char* in, size_t in_bytes, char* out, size_t* ret_in_used);
+#define DC_DECODE_BASE64_MAX_BYTES(in_bytes)           ((in_bytes)/4*3+6)
+#define DC_DECODE_QUOTED_PRINTABLE_MAX_BYTES(in_bytes) ((in_bytes)*2+1)
+
 
 #ifdef __cplusplus
 } // /extern "C"
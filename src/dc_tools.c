@@ -242,6 +242,44 @@ cleanup:
 }
 
 
+/* convert a hex string as returned by dc_binary_to_uc_hex() back to binary,
+lower case is also accepted. returns NULL for empty or invalid strings. */
+uint8_t* dc_hex_to_binary(const char* hex, size_t* ret_bytes)
+{
+	uint8_t* buf = NULL;
+	size_t   hex_len = 0;
+	size_t   i = 0;
+
+	*ret_bytes = 0;
+
+	if (hex==NULL || (hex_len=strlen(hex))==0 || hex_len%2!=0) {
+		return NULL;
+	}
+
+	if ((buf=malloc(hex_len/2))==NULL) {
+		exit(69);
+	}
+
+	for (i = 0; i < hex_len; i++) {
+		char c = hex[i];
+		int  nibble = (c>='0' && c<='9')? c-'0' : (c>='A' && c<='F')? c-'A'+10 : (c>='a' && c<='f')? c-'a'+10 : -1;
+		if (nibble<0) {
+			free(buf);
+			return NULL;
+		}
+		if (i%2==0) {
+			buf[i/2] = (uint8_t)(nibble<<4);
+		}
+		else {
+			buf[i/2] |= (uint8_t)nibble;
+		}
+	}
+
+	*ret_bytes = hex_len/2;
+	return buf;
+}
+
+
 char* dc_mprintf(const char* format, ...)
 {
 	char  testbuf[1];
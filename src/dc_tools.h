@@ -36,6 +36,7 @@ int     dc_str_contains            (const char* haystack, const char* needle);
 char*   dc_null_terminate          (const char*, int bytes); /* the result must be free()'d */
 char*   dc_mprintf                 (const char* format, ...); /* The result must be free()'d. */
 char*   dc_binary_to_uc_hex        (const uint8_t* buf, size_t bytes);
+uint8_t* dc_hex_to_binary          (const char* hex, size_t* ret_bytes);
 void    dc_remove_cr_chars         (char*); /* remove all \r characters from string */
 void    dc_unify_lineends          (char*);
 void    dc_replace_bad_utf8_chars  (char*); /* replace bad UTF-8 characters by sequences of `_` (to avoid problems in filenames, we do not use eg. `?`) the function is useful if strings are unexpectingly encoded eg. as ISO-8859-1 */
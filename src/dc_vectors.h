@@ -0,0 +1,70 @@
+#ifndef __DC_VECTORS_H__
+#define __DC_VECTORS_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*** library-private **********************************************************/
+
+/* Some loops process blocks of 16 or 32 characters at once.
+The blocks are handled using the vector extensions of GCC and clang;
+these compile to SSE2 on x86-64 and to NEON on ARM. On x86-64, AVX2 is used
+if the CPU supports it, see dc_use_avx2(). Where no vectors are available,
+DC_USE_VECTORS is not defined and the characters are processed one by one. */
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__SSE2__) || defined(__ARM_NEON)) \
+ && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+#define DC_USE_VECTORS 1
+#if defined(__x86_64__)
+#define DC_USE_AVX2 1
+#endif
+#endif
+
+
+#ifdef DC_USE_VECTORS
+
+#include <stdint.h>
+
+typedef int8_t   dc_s8x16_t  __attribute__((vector_size(16)));
+typedef uint8_t  dc_u8x16_t  __attribute__((vector_size(16)));
+typedef uint32_t dc_u32x4_t  __attribute__((vector_size(16)));
+typedef uint64_t dc_u64x2_t  __attribute__((vector_size(16)));
+typedef int8_t   dc_s8x32_t  __attribute__((vector_size(32)));
+typedef uint8_t  dc_u8x32_t  __attribute__((vector_size(32)));
+typedef uint32_t dc_u32x8_t  __attribute__((vector_size(32)));
+typedef uint64_t dc_u64x4_t  __attribute__((vector_size(32)));
+
+
+/* Offset of the first set byte in a vector; the vector is read as 64-bit words, so this needs a little-endian CPU. */
+#define DC_FIRST_SET_BYTE(u64v, mask, ret_offset) { \
+	u64v     m_ = (u64v)(mask); \
+	uint64_t any_ = 0; \
+	int      k_; \
+	for (k_ = 0; k_ < (int)(sizeof(u64v)/8); k_++) { any_ |= m_[k_]; } \
+	(ret_offset) = sizeof(u64v); \
+	if (any_) { \
+		for (k_ = 0; m_[k_]==0; k_++) { ; } \
+		(ret_offset) = k_*8 + __builtin_ctzll(m_[k_])/8; \
+	} \
+}
+
+
+/* Functions using 32-byte vectors must be declared as __attribute__((target("avx2")))
+and must only be called if this function returns 1. */
+static inline int dc_use_avx2(void)
+{
+	#ifdef DC_USE_AVX2
+		return __builtin_cpu_supports("avx2");
+	#else
+		return 0;
+	#endif
+}
+
+#endif /* DC_USE_VECTORS */
+
+
+#ifdef __cplusplus
+} /* /extern "C" */
+#endif
+#endif /* __DC_VECTORS_H__ */
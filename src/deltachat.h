@@ -402,6 +402,8 @@ const uintptr_t* dc_array_get_raw            (const dc_array_t*);
  * (the list may have several hundreds chats),
  * the UI should call dc_chatlist_get_summary() then.
  * dc_chatlist_get_summary() provides all elements needed for painting the item.
+ * The summaries are loaded in pages and cached in the chatlist object;
+ * if the UI knows the items in view, it may load exactly them using dc_chatlist_load_summaries().
  *
  * On a click of such an item,
  * the UI should change to the chat view
@@ -428,6 +430,7 @@ size_t           dc_chatlist_get_cnt         (const dc_chatlist_t*);
 uint32_t         dc_chatlist_get_chat_id     (const dc_chatlist_t*, size_t index);
 uint32_t         dc_chatlist_get_msg_id      (const dc_chatlist_t*, size_t index);
 dc_lot_t*        dc_chatlist_get_summary     (const dc_chatlist_t*, size_t index, dc_chat_t*);
+int              dc_chatlist_load_summaries  (dc_chatlist_t*, size_t index, size_t cnt);
 dc_context_t*    dc_chatlist_get_context     (dc_chatlist_t*);
 
 
@@ -1043,6 +1046,21 @@ time_t          dc_lot_get_timestamp     (const dc_lot_t*);
 #define DC_EVENT_SECUREJOIN_JOINER_PROGRESS       2061
 
 
+/**
+ * Inform about the generation of the own keypair.
+ *
+ * The keypair is generated in the background as soon as the address is known,
+ * typically while dc_configure() is running, or when the first message is sent.
+ * The event is not sent if the keypair already exists;
+ * if a spare keypair is used, see dc_set_config(), the progress is done at once.
+ *
+ * @param data1 (int) 0=error, 1-999=progress in permille, 1000=success and done
+ * @param data2 0
+ * @return 0
+ */
+#define DC_EVENT_KEYGEN_PROGRESS          2070
+
+
 // the following events are functions that should be provided by the frontends
 
 